@@ -0,0 +1,1163 @@
+// Throughput of every public operation on synthetic images of 256^2 to 8192^2 pixels
+// with 1, 3 and 4 channels. Operations that take an ExecutionPolicy are measured
+// sequentially (threads 1) and on every hardware thread; at 4096^2 and 8192^2 also on
+// 2, 4, 8, ... threads in between, for the scaling curve.
+//
+// Results go to the console by default. To keep a run for comparison:
+//   ImageGeneBenchmarks --benchmark_out=results.json --benchmark_out_format=json
+// and compare two runs with tools/compare.py from the Google Benchmark repository:
+//   compare.py benchmarks before.json after.json
+// --benchmark_filter=<regex> restricts a run, e.g. to BM_Stream for the peak RSS figures.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <benchmark/benchmark.h>
+
+#include "../ImageGene/Allocator.h"
+#include "../ImageGene/Blend.h"
+#include "../ImageGene/Compare.h"
+#include "../ImageGene/Cpu.h"
+#include "../ImageGene/Dither.h"
+#include "../ImageGene/IGFont.h"
+#include "../ImageGene/Image.h"
+#include "../ImageGene/LazyImage.h"
+#include "../ImageGene/Pixels.h"
+#include "../ImageGene/Png.h"
+#include "../ImageGene/Random.h"
+#include "../ImageGene/Stream.h"
+#include "../ImageGene/Thumbnail.h"
+
+using namespace ImageGene;
+
+namespace {
+	const char* FONT_FILE = "src/ImageGene/Fonts/arial.ttf";
+
+	// Smooth per-channel gradients with mild noise, so codecs, dithers and diffmaps see
+	// content closer to a photograph than either a flat field or white noise.
+	void Fill(uint8_t* data, int w, int h, int channels, uint64_t seed)
+	{
+		for (int y = 0; y < h; y++) {
+			uint8_t* px = data + (size_t)y * w * channels;
+			for (int x = 0; x < w; x++, px += channels) {
+				int noise = (int)(PixelRandom(seed, x, y) >> 60) - 8;
+				for (int k = 0; k < channels; k++) {
+					int v = (x * (k + 1) * 255 / w + y * (3 - k) * 255 / h) / 2 + noise;
+					px[k] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+				}
+			}
+		}
+	}
+
+	// Images are generated once per (size, channels, seed) and copied per iteration.
+	const Image& Source(int size, int channels, uint64_t seed = 1)
+	{
+		static std::map<std::pair<std::pair<int, int>, uint64_t>, std::unique_ptr<Image>> sources;
+		std::unique_ptr<Image>& image = sources[{ { size, channels }, seed }];
+		if (!image) {
+			image.reset(new Image(size, size, channels));
+			Fill(image->data, size, size, channels, seed);
+		}
+		return *image;
+	}
+
+	int Size(const benchmark::State& state) { return (int)state.range(0); }
+	int Channels(const benchmark::State& state) { return (int)state.range(1); }
+
+	ExecutionPolicy Policy(const benchmark::State& state)
+	{
+		return state.range(2) == 0 ? Parallel : Threads((uint32_t)state.range(2));
+	}
+
+	// Thread counts to measure an operation with at the given image size: 1 and every
+	// hardware thread, with the powers of two in between from 4096^2 up.
+	std::vector<int> ThreadCounts(int size)
+	{
+		const int hardware = std::max(1, (int)std::thread::hardware_concurrency());
+		std::vector<int> counts = { 1 };
+		if (size >= 4096) {
+			for (int threads = 2; threads < hardware; threads *= 2) {
+				counts.push_back(threads);
+			}
+		}
+		if (hardware > 1) {
+			counts.push_back(hardware);
+		}
+		return counts;
+	}
+
+	void SetThroughput(benchmark::State& state, int64_t pixels, int channels)
+	{
+		state.counters["MP/s"] = benchmark::Counter((double)pixels * state.iterations() / 1e6, benchmark::Counter::kIsRate);
+		state.SetBytesProcessed(pixels * channels * state.iterations());
+	}
+
+	// Runs op on a fresh copy of the source image each iteration; the copy is not timed.
+	template <typename Op>
+	void InPlace(benchmark::State& state, Op op)
+	{
+		const Image& source = Source(Size(state), Channels(state));
+		Image image(source);
+		for (auto _ : state) {
+			state.PauseTiming();
+			memcpy(image.Mutable(), source.data, source.size);
+			state.ResumeTiming();
+			op(&image);
+			benchmark::ClobberMemory();
+		}
+		SetThroughput(state, (int64_t)image.w * image.h, image.channels);
+	}
+
+	void Arguments(benchmark::internal::Benchmark* b, int minChannels, bool policy)
+	{
+		b->ArgNames({ "size", "channels", "threads" });
+		for (int size : { 256, 1024, 4096, 8192 }) {
+			for (int channels : { 1, 3, 4 }) {
+				if (channels < minChannels) {
+					continue;
+				}
+				if (!policy) {
+					b->Args({ size, channels, 1 });
+					continue;
+				}
+				for (int threads : ThreadCounts(size)) {
+					b->Args({ size, channels, threads });
+				}
+			}
+		}
+		b->Unit(benchmark::kMillisecond)->UseRealTime();
+	}
+
+	void AnyChannels(benchmark::internal::Benchmark* b) { Arguments(b, 1, true); }
+	void ColorChannels(benchmark::internal::Benchmark* b) { Arguments(b, 3, true); }
+	void AnyChannelsSequential(benchmark::internal::Benchmark* b) { Arguments(b, 1, false); }
+
+	size_t PeakResidentBytes()
+	{
+#if defined(_WIN32)
+		PROCESS_MEMORY_COUNTERS counters;
+		GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+		return counters.PeakWorkingSetSize;
+#else
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+		return (size_t)usage.ru_maxrss;
+#else
+		return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+	}
+
+	// Page faults taken by the process so far; each is a fresh page of a new buffer
+	// being touched for the first time, the cost the buffer pool exists to avoid.
+	uint64_t PageFaults()
+	{
+#if defined(_WIN32)
+		PROCESS_MEMORY_COUNTERS counters;
+		GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+		return counters.PageFaultCount;
+#else
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return (uint64_t)usage.ru_minflt + usage.ru_majflt;
+#endif
+	}
+
+	double GaussianKernel[25] = {
+		1 / 256.0, 4 / 256.0, 6 / 256.0, 4 / 256.0, 1 / 256.0,
+		4 / 256.0, 16 / 256.0, 24 / 256.0, 16 / 256.0, 4 / 256.0,
+		6 / 256.0, 24 / 256.0, 36 / 256.0, 24 / 256.0, 6 / 256.0,
+		4 / 256.0, 16 / 256.0, 24 / 256.0, 16 / 256.0, 4 / 256.0,
+		1 / 256.0, 4 / 256.0, 6 / 256.0, 4 / 256.0, 1 / 256.0,
+	};
+
+	// Not separable, so it measures the direct path.
+	double EdgeKernel[9] = {
+		-1, -1, 0,
+		-1, 0, 1,
+		0, 1, 1,
+	};
+}
+
+static void BM_GrayscaleAverage(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { GrayscaleAverage(image, policy); });
+}
+BENCHMARK(BM_GrayscaleAverage)->Apply(ColorChannels);
+
+static void BM_GrayscaleLum(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { GrayscaleLum(image, policy); });
+}
+BENCHMARK(BM_GrayscaleLum)->Apply(ColorChannels);
+
+static void BM_ColorMask(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { ColorMask(image, 1, 0, 1, policy); });
+}
+BENCHMARK(BM_ColorMask)->Apply(ColorChannels);
+
+static void BM_Diffmap(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	Image other(Source(Size(state), Channels(state), 2));
+	InPlace(state, [&](Image* image) { Diffmap(image, &other, policy); });
+}
+BENCHMARK(BM_Diffmap)->Apply(AnyChannels);
+
+static void BM_DiffmapWithScale(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	Image other(Source(Size(state), Channels(state), 2));
+	InPlace(state, [&](Image* image) { DiffmapWithScale(image, &other, 0, policy); });
+}
+BENCHMARK(BM_DiffmapWithScale)->Apply(AnyChannels);
+
+// Compare in each mode: write 0 only reads both images, write 1 also writes the diff as
+// Diffmap does. ssim 1 adds the windowed SSIM; the other statistics are always computed.
+static void BM_Compare(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	const Image& source = Source(Size(state), Channels(state));
+	const Image& other = Source(Size(state), Channels(state), 2);
+	const bool write = state.range(3) != 0;
+	const bool ssim = state.range(4) != 0;
+	if (write) {
+		InPlace(state, [&](Image* image) {
+			benchmark::DoNotOptimize(Compare(image, &other, CompareWriteDiff, ssim, policy));
+		});
+		return;
+	}
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(Compare(ImageView(source), ImageView(other), CompareStatsOnly, ssim, policy));
+	}
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+}
+BENCHMARK(BM_Compare)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "threads", "write", "ssim" });
+	for (int size : { 1024, 4096, 8192 }) {
+		for (int channels : { 1, 3, 4 }) {
+			for (int threads : ThreadCounts(size)) {
+				for (int write : { 0, 1 }) {
+					b->Args({ size, channels, threads, write, 0 })->Args({ size, channels, threads, write, 1 });
+				}
+			}
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+// Equal on two identical copies, the case a passing regression test hits, against one
+// memcmp over the whole buffer (memcmp 1), which is the floor for tolerance 0.
+static void BM_Equal(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	const Image& source = Source(Size(state), Channels(state));
+	Image copy(source);
+	copy.Mutable();
+	const uint8_t tolerance = (uint8_t)state.range(3);
+	const bool baseline = state.range(4) != 0;
+	for (auto _ : state) {
+		if (baseline) {
+			benchmark::DoNotOptimize(memcmp(source.data, copy.data, source.size));
+		}
+		else {
+			benchmark::DoNotOptimize(Equal(source, copy, tolerance, policy));
+		}
+	}
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+}
+BENCHMARK(BM_Equal)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "threads", "tolerance", "memcmp" });
+	for (int size : { 1024, 4096, 8192 }) {
+		for (int channels : { 1, 3, 4 }) {
+			b->Args({ size, channels, 1, 0, 1 });
+			for (int threads : ThreadCounts(size)) {
+				b->Args({ size, channels, threads, 0, 0 })->Args({ size, channels, threads, 2, 0 });
+			}
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+// ChangedRegions with `changes` single-pixel edits scattered over an otherwise identical
+// copy, in 64 x 64 tiles.
+static void BM_ChangedRegions(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	const Image& source = Source(Size(state), Channels(state));
+	Image copy(source);
+	uint8_t* data = copy.Mutable();
+	const int changes = (int)state.range(3);
+	for (int i = 0; i < changes; i++) {
+		uint64_t r = PixelRandom(3, i, 0);
+		int x = (int)(r % copy.w);
+		int y = (int)((r >> 32) % copy.h);
+		data[((size_t)y * copy.w + x) * copy.channels] ^= 0x80;
+	}
+	size_t regions = 0;
+	for (auto _ : state) {
+		regions = ChangedRegions(source, copy, 0, 64, policy).size();
+	}
+	state.counters["regions"] = (double)regions;
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+}
+BENCHMARK(BM_ChangedRegions)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "threads", "changes" });
+	for (int size : { 1024, 4096, 8192 }) {
+		for (int channels : { 3, 4 }) {
+			for (int threads : ThreadCounts(size)) {
+				for (int changes : { 0, 16, 1024 }) {
+					b->Args({ size, channels, threads, changes });
+				}
+			}
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+// Hides a message filling a quarter of the image's capacity, then reads it back.
+static void BM_Steganograph(benchmark::State& state)
+{
+	const Image& source = Source(Size(state), Channels(state));
+	std::string message(source.size / 8 / 4, 'x');
+	std::vector<char> buffer(message.size() + 1);
+	size_t length;
+	InPlace(state, [&](Image* image) {
+		Steganograph(image, message.c_str());
+		DecodeSteganograph(image, buffer.data(), &length);
+	});
+}
+BENCHMARK(BM_Steganograph)->Apply(AnyChannelsSequential);
+
+static void BM_ConvolveClampTo0(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { ConvolveClampTo0(image, 0, 5, 5, GaussianKernel, 2, 2, policy); });
+}
+BENCHMARK(BM_ConvolveClampTo0)->Apply(AnyChannels);
+
+static void BM_ConvolveClampToBorder(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { ConvolveClampToBorder(image, 0, 5, 5, GaussianKernel, 2, 2, policy); });
+}
+BENCHMARK(BM_ConvolveClampToBorder)->Apply(AnyChannels);
+
+static void BM_ConvolveGaussian5x5(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { Convolve(image, 5, 5, GaussianKernel, 2, 2, BorderClamp, policy); });
+}
+BENCHMARK(BM_ConvolveGaussian5x5)->Apply(AnyChannels);
+
+static void BM_ConvolveEdge3x3(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { Convolve(image, 3, 3, EdgeKernel, 1, 1, BorderClamp, policy); });
+}
+BENCHMARK(BM_ConvolveEdge3x3)->Apply(AnyChannels);
+
+// Per-channel convolution of every channel in turn, on interleaved pixels (planar 0)
+// and on planes (planar 1). The source is converted before timing starts.
+static void PerChannel(benchmark::State& state, BorderMode border)
+{
+	ExecutionPolicy policy = Policy(state);
+	Image source(Source(Size(state), Channels(state)));
+	source.SetLayout(state.range(3) != 0 ? LayoutPlanar : LayoutInterleaved);
+	Image image(source);
+	for (auto _ : state) {
+		state.PauseTiming();
+		memcpy(image.Mutable(), source.data, source.size);
+		state.ResumeTiming();
+		for (int c = 0; c < image.channels; c++) {
+			if (border == BorderZero) {
+				ConvolveClampTo0(&image, c, 5, 5, GaussianKernel, 2, 2, policy);
+			}
+			else {
+				ConvolveClampToBorder(&image, c, 5, 5, GaussianKernel, 2, 2, policy);
+			}
+		}
+		benchmark::ClobberMemory();
+	}
+	SetThroughput(state, (int64_t)image.w * image.h, image.channels);
+}
+
+static void LayoutArguments(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({ "size", "channels", "threads", "planar" });
+	for (int size : { 1024, 4096 }) {
+		for (int channels : { 3, 4 }) {
+			for (int threads : ThreadCounts(size)) {
+				b->Args({ size, channels, threads, 0 })->Args({ size, channels, threads, 1 });
+			}
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+static void BM_LayoutConvolveClampTo0(benchmark::State& state) { PerChannel(state, BorderZero); }
+BENCHMARK(BM_LayoutConvolveClampTo0)->Apply(LayoutArguments);
+
+static void BM_LayoutConvolveClampToBorder(benchmark::State& state) { PerChannel(state, BorderClamp); }
+BENCHMARK(BM_LayoutConvolveClampToBorder)->Apply(LayoutArguments);
+
+// Conversion to planes (planar 1) and back to interleaved pixels (planar 0).
+static void BM_SetLayout(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	const bool planar = state.range(3) != 0;
+	Image source(Source(Size(state), Channels(state)));
+	source.SetLayout(planar ? LayoutInterleaved : LayoutPlanar);
+	for (auto _ : state) {
+		Image image(source);
+		image.SetLayout(planar ? LayoutPlanar : LayoutInterleaved, policy);
+		benchmark::DoNotOptimize(image.data);
+	}
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+}
+BENCHMARK(BM_SetLayout)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "threads", "planar" });
+	for (int size : { 1024, 4096 }) {
+		for (int channels : { 1, 2, 3, 4 }) {
+			for (int threads : ThreadCounts(size)) {
+				b->Args({ size, channels, threads, 1 })->Args({ size, channels, threads, 0 });
+			}
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+static void BM_FlipHorizontal(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { FlipHorizontal(image, policy); });
+}
+BENCHMARK(BM_FlipHorizontal)->Apply(AnyChannels);
+
+static void BM_FlipVertical(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { FlipVertical(image, policy); });
+}
+BENCHMARK(BM_FlipVertical)->Apply(AnyChannels);
+
+// Overlays cover the whole destination from an offset, so every row is clipped.
+static void BM_Overlay(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	const Image& source = Source(Size(state), Channels(state), 2);
+	InPlace(state, [&](Image* image) { Overlay(image, &source, 16, -16, policy); });
+}
+BENCHMARK(BM_Overlay)->Apply(AnyChannels);
+
+// Overlay from a source with a different channel count (source argument), converted
+// row by row on the way in.
+static void BM_OverlayConvert(benchmark::State& state)
+{
+	const Image& source = Source(Size(state), (int)state.range(2), 2);
+	InPlace(state, [&](Image* image) { Overlay(image, &source, 16, -16); });
+}
+BENCHMARK(BM_OverlayConvert)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "source" });
+	for (int size : { 1024, 4096 }) {
+		for (int channels : { 1, 2, 3, 4 }) {
+			for (int source : { 1, 2, 3, 4 }) {
+				if (source != channels) {
+					b->Args({ size, channels, source });
+				}
+			}
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+namespace {
+	// OverlayWithAlpha as it was before Blend: straight alpha in float per pixel, with
+	// alphas above 0.99 taken as opaque and below 0.01 as transparent. Kept to measure
+	// Blend against; source must have at least as many channels as image.
+	void FloatOverlayWithAlpha(const ImageView& image, const ImageView& source, int x, int y)
+	{
+		for (int sy = 0; sy < source.h; sy++) {
+			if (sy + y < 0) {
+				continue;
+			}
+			else if (sy + y >= image.h) {
+				break;
+			}
+			for (int sx = 0; sx < source.w; sx++) {
+				if (sx + x < 0) {
+					continue;
+				}
+				else if (sx + x >= image.w) {
+					break;
+				}
+				const uint8_t* sourcePixels = source.Row(sy) + sx * source.channels;
+				uint8_t* destPixels = image.Row(sy + y) + (sx + x) * image.channels;
+
+				float sourceAlpha = source.channels < 4 ? 1 : sourcePixels[3] / 255.0f;
+				float destAlpha = image.channels < 4 ? 1 : destPixels[3] / 255.0f;
+				if (sourceAlpha > 0.99 && destAlpha > 0.99) {
+					memcpy(destPixels, sourcePixels, image.channels);
+					continue;
+				}
+				float outputAlpha = sourceAlpha + destAlpha * (1 - sourceAlpha);
+				if (outputAlpha < 0.01f) {
+					memset(destPixels, 0, image.channels);
+					continue;
+				}
+				for (int c = 0; c < image.channels; c++) {
+					float v = (sourcePixels[c] / 255.0f * sourceAlpha + destPixels[c] / 255.0f * destAlpha * (1 - sourceAlpha)) / outputAlpha * 255.0f;
+					destPixels[c] = (uint8_t)(v < 0 ? 0 : v >= 255 ? 255 : v);
+				}
+				if (image.channels > 3) {
+					destPixels[3] = (uint8_t)(outputAlpha * 255.0f > 255 ? 255 : outputAlpha * 255.0f);
+				}
+			}
+		}
+	}
+}
+
+// An RGBA overlay (a watermark) on an RGB or RGBA image; float 1 runs the float code
+// OverlayWithAlpha used before Blend. maxError and meanError compare the two outputs
+// over pixels whose result alpha is at least 64, where 8-bit premultiplied color keeps
+// its precision.
+static void BM_OverlayWithAlpha(benchmark::State& state)
+{
+	const Image& source = Source(Size(state), 4, 2);
+	const bool useFloat = state.range(2) != 0;
+	InPlace(state, [&](Image* image) {
+		if (useFloat) {
+			FloatOverlayWithAlpha(ImageView(*image), ImageView(source), 16, -16);
+		}
+		else {
+			OverlayWithAlpha(image, &source, 16, -16);
+		}
+	});
+
+	const Image& original = Source(Size(state), Channels(state));
+	Image blended(original);
+	Image reference(original);
+	OverlayWithAlpha(&blended, &source, 16, -16);
+	FloatOverlayWithAlpha(ImageView(reference), ImageView(source), 16, -16);
+	int largest = 0;
+	double total = 0;
+	size_t count = 0;
+	for (size_t i = 0; i < blended.size; i += blended.channels) {
+		if (blended.channels == 4 && blended.data[i + 3] < 64) {
+			continue;
+		}
+		for (int c = 0; c < blended.channels; c++) {
+			int error = abs(blended.data[i + c] - reference.data[i + c]);
+			largest = error > largest ? error : largest;
+			total += error;
+			count++;
+		}
+	}
+	state.counters["maxError"] = largest;
+	state.counters["meanError"] = count ? total / count : 0;
+}
+BENCHMARK(BM_OverlayWithAlpha)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "float" });
+	for (int size : { 1024, 4096 }) {
+		for (int channels : { 3, 4 }) {
+			b->Args({ size, channels, 0 })->Args({ size, channels, 1 });
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+// Each blend mode with an RGBA overlay on an RGB or RGBA image.
+static void BM_Blend(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	const Image& source = Source(Size(state), 4, 2);
+	const BlendMode mode = (BlendMode)state.range(3);
+	InPlace(state, [&](Image* image) { Blend(image, &source, 16, -16, mode, policy); });
+}
+BENCHMARK(BM_Blend)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "threads", "mode" });
+	for (int size : { 1024, 4096 }) {
+		for (int channels : { 3, 4 }) {
+			for (int threads : ThreadCounts(size)) {
+				for (int mode : { BlendOver, BlendMultiply, BlendScreen, BlendAdd }) {
+					b->Args({ size, channels, threads, mode });
+				}
+			}
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+// One caption line per 64 rows, so the text covers a fixed share of the image.
+static void BM_OverlayText(benchmark::State& state)
+{
+	IGFont font(FONT_FILE, 24);
+	if (font.sft.font == NULL) {
+		state.SkipWithError("font not found; run from the repository root");
+		return;
+	}
+	const char* caption = "The quick brown fox jumps over the lazy dog 0123456789";
+	InPlace(state, [&](Image* image) {
+		for (int y = 24; y < image->h; y += 64) {
+			for (int x = 0; x < image->w; x += 640) {
+				OverlayText(image, caption, font, x, y, 255, 255, 255, 192);
+			}
+		}
+	});
+	GlyphCacheStats stats = font.CacheStats();
+	state.counters["glyphHitRate"] = stats.HitRate();
+}
+BENCHMARK(BM_OverlayText)->Apply(AnyChannelsSequential);
+
+static void BM_Crop(benchmark::State& state)
+{
+	const Image& source = Source(Size(state), Channels(state));
+	for (auto _ : state) {
+		state.PauseTiming();
+		Image image(source);
+		state.ResumeTiming();
+		Crop(&image, source.w / 4, source.h / 4, source.w / 2, source.h / 2);
+		benchmark::DoNotOptimize(image.data);
+	}
+	SetThroughput(state, (int64_t)source.w * source.h / 4, source.channels);
+}
+BENCHMARK(BM_Crop)->Apply(AnyChannelsSequential);
+
+// The same centre crop as a view, then copied out with Materialize.
+static void BM_CropView(benchmark::State& state)
+{
+	const Image& source = Source(Size(state), Channels(state));
+	for (auto _ : state) {
+		ImageView view = Crop(ImageView(source), source.w / 4, source.h / 4, source.w / 2, source.h / 2);
+		benchmark::DoNotOptimize(view.data);
+	}
+	SetThroughput(state, (int64_t)source.w * source.h / 4, source.channels);
+}
+BENCHMARK(BM_CropView)->Apply(AnyChannelsSequential);
+
+static void BM_Materialize(benchmark::State& state)
+{
+	const Image& source = Source(Size(state), Channels(state));
+	ImageView view = Crop(ImageView(source), source.w / 4, source.h / 4, source.w / 2, source.h / 2);
+	for (auto _ : state) {
+		Image image = Materialize(view);
+		benchmark::DoNotOptimize(image.data);
+	}
+	SetThroughput(state, (int64_t)view.w * view.h, source.channels);
+}
+BENCHMARK(BM_Materialize)->Apply(AnyChannelsSequential);
+
+static void BM_DitherThreshold(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { DitherThreshold(image, 0x7F, policy); });
+}
+BENCHMARK(BM_DitherThreshold)->Apply(AnyChannels);
+
+static void BM_DitherRandom(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { DitherRandom(image, 1, policy); });
+}
+BENCHMARK(BM_DitherRandom)->Apply(AnyChannels);
+
+// The blue-noise map is generated on first use, so it is built before the timed loop.
+static void BM_DitherOrdered(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	ThresholdMap(BlueNoise64x64);
+	InPlace(state, [&](Image* image) { DitherOrdered(image, BlueNoise64x64, policy); });
+}
+BENCHMARK(BM_DitherOrdered)->Apply(AnyChannels);
+
+static void BM_DitherFloydSteinberg(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { DitherFloydSteinberg(image, false, policy); });
+}
+BENCHMARK(BM_DitherFloydSteinberg)->Apply(AnyChannels);
+
+static void BM_DitherJarvisJudiceNinke(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	InPlace(state, [&](Image* image) { DitherErrorDiffusion(image, JarvisJudiceNinke, true, policy); });
+}
+BENCHMARK(BM_DitherJarvisJudiceNinke)->Apply(AnyChannels);
+
+// Read and write benchmarks go through a file in the working directory.
+// ratio is the file size over the raw pixel bytes. QOI stores gray as RGB and gray +
+// alpha as RGBA, so its 1-channel files start from three times the bytes.
+static void Write(benchmark::State& state, const char* extension)
+{
+	const Image& source = Source(Size(state), Channels(state));
+	std::string filename = std::string("benchmark_output") + extension;
+	Image image(source);
+	for (auto _ : state) {
+		if (!image.Write(filename.c_str())) {
+			state.SkipWithError("write failed");
+			break;
+		}
+	}
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file != nullptr) {
+		fseek(file, 0, SEEK_END);
+		state.counters["ratio"] = (double)ftell(file) / source.size;
+		fclose(file);
+	}
+	std::remove(filename.c_str());
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+}
+
+static void Read(benchmark::State& state, const char* extension)
+{
+	const Image& source = Source(Size(state), Channels(state));
+	std::string filename = std::string("benchmark_input") + extension;
+	Image image(source);
+	if (!image.Write(filename.c_str())) {
+		state.SkipWithError("write failed");
+		return;
+	}
+	for (auto _ : state) {
+		Image loaded(filename.c_str());
+		benchmark::DoNotOptimize(loaded.data);
+	}
+	std::remove(filename.c_str());
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+}
+
+BENCHMARK_CAPTURE(Write, png, ".png")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Write, jpg, ".jpg")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Write, bmp, ".bmp")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Write, tga, ".tga")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Write, pnm, ".pnm")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Write, igr, ".igr")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Write, qoi, ".qoi")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Read, png, ".png")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Read, jpg, ".jpg")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Read, bmp, ".bmp")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Read, tga, ".tga")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Read, pnm, ".pnm")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Read, igr, ".igr")->Apply(AnyChannelsSequential);
+BENCHMARK_CAPTURE(Read, qoi, ".qoi")->Apply(AnyChannelsSequential);
+
+// Defined by stb_image_write in Image.cpp, which allocates the result with AllocateBuffer,
+// but declared only in its implementation section.
+extern "C" unsigned char* stbi_write_png_to_mem(const unsigned char* pixels, int strideBytes, int x, int y, int n, int* outLength);
+
+// PNG encoding in memory, without file I/O, at a zlib level and filter (PngFilter), or
+// with stb_image_write at its default level 8 and per-row filter choice (stb 1) as it
+// was used before Png.h. ratio is the output size over the raw pixel bytes.
+static void BM_EncodePng(benchmark::State& state)
+{
+	const Image& source = Source(Size(state), Channels(state));
+	const bool stb = state.range(5) != 0;
+	PngOptions options;
+	options.level = (int)state.range(3);
+	options.filter = (PngFilter)state.range(4);
+	options.policy = Policy(state);
+	std::vector<uint8_t> png;
+	int stbBytes = 0;
+	for (auto _ : state) {
+		if (stb) {
+			uint8_t* encoded = stbi_write_png_to_mem(source.data, source.w * source.channels,
+				source.w, source.h, source.channels, &stbBytes);
+			benchmark::DoNotOptimize(encoded);
+			FreeBuffer(encoded);
+		}
+		else if (!EncodePng(ImageView(source), options, &png)) {
+			state.SkipWithError("encode failed");
+			break;
+		}
+	}
+	state.counters["ratio"] = (double)(stb ? (size_t)stbBytes : png.size()) / source.size;
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+}
+BENCHMARK(BM_EncodePng)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "threads", "level", "filter", "stb" });
+	for (int size : { 1024, 4096 }) {
+		for (int channels : { 1, 3, 4 }) {
+			b->Args({ size, channels, 1, 8, PngFilterAdaptive, 1 });
+			for (int threads : ThreadCounts(size)) {
+				b->Args({ size, channels, threads, 5, PngFilterAdaptive, 0 });
+				b->Args({ size, channels, threads, 1, PngFilterUp, 0 });
+			}
+			b->Args({ size, channels, 1, 1, PngFilterNone, 0 });
+			b->Args({ size, channels, 1, 6, PngFilterAdaptive, 0 });
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+// A 24 MP (6000 x 4000) photo-sized image to a 512 x 341 thumbnail, per filter
+// (ResizeFilter), and for Lanczos also a 2x upscale of a 1024^2 image, which takes no
+// halving. simd 0 runs the scalar loops, simd 1 the kernels ActiveSimdLevel picks.
+static void BM_Resize(benchmark::State& state)
+{
+	const int channels = Channels(state);
+	const ExecutionPolicy policy = Policy(state);
+	const ResizeFilter filter = (ResizeFilter)state.range(3);
+	const bool simd = state.range(4) != 0;
+	const bool upscale = state.range(0) != 0;
+	static std::unique_ptr<Image> photos[5];
+	std::unique_ptr<Image>& photo = photos[channels];
+	if (!photo) {
+		photo.reset(new Image(6000, 4000, channels));
+		Fill(photo->data, photo->w, photo->h, channels, 1);
+	}
+	const Image& source = upscale ? Source(1024, channels) : *photo;
+	const int w = upscale ? 2048 : 512;
+	const int h = upscale ? 2048 : 341;
+
+	SimdLevel level = ActiveSimdLevel();
+	ForceSimdLevel(simd ? level : SimdScalar);
+	Image thumbnail(w, h, channels);
+	for (auto _ : state) {
+		Resize(ImageView(thumbnail), ImageView(source), filter, policy);
+		benchmark::ClobberMemory();
+	}
+	ForceSimdLevel(level);
+	state.counters["MP/s"] = benchmark::Counter((double)source.w * source.h * state.iterations() / 1e6,
+		benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Resize)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "upscale", "channels", "threads", "filter", "simd" });
+	for (int channels : { 1, 3, 4 }) {
+		for (int filter : { ResizeBox, ResizeBilinear, ResizeBicubic, ResizeLanczos }) {
+			b->Args({ 0, channels, 1, filter, 1 });
+		}
+		b->Args({ 0, channels, 1, ResizeLanczos, 0 });
+		b->Args({ 0, channels, 0, ResizeLanczos, 1 });
+		b->Args({ 1, channels, 1, ResizeLanczos, 1 });
+		b->Args({ 1, channels, 1, ResizeLanczos, 0 });
+		b->Args({ 1, channels, 0, ResizeLanczos, 1 });
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+// The five ingest sizes of a 6000x4000 photo, from one pyramid (pyramid 1) or as five
+// Resize calls that each halve the full image again (pyramid 0). Output is identical.
+static void BM_Thumbnails(benchmark::State& state)
+{
+	const int channels = Channels(state);
+	const ExecutionPolicy policy = Policy(state);
+	const bool pyramid = state.range(0) != 0;
+	static std::unique_ptr<Image> photos[5];
+	std::unique_ptr<Image>& photo = photos[channels];
+	if (!photo) {
+		photo.reset(new Image(6000, 4000, channels));
+		Fill(photo->data, photo->w, photo->h, channels, 1);
+	}
+	std::vector<ThumbnailSpec> specs;
+	for (int box : { 2048, 1024, 512, 256, 128 }) {
+		specs.push_back({ box, box, std::string() });
+	}
+
+	for (auto _ : state) {
+		if (pyramid) {
+			benchmark::DoNotOptimize(MakeThumbnails(*photo, specs, ResizeLanczos, policy));
+		} else {
+			for (const ThumbnailSpec& spec : specs) {
+				int w, h;
+				FitInside(photo->w, photo->h, spec.w, spec.h, &w, &h);
+				Image thumbnail(w, h, channels);
+				Resize(ImageView(thumbnail), ImageView(*photo), ResizeLanczos, policy);
+				benchmark::DoNotOptimize(thumbnail.data);
+			}
+		}
+		benchmark::ClobberMemory();
+	}
+	state.counters["MP/s"] = benchmark::Counter((double)photo->w * photo->h * state.iterations() / 1e6,
+		benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Thumbnails)->ArgNames({ "pyramid", "channels", "threads" })
+	->ArgsProduct({ { 0, 1 }, { 3, 4 }, { 0, 1 } })->Unit(benchmark::kMillisecond)->UseRealTime();
+
+namespace {
+	// Generates rows on demand, so a tall image never exists in memory.
+	class SyntheticReader : public StripReader {
+	public:
+		SyntheticReader(int w, int h, int channels)
+		{
+			this->w = w;
+			this->h = h;
+			this->channels = channels;
+		}
+
+		bool ReadRows(uint8_t* data, size_t stride, int rows) override
+		{
+			for (int y = 0; y < rows; y++, next++) {
+				uint8_t* row = data + (size_t)y * stride;
+				for (int x = 0; x < w * channels; x++) {
+					row[x] = (uint8_t)(x * 7 + next * 13);
+				}
+			}
+			return true;
+		}
+
+	private:
+		int next = 0;
+	};
+
+	class DiscardWriter : public StripWriter {
+	public:
+		bool WriteRows(const uint8_t* data, size_t, int) override
+		{
+			benchmark::DoNotOptimize(data);
+			return true;
+		}
+
+		bool Finish() override { return true; }
+	};
+}
+
+// Grayscale, 5x5 Gaussian and Floyd-Steinberg over a 4096-wide RGB image of the given
+// height, a strip at a time. peakRSS is the process high-water mark, so it only shows
+// the pipeline's footprint when run on its own (--benchmark_filter=BM_Stream).
+static void BM_StreamTall(benchmark::State& state)
+{
+	const int w = 4096;
+	const int h = (int)state.range(0);
+	ExecutionPolicy policy = state.range(1) == 0 ? Parallel : Sequential;
+	for (auto _ : state) {
+		SyntheticReader reader(w, h, 3);
+		DiscardWriter writer;
+		StripPipeline pipeline(policy);
+		pipeline.GrayscaleLum().Convolve(5, 5, GaussianKernel, 2, 2).DitherErrorDiffusion(FloydSteinberg);
+		pipeline.Run(reader, writer);
+	}
+	SetThroughput(state, (int64_t)w * h, 3);
+	state.counters["peakRSS_MB"] = PeakResidentBytes() / (1024.0 * 1024.0);
+}
+BENCHMARK(BM_StreamTall)->ArgNames({ "height", "threads" })
+	->Args({ 16384, 1 })->Args({ 65536, 1 })->Args({ 16384, 0 })->Args({ 65536, 0 })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Multi-stage chains run eagerly (lazy 0), one sweep over the image per operation,
+// and recorded on a LazyImage (lazy 1), which fuses each chain into a single tiled
+// pass. Both write a fresh output image from the unchanged source.
+static void Chain(benchmark::State& state, bool convolve)
+{
+	const Image& source = Source(Size(state), 3);
+	ExecutionPolicy policy = Policy(state);
+	const bool lazy = state.range(3) != 0;
+	int passes = 0;
+	for (auto _ : state) {
+		if (lazy) {
+			LazyImage chain(source);
+			chain.GrayscaleLum();
+			if (convolve) {
+				chain.Convolve(5, 5, GaussianKernel, 2, 2);
+			}
+			else {
+				chain.ColorMask(1, 1, 0);
+			}
+			chain.DitherThreshold();
+			Image result = chain.Evaluate(policy);
+			benchmark::DoNotOptimize(result.data);
+			passes = chain.Passes();
+		}
+		else {
+			Image result = Materialize(source);
+			GrayscaleLum(&result, policy);
+			if (convolve) {
+				Convolve(&result, 5, 5, GaussianKernel, 2, 2, BorderClamp, policy);
+			}
+			else {
+				ColorMask(&result, 1, 1, 0, policy);
+			}
+			DitherThreshold(&result, 0x7F, policy);
+			benchmark::DoNotOptimize(result.data);
+			passes = 4;
+		}
+	}
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+	state.counters["passes"] = passes;
+}
+
+static void ChainArguments(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({ "size", "channels", "threads", "lazy" });
+	for (int size : { 1024, 4096, 8192 }) {
+		for (int threads : ThreadCounts(size)) {
+			b->Args({ size, 3, threads, 0 })->Args({ size, 3, threads, 1 });
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+// GrayscaleLum -> ColorMask -> DitherThreshold, all pointwise.
+static void BM_ChainPointwise(benchmark::State& state) { Chain(state, false); }
+BENCHMARK(BM_ChainPointwise)->Apply(ChainArguments);
+
+// GrayscaleLum -> 5x5 Gaussian -> DitherThreshold, fused around the convolution's halo.
+static void BM_ChainConvolution(benchmark::State& state) { Chain(state, true); }
+BENCHMARK(BM_ChainConvolution)->Apply(ChainArguments);
+
+// The pointwise chain again, as the eager calls in sequence (fused 0) and as one
+// compile-time Pixels expression (fused 1), in place on a copy of the source.
+static void BM_PixelExpression(benchmark::State& state)
+{
+	ExecutionPolicy policy = Policy(state);
+	const bool fused = state.range(3) != 0;
+	InPlace(state, [&](Image* image) {
+		if (fused) {
+			(*image | Pixels::GrayscaleLum | Pixels::ColorMask(1, 1, 0) | Pixels::DitherThreshold()).Run(policy);
+		}
+		else {
+			GrayscaleLum(image, policy);
+			ColorMask(image, 1, 1, 0, policy);
+			DitherThreshold(image, 0x7F, policy);
+		}
+	});
+}
+BENCHMARK(BM_PixelExpression)->Apply([](benchmark::internal::Benchmark* b) {
+	b->ArgNames({ "size", "channels", "threads", "fused" });
+	for (int size : { 1024, 4096, 8192 }) {
+		for (int channels : { 3, 4 }) {
+			for (int threads : ThreadCounts(size)) {
+				b->Args({ size, channels, threads, 0 })->Args({ size, channels, threads, 1 });
+			}
+		}
+	}
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+// One decoded image fanned out to three outputs the way Main.cpp does it: a dithered
+// copy, a centre crop, and an ordered dither of the original itself. With eager 1
+// every branch takes a private copy up front, which is what copying an Image used to
+// do; with eager 0 copies share pixels and only the dithered copy pays for one.
+// peakLive_MB is the most image memory held at once.
+static void BM_FanOut(benchmark::State& state)
+{
+	const Image& source = Source(Size(state), Channels(state));
+	const bool eager = state.range(2) != 0;
+	size_t peak = 0;
+	auto track = [&]() {
+		size_t live = GetBufferPoolStats().liveBytes;
+		peak = live > peak ? live : peak;
+	};
+
+	for (auto _ : state) {
+		state.PauseTiming();
+		Image original(source);
+		original.Mutable();
+		size_t base = GetBufferPoolStats().liveBytes;
+		peak = base;
+		state.ResumeTiming();
+
+		Image dithered = original;
+		Image cropped = original;
+		Image ordered = eager ? Image(original) : std::move(original);
+		if (eager) {
+			dithered.Mutable();
+			cropped.Mutable();
+			ordered.Mutable();
+		}
+		track();
+		DitherThreshold(&dithered);
+		track();
+		Crop(&cropped, source.w / 4, source.h / 4, source.w / 2, source.h / 2);
+		track();
+		DitherOrdered(&ordered);
+		track();
+		benchmark::DoNotOptimize(dithered.data);
+		benchmark::DoNotOptimize(ordered.data);
+	}
+	SetThroughput(state, (int64_t)source.w * source.h, source.channels);
+	state.counters["peakLive_MB"] = peak / (1024.0 * 1024.0);
+}
+BENCHMARK(BM_FanOut)->ArgNames({ "size", "channels", "eager" })
+	->Args({ 1024, 3, 1 })->Args({ 1024, 3, 0 })->Args({ 4096, 3, 1 })->Args({ 4096, 3, 0 })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// A batch of 10k same-sized frames, each allocated, filled, thresholded and freed the
+// way a batch job handles them, with the buffer pool on (pooled 1) and off (pooled 0).
+// systemAllocs/frame counts buffers the pool had to get from the system, and
+// pageFaults/frame the pages first touched, which is the RSS churn of the batch.
+const int BATCH_FRAMES = 10000;
+
+static void SetBatchCounters(benchmark::State& state, const BufferPoolStats& before, uint64_t faults, int64_t pixels, int channels)
+{
+	BufferPoolStats after = GetBufferPoolStats();
+	double frames = (double)BATCH_FRAMES * state.iterations();
+	state.counters["systemAllocs/frame"] = (after.systemAllocations - before.systemAllocations) / frames;
+	state.counters["pageFaults/frame"] = (PageFaults() - faults) / frames;
+	state.counters["frames/s"] = benchmark::Counter(frames, benchmark::Counter::kIsRate);
+	SetThroughput(state, pixels * BATCH_FRAMES, channels);
+	SetBufferPoolCapacity(DEFAULT_BUFFER_POOL_BYTES);
+}
+
+static void BM_FrameBatch(benchmark::State& state)
+{
+	const int size = (int)state.range(0);
+	const int channels = (int)state.range(1);
+	const Image& source = Source(size, channels);
+	SetBufferPoolCapacity(state.range(2) ? DEFAULT_BUFFER_POOL_BYTES : 0);
+
+	BufferPoolStats before = GetBufferPoolStats();
+	uint64_t faults = PageFaults();
+	for (auto _ : state) {
+		for (int i = 0; i < BATCH_FRAMES; i++) {
+			Image frame(size, size, channels);
+			memcpy(frame.data, source.data, source.size);
+			DitherThreshold(&frame);
+			benchmark::DoNotOptimize(frame.data);
+		}
+	}
+	SetBatchCounters(state, before, faults, (int64_t)size * size, channels);
+}
+BENCHMARK(BM_FrameBatch)->ArgNames({ "size", "channels", "pooled" })
+	->Args({ 256, 3, 1 })->Args({ 256, 3, 0 })->Args({ 1024, 3, 1 })->Args({ 1024, 3, 0 })
+	->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// The same batch decoded from PNG, where stb_image's own buffers come from the pool too.
+static void BM_DecodeBatch(benchmark::State& state)
+{
+	const int size = (int)state.range(0);
+	const int channels = (int)state.range(1);
+	Image image(Source(size, channels));
+	if (!image.Write("benchmark_batch.png")) {
+		state.SkipWithError("write failed");
+		return;
+	}
+	SetBufferPoolCapacity(state.range(2) ? DEFAULT_BUFFER_POOL_BYTES : 0);
+
+	BufferPoolStats before = GetBufferPoolStats();
+	uint64_t faults = PageFaults();
+	for (auto _ : state) {
+		for (int i = 0; i < BATCH_FRAMES; i++) {
+			Image frame("benchmark_batch.png");
+			benchmark::DoNotOptimize(frame.data);
+		}
+	}
+	SetBatchCounters(state, before, faults, (int64_t)size * size, channels);
+	std::remove("benchmark_batch.png");
+}
+BENCHMARK(BM_DecodeBatch)->ArgNames({ "size", "channels", "pooled" })
+	->Args({ 256, 3, 1 })->Args({ 256, 3, 0 })
+	->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,204 @@
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "Allocator.h"
+
+namespace ImageGene {
+	namespace {
+		const int CLASS_STEPS = 8;
+		const int MIN_CLASS_SHIFT = 6;
+
+		// Sits in the BUFFER_ALIGNMENT bytes in front of each buffer, so free and
+		// realloc can find the block's class without being told its size.
+		struct BlockHeader {
+			size_t capacity;
+			size_t requested;
+			uint32_t sizeClass;
+		};
+
+		static_assert(sizeof(BlockHeader) <= BUFFER_ALIGNMENT, "block header must fit in the alignment padding");
+
+		// Classes are 64 bytes, then eight evenly spaced sizes up to each power of two,
+		// so rounding up never wastes more than an eighth of the block.
+		uint32_t SizeClass(size_t bytes, size_t* capacity)
+		{
+			if (bytes <= ((size_t)1 << MIN_CLASS_SHIFT)) {
+				*capacity = (size_t)1 << MIN_CLASS_SHIFT;
+				return 0;
+			}
+			int shift = 0;
+			while (((size_t)2 << shift) < bytes) {
+				shift++;
+			}
+			size_t base = (size_t)1 << shift;
+			size_t step = base / CLASS_STEPS;
+			size_t index = (bytes - base + step - 1) / step;
+			*capacity = base + index * step;
+			return (uint32_t)((shift - MIN_CLASS_SHIFT) * CLASS_STEPS + index);
+		}
+
+		class BufferPool {
+		public:
+			void* Allocate(size_t bytes)
+			{
+				size_t capacity;
+				uint32_t sizeClass = SizeClass(bytes, &capacity);
+
+				uint8_t* block = nullptr;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stats.allocations++;
+					if (sizeClass < free.size() && !free[sizeClass].empty()) {
+						block = free[sizeClass].back();
+						free[sizeClass].pop_back();
+						stats.reuses++;
+						stats.pooledBytes -= capacity;
+						stats.pooledBlocks--;
+					}
+					else {
+						stats.systemAllocations++;
+					}
+					stats.liveBytes += capacity;
+				}
+
+				if (block == nullptr) {
+					block = (uint8_t*)::operator new(BUFFER_ALIGNMENT + capacity, std::align_val_t(BUFFER_ALIGNMENT), std::nothrow);
+					if (block == nullptr) {
+						std::lock_guard<std::mutex> lock(mutex);
+						stats.systemAllocations--;
+						stats.liveBytes -= capacity;
+						return nullptr;
+					}
+				}
+
+				BlockHeader* header = (BlockHeader*)block;
+				header->capacity = capacity;
+				header->requested = bytes;
+				header->sizeClass = sizeClass;
+				return block + BUFFER_ALIGNMENT;
+			}
+
+			void Free(void* buffer)
+			{
+				uint8_t* block = (uint8_t*)buffer - BUFFER_ALIGNMENT;
+				BlockHeader* header = (BlockHeader*)block;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stats.liveBytes -= header->capacity;
+					if (stats.pooledBytes + header->capacity <= capacity) {
+						if (header->sizeClass >= free.size()) {
+							free.resize(header->sizeClass + 1);
+						}
+						free[header->sizeClass].push_back(block);
+						stats.pooledBytes += header->capacity;
+						stats.pooledBlocks++;
+						return;
+					}
+					stats.systemFrees++;
+				}
+				::operator delete(block, std::align_val_t(BUFFER_ALIGNMENT));
+			}
+
+			void* Reallocate(void* buffer, size_t bytes)
+			{
+				if (buffer == nullptr) {
+					return Allocate(bytes);
+				}
+				BlockHeader* header = (BlockHeader*)((uint8_t*)buffer - BUFFER_ALIGNMENT);
+				if (bytes <= header->capacity) {
+					header->requested = bytes;
+					return buffer;
+				}
+				void* grown = Allocate(bytes);
+				if (grown == nullptr) {
+					return nullptr;
+				}
+				memcpy(grown, buffer, header->requested);
+				Free(buffer);
+				return grown;
+			}
+
+			void SetCapacity(size_t bytes)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				capacity = bytes;
+				Release(bytes);
+			}
+
+			void Trim()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				Release(0);
+			}
+
+			BufferPoolStats Stats()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				return stats;
+			}
+
+		private:
+			// Frees pooled blocks, largest classes first, until at most limit bytes remain.
+			void Release(size_t limit)
+			{
+				for (size_t c = free.size(); c-- > 0 && stats.pooledBytes > limit; ) {
+					while (!free[c].empty() && stats.pooledBytes > limit) {
+						uint8_t* block = free[c].back();
+						free[c].pop_back();
+						stats.pooledBytes -= ((BlockHeader*)block)->capacity;
+						stats.pooledBlocks--;
+						stats.systemFrees++;
+						::operator delete(block, std::align_val_t(BUFFER_ALIGNMENT));
+					}
+				}
+			}
+
+			std::mutex mutex;
+			std::vector<std::vector<uint8_t*>> free;
+			size_t capacity = DEFAULT_BUFFER_POOL_BYTES;
+			BufferPoolStats stats = {};
+		};
+
+		// Never destroyed: images in static storage may be freed after any other static
+		// object has gone, and the system reclaims pooled blocks at exit anyway.
+		BufferPool& Pool()
+		{
+			static BufferPool* pool = new BufferPool();
+			return *pool;
+		}
+	}
+
+	void* AllocateBuffer(size_t bytes)
+	{
+		return Pool().Allocate(bytes);
+	}
+
+	void* ReallocateBuffer(void* buffer, size_t bytes)
+	{
+		return Pool().Reallocate(buffer, bytes);
+	}
+
+	void FreeBuffer(void* buffer)
+	{
+		if (buffer != nullptr) {
+			Pool().Free(buffer);
+		}
+	}
+
+	void SetBufferPoolCapacity(size_t bytes)
+	{
+		Pool().SetCapacity(bytes);
+	}
+
+	void TrimBufferPool()
+	{
+		Pool().Trim();
+	}
+
+	BufferPoolStats GetBufferPoolStats()
+	{
+		return Pool().Stats();
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageGene {
+	// Every pixel buffer starts on a cache line, which is also the widest SIMD load.
+	const size_t BUFFER_ALIGNMENT = 64;
+	const size_t DEFAULT_BUFFER_POOL_BYTES = 256 * 1024 * 1024;
+
+	struct BufferPoolStats {
+		uint64_t allocations;
+		uint64_t reuses;
+		uint64_t systemAllocations;
+		uint64_t systemFrees;
+		size_t liveBytes;
+		size_t pooledBytes;
+		size_t pooledBlocks;
+	};
+
+	// Allocator behind Image data and stb_image's internal buffers. Requests are rounded
+	// up to a size class (eight classes per power of two), and freed blocks are kept per
+	// class to be handed out again, so a stream of same-sized frames reuses pages that
+	// are already faulted in instead of mapping fresh ones. Blocks beyond the pool
+	// capacity go back to the system. Safe to use from several threads.
+	//
+	// AllocateBuffer returns nullptr on failure; FreeBuffer accepts nullptr.
+	void* AllocateBuffer(size_t bytes);
+	void* ReallocateBuffer(void* buffer, size_t bytes);
+	void FreeBuffer(void* buffer);
+
+	// Bytes of freed blocks the pool may hold. 0 disables recycling.
+	void SetBufferPoolCapacity(size_t bytes);
+	// Returns every pooled block to the system.
+	void TrimBufferPool();
+	BufferPoolStats GetBufferPoolStats();
+}
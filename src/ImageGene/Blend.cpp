@@ -0,0 +1,396 @@
+#include <cstring>
+#include <vector>
+
+#include "Blend.h"
+#include "Blit.h"
+#include "Cpu.h"
+
+#if defined(IG_X86)
+#include <immintrin.h>
+#elif defined(IG_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		// x y / 255 rounded to nearest, exact for x, y <= 255.
+		inline uint32_t Mul255(uint32_t x, uint32_t y)
+		{
+			uint32_t t = x * y + 128;
+			return (t + (t >> 8)) >> 8;
+		}
+
+		inline uint8_t Saturate(uint32_t v)
+		{
+			return (uint8_t)(v > 255 ? 255 : v);
+		}
+
+		inline uint8_t BlendChannel(uint32_t s, uint32_t d, uint32_t sa, uint32_t da, BlendMode mode)
+		{
+			switch (mode) {
+			case BlendMultiply:
+				return Saturate(Mul255(s, d) + Mul255(s, 255 - da) + Mul255(d, 255 - sa));
+			case BlendScreen:
+				return Saturate(s + d - Mul255(s, d));
+			case BlendAdd:
+				return Saturate(s + d);
+			default:
+				return Saturate(s + Mul255(d, 255 - sa));
+			}
+		}
+
+		void PremultiplyScalar(uint8_t* rgba, int x, int w)
+		{
+			for (uint8_t* px = rgba + (size_t)x * 4; x < w; x++, px += 4) {
+				for (int c = 0; c < 3; c++) {
+					px[c] = (uint8_t)Mul255(px[c], px[3]);
+				}
+			}
+		}
+
+		void BlendScalar(uint8_t* dst, const uint8_t* src, int x, int w, BlendMode mode)
+		{
+			for (; x < w; x++) {
+				const uint8_t* s = src + (size_t)x * 4;
+				uint8_t* d = dst + (size_t)x * 4;
+				uint32_t sa = s[3];
+				uint32_t da = d[3];
+				for (int c = 0; c < 4; c++) {
+					d[c] = BlendChannel(s[c], d[c], sa, da, mode);
+				}
+			}
+		}
+
+		// Each kernel handles as many leading pixels as it can and returns how many; the
+		// scalar loop finishes the row.
+		typedef int (*PremultiplyKernel)(uint8_t* rgba, int w);
+		typedef int (*BlendKernel)(uint8_t* dst, const uint8_t* src, int w);
+
+#if defined(IG_X86)
+		IG_TARGET_SSE41 inline __m128i Mul255(__m128i x, __m128i y)
+		{
+			__m128i t = _mm_add_epi16(_mm_mullo_epi16(x, y), _mm_set1_epi16(128));
+			return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		}
+
+		// Two RGBA pixels in 16-bit lanes, with each pixel's alpha in all four of its lanes.
+		IG_TARGET_SSE41 inline __m128i Alphas(__m128i px)
+		{
+			return _mm_shuffle_epi8(px, _mm_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15));
+		}
+
+		// Sums stay below 3 * 255 in 16 bits; the final pack saturates them.
+		template <BlendMode Mode>
+		IG_TARGET_SSE41 inline __m128i Blend16(__m128i s, __m128i d)
+		{
+			const __m128i full = _mm_set1_epi16(255);
+			if (Mode == BlendScreen) {
+				return _mm_sub_epi16(_mm_add_epi16(s, d), Mul255(s, d));
+			}
+			if (Mode == BlendMultiply) {
+				__m128i t = _mm_add_epi16(Mul255(s, d), Mul255(s, _mm_sub_epi16(full, Alphas(d))));
+				return _mm_add_epi16(t, Mul255(d, _mm_sub_epi16(full, Alphas(s))));
+			}
+			return _mm_add_epi16(s, Mul255(d, _mm_sub_epi16(full, Alphas(s))));
+		}
+
+		template <BlendMode Mode>
+		IG_TARGET_SSE41 int BlendSSE41(uint8_t* dst, const uint8_t* src, int w)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			int x = 0;
+			for (; x + 8 <= w; x += 8) {
+				for (int half = 0; half < 2; half++) {
+					const uint8_t* sp = src + (size_t)x * 4 + 16 * half;
+					uint8_t* dp = dst + (size_t)x * 4 + 16 * half;
+					__m128i s = _mm_loadu_si128((const __m128i*)sp);
+					__m128i d = _mm_loadu_si128((const __m128i*)dp);
+					if (Mode == BlendAdd) {
+						_mm_storeu_si128((__m128i*)dp, _mm_adds_epu8(s, d));
+						continue;
+					}
+					__m128i lo = Blend16<Mode>(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+					__m128i hi = Blend16<Mode>(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+					_mm_storeu_si128((__m128i*)dp, _mm_packus_epi16(lo, hi));
+				}
+			}
+			return x;
+		}
+
+		IG_TARGET_SSE41 int PremultiplySSE41(uint8_t* rgba, int w)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			// Alpha is multiplied by 255, which leaves it as it is.
+			const __m128i keepAlpha = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+			int x = 0;
+			for (; x + 8 <= w; x += 8) {
+				for (int half = 0; half < 2; half++) {
+					uint8_t* p = rgba + (size_t)x * 4 + 16 * half;
+					__m128i v = _mm_loadu_si128((const __m128i*)p);
+					__m128i lo = _mm_unpacklo_epi8(v, zero);
+					__m128i hi = _mm_unpackhi_epi8(v, zero);
+					lo = Mul255(lo, _mm_or_si128(Alphas(lo), keepAlpha));
+					hi = Mul255(hi, _mm_or_si128(Alphas(hi), keepAlpha));
+					_mm_storeu_si128((__m128i*)p, _mm_packus_epi16(lo, hi));
+				}
+			}
+			return x;
+		}
+
+		// Four pixels per step, one 32-bit lane each. Steps whose alphas are all 255 are
+		// skipped, which is the common case of an opaque destination.
+		IG_TARGET_SSE41 int UnpremultiplySSE41(uint8_t* rgba, int w)
+		{
+			const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+			const __m128i low = _mm_set1_epi32(0xFF);
+			const __m128i maximum = _mm_set1_epi32(255);
+			const __m128 full = _mm_set1_ps(255.0f);
+			const __m128 half = _mm_set1_ps(0.5f);
+			int x = 0;
+			for (; x + 4 <= w; x += 4) {
+				uint8_t* p = rgba + (size_t)x * 4;
+				__m128i px = _mm_loadu_si128((const __m128i*)p);
+				__m128i alphaBits = _mm_and_si128(px, opaque);
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(alphaBits, opaque)) == 0xFFFF) {
+					continue;
+				}
+				__m128 alpha = _mm_cvtepi32_ps(_mm_srli_epi32(px, 24));
+				__m128 r = _mm_and_ps(_mm_div_ps(full, alpha), _mm_cmpneq_ps(alpha, _mm_setzero_ps()));
+				__m128i out = alphaBits;
+				for (int c = 0; c < 3; c++) {
+					__m128 channel = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8 * c), low));
+					__m128i v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(channel, r), half));
+					out = _mm_or_si128(out, _mm_slli_epi32(_mm_min_epi32(v, maximum), 8 * c));
+				}
+				_mm_storeu_si128((__m128i*)p, out);
+			}
+			return x;
+		}
+#elif defined(IG_NEON)
+		// The same rounding as the scalar Mul255: (p + ((p + 128) >> 8) + 128) >> 8.
+		inline uint8x16_t Mul255(uint8x16_t x, uint8x16_t y)
+		{
+			uint16x8_t lo = vmull_u8(vget_low_u8(x), vget_low_u8(y));
+			uint16x8_t hi = vmull_u8(vget_high_u8(x), vget_high_u8(y));
+			return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)), vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+		}
+
+		// One channel plane of 16 pixels; inverse alphas are 255 - alpha.
+		template <BlendMode Mode>
+		inline uint8x16_t BlendPlane(uint8x16_t s, uint8x16_t d, uint8x16_t sInverse, uint8x16_t dInverse)
+		{
+			if (Mode == BlendScreen) {
+				return vqaddq_u8(s, vqsubq_u8(d, Mul255(s, d)));
+			}
+			if (Mode == BlendMultiply) {
+				return vqaddq_u8(vqaddq_u8(Mul255(s, d), Mul255(s, dInverse)), Mul255(d, sInverse));
+			}
+			if (Mode == BlendAdd) {
+				return vqaddq_u8(s, d);
+			}
+			return vqaddq_u8(s, Mul255(d, sInverse));
+		}
+
+		template <BlendMode Mode>
+		int BlendNEON(uint8_t* dst, const uint8_t* src, int w)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16x4_t s = vld4q_u8(src + (size_t)x * 4);
+				uint8x16x4_t d = vld4q_u8(dst + (size_t)x * 4);
+				uint8x16_t sInverse = vmvnq_u8(s.val[3]);
+				uint8x16_t dInverse = vmvnq_u8(d.val[3]);
+				uint8x16x4_t out;
+				for (int c = 0; c < 4; c++) {
+					out.val[c] = BlendPlane<Mode>(s.val[c], d.val[c], sInverse, dInverse);
+				}
+				vst4q_u8(dst + (size_t)x * 4, out);
+			}
+			return x;
+		}
+
+		int PremultiplyNEON(uint8_t* rgba, int w)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16x4_t px = vld4q_u8(rgba + (size_t)x * 4);
+				for (int c = 0; c < 3; c++) {
+					px.val[c] = Mul255(px.val[c], px.val[3]);
+				}
+				vst4q_u8(rgba + (size_t)x * 4, px);
+			}
+			return x;
+		}
+#endif
+
+		PremultiplyKernel SelectPremultiplyKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return PremultiplySSE41;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				return PremultiplyNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		PremultiplyKernel SelectUnpremultiplyKernel()
+		{
+#if defined(IG_X86)
+			if (ActiveSimdLevel() >= SimdSSE41) {
+				return UnpremultiplySSE41;
+			}
+#endif
+			return nullptr;
+		}
+
+		BlendKernel SelectBlendKernel(BlendMode mode)
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				switch (mode) {
+				case BlendMultiply: return BlendSSE41<BlendMultiply>;
+				case BlendScreen: return BlendSSE41<BlendScreen>;
+				case BlendAdd: return BlendSSE41<BlendAdd>;
+				default: return BlendSSE41<BlendOver>;
+				}
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				switch (mode) {
+				case BlendMultiply: return BlendNEON<BlendMultiply>;
+				case BlendScreen: return BlendNEON<BlendScreen>;
+				case BlendAdd: return BlendNEON<BlendAdd>;
+				default: return BlendNEON<BlendOver>;
+				}
+			}
+#endif
+			(void)level;
+			(void)mode;
+			return nullptr;
+		}
+
+		// 255 / a in float, 0 for a = 0. The SIMD kernel divides the same way, so both
+		// round (c * 255 / a + 0.5) identically.
+		struct Reciprocals {
+			float table[256];
+
+			Reciprocals()
+			{
+				table[0] = 0;
+				for (int a = 1; a < 256; a++) {
+					table[a] = 255.0f / (float)a;
+				}
+			}
+		};
+
+		void UnpremultiplyScalar(uint8_t* rgba, int x, int w)
+		{
+			static const Reciprocals reciprocals;
+			for (uint8_t* px = rgba + (size_t)x * 4; x < w; x++, px += 4) {
+				if (px[3] == 255) {
+					continue;
+				}
+				float r = reciprocals.table[px[3]];
+				for (int c = 0; c < 3; c++) {
+					int v = (int)((float)px[c] * r + 0.5f);
+					px[c] = (uint8_t)(v > 255 ? 255 : v);
+				}
+			}
+		}
+
+		// Puts the blended straight pixels back into the destination, except where the
+		// source is fully transparent, which no mode changes: there the destination keeps
+		// its exact value rather than one that went through premultiplication.
+		void Commit(uint8_t* dst, const uint8_t* blended, const uint8_t* src, int w)
+		{
+			for (int x = 0; x < w; x++) {
+				if (src[(size_t)x * 4 + 3] != 0) {
+					memcpy(dst + (size_t)x * 4, blended + (size_t)x * 4, 4);
+				}
+			}
+		}
+	}
+
+	void PremultiplyRow(uint8_t* rgba, int w)
+	{
+		PremultiplyKernel kernel = SelectPremultiplyKernel();
+		PremultiplyScalar(rgba, kernel ? kernel(rgba, w) : 0, w);
+	}
+
+	void UnpremultiplyRow(uint8_t* rgba, int w)
+	{
+		PremultiplyKernel kernel = SelectUnpremultiplyKernel();
+		UnpremultiplyScalar(rgba, kernel ? kernel(rgba, w) : 0, w);
+	}
+
+	void BlendRow(uint8_t* dst, const uint8_t* src, int w, BlendMode mode)
+	{
+		BlendKernel kernel = SelectBlendKernel(mode);
+		BlendScalar(dst, src, kernel ? kernel(dst, src, w) : 0, w, mode);
+	}
+
+	Image& Blend(Image* image, const Image* source, int x, int y, BlendMode mode, const ExecutionPolicy& policy)
+	{
+		std::unique_ptr<Image> copy;
+		Blend(ImageView(*image), SourceView(*source, copy), x, y, mode, policy);
+		return *image;
+	}
+
+	ImageView Blend(const ImageView& image, const ImageView& source, int x, int y, BlendMode mode,
+		const ExecutionPolicy& policy)
+	{
+		Rect clip = image.Clip(x, y, source.w, source.h);
+		if (clip.w == 0 || clip.h == 0 || image.channels < 1 || source.channels < 1) {
+			return image;
+		}
+		ImageView target = image.Region(clip.x, clip.y, clip.w, clip.h);
+		const uint8_t* origin = source.Row(clip.y - y) + (size_t)(clip.x - x) * source.channels;
+		const bool sourceAlpha = source.channels == 2 || source.channels >= 4;
+		const bool targetAlpha = target.channels == 2 || target.channels >= 4;
+		const int w = target.w;
+
+		ParallelRows(target.h, (size_t)w * 4 * 3, policy, [&](int first, int last) {
+			std::vector<uint8_t> src((size_t)w * 4);
+			std::vector<uint8_t> blended((size_t)w * 4);
+			std::vector<uint8_t> straight(targetAlpha && target.channels != 4 ? (size_t)w * 4 : 0);
+			for (int row = first; row < last; row++) {
+				ConvertPixels(origin + (size_t)row * source.stride, source.channels, src.data(), 4, w);
+				if (sourceAlpha) {
+					PremultiplyRow(src.data(), w);
+				}
+
+				uint8_t* dst = target.Row(row);
+				if (!targetAlpha) {
+					// Opaque stays opaque, so there is nothing to premultiply or undo.
+					ConvertPixels(dst, target.channels, blended.data(), 4, w);
+					BlendRow(blended.data(), src.data(), w, mode);
+					ConvertPixels(blended.data(), 4, dst, target.channels, w);
+					continue;
+				}
+
+				uint8_t* rgba = dst;
+				if (target.channels != 4) {
+					ConvertPixels(dst, target.channels, straight.data(), 4, w);
+					rgba = straight.data();
+				}
+				memcpy(blended.data(), rgba, (size_t)w * 4);
+				PremultiplyRow(blended.data(), w);
+				BlendRow(blended.data(), src.data(), w, mode);
+				UnpremultiplyRow(blended.data(), w);
+				Commit(rgba, blended.data(), src.data(), w);
+				if (target.channels != 4) {
+					ConvertPixels(rgba, 4, dst, target.channels, w);
+				}
+			}
+		});
+
+		return image;
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Image.h"
+
+namespace ImageGene {
+	// Separable blend modes on premultiplied alpha, with s, d the source and destination
+	// channels and sa, da their alphas, all in 0..1. Alpha follows the same formula as
+	// the color channels.
+	//   Over:     s + d (1 - sa)
+	//   Multiply: s d + s (1 - da) + d (1 - sa)
+	//   Screen:   s + d - s d
+	//   Add:      min(1, s + d)
+	// A fully transparent source pixel leaves the destination unchanged in every mode.
+	enum BlendMode {
+		BlendOver, BlendMultiply, BlendScreen, BlendAdd
+	};
+
+	// Row kernels on premultiplied RGBA in 8-bit fixed point: a product x y / 255 is
+	// rounded to nearest and sums saturate at 255. SSE4.1 handles 8 pixels per step and
+	// NEON 16; every path writes the same bytes. Unpremultiplying rounds c * 255 / a in
+	// float (SSE4.1, 4 pixels per step) and leaves a = 0 pixels black.
+	void PremultiplyRow(uint8_t* rgba, int w);
+	void UnpremultiplyRow(uint8_t* rgba, int w);
+	void BlendRow(uint8_t* dst, const uint8_t* src, int w, BlendMode mode);
+
+	// Blends straight-alpha source onto image with its top left corner at (x, y), clipped
+	// to image. Either side may have 1 to 4 channels (gray, gray + alpha, RGB, RGBA, see
+	// ConvertPixels); a side without alpha is opaque. Rows are premultiplied, blended and
+	// converted back in small buffers, and split across threads by policy. An image
+	// without alpha stays opaque in every mode, so only images with alpha pay for
+	// unpremultiplying, and there pixels the source leaves alone keep their exact values.
+	Image& Blend(Image* image, const Image* source, int x, int y, BlendMode mode = BlendOver,
+		const ExecutionPolicy& policy = Sequential);
+	ImageView Blend(const ImageView& image, const ImageView& source, int x, int y, BlendMode mode = BlendOver,
+		const ExecutionPolicy& policy = Sequential);
+}
@@ -0,0 +1,280 @@
+#include <cstring>
+
+#include "Blit.h"
+#include "Cpu.h"
+#include "Grayscale.h"
+
+#if defined(IG_X86)
+#include <immintrin.h>
+#elif defined(IG_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		bool HasAlpha(int channels)
+		{
+			return channels == 2 || channels == 4;
+		}
+
+		int ColorChannels(int channels)
+		{
+			return channels >= 3 ? 3 : 1;
+		}
+
+		// For each destination channel, the source channel it is copied from, or -1 for an
+		// alpha of 255. Covers every conversion except color to gray.
+		void ChannelMap(int srcChannels, int dstChannels, int* map)
+		{
+			for (int c = 0; c < dstChannels; c++) {
+				if (HasAlpha(dstChannels) && c == dstChannels - 1) {
+					map[c] = HasAlpha(srcChannels) ? srcChannels - 1 : -1;
+				}
+				else {
+					map[c] = ColorChannels(srcChannels) == 1 ? 0 : c;
+				}
+			}
+		}
+
+		void ShuffleScalar(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int x, int w,
+			const int* map)
+		{
+			for (; x < w; x++) {
+				const uint8_t* sp = src + (size_t)x * srcChannels;
+				uint8_t* dp = dst + (size_t)x * dstChannels;
+				for (int c = 0; c < dstChannels; c++) {
+					dp[c] = map[c] < 0 ? 255 : sp[map[c]];
+				}
+			}
+		}
+
+		// Byte shuffle moving `step` pixels per 16-byte load and store: destination byte j
+		// takes source byte shuffle[j], or 0 where shuffle[j] is negative, ORed with
+		// fill[j], which is 0xFF for an added alpha.
+		struct Shuffle {
+			int step;
+			int8_t shuffle[16];
+			uint8_t fill[16];
+
+			Shuffle(int srcChannels, int dstChannels, const int* map)
+			{
+				step = 16 / (srcChannels > dstChannels ? srcChannels : dstChannels);
+				for (int j = 0; j < 16; j++) {
+					int p = j / dstChannels;
+					int source = p < step ? map[j % dstChannels] : 0;
+					shuffle[j] = p < step && source >= 0 ? (int8_t)(p * srcChannels + source) : (int8_t)-128;
+					fill[j] = p < step && source < 0 ? 0xFF : 0;
+				}
+			}
+		};
+
+		// Each kernel converts as many leading pixels as it can without reading or writing
+		// past either span and returns how many; ShuffleScalar finishes. A store covers
+		// more than `step` pixels, and the next store or the scalar loop overwrites the rest.
+		typedef int (*ShuffleKernel)(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int w,
+			const Shuffle& shuffle);
+
+#if defined(IG_X86)
+		IG_TARGET_SSE41 int ShuffleSSE41(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int w,
+			const Shuffle& shuffle)
+		{
+			const __m128i mask = _mm_loadu_si128((const __m128i*)shuffle.shuffle);
+			const __m128i fill = _mm_loadu_si128((const __m128i*)shuffle.fill);
+			const size_t srcEnd = (size_t)w * srcChannels;
+			const size_t dstEnd = (size_t)w * dstChannels;
+
+			int x = 0;
+			for (; (size_t)x * srcChannels + 16 <= srcEnd && (size_t)x * dstChannels + 16 <= dstEnd; x += shuffle.step) {
+				__m128i px = _mm_loadu_si128((const __m128i*)(src + (size_t)x * srcChannels));
+				_mm_storeu_si128((__m128i*)(dst + (size_t)x * dstChannels), _mm_or_si128(_mm_shuffle_epi8(px, mask), fill));
+			}
+			return x;
+		}
+#elif defined(IG_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+		// Table lookups of 16 bytes are AArch64 only; 32-bit ARM takes the scalar loop.
+		int ShuffleNEON(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int w,
+			const Shuffle& shuffle)
+		{
+			const uint8x16_t mask = vreinterpretq_u8_s8(vld1q_s8(shuffle.shuffle));
+			const uint8x16_t fill = vld1q_u8(shuffle.fill);
+			const size_t srcEnd = (size_t)w * srcChannels;
+			const size_t dstEnd = (size_t)w * dstChannels;
+
+			int x = 0;
+			for (; (size_t)x * srcChannels + 16 <= srcEnd && (size_t)x * dstChannels + 16 <= dstEnd; x += shuffle.step) {
+				uint8x16_t px = vld1q_u8(src + (size_t)x * srcChannels);
+				vst1q_u8(dst + (size_t)x * dstChannels, vorrq_u8(vqtbl1q_u8(px, mask), fill));
+			}
+			return x;
+		}
+#define IG_SHUFFLE_NEON 1
+#endif
+
+		ShuffleKernel SelectKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return ShuffleSSE41;
+			}
+#elif defined(IG_SHUFFLE_NEON)
+			if (level == SimdNEON) {
+				return ShuffleNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		void LuminanceScalar(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int x, int w)
+		{
+			for (; x < w; x++) {
+				const uint8_t* sp = src + (size_t)x * srcChannels;
+				uint8_t* dp = dst + (size_t)x * dstChannels;
+				dp[0] = GrayPixel(sp, GrayscaleMethodLum);
+				if (dstChannels == 2) {
+					dp[1] = HasAlpha(srcChannels) ? sp[3] : 255;
+				}
+			}
+		}
+
+		// Color to gray, with the same arithmetic as GrayPixel, for 3 or 4 source channels
+		// and 1 or 2 destination channels. Same contract as ShuffleKernel.
+		typedef int (*LuminanceKernel)(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int w);
+
+#if defined(IG_X86)
+		// Four pixels per step in 32-bit lanes: R and G as 16-bit pairs for one madd, B on
+		// its own for another, and for gray + alpha the alpha byte placed above the gray
+		// value so one saturating pack interleaves them.
+		IG_TARGET_SSE41 int LuminanceSSE41(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int w)
+		{
+			int8_t rg[16], b[16], a[16];
+			uint8_t opaque[16] = {};
+			for (int p = 0; p < 4; p++) {
+				int8_t base = (int8_t)(p * srcChannels);
+				int8_t none = (int8_t)-128;
+				int8_t rgLane[4] = { base, none, (int8_t)(base + 1), none };
+				int8_t bLane[4] = { (int8_t)(base + 2), none, none, none };
+				int8_t aLane[4] = { none, srcChannels == 4 ? (int8_t)(base + 3) : none, none, none };
+				memcpy(rg + 4 * p, rgLane, 4);
+				memcpy(b + 4 * p, bLane, 4);
+				memcpy(a + 4 * p, aLane, 4);
+				opaque[4 * p + 1] = srcChannels == 4 ? 0 : 0xFF;
+			}
+			const __m128i rgMask = _mm_loadu_si128((const __m128i*)rg);
+			const __m128i bMask = _mm_loadu_si128((const __m128i*)b);
+			const __m128i aMask = _mm_loadu_si128((const __m128i*)a);
+			const __m128i aFill = _mm_loadu_si128((const __m128i*)opaque);
+			const __m128i rgWeights = _mm_set1_epi32((int)(LUM_R | LUM_G << 16));
+			const __m128i bWeight = _mm_set1_epi32((int)LUM_B);
+			const __m128i round = _mm_set1_epi32((int)LUM_ROUND);
+
+			int x = 0;
+			for (; (size_t)x * srcChannels + 16 <= (size_t)w * srcChannels; x += 4) {
+				__m128i px = _mm_loadu_si128((const __m128i*)(src + (size_t)x * srcChannels));
+				__m128i sum = _mm_add_epi32(_mm_madd_epi16(_mm_shuffle_epi8(px, rgMask), rgWeights),
+					_mm_madd_epi16(_mm_shuffle_epi8(px, bMask), bWeight));
+				__m128i gray = _mm_srli_epi32(_mm_add_epi32(sum, round), LUM_SHIFT);
+				uint8_t* dp = dst + (size_t)x * dstChannels;
+				if (dstChannels == 2) {
+					__m128i pairs = _mm_or_si128(gray, _mm_or_si128(_mm_shuffle_epi8(px, aMask), aFill));
+					_mm_storel_epi64((__m128i*)dp, _mm_packus_epi32(pairs, pairs));
+				}
+				else {
+					__m128i packed = _mm_packus_epi16(_mm_packus_epi32(gray, gray), gray);
+					int bytes = _mm_cvtsi128_si32(packed);
+					memcpy(dp, &bytes, 4);
+				}
+			}
+			return x;
+		}
+#elif defined(IG_NEON)
+		int LuminanceNEON(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int w)
+		{
+			int x = 0;
+			for (; x + 8 <= w; x += 8) {
+				const uint8_t* sp = src + (size_t)x * srcChannels;
+				uint8x8_t r, g, b;
+				uint8x8_t a = vdup_n_u8(255);
+				if (srcChannels == 4) {
+					uint8x8x4_t px = vld4_u8(sp);
+					r = px.val[0];
+					g = px.val[1];
+					b = px.val[2];
+					a = px.val[3];
+				}
+				else {
+					uint8x8x3_t px = vld3_u8(sp);
+					r = px.val[0];
+					g = px.val[1];
+					b = px.val[2];
+				}
+				uint16x8_t r16 = vmovl_u8(r), g16 = vmovl_u8(g), b16 = vmovl_u8(b);
+				uint32x4_t lo = vdupq_n_u32(LUM_ROUND);
+				uint32x4_t hi = vdupq_n_u32(LUM_ROUND);
+				lo = vmlal_n_u16(lo, vget_low_u16(r16), (uint16_t)LUM_R);
+				hi = vmlal_n_u16(hi, vget_high_u16(r16), (uint16_t)LUM_R);
+				lo = vmlal_n_u16(lo, vget_low_u16(g16), (uint16_t)LUM_G);
+				hi = vmlal_n_u16(hi, vget_high_u16(g16), (uint16_t)LUM_G);
+				lo = vmlal_n_u16(lo, vget_low_u16(b16), (uint16_t)LUM_B);
+				hi = vmlal_n_u16(hi, vget_high_u16(b16), (uint16_t)LUM_B);
+				uint8x8_t gray = vmovn_u16(vcombine_u16(vshrn_n_u32(lo, LUM_SHIFT), vshrn_n_u32(hi, LUM_SHIFT)));
+				uint8_t* dp = dst + (size_t)x * dstChannels;
+				if (dstChannels == 2) {
+					uint8x8x2_t out = { { gray, a } };
+					vst2_u8(dp, out);
+				}
+				else {
+					vst1_u8(dp, gray);
+				}
+			}
+			return x;
+		}
+#endif
+
+		LuminanceKernel SelectLuminanceKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return LuminanceSSE41;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				return LuminanceNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+	}
+
+	void ConvertPixels(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int w)
+	{
+		if (srcChannels == dstChannels) {
+			memcpy(dst, src, (size_t)w * srcChannels);
+			return;
+		}
+		if (srcChannels < 1 || srcChannels > 4 || dstChannels < 1 || dstChannels > 4) {
+			int count = srcChannels < dstChannels ? srcChannels : dstChannels;
+			for (int x = 0; x < w; x++) {
+				memcpy(dst + (size_t)x * dstChannels, src + (size_t)x * srcChannels, count);
+			}
+			return;
+		}
+		if (ColorChannels(srcChannels) == 3 && ColorChannels(dstChannels) == 1) {
+			LuminanceKernel kernel = SelectLuminanceKernel();
+			LuminanceScalar(src, srcChannels, dst, dstChannels, kernel ? kernel(src, srcChannels, dst, dstChannels, w) : 0, w);
+			return;
+		}
+
+		int map[4];
+		ChannelMap(srcChannels, dstChannels, map);
+		ShuffleKernel kernel = SelectKernel();
+		int x = 0;
+		if (kernel) {
+			x = kernel(src, srcChannels, dst, dstChannels, w, Shuffle(srcChannels, dstChannels, map));
+		}
+		ShuffleScalar(src, srcChannels, dst, dstChannels, x, w, map);
+	}
+}
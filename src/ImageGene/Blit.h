@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ImageGene {
+	// Converts w pixels from srcChannels to dstChannels. 1 and 2 channels are gray and
+	// gray + alpha, 3 and 4 are RGB and RGBA:
+	//   gray to color repeats the gray value into R, G and B,
+	//   color to gray takes the BT.709 luminance (GrayPixel, GrayscaleMethodLum),
+	//   alpha is copied when both sides have it, set to 255 when only dst has it, and
+	//   dropped when only src has it.
+	// Other channel counts copy the first min(srcChannels, dstChannels) channels and leave
+	// any further dst channels as they are.
+	// Equal channel counts are one memcpy; other conversions are a byte shuffle or a
+	// fixed-point luminance kernel (SSE4.1 or NEON). src and dst must not overlap.
+	void ConvertPixels(const uint8_t* src, int srcChannels, uint8_t* dst, int dstChannels, int w);
+}
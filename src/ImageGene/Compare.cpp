@@ -0,0 +1,678 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "Compare.h"
+#include "Cpu.h"
+
+#if defined(IG_X86)
+#include <immintrin.h>
+#elif defined(IG_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		const int SSIM_BLOCK = 4;
+		const double SSIM_C1 = (0.01 * 255) * (0.01 * 255);
+		const double SSIM_C2 = (0.03 * 255) * (0.03 * 255);
+
+		struct DiffSums {
+			uint64_t absolute = 0;
+			uint64_t squared = 0;
+			uint64_t differing = 0;
+			uint8_t largest = 0;
+		};
+
+		inline void Accumulate(uint8_t* a, uint8_t b, bool write, DiffSums& sums)
+		{
+			uint8_t d = (uint8_t)(*a > b ? *a - b : b - *a);
+			if (write) {
+				*a = d;
+			}
+			sums.absolute += d;
+			sums.squared += (uint32_t)d * d;
+			sums.differing += d != 0;
+			sums.largest = d > sums.largest ? d : sums.largest;
+		}
+
+		// Each kernel handles as many leading bytes of two rows with the same channel
+		// layout as it can and returns how many it handled; the scalar loop finishes.
+		typedef size_t (*DiffKernel)(uint8_t* a, const uint8_t* b, size_t n, bool write, DiffSums& sums);
+
+#if defined(IG_X86)
+		// |a - b| is the OR of the two saturating differences. Per-lane counters of equal
+		// bytes overflow after 255 steps, so they and the 32-bit squared sums go into the
+		// 64-bit totals after every chunk of that many steps.
+		IG_TARGET_SSE41 size_t DiffSSE41(uint8_t* a, const uint8_t* b, size_t n, bool write, DiffSums& sums)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i largest = zero;
+
+			size_t i = 0;
+			while (i + 16 <= n) {
+				size_t start = i;
+				size_t end = n - i > 16 * 255 ? i + 16 * 255 : n;
+				__m128i absolute = zero;
+				__m128i squared = zero;
+				__m128i equal = zero;
+				for (; i + 16 <= end; i += 16) {
+					__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+					__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+					__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+					if (write) {
+						_mm_storeu_si128((__m128i*)(a + i), d);
+					}
+					absolute = _mm_add_epi64(absolute, _mm_sad_epu8(d, zero));
+					largest = _mm_max_epu8(largest, d);
+					equal = _mm_sub_epi8(equal, _mm_cmpeq_epi8(d, zero));
+					__m128i lo = _mm_unpacklo_epi8(d, zero);
+					__m128i hi = _mm_unpackhi_epi8(d, zero);
+					squared = _mm_add_epi32(squared, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+				}
+
+				alignas(16) uint64_t wide[2];
+				_mm_store_si128((__m128i*)wide, absolute);
+				sums.absolute += wide[0] + wide[1];
+				_mm_store_si128((__m128i*)wide, _mm_sad_epu8(equal, zero));
+				sums.differing += (i - start) - (wide[0] + wide[1]);
+				alignas(16) uint32_t lanes[4];
+				_mm_store_si128((__m128i*)lanes, squared);
+				sums.squared += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+			}
+
+			alignas(16) uint8_t bytes[16];
+			_mm_store_si128((__m128i*)bytes, largest);
+			for (int k = 0; k < 16; k++) {
+				sums.largest = bytes[k] > sums.largest ? bytes[k] : sums.largest;
+			}
+			return i;
+		}
+#elif defined(IG_NEON)
+		inline uint64_t Total(uint32x4_t v)
+		{
+			uint64x2_t pairs = vpaddlq_u32(v);
+			return vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1);
+		}
+
+		// The 16-bit absolute sums overflow after 128 steps, which sets the chunk size.
+		size_t DiffNEON(uint8_t* a, const uint8_t* b, size_t n, bool write, DiffSums& sums)
+		{
+			const uint8x16_t zero = vdupq_n_u8(0);
+			uint8x16_t largest = zero;
+
+			size_t i = 0;
+			while (i + 16 <= n) {
+				size_t start = i;
+				size_t end = n - i > 16 * 128 ? i + 16 * 128 : n;
+				uint16x8_t absolute = vdupq_n_u16(0);
+				uint32x4_t squared = vdupq_n_u32(0);
+				uint8x16_t equal = zero;
+				for (; i + 16 <= end; i += 16) {
+					uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+					if (write) {
+						vst1q_u8(a + i, d);
+					}
+					absolute = vpadalq_u8(absolute, d);
+					largest = vmaxq_u8(largest, d);
+					equal = vsubq_u8(equal, vceqq_u8(d, zero));
+					squared = vpadalq_u16(squared, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+					squared = vpadalq_u16(squared, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+				}
+
+				sums.absolute += Total(vpaddlq_u16(absolute));
+				sums.differing += (i - start) - Total(vpaddlq_u16(vpaddlq_u8(equal)));
+				sums.squared += Total(squared);
+			}
+
+			uint8_t bytes[16];
+			vst1q_u8(bytes, largest);
+			for (int k = 0; k < 16; k++) {
+				sums.largest = bytes[k] > sums.largest ? bytes[k] : sums.largest;
+			}
+			return i;
+		}
+#endif
+
+		DiffKernel SelectKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return DiffSSE41;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				return DiffNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		// Rows [y0, y1) of the w x h x channels region the two views have in common. When
+		// both views have exactly those channels a row is one run of bytes.
+		void DiffRows(const ImageView& a, const ImageView& b, int y0, int y1, int w, int channels,
+			bool write, DiffSums& sums)
+		{
+			DiffKernel kernel = SelectKernel();
+			bool packed = a.channels == channels && b.channels == channels;
+			for (int y = y0; y < y1; y++) {
+				uint8_t* ra = a.Row(y);
+				const uint8_t* rb = b.Row(y);
+				if (packed) {
+					size_t n = (size_t)w * channels;
+					size_t i = kernel ? kernel(ra, rb, n, write, sums) : 0;
+					for (; i < n; i++) {
+						Accumulate(ra + i, rb[i], write, sums);
+					}
+					continue;
+				}
+				for (int x = 0; x < w; x++) {
+					for (int k = 0; k < channels; k++) {
+						Accumulate(ra + (size_t)x * a.channels + k, rb[(size_t)x * b.channels + k], write, sums);
+					}
+				}
+			}
+		}
+
+		struct BlockSums {
+			uint32_t s1;
+			uint32_t s2;
+			uint32_t ss;
+			uint32_t s12;
+		};
+
+		// Per-sample sums down the four rows of a block row, one entry per channel value.
+		struct ColumnSums {
+			std::vector<uint32_t> s1;
+			std::vector<uint32_t> s2;
+			std::vector<uint32_t> ss;
+			std::vector<uint32_t> s12;
+
+			explicit ColumnSums(size_t n) : s1(n), s2(n), ss(n), s12(n) {}
+		};
+
+		// Like DiffKernel: fills the leading column sums of four packed rows of each image
+		// and returns how many it filled.
+		typedef size_t (*ColumnKernel)(const uint8_t* const* ra, const uint8_t* const* rb, size_t n, ColumnSums& columns);
+
+#if defined(IG_X86)
+		// Eight columns at a time, all four rows in registers. The products fit 16 bits
+		// unsigned, so a * b uses mullo and a^2 + b^2 one madd of a and b interleaved.
+		IG_TARGET_SSE41 size_t ColumnsSSE41(const uint8_t* const* ra, const uint8_t* const* rb, size_t n, ColumnSums& columns)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m128i s1 = zero, s2 = zero;
+				__m128i ssLo = zero, ssHi = zero, s12Lo = zero, s12Hi = zero;
+				for (int r = 0; r < SSIM_BLOCK; r++) {
+					__m128i va = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(ra[r] + i)));
+					__m128i vb = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(rb[r] + i)));
+					s1 = _mm_add_epi16(s1, va);
+					s2 = _mm_add_epi16(s2, vb);
+					__m128i lo = _mm_unpacklo_epi16(va, vb);
+					__m128i hi = _mm_unpackhi_epi16(va, vb);
+					ssLo = _mm_add_epi32(ssLo, _mm_madd_epi16(lo, lo));
+					ssHi = _mm_add_epi32(ssHi, _mm_madd_epi16(hi, hi));
+					__m128i product = _mm_mullo_epi16(va, vb);
+					s12Lo = _mm_add_epi32(s12Lo, _mm_unpacklo_epi16(product, zero));
+					s12Hi = _mm_add_epi32(s12Hi, _mm_unpackhi_epi16(product, zero));
+				}
+				_mm_storeu_si128((__m128i*)&columns.s1[i], _mm_unpacklo_epi16(s1, zero));
+				_mm_storeu_si128((__m128i*)&columns.s1[i + 4], _mm_unpackhi_epi16(s1, zero));
+				_mm_storeu_si128((__m128i*)&columns.s2[i], _mm_unpacklo_epi16(s2, zero));
+				_mm_storeu_si128((__m128i*)&columns.s2[i + 4], _mm_unpackhi_epi16(s2, zero));
+				_mm_storeu_si128((__m128i*)&columns.ss[i], ssLo);
+				_mm_storeu_si128((__m128i*)&columns.ss[i + 4], ssHi);
+				_mm_storeu_si128((__m128i*)&columns.s12[i], s12Lo);
+				_mm_storeu_si128((__m128i*)&columns.s12[i + 4], s12Hi);
+			}
+			return i;
+		}
+#elif defined(IG_NEON)
+		size_t ColumnsNEON(const uint8_t* const* ra, const uint8_t* const* rb, size_t n, ColumnSums& columns)
+		{
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				uint16x8_t s1 = vdupq_n_u16(0), s2 = vdupq_n_u16(0);
+				uint32x4_t ssLo = vdupq_n_u32(0), ssHi = vdupq_n_u32(0);
+				uint32x4_t s12Lo = vdupq_n_u32(0), s12Hi = vdupq_n_u32(0);
+				for (int r = 0; r < SSIM_BLOCK; r++) {
+					uint8x8_t va = vld1_u8(ra[r] + i);
+					uint8x8_t vb = vld1_u8(rb[r] + i);
+					s1 = vaddw_u8(s1, va);
+					s2 = vaddw_u8(s2, vb);
+					uint16x8_t aa = vmull_u8(va, va);
+					uint16x8_t bb = vmull_u8(vb, vb);
+					uint16x8_t ab = vmull_u8(va, vb);
+					ssLo = vaddw_u16(vaddw_u16(ssLo, vget_low_u16(aa)), vget_low_u16(bb));
+					ssHi = vaddw_u16(vaddw_u16(ssHi, vget_high_u16(aa)), vget_high_u16(bb));
+					s12Lo = vaddw_u16(s12Lo, vget_low_u16(ab));
+					s12Hi = vaddw_u16(s12Hi, vget_high_u16(ab));
+				}
+				vst1q_u32(&columns.s1[i], vmovl_u16(vget_low_u16(s1)));
+				vst1q_u32(&columns.s1[i + 4], vmovl_u16(vget_high_u16(s1)));
+				vst1q_u32(&columns.s2[i], vmovl_u16(vget_low_u16(s2)));
+				vst1q_u32(&columns.s2[i + 4], vmovl_u16(vget_high_u16(s2)));
+				vst1q_u32(&columns.ss[i], ssLo);
+				vst1q_u32(&columns.ss[i + 4], ssHi);
+				vst1q_u32(&columns.s12[i], s12Lo);
+				vst1q_u32(&columns.s12[i + 4], s12Hi);
+			}
+			return i;
+		}
+#endif
+
+		ColumnKernel SelectColumnKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return ColumnsSSE41;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				return ColumnsNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		// Sums of every 4 x 4 block, per channel, along block row j: image rows 4j to 4j + 3.
+		// The four rows are summed column by column first.
+		void BlockRow(const ImageView& a, const ImageView& b, int j, int blocks, int channels,
+			ColumnSums& columns, BlockSums* out)
+		{
+			const size_t n = (size_t)blocks * SSIM_BLOCK * channels;
+			const uint8_t* ra[SSIM_BLOCK];
+			const uint8_t* rb[SSIM_BLOCK];
+			for (int r = 0; r < SSIM_BLOCK; r++) {
+				ra[r] = a.Row(j * SSIM_BLOCK + r);
+				rb[r] = b.Row(j * SSIM_BLOCK + r);
+			}
+
+			bool packed = a.channels == channels && b.channels == channels;
+			ColumnKernel kernel = packed ? SelectColumnKernel() : nullptr;
+			for (size_t i = kernel ? kernel(ra, rb, n, columns) : 0; i < n; i++) {
+				size_t x = i / channels;
+				size_t k = i % channels;
+				uint32_t s1 = 0, s2 = 0, ss = 0, s12 = 0;
+				for (int r = 0; r < SSIM_BLOCK; r++) {
+					uint32_t va = ra[r][x * a.channels + k];
+					uint32_t vb = rb[r][x * b.channels + k];
+					s1 += va;
+					s2 += vb;
+					ss += va * va + vb * vb;
+					s12 += va * vb;
+				}
+				columns.s1[i] = s1;
+				columns.s2[i] = s2;
+				columns.ss[i] = ss;
+				columns.s12[i] = s12;
+			}
+
+			for (int bx = 0; bx < blocks; bx++) {
+				for (int k = 0; k < channels; k++) {
+					BlockSums& block = out[(size_t)bx * channels + k];
+					block = {};
+					for (int c = 0; c < SSIM_BLOCK; c++) {
+						size_t i = ((size_t)bx * SSIM_BLOCK + c) * channels + k;
+						block.s1 += columns.s1[i];
+						block.s2 += columns.s2[i];
+						block.ss += columns.ss[i];
+						block.s12 += columns.s12[i];
+					}
+				}
+			}
+		}
+
+		double WindowSsim(double s1, double s2, double ss, double s12, double n)
+		{
+			double mu1 = s1 / n;
+			double mu2 = s2 / n;
+			double variances = ss / n - mu1 * mu1 - mu2 * mu2;
+			double covariance = s12 / n - mu1 * mu2;
+			return (2 * mu1 * mu2 + SSIM_C1) * (2 * covariance + SSIM_C2) /
+				((mu1 * mu1 + mu2 * mu2 + SSIM_C1) * (variances + SSIM_C2));
+		}
+
+		// SSIM summed over the windows of window rows [wy0, wy1), one total per window row.
+		// Window row wy covers block rows wy and wy + 1; each window is two blocks wide.
+		void SsimRows(const ImageView& a, const ImageView& b, int wy0, int wy1, int blocks, int channels,
+			double* totals)
+		{
+			if (wy0 >= wy1) {
+				return;
+			}
+			std::vector<BlockSums> upper((size_t)blocks * channels);
+			std::vector<BlockSums> lower((size_t)blocks * channels);
+			ColumnSums columns((size_t)blocks * SSIM_BLOCK * channels);
+			BlockRow(a, b, wy0, blocks, channels, columns, upper.data());
+			for (int wy = wy0; wy < wy1; wy++) {
+				BlockRow(a, b, wy + 1, blocks, channels, columns, lower.data());
+				double total = 0;
+				for (int bx = 0; bx + 1 < blocks; bx++) {
+					const BlockSums* u = &upper[(size_t)bx * channels];
+					const BlockSums* l = &lower[(size_t)bx * channels];
+					for (int k = 0; k < channels; k++) {
+						const BlockSums& u0 = u[k];
+						const BlockSums& u1 = u[channels + k];
+						const BlockSums& l0 = l[k];
+						const BlockSums& l1 = l[channels + k];
+						total += WindowSsim(
+							(double)u0.s1 + u1.s1 + l0.s1 + l1.s1,
+							(double)u0.s2 + u1.s2 + l0.s2 + l1.s2,
+							(double)u0.ss + u1.ss + l0.ss + l1.ss,
+							(double)u0.s12 + u1.s12 + l0.s12 + l1.s12,
+							4 * SSIM_BLOCK * SSIM_BLOCK);
+					}
+				}
+				totals[wy] = total;
+				upper.swap(lower);
+			}
+		}
+
+		// A region too small for a window is compared as a single window.
+		double WholeSsim(const ImageView& a, const ImageView& b, int w, int h, int channels)
+		{
+			double total = 0;
+			for (int k = 0; k < channels; k++) {
+				uint64_t s1 = 0, s2 = 0, ss = 0, s12 = 0;
+				for (int y = 0; y < h; y++) {
+					for (int x = 0; x < w; x++) {
+						uint64_t va = a.Row(y)[(size_t)x * a.channels + k];
+						uint64_t vb = b.Row(y)[(size_t)x * b.channels + k];
+						s1 += va;
+						s2 += vb;
+						ss += va * va + vb * vb;
+						s12 += va * vb;
+					}
+				}
+				total += WindowSsim((double)s1, (double)s2, (double)ss, (double)s12, (double)w * h);
+			}
+			return total / channels;
+		}
+
+		// Like DiffKernel, but stops early: returns the offset of the first 16 bytes holding
+		// a difference beyond tolerance, or how many leading bytes are all within it.
+		typedef size_t (*ToleranceKernel)(const uint8_t* a, const uint8_t* b, size_t n, uint8_t tolerance);
+
+#if defined(IG_X86)
+		IG_TARGET_SSE41 size_t WithinSSE41(const uint8_t* a, const uint8_t* b, size_t n, uint8_t tolerance)
+		{
+			const __m128i limit = _mm_set1_epi8((char)tolerance);
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+				__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+				__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+				__m128i over = _mm_subs_epu8(d, limit);
+				if (!_mm_testz_si128(over, over)) {
+					return i;
+				}
+			}
+			return i;
+		}
+#elif defined(IG_NEON)
+		size_t WithinNEON(const uint8_t* a, const uint8_t* b, size_t n, uint8_t tolerance)
+		{
+			const uint8x16_t limit = vdupq_n_u8(tolerance);
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				uint8x16_t over = vcgtq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)), limit);
+				uint64x2_t lanes = vreinterpretq_u64_u8(over);
+				if (vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) {
+					return i;
+				}
+			}
+			return i;
+		}
+#endif
+
+		ToleranceKernel SelectToleranceKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return WithinSSE41;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				return WithinNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		// Whether columns [x0, x1) of row y differ anywhere by more than tolerance, over the
+		// first `channels` channels of each pixel.
+		bool RowDiffers(const ImageView& a, const ImageView& b, int y, int x0, int x1, int channels,
+			uint8_t tolerance, ToleranceKernel kernel)
+		{
+			const uint8_t* ra = a.Row(y);
+			const uint8_t* rb = b.Row(y);
+			if (a.channels == channels && b.channels == channels) {
+				ra += (size_t)x0 * channels;
+				rb += (size_t)x0 * channels;
+				size_t n = (size_t)(x1 - x0) * channels;
+				if (tolerance == 0) {
+					return memcmp(ra, rb, n) != 0;
+				}
+				for (size_t i = kernel ? kernel(ra, rb, n, tolerance) : 0; i < n; i++) {
+					if ((ra[i] > rb[i] ? ra[i] - rb[i] : rb[i] - ra[i]) > tolerance) {
+						return true;
+					}
+				}
+				return false;
+			}
+			for (int x = x0; x < x1; x++) {
+				const uint8_t* pa = ra + (size_t)x * a.channels;
+				const uint8_t* pb = rb + (size_t)x * b.channels;
+				for (int k = 0; k < channels; k++) {
+					if ((pa[k] > pb[k] ? pa[k] - pb[k] : pb[k] - pa[k]) > tolerance) {
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+	}
+
+	DiffStats Compare(const ImageView& image1, const ImageView& image2, CompareMode mode, bool ssim,
+		const ExecutionPolicy& policy)
+	{
+		int w = image1.w < image2.w ? image1.w : image2.w;
+		int h = image1.h < image2.h ? image1.h : image2.h;
+		int channels = image1.channels < image2.channels ? image1.channels : image2.channels;
+		const bool write = mode == CompareWriteDiff;
+
+		DiffStats stats = {};
+		stats.psnr = std::numeric_limits<double>::infinity();
+		stats.ssim = std::numeric_limits<double>::quiet_NaN();
+		if (w <= 0 || h <= 0 || channels <= 0) {
+			return stats;
+		}
+
+		int blocks = w / SSIM_BLOCK;
+		int windowRows = w >= 2 * SSIM_BLOCK && h >= 2 * SSIM_BLOCK ? (h - 2 * SSIM_BLOCK) / SSIM_BLOCK + 1 : 0;
+		bool windows = ssim && windowRows > 0;
+		std::vector<double> windowTotals(windows ? windowRows : 0);
+		size_t rowBytes = (size_t)w * channels * 2;
+
+		// Window row wy is measured by the band holding image row 4 * wy.
+		auto measure = [&](int y0, int y1) {
+			int wy0 = (y0 + SSIM_BLOCK - 1) / SSIM_BLOCK;
+			int wy1 = (y1 + SSIM_BLOCK - 1) / SSIM_BLOCK;
+			SsimRows(image1, image2, wy0, wy1 < windowRows ? wy1 : windowRows, blocks, channels, windowTotals.data());
+		};
+
+		if (ssim && !windows) {
+			stats.ssim = WholeSsim(image1, image2, w, h, channels);
+		}
+		if (windows && write) {
+			ParallelRows(h, rowBytes, policy, measure);
+		}
+
+		DiffSums total;
+		std::mutex mutex;
+		ParallelRows(h, rowBytes, policy, [&](int y0, int y1) {
+			DiffSums sums;
+			DiffRows(image1, image2, y0, y1, w, channels, write, sums);
+			if (windows && !write) {
+				measure(y0, y1);
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			total.absolute += sums.absolute;
+			total.squared += sums.squared;
+			total.differing += sums.differing;
+			total.largest = sums.largest > total.largest ? sums.largest : total.largest;
+		});
+
+		stats.samples = (uint64_t)w * h * channels;
+		stats.differing = total.differing;
+		stats.maxError = total.largest;
+		stats.meanAbsoluteError = (double)total.absolute / stats.samples;
+		stats.meanSquaredError = (double)total.squared / stats.samples;
+		if (total.squared != 0) {
+			stats.psnr = 10 * log10(255.0 * 255.0 / stats.meanSquaredError);
+		}
+		if (windows) {
+			double sum = 0;
+			for (double t : windowTotals) {
+				sum += t;
+			}
+			stats.ssim = sum / ((double)windowRows * (blocks - 1) * channels);
+		}
+		return stats;
+	}
+
+	DiffStats Compare(Image* image1, const Image* image2, CompareMode mode, bool ssim, const ExecutionPolicy& policy)
+	{
+		std::unique_ptr<Image> copy1;
+		std::unique_ptr<Image> copy2;
+		ImageView view1 = mode == CompareWriteDiff ? ImageView(*image1) : SourceView(*image1, copy1);
+		return Compare(view1, SourceView(*image2, copy2), mode, ssim, policy);
+	}
+
+	bool Equal(const ImageView& image1, const ImageView& image2, uint8_t tolerance, const ExecutionPolicy& policy)
+	{
+		if (image1.w != image2.w || image1.h != image2.h || image1.channels != image2.channels) {
+			return false;
+		}
+
+		ToleranceKernel kernel = SelectToleranceKernel();
+		std::atomic<bool> differs(false);
+		ParallelRows(image1.h, image1.RowBytes() * 2, policy, [&](int y0, int y1) {
+			for (int y = y0; y < y1 && !differs.load(std::memory_order_relaxed); y++) {
+				if (RowDiffers(image1, image2, y, 0, image1.w, image1.channels, tolerance, kernel)) {
+					differs.store(true, std::memory_order_relaxed);
+				}
+			}
+		});
+		return !differs.load();
+	}
+
+	bool Equal(const Image& image1, const Image& image2, uint8_t tolerance, const ExecutionPolicy& policy)
+	{
+		std::unique_ptr<Image> copy1;
+		std::unique_ptr<Image> copy2;
+		return Equal(SourceView(image1, copy1), SourceView(image2, copy2), tolerance, policy);
+	}
+
+	std::vector<Rect> ChangedRegions(const ImageView& image1, const ImageView& image2, uint8_t tolerance,
+		int tileSize, const ExecutionPolicy& policy)
+	{
+		std::vector<Rect> regions;
+		if (tileSize <= 0) {
+			printf("Tile size must be positive, got %d\n", tileSize);
+			return regions;
+		}
+		int w = image1.w < image2.w ? image1.w : image2.w;
+		int h = image1.h < image2.h ? image1.h : image2.h;
+		int channels = image1.channels < image2.channels ? image1.channels : image2.channels;
+		if (w <= 0 || h <= 0 || channels <= 0) {
+			return regions;
+		}
+
+		// Each tile row is marked by the one thread that owns it. A row that matches as a
+		// whole is one check; otherwise only tiles not yet marked are looked at.
+		int columns = (w + tileSize - 1) / tileSize;
+		int rows = (h + tileSize - 1) / tileSize;
+		std::vector<uint8_t> changed((size_t)columns * rows);
+		ToleranceKernel kernel = SelectToleranceKernel();
+		ParallelRows(rows, (size_t)w * channels * 2 * tileSize, policy, [&](int ty0, int ty1) {
+			for (int ty = ty0; ty < ty1; ty++) {
+				uint8_t* marks = &changed[(size_t)ty * columns];
+				int marked = 0;
+				int yEnd = (ty + 1) * tileSize < h ? (ty + 1) * tileSize : h;
+				for (int y = ty * tileSize; y < yEnd && marked < columns; y++) {
+					if (!RowDiffers(image1, image2, y, 0, w, channels, tolerance, kernel)) {
+						continue;
+					}
+					for (int tx = 0; tx < columns; tx++) {
+						int x0 = tx * tileSize;
+						int x1 = x0 + tileSize < w ? x0 + tileSize : w;
+						if (!marks[tx] && RowDiffers(image1, image2, y, x0, x1, channels, tolerance, kernel)) {
+							marks[tx] = 1;
+							marked++;
+						}
+					}
+				}
+			}
+		});
+
+		// Group touching tiles, in row order of each group's first tile.
+		std::vector<int> stack;
+		for (int start = 0; start < columns * rows; start++) {
+			if (changed[start] != 1) {
+				continue;
+			}
+			int tx0 = start % columns, tx1 = tx0, ty0 = start / columns, ty1 = ty0;
+			changed[start] = 2;
+			stack.push_back(start);
+			while (!stack.empty()) {
+				int tile = stack.back();
+				stack.pop_back();
+				int tx = tile % columns;
+				int ty = tile / columns;
+				tx0 = tx < tx0 ? tx : tx0;
+				tx1 = tx > tx1 ? tx : tx1;
+				ty0 = ty < ty0 ? ty : ty0;
+				ty1 = ty > ty1 ? ty : ty1;
+				for (int ny = ty - 1; ny <= ty + 1; ny++) {
+					for (int nx = tx - 1; nx <= tx + 1; nx++) {
+						if (nx >= 0 && nx < columns && ny >= 0 && ny < rows && changed[(size_t)ny * columns + nx] == 1) {
+							changed[(size_t)ny * columns + nx] = 2;
+							stack.push_back(ny * columns + nx);
+						}
+					}
+				}
+			}
+
+			Rect region;
+			region.x = tx0 * tileSize;
+			region.y = ty0 * tileSize;
+			region.w = ((tx1 + 1) * tileSize < w ? (tx1 + 1) * tileSize : w) - region.x;
+			region.h = ((ty1 + 1) * tileSize < h ? (ty1 + 1) * tileSize : h) - region.y;
+			regions.push_back(region);
+		}
+		return regions;
+	}
+
+	std::vector<Rect> ChangedRegions(const Image& image1, const Image& image2, uint8_t tolerance, int tileSize,
+		const ExecutionPolicy& policy)
+	{
+		std::unique_ptr<Image> copy1;
+		std::unique_ptr<Image> copy2;
+		return ChangedRegions(SourceView(image1, copy1), SourceView(image2, copy2), tolerance, tileSize, policy);
+	}
+}
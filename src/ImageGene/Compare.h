@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Image.h"
+
+namespace ImageGene {
+	enum CompareMode {
+		CompareStatsOnly, CompareWriteDiff
+	};
+
+	// Statistics over every channel value two images have in common: the columns, rows
+	// and channels both of them have.
+	struct DiffStats {
+		// Channel values compared, and how many of them differ.
+		uint64_t samples;
+		uint64_t differing;
+		uint8_t maxError;
+		double meanAbsoluteError;
+		double meanSquaredError;
+		// 10 log10(255^2 / MSE) in dB; +infinity when the images match.
+		double psnr;
+		// Mean SSIM over 8 x 8 windows spaced 4 pixels apart, averaged over channels, with
+		// the usual constants (0.01 * 255)^2 and (0.03 * 255)^2. A common region smaller
+		// than a window is one window. NaN unless requested.
+		double ssim;
+	};
+
+	// Compares two images in one pass over their rows, split across threads by policy.
+	// CompareWriteDiff also writes |image1 - image2| into image1 in the same pass, exactly
+	// as Diffmap does; CompareStatsOnly never writes. The sums are kept as integers, so the
+	// statistics are the same for every thread count and instruction set.
+	//
+	// SSIM reads the pixels around each row, so when the diff is also written it is
+	// measured in a read-only pass first.
+	DiffStats Compare(const ImageView& image1, const ImageView& image2, CompareMode mode = CompareStatsOnly,
+		bool ssim = false, const ExecutionPolicy& policy = Sequential);
+	// With CompareStatsOnly image1 is only read: it is not copied if shared, nor
+	// interleaved if planar.
+	DiffStats Compare(Image* image1, const Image* image2, CompareMode mode = CompareStatsOnly,
+		bool ssim = false, const ExecutionPolicy& policy = Sequential);
+
+	// Whether two images have the same size and channel count and no channel value
+	// differs by more than tolerance. Rows are checked in parallel with memcmp, or a SIMD
+	// range test when tolerance > 0, and every thread stops at the first failing row.
+	// Neither image is modified.
+	bool Equal(const ImageView& image1, const ImageView& image2, uint8_t tolerance = 0,
+		const ExecutionPolicy& policy = Sequential);
+	bool Equal(const Image& image1, const Image& image2, uint8_t tolerance = 0,
+		const ExecutionPolicy& policy = Sequential);
+
+	// Where two images differ by more than tolerance, over the region they have in common.
+	// The region is split into tileSize x tileSize tiles; touching changed tiles (edges or
+	// corners) are merged and each group is returned as its bounding rectangle, clipped
+	// to the region and ordered by its first tile in row order. Empty when nothing
+	// changed. Rows that match as a whole cost a single memcmp.
+	std::vector<Rect> ChangedRegions(const ImageView& image1, const ImageView& image2, uint8_t tolerance = 0,
+		int tileSize = 64, const ExecutionPolicy& policy = Sequential);
+	std::vector<Rect> ChangedRegions(const Image& image1, const Image& image2, uint8_t tolerance = 0,
+		int tileSize = 64, const ExecutionPolicy& policy = Sequential);
+}
@@ -0,0 +1,363 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "Convolution.h"
+
+#define BYTE_BOUND(x) x < 0 ? 0 : (x >= 255 ? 255 : x)
+
+namespace ImageGene {
+	namespace {
+		// Working set per tile: padded source rows, the row cache and the accumulator.
+		const size_t TILE_BYTES = 256 * 1024;
+		const int MIN_TILE_WIDTH = 32;
+		const int BANDS_PER_THREAD = 4;
+		// Doubles hold every integer below 2^53 exactly.
+		const double EXACT_LIMIT = 9007199254740992.0;
+
+		// The source rows of an image h rows tall, of which data holds rows from top on.
+		struct Plane {
+			const uint8_t* data;
+			int w;
+			int h;
+			int channels;
+			size_t stride;
+			int first;
+			int count;
+			int top;
+		};
+
+		// Destination of packed output channels; data holds output rows from top on.
+		struct Output {
+			uint8_t* data;
+			size_t stride;
+			int top;
+		};
+
+		// Copies the selected channels of source row y for columns [x0 - left, x1 + right)
+		// into dst, resolving columns outside the image with the border rule once per row.
+		// When every channel is selected (a plane, or a whole-image convolution) the columns
+		// inside the image are one contiguous run of bytes, converted in a single loop.
+		void LoadRow(const Plane& p, int y, int x0, int x1, int left, int right, BorderMode border, double* dst)
+		{
+			const uint8_t* row = p.data + (size_t)(y - p.top) * p.stride;
+			const int lo = x0 - left;
+			const int hi = x1 + right;
+			const int inLo = lo < 0 ? 0 : lo;
+			const int inHi = hi > p.w ? p.w : hi;
+
+			for (int x = lo; x < inLo; x++) {
+				const uint8_t* px = row + p.first;
+				for (int k = 0; k < p.count; k++) {
+					*dst++ = border == BorderZero ? 0.0 : px[k];
+				}
+			}
+
+			if (p.count == p.channels) {
+				const uint8_t* src = row + (size_t)inLo * p.channels;
+				const size_t n = (size_t)(inHi - inLo) * p.channels;
+				for (size_t e = 0; e < n; e++) {
+					dst[e] = src[e];
+				}
+				dst += n;
+			}
+			else {
+				for (int x = inLo; x < inHi; x++) {
+					const uint8_t* px = row + (size_t)x * p.channels + p.first;
+					for (int k = 0; k < p.count; k++) {
+						*dst++ = px[k];
+					}
+				}
+			}
+
+			for (int x = inHi; x < hi; x++) {
+				const uint8_t* px = row + (size_t)(p.w - 1) * p.channels + p.first;
+				for (int k = 0; k < p.count; k++) {
+					*dst++ = border == BorderZero ? 0.0 : px[k];
+				}
+			}
+		}
+
+		// Maps a source row to the row actually read, or -1 if it contributes nothing.
+		inline int SourceRow(int y, int h, BorderMode border)
+		{
+			if (y < 0) {
+				return border == BorderZero ? -1 : 0;
+			}
+			if (y > h - 1) {
+				return border == BorderZero ? -1 : h - 1;
+			}
+			return y;
+		}
+
+		// A small ring of per-row buffers keyed by source row, so each source row of a
+		// tile is loaded (and filtered, for separable kernels) exactly once.
+		class RowCache {
+		public:
+			RowCache(int rows, size_t elements) : rows(rows), elements(elements),
+				buffer((size_t)rows * elements), tags(rows, -1) {}
+
+			double* Find(int y, bool* cached)
+			{
+				int slot = y % rows;
+				*cached = tags[slot] == y;
+				tags[slot] = y;
+				return &buffer[(size_t)slot * elements];
+			}
+
+		private:
+			int rows;
+			size_t elements;
+			std::vector<double> buffer;
+			std::vector<int> tags;
+		};
+
+		void StoreRow(const double* acc, size_t n, uint8_t* dst)
+		{
+			for (size_t e = 0; e < n; e++) {
+				double c = round(acc[e]);
+				dst[e] = (uint8_t)(BYTE_BOUND(c));
+			}
+		}
+
+		// Smallest e for which every value times 2^e is an integer, or -1 if there is none
+		// below 52, as for weights like 1/9.
+		int DyadicExponent(const double* values, size_t n)
+		{
+			for (int e = 0; e < 52; e++) {
+				bool integral = true;
+				for (size_t k = 0; k < n && integral; k++) {
+					double scaled = ldexp(values[k], e);
+					integral = scaled == floor(scaled);
+				}
+				if (integral) {
+					return e;
+				}
+			}
+			return -1;
+		}
+
+		// Whether column * row, applied as two passes, rounds nowhere. Then every partial sum
+		// of both passes, and of the direct path, is the exact value, so the two paths give
+		// identical output; otherwise the order the taps are summed in decides .5 ties.
+		bool ExactlySeparable(const double* column, uint32_t kernelHeight, const double* row, uint32_t kernelWidth)
+		{
+			int ec = DyadicExponent(column, kernelHeight);
+			int er = DyadicExponent(row, kernelWidth);
+			if (ec < 0 || er < 0) {
+				return false;
+			}
+			double columnSum = 0;
+			double rowSum = 0;
+			for (uint32_t i = 0; i < kernelHeight; i++) {
+				columnSum += fabs(column[i]);
+			}
+			for (uint32_t j = 0; j < kernelWidth; j++) {
+				rowSum += fabs(row[j]);
+			}
+			return ldexp(255 * rowSum, er) < EXACT_LIMIT &&
+				ldexp(255 * rowSum * columnSum, ec + er) < EXACT_LIMIT;
+		}
+
+		void ConvolveTileDirect(const Plane& p, int x0, int x1, int y0, int y1, const Output& out,
+			const double* kernel, uint32_t kw, uint32_t kh, uint32_t cr, uint32_t cc, BorderMode border)
+		{
+			const int nc = p.count;
+			const int left = kw - cc - 1;
+			const int right = cc;
+			const size_t n = (size_t)(x1 - x0) * nc;
+			const size_t padded = (size_t)(x1 - x0 + left + right) * nc;
+
+			RowCache rows(kh, padded);
+			std::vector<double> acc(n);
+
+			for (int y = y0; y < y1; y++) {
+				memset(acc.data(), 0, n * sizeof(double));
+				for (int i = -((int)cr); i < (int)(kh - cr); i++) {
+					int sy = SourceRow(y - i, p.h, border);
+					if (sy < 0) {
+						continue;
+					}
+					bool cached;
+					double* src = rows.Find(sy, &cached);
+					if (!cached) {
+						LoadRow(p, sy, x0, x1, left, right, border, src);
+					}
+					const double* k = kernel + (size_t)(cr + i) * kw + cc;
+					for (int j = -((int)cc); j < (int)(kw - cc); j++) {
+						const double weight = k[j];
+						const double* s = src + (size_t)(left - j) * nc;
+						for (size_t e = 0; e < n; e++) {
+							acc[e] += weight * s[e];
+						}
+					}
+				}
+				StoreRow(acc.data(), n, out.data + (size_t)(y - out.top) * out.stride + (size_t)x0 * nc);
+			}
+		}
+
+		void ConvolveTileSeparable(const Plane& p, int x0, int x1, int y0, int y1, const Output& out,
+			const double* column, const double* row, uint32_t kw, uint32_t kh, uint32_t cr, uint32_t cc, BorderMode border)
+		{
+			const int nc = p.count;
+			const int left = kw - cc - 1;
+			const int right = cc;
+			const size_t n = (size_t)(x1 - x0) * nc;
+			const size_t padded = (size_t)(x1 - x0 + left + right) * nc;
+
+			RowCache filtered(kh, n);
+			std::vector<double> src(padded);
+			std::vector<double> acc(n);
+
+			for (int y = y0; y < y1; y++) {
+				memset(acc.data(), 0, n * sizeof(double));
+				for (int i = -((int)cr); i < (int)(kh - cr); i++) {
+					int sy = SourceRow(y - i, p.h, border);
+					if (sy < 0) {
+						continue;
+					}
+					bool cached;
+					double* hrow = filtered.Find(sy, &cached);
+					if (!cached) {
+						LoadRow(p, sy, x0, x1, left, right, border, src.data());
+						memset(hrow, 0, n * sizeof(double));
+						for (int j = -((int)cc); j < (int)(kw - cc); j++) {
+							const double weight = row[cc + j];
+							const double* s = src.data() + (size_t)(left - j) * nc;
+							for (size_t e = 0; e < n; e++) {
+								hrow[e] += weight * s[e];
+							}
+						}
+					}
+					const double weight = column[cr + i];
+					for (size_t e = 0; e < n; e++) {
+						acc[e] += weight * hrow[e];
+					}
+				}
+				StoreRow(acc.data(), n, out.data + (size_t)(y - out.top) * out.stride + (size_t)x0 * nc);
+			}
+		}
+	}
+
+	bool SeparateKernel(const double* kernel, uint32_t kernelWidth, uint32_t kernelHeight,
+		double* column, double* row)
+	{
+		const size_t taps = (size_t)kernelWidth * kernelHeight;
+
+		double largest = 0;
+		for (size_t k = 0; k < taps; k++) {
+			largest = fmax(largest, fabs(kernel[k]));
+		}
+		if (largest == 0) {
+			return false;
+		}
+
+		// Prefer a pivot whose factors reproduce every tap exactly, so integer and
+		// power-of-two weighted kernels (binomial Gaussian, Sobel) can sum to the same doubles
+		// as the direct path. Otherwise accept any rank-one factorisation within rounding noise.
+		for (int pass = 0; pass < 2; pass++) {
+			const double tolerance = pass == 0 ? 0 : largest * 1e-12;
+			for (size_t pivot = 0; pivot < taps; pivot++) {
+				if (kernel[pivot] == 0 || (pass == 1 && fabs(kernel[pivot]) != largest)) {
+					continue;
+				}
+
+				uint32_t pr = pivot / kernelWidth;
+				uint32_t pc = pivot % kernelWidth;
+				for (uint32_t i = 0; i < kernelHeight; i++) {
+					column[i] = kernel[i * kernelWidth + pc] / kernel[pivot];
+				}
+				for (uint32_t j = 0; j < kernelWidth; j++) {
+					row[j] = kernel[pr * kernelWidth + j];
+				}
+
+				bool matches = true;
+				for (size_t k = 0; k < taps && matches; k++) {
+					matches = fabs(kernel[k] - column[k / kernelWidth] * row[k % kernelWidth]) <= tolerance;
+				}
+				if (matches) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	void ConvolveRows(const uint8_t* src, size_t srcStride, int srcFirst, int w, int h, int channels,
+		int firstChannel, int channelCount,
+		const double* kernel, uint32_t kernelWidth, uint32_t kernelHeight, uint32_t cr, uint32_t cc,
+		BorderMode border, uint8_t* dst, size_t dstStride, int outFirst, int outRows, const ExecutionPolicy& policy)
+	{
+		if (w <= 0 || outRows <= 0 || channelCount <= 0) {
+			return;
+		}
+
+		Plane p = { src, w, h, channels, srcStride, firstChannel, channelCount, srcFirst };
+		Output out = { dst, dstStride, outFirst };
+
+		std::vector<double> column(kernelHeight);
+		std::vector<double> row(kernelWidth);
+		bool separable = kernelWidth > 1 && kernelHeight > 1 &&
+			SeparateKernel(kernel, kernelWidth, kernelHeight, column.data(), row.data()) &&
+			ExactlySeparable(column.data(), kernelHeight, row.data(), kernelWidth);
+
+		// Tiles are column strips of the output rows, narrow enough that the rows a kernel
+		// touches stay in cache while the strip is swept top to bottom.
+		size_t columnBytes = (size_t)channelCount * sizeof(double) * (kernelHeight + 2);
+		int tileWidth = (int)(TILE_BYTES / columnBytes);
+		if (tileWidth < MIN_TILE_WIDTH) {
+			tileWidth = MIN_TILE_WIDTH;
+		}
+
+		// Tiles write disjoint parts of the output, so they run independently. Row bands
+		// are only split off when there are too few column strips to occupy every thread.
+		int columns = (w + tileWidth - 1) / tileWidth;
+		uint32_t threads = ThreadPool::Shared().Concurrency(policy);
+		int bands = threads > 1 ? (int)(threads * BANDS_PER_THREAD + columns - 1) / columns : 1;
+		if (bands > outRows) {
+			bands = outRows;
+		}
+
+		ThreadPool::Shared().ParallelFor(0, columns * bands, 1, threads, [&](int first, int last) {
+			for (int t = first; t < last; t++) {
+				int x0 = (t % columns) * tileWidth;
+				int x1 = x0 + tileWidth < w ? x0 + tileWidth : w;
+				int y0 = outFirst + (int)((int64_t)outRows * (t / columns) / bands);
+				int y1 = outFirst + (int)((int64_t)outRows * (t / columns + 1) / bands);
+				if (separable) {
+					ConvolveTileSeparable(p, x0, x1, y0, y1, out, column.data(), row.data(),
+						kernelWidth, kernelHeight, cr, cc, border);
+				}
+				else {
+					ConvolveTileDirect(p, x0, x1, y0, y1, out, kernel, kernelWidth, kernelHeight, cr, cc, border);
+				}
+			}
+		});
+	}
+
+	void ConvolveChannels(uint8_t* data, int w, int h, int channels, size_t stride,
+		int firstChannel, int channelCount,
+		const double* kernel, uint32_t kernelWidth, uint32_t kernelHeight, uint32_t cr, uint32_t cc,
+		BorderMode border, const ExecutionPolicy& policy)
+	{
+		if (w <= 0 || h <= 0 || channelCount <= 0) {
+			return;
+		}
+
+		std::vector<uint8_t> out((size_t)w * h * channelCount);
+		ConvolveRows(data, stride, 0, w, h, channels, firstChannel, channelCount,
+			kernel, kernelWidth, kernelHeight, cr, cc, border, out.data(), (size_t)w * channelCount, 0, h, policy);
+
+		for (int y = 0; y < h; y++) {
+			uint8_t* dst = data + (size_t)y * stride;
+			const uint8_t* src = &out[(size_t)y * w * channelCount];
+			if (channelCount == channels) {
+				memcpy(dst, src, (size_t)w * channels);
+				continue;
+			}
+			for (int x = 0; x < w; x++) {
+				memcpy(dst + (size_t)x * channels + firstChannel, src + (size_t)x * channelCount, channelCount);
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Image.h"
+
+namespace ImageGene {
+	// Convolves channels [firstChannel, firstChannel + channelCount) of an interleaved
+	// buffer in place. Output matches a direct per-pixel evaluation of
+	// sum(kernel[cr + i][cc + j] * src[y - i][x - j]) rounded to the nearest byte.
+	void ConvolveChannels(uint8_t* data, int w, int h, int channels, size_t stride,
+		int firstChannel, int channelCount,
+		const double* kernel, uint32_t kernelWidth, uint32_t kernelHeight, uint32_t cr, uint32_t cc,
+		BorderMode border, const ExecutionPolicy& policy = Sequential);
+
+	// Convolves output rows [outFirst, outFirst + outRows) of an image h rows tall into dst,
+	// which receives channelCount packed channels per pixel and holds row outFirst first.
+	// src holds image rows from srcFirst on and must include every row those outputs read,
+	// other than rows outside the image, which follow the border rule as usual.
+	void ConvolveRows(const uint8_t* src, size_t srcStride, int srcFirst, int w, int h, int channels,
+		int firstChannel, int channelCount,
+		const double* kernel, uint32_t kernelWidth, uint32_t kernelHeight, uint32_t cr, uint32_t cc,
+		BorderMode border, uint8_t* dst, size_t dstStride, int outFirst, int outRows,
+		const ExecutionPolicy& policy = Sequential);
+
+	// Factors kernel into column * row if it is rank one. column must hold kernelHeight
+	// values and row kernelWidth values.
+	bool SeparateKernel(const double* kernel, uint32_t kernelWidth, uint32_t kernelHeight,
+		double* column, double* row);
+}
@@ -0,0 +1,74 @@
+#include <atomic>
+
+#include "Cpu.h"
+
+#if defined(IG_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		SimdLevel Detect()
+		{
+#if defined(IG_X86) && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			int maxLeaf = info[0];
+
+			__cpuid(info, 1);
+			bool sse41 = (info[2] & (1 << 19)) != 0;
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx = (info[2] & (1 << 28)) != 0;
+
+			bool avx2 = false;
+			if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+				__cpuidex(info, 7, 0);
+				avx2 = (info[1] & (1 << 5)) != 0;
+			}
+
+			if (avx2) return SimdAVX2;
+			if (sse41) return SimdSSE41;
+			return SimdScalar;
+#elif defined(IG_X86)
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")) return SimdAVX2;
+			if (__builtin_cpu_supports("sse4.1")) return SimdSSE41;
+			return SimdScalar;
+#elif defined(IG_NEON)
+			return SimdNEON;
+#else
+			return SimdScalar;
+#endif
+		}
+
+		std::atomic<int> forcedLevel(-1);
+	}
+
+	SimdLevel DetectSimdLevel()
+	{
+		static const SimdLevel level = Detect();
+		return level;
+	}
+
+	SimdLevel ActiveSimdLevel()
+	{
+		int forced = forcedLevel.load(std::memory_order_relaxed);
+		return forced < 0 ? DetectSimdLevel() : (SimdLevel)forced;
+	}
+
+	void ForceSimdLevel(SimdLevel level)
+	{
+		SimdLevel detected = DetectSimdLevel();
+		forcedLevel.store(level > detected ? detected : level, std::memory_order_relaxed);
+	}
+
+	const char* SimdLevelName(SimdLevel level)
+	{
+		switch (level) {
+			case SimdSSE41: return "SSE4.1";
+			case SimdAVX2: return "AVX2";
+			case SimdNEON: return "NEON";
+			default: return "Scalar";
+		}
+	}
+}
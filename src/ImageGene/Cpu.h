@@ -0,0 +1,33 @@
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IG_X86 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define IG_NEON 1
+#endif
+
+// GCC and Clang only emit instructions the function was compiled for, so SIMD
+// kernels opt in per function. MSVC always accepts the intrinsics.
+#if defined(IG_X86) && !defined(_MSC_VER)
+#define IG_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define IG_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define IG_TARGET_SSE41
+#define IG_TARGET_AVX2
+#endif
+
+namespace ImageGene {
+	enum SimdLevel {
+		SimdScalar, SimdSSE41, SimdAVX2, SimdNEON
+	};
+
+	// Best instruction set supported by this machine, detected once.
+	SimdLevel DetectSimdLevel();
+
+	// Level the kernels dispatch on. Defaults to DetectSimdLevel(); ForceSimdLevel
+	// lowers it, which is how benchmarks compare implementations.
+	SimdLevel ActiveSimdLevel();
+	void ForceSimdLevel(SimdLevel level);
+
+	const char* SimdLevelName(SimdLevel level);
+}
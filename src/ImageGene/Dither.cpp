@@ -0,0 +1,243 @@
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "Dither.h"
+#include "Pixels.h"
+
+namespace ImageGene {
+	struct DiffusionTap {
+		int dx;
+		int dy;
+		int weight;
+	};
+
+	// Taps are listed in-row first (dy == 0), then the rows below.
+	struct DiffusionKernelSpec {
+		int divisor;
+		int depth;
+		int inRow;
+		int count;
+		const DiffusionTap* taps;
+	};
+
+	namespace {
+		const int CHUNK = 64;
+		const int REACH = 2;
+		const int PAD = REACH;
+
+		const DiffusionTap FLOYD_STEINBERG_TAPS[] = {
+			{ 1, 0, 7 },
+			{ -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 }
+		};
+		const DiffusionTap JARVIS_JUDICE_NINKE_TAPS[] = {
+			{ 1, 0, 7 }, { 2, 0, 5 },
+			{ -2, 1, 3 }, { -1, 1, 5 }, { 0, 1, 7 }, { 1, 1, 5 }, { 2, 1, 3 },
+			{ -2, 2, 1 }, { -1, 2, 3 }, { 0, 2, 5 }, { 1, 2, 3 }, { 2, 2, 1 }
+		};
+		const DiffusionTap STUCKI_TAPS[] = {
+			{ 1, 0, 8 }, { 2, 0, 4 },
+			{ -2, 1, 2 }, { -1, 1, 4 }, { 0, 1, 8 }, { 1, 1, 4 }, { 2, 1, 2 },
+			{ -2, 2, 1 }, { -1, 2, 2 }, { 0, 2, 4 }, { 1, 2, 2 }, { 2, 2, 1 }
+		};
+		// Atkinson deliberately diffuses only 6/8 of the error.
+		const DiffusionTap ATKINSON_TAPS[] = {
+			{ 1, 0, 1 }, { 2, 0, 1 },
+			{ -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 },
+			{ 0, 2, 1 }
+		};
+
+		const DiffusionKernelSpec KERNEL_SPECS[] = {
+			{ 16, 1, 1, 4, FLOYD_STEINBERG_TAPS },
+			{ 48, 2, 2, 12, JARVIS_JUDICE_NINKE_TAPS },
+			{ 42, 2, 2, 12, STUCKI_TAPS },
+			{ 8, 2, 2, 6, ATKINSON_TAPS }
+		};
+
+		struct RowJob {
+			uint8_t* data;
+			int channels;
+			size_t stride;
+			int rows;
+			int64_t firstRow;
+
+			int w;
+			const DiffusionKernelSpec* spec;
+			bool serpentine;
+
+			int32_t* ring;
+			int ringRows;
+			size_t ringStride;
+
+			// Columns of each row of this call whose error has been fully handed on.
+			std::unique_ptr<std::atomic<int>[]> flushed;
+			std::atomic<int> next;
+
+			int32_t* ErrorRow(int64_t y) const
+			{
+				return ring + (size_t)(y % ringRows) * ringStride + PAD;
+			}
+
+			bool Reversed(int64_t y) const
+			{
+				return serpentine && (y & 1) != 0;
+			}
+
+			void WaitFor(int r, int columns) const
+			{
+				if (r < 0) {
+					return;
+				}
+				while (flushed[r].load(std::memory_order_acquire) < columns) {
+					std::this_thread::yield();
+				}
+			}
+		};
+
+		// Rounds half away from zero; Divisor is a constant so this compiles to multiplies.
+		template <int Divisor>
+		inline int32_t RoundDiv(int32_t numerator)
+		{
+			return (numerator >= 0 ? numerator + Divisor / 2 : numerator - Divisor / 2) / Divisor;
+		}
+
+		template <int Divisor>
+		void DitherRow(const RowJob& job, int r, int32_t* errors)
+		{
+			const DiffusionKernelSpec& spec = *job.spec;
+			const int w = job.w;
+			const int64_t y = job.firstRow + r;
+			const bool reversed = job.Reversed(y);
+			const bool aboveReversed = job.Reversed(y - 1);
+			const int sign = reversed ? -1 : 1;
+
+			// This row is the first to reach the row `depth` below, so it clears that
+			// row's buffer once the row that last used the slot is done with it.
+			int64_t previous = y + spec.depth - job.ringRows;
+			job.WaitFor((int)(previous - job.firstRow), w);
+			memset(job.ErrorRow(y + spec.depth) - PAD, 0, job.ringStride * sizeof(int32_t));
+
+			uint8_t* row = job.data + (size_t)r * job.stride;
+			int32_t* current = job.ErrorRow(y);
+
+			for (int done = 0; done < w; ) {
+				int n = w - done < CHUNK ? w - done : CHUNK;
+				int a = reversed ? w - done - n : done;
+				int b = a + n;
+
+				// The row above must have handed on all error within 2 * REACH of this
+				// chunk: then everything this chunk reads is final, and nothing either row
+				// writes to the rows below can overlap.
+				if (aboveReversed) {
+					job.WaitFor(r - 1, w - (a - 2 * REACH > 0 ? a - 2 * REACH : 0));
+				}
+				else {
+					job.WaitFor(r - 1, b + 2 * REACH < w ? b + 2 * REACH : w);
+				}
+
+				for (int i = 0; i < n; i++) {
+					int x = reversed ? b - 1 - i : a + i;
+					uint8_t* px = row + (size_t)x * job.channels;
+
+					int32_t value = px[0] + RoundDiv<Divisor>(current[x]);
+					uint8_t out = value > 127 ? 255 : 0;
+					int32_t error = value - out;
+					errors[x] = error;
+
+					for (int t = 0; t < spec.inRow; t++) {
+						current[x + sign * spec.taps[t].dx] += spec.taps[t].weight * error;
+					}
+					memset(px, out, job.channels);
+				}
+
+				for (int t = spec.inRow; t < spec.count; t++) {
+					const DiffusionTap& tap = spec.taps[t];
+					int32_t* below = job.ErrorRow(y + tap.dy) + sign * tap.dx;
+					const int32_t weight = tap.weight;
+					for (int x = a; x < b; x++) {
+						below[x] += weight * errors[x];
+					}
+				}
+
+				done += n;
+				job.flushed[r].store(done, std::memory_order_release);
+			}
+		}
+
+		template <int Divisor>
+		void DitherWavefront(RowJob& job, uint32_t threads)
+		{
+			ThreadPool::Shared().ParallelFor(0, threads, 1, threads, [&job](int, int) {
+				std::vector<int32_t> errors(job.w);
+				for (;;) {
+					int r = job.next.fetch_add(1, std::memory_order_relaxed);
+					if (r >= job.rows) {
+						return;
+					}
+					DitherRow<Divisor>(job, r, errors.data());
+				}
+			});
+		}
+	}
+
+	ErrorDiffuser::ErrorDiffuser(int w, DiffusionKernel kernel, bool serpentine, const ExecutionPolicy& policy) :
+		w(w), spec(&KERNEL_SPECS[kernel]), serpentine(serpentine), nextRow(0)
+	{
+		threads = ThreadPool::Shared().Concurrency(policy);
+
+		// Enough rows for every row in flight plus the ones they diffuse into.
+		ringRows = (int)threads + spec->depth + 1;
+		ringStride = (size_t)w + 2 * PAD;
+		ring.assign((size_t)ringRows * ringStride, 0);
+	}
+
+	ErrorDiffuser::~ErrorDiffuser()
+	{
+	}
+
+	void ErrorDiffuser::DitherRows(uint8_t* data, int channels, size_t stride, int rows)
+	{
+		if (w <= 0 || rows <= 0 || channels <= 0) {
+			return;
+		}
+
+		RowJob job;
+		job.data = data;
+		job.channels = channels;
+		job.stride = stride;
+		job.rows = rows;
+		job.firstRow = nextRow;
+		job.w = w;
+		job.spec = spec;
+		job.serpentine = serpentine;
+		job.ring = ring.data();
+		job.ringRows = ringRows;
+		job.ringStride = ringStride;
+		job.flushed.reset(new std::atomic<int>[rows]);
+		for (int r = 0; r < rows; r++) {
+			job.flushed[r].store(0, std::memory_order_relaxed);
+		}
+		job.next.store(0, std::memory_order_relaxed);
+
+		uint32_t participants = threads < (uint32_t)rows ? threads : (uint32_t)rows;
+		switch (spec->divisor) {
+			case 16: DitherWavefront<16>(job, participants); break;
+			case 48: DitherWavefront<48>(job, participants); break;
+			case 42: DitherWavefront<42>(job, participants); break;
+			case 8: DitherWavefront<8>(job, participants); break;
+		}
+
+		nextRow += rows;
+	}
+
+	void DitherThresholdRows(uint8_t* data, int w, int h, int channels, size_t stride, uint8_t threshold)
+	{
+		Pixels::ApplyRows(data, w, h, channels, stride, 0, Pixels::DitherThreshold(threshold));
+	}
+
+	void DitherRandomRows(uint8_t* data, int w, int h, int channels, size_t stride, int64_t firstRow,
+		uint64_t seed)
+	{
+		Pixels::ApplyRows(data, w, h, channels, stride, firstRow, Pixels::DitherRandom(seed));
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Image.h"
+
+namespace ImageGene {
+	struct DiffusionKernelSpec;
+
+	// Ordered-dither thresholds tiled to THRESHOLD_MAP_SIZE square, so every matrix is
+	// read the same way: a pixel turns white when channel 0 is greater than the
+	// threshold at (x % THRESHOLD_MAP_SIZE, y % THRESHOLD_MAP_SIZE). A cell of rank b in
+	// an n-cell matrix has threshold floor(255 * (b + 0.5) / n). Built on first use.
+	const int THRESHOLD_MAP_SIZE = 64;
+	const uint8_t* ThresholdMap(OrderedMatrix matrix);
+
+	// Threshold dithering of rows: a pixel turns white when channel 0 is greater than
+	// threshold, and the result is written to every channel.
+	void DitherThresholdRows(uint8_t* data, int w, int h, int channels, size_t stride, uint8_t threshold);
+
+	// Random dithering of rows that start at image row firstRow: a pixel turns white
+	// when the top byte of PixelRandom(seed, x, y) is at most its channel 0, so the
+	// result depends only on the seed and the pixel's coordinates.
+	void DitherRandomRows(uint8_t* data, int w, int h, int channels, size_t stride, int64_t firstRow,
+		uint64_t seed);
+
+	// Ordered dithering of rows that start at image row firstRow; the result of channel 0
+	// is written to every channel.
+	void DitherOrderedRows(uint8_t* data, int w, int h, int channels, size_t stride, int64_t firstRow,
+		OrderedMatrix matrix);
+
+	// Error-diffusion dithering of channel 0 against a 50% threshold, writing the
+	// result to every channel. Error is kept as signed integers in a small ring of
+	// padded row buffers, so rows can be fed in any number of calls (strips) and the
+	// error carries across them.
+	//
+	// Rows are scheduled as a wavefront: every thread takes the next unclaimed row and
+	// processes it in column chunks, each chunk waiting until the row above has flushed
+	// its error far enough ahead that the two rows never touch the same buffer entries.
+	// Within a chunk only the in-row propagation is sequential; error for the rows below
+	// is accumulated afterwards in plain loops the compiler vectorizes. The integer sums
+	// make the output identical for any thread count.
+	class ErrorDiffuser {
+	public:
+		ErrorDiffuser(int w, DiffusionKernel kernel, bool serpentine, const ExecutionPolicy& policy = Sequential);
+		~ErrorDiffuser();
+
+		// Dithers the next `rows` rows of the image. data points at the first of them.
+		void DitherRows(uint8_t* data, int channels, size_t stride, int rows);
+
+	private:
+		int w;
+		const DiffusionKernelSpec* spec;
+		bool serpentine;
+		uint32_t threads;
+
+		int64_t nextRow;
+		int ringRows;
+		size_t ringStride;
+		std::vector<int32_t> ring;
+	};
+}
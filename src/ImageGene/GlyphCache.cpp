@@ -0,0 +1,205 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+#include "GlyphCache.h"
+
+namespace ImageGene {
+	// Glyphs are packed left to right on shelves as tall as the tallest glyph on them;
+	// a glyph that does not fit on the current shelf opens a new one below it.
+	struct GlyphPage {
+		int w;
+		int h;
+		std::vector<uint8_t> pixels;
+
+		int shelfY = 0;
+		int shelfHeight = 0;
+		int cursorX = 0;
+		uint64_t lastUse = 0;
+
+		GlyphPage(int w, int h) : w(w), h(h), pixels((size_t)w * h, 0) {}
+
+		bool Place(int width, int height, int* x, int* y)
+		{
+			if (cursorX + width > w) {
+				shelfY += shelfHeight;
+				shelfHeight = 0;
+				cursorX = 0;
+			}
+			if (width > w || shelfY + height > h) {
+				return false;
+			}
+			*x = cursorX;
+			*y = shelfY;
+			cursorX += width;
+			shelfHeight = height > shelfHeight ? height : shelfHeight;
+			return true;
+		}
+	};
+
+	uint32_t NextCodepoint(const char** text)
+	{
+		const uint8_t* s = (const uint8_t*)*text;
+		int length = s[0] < 0x80 ? 1 : (s[0] >> 5) == 0x6 ? 2 : (s[0] >> 4) == 0xE ? 3 : (s[0] >> 3) == 0x1E ? 4 : 0;
+		uint32_t codepoint = length == 1 ? s[0] : length == 2 ? s[0] & 0x1F : length == 3 ? s[0] & 0x0F : s[0] & 0x07;
+		for (int k = 1; k < length; k++) {
+			if ((s[k] & 0xC0) != 0x80) {
+				length = 0;
+				break;
+			}
+			codepoint = (codepoint << 6) | (s[k] & 0x3F);
+		}
+		if (length == 0) {
+			*text += 1;
+			return 0xFFFD;
+		}
+		*text += length;
+		return codepoint;
+	}
+
+	size_t GlyphCache::KeyHash::operator()(const Key& key) const
+	{
+		std::hash<double> hash;
+		return key.codepoint ^ (hash(key.xScale) * 31 + hash(key.yScale)) * 0x9E3779B97F4A7C15ull;
+	}
+
+	GlyphCache::GlyphCache(size_t capacity) : capacity(capacity) {}
+
+	bool GlyphCache::Find(const SFT& sft, uint32_t codepoint, CachedGlyph* glyph)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		Key key = { codepoint, sft.xScale, sft.yScale };
+		auto found = entries.find(key);
+		if (found != entries.end()) {
+			hits++;
+		}
+		else {
+			misses++;
+			Entry entry;
+			Render(sft, key, &entry);
+			found = entries.emplace(key, entry).first;
+		}
+
+		const Entry& entry = found->second;
+		if (entry.missing) {
+			return false;
+		}
+
+		glyph->page = entry.page;
+		glyph->pixels = nullptr;
+		glyph->pitch = 0;
+		if (entry.page) {
+			entry.page->lastUse = ++tick;
+			glyph->pixels = entry.page->pixels.data() + (size_t)entry.atlasY * entry.page->w + entry.atlasX;
+			glyph->pitch = entry.page->w;
+		}
+		glyph->width = entry.width;
+		glyph->height = entry.height;
+		glyph->x = entry.x;
+		glyph->y = entry.y;
+		glyph->advance = entry.advance;
+		return true;
+	}
+
+	// Fills entry from sft_char. Glyphs the font lacks, or that fail to render, are
+	// cached as missing so the outline is not parsed again.
+	void GlyphCache::Render(const SFT& sft, const Key& key, Entry* entry)
+	{
+		SFT_Char chr;
+		int status = sft_char(&sft, key.codepoint, &chr);
+		*entry = Entry();
+		entry->missing = status != 0;
+		if (entry->missing) {
+			free(chr.image);
+			return;
+		}
+
+		entry->width = chr.width;
+		entry->height = chr.height;
+		entry->x = chr.x;
+		entry->y = chr.y;
+		entry->advance = chr.advance;
+		if (chr.image == nullptr || chr.width <= 0 || chr.height <= 0) {
+			entry->width = 0;
+			entry->height = 0;
+			free(chr.image);
+			return;
+		}
+
+		entry->page = Allocate(chr.width, chr.height, &entry->atlasX, &entry->atlasY);
+		uint8_t* dst = entry->page->pixels.data() + (size_t)entry->atlasY * entry->page->w + entry->atlasX;
+		for (int y = 0; y < chr.height; y++) {
+			memcpy(dst + (size_t)y * entry->page->w, chr.image + (size_t)y * chr.width, chr.width);
+		}
+		free(chr.image);
+	}
+
+	std::shared_ptr<GlyphPage> GlyphCache::Allocate(int width, int height, int* atlasX, int* atlasY)
+	{
+		if (!pages.empty() && pages.back()->Place(width, height, atlasX, atlasY)) {
+			return pages.back();
+		}
+
+		int w = width > GLYPH_PAGE_SIZE ? width : GLYPH_PAGE_SIZE;
+		int h = height > GLYPH_PAGE_SIZE ? height : GLYPH_PAGE_SIZE;
+		Trim((size_t)w * h);
+
+		pages.push_back(std::make_shared<GlyphPage>(w, h));
+		bytes += pages.back()->pixels.size();
+		pages.back()->Place(width, height, atlasX, atlasY);
+		return pages.back();
+	}
+
+	// Evicts least recently used pages until `incoming` more bytes fit in the capacity.
+	void GlyphCache::Trim(size_t incoming)
+	{
+		while (!pages.empty() && bytes + incoming > capacity) {
+			size_t oldest = 0;
+			for (size_t p = 1; p < pages.size(); p++) {
+				if (pages[p]->lastUse < pages[oldest]->lastUse) {
+					oldest = p;
+				}
+			}
+			Evict(oldest);
+		}
+	}
+
+	void GlyphCache::Evict(size_t page)
+	{
+		GlyphPage* victim = pages[page].get();
+		for (auto it = entries.begin(); it != entries.end();) {
+			if (it->second.page.get() == victim) {
+				it = entries.erase(it);
+				evictions++;
+			}
+			else {
+				++it;
+			}
+		}
+		bytes -= victim->pixels.size();
+		pages.erase(pages.begin() + page);
+	}
+
+	void GlyphCache::SetCapacity(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		capacity = bytes;
+		Trim(0);
+	}
+
+	void GlyphCache::Clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.clear();
+		pages.clear();
+		bytes = 0;
+	}
+
+	GlyphCacheStats GlyphCache::Stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return { hits, misses, evictions, entries.size(), pages.size(), bytes };
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "schrift.h"
+
+namespace ImageGene {
+	const int GLYPH_PAGE_SIZE = 256;
+	const size_t DEFAULT_GLYPH_CACHE_BYTES = 4 * 1024 * 1024;
+
+	struct GlyphCacheStats {
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		size_t glyphs;
+		size_t pages;
+		size_t bytes;
+
+		double HitRate() const { return hits + misses > 0 ? (double)hits / (hits + misses) : 0; }
+	};
+
+	// Decodes the UTF-8 sequence at *text and advances past it. Malformed bytes decode
+	// to U+FFFD one byte at a time.
+	uint32_t NextCodepoint(const char** text);
+
+	struct GlyphPage;
+
+	// Coverage bitmap of a rendered glyph, pitch bytes per row, inside an atlas page.
+	// The glyph keeps its page alive, so it stays valid after the page is evicted.
+	struct CachedGlyph {
+		std::shared_ptr<const GlyphPage> page;
+		const uint8_t* pixels;
+		int pitch;
+		int width;
+		int height;
+		int x;
+		int y;
+		double advance;
+	};
+
+	// Rendered glyphs keyed by (codepoint, size), packed on shelves into atlas pages of
+	// GLYPH_PAGE_SIZE square (larger glyphs get a page of their own). When adding a page
+	// would exceed the capacity, the least recently used page is evicted with all of its
+	// glyphs. Safe to use from several threads.
+	class GlyphCache {
+	public:
+		explicit GlyphCache(size_t capacity = DEFAULT_GLYPH_CACHE_BYTES);
+
+		// Looks the glyph up, rendering it with sft on a miss. Returns false if the font
+		// has no glyph for the codepoint.
+		bool Find(const SFT& sft, uint32_t codepoint, CachedGlyph* glyph);
+
+		void SetCapacity(size_t bytes);
+		void Clear();
+		GlyphCacheStats Stats() const;
+
+	private:
+		struct Key {
+			uint32_t codepoint;
+			double xScale;
+			double yScale;
+
+			bool operator==(const Key& other) const
+			{
+				return codepoint == other.codepoint && xScale == other.xScale && yScale == other.yScale;
+			}
+		};
+
+		struct KeyHash {
+			size_t operator()(const Key& key) const;
+		};
+
+		struct Entry {
+			std::shared_ptr<GlyphPage> page;
+			int atlasX;
+			int atlasY;
+			int width;
+			int height;
+			int x;
+			int y;
+			double advance;
+			bool missing;
+		};
+
+		void Render(const SFT& sft, const Key& key, Entry* entry);
+		std::shared_ptr<GlyphPage> Allocate(int width, int height, int* atlasX, int* atlasY);
+		void Trim(size_t incoming);
+		void Evict(size_t page);
+
+		mutable std::mutex mutex;
+		std::unordered_map<Key, Entry, KeyHash> entries;
+		std::vector<std::shared_ptr<GlyphPage>> pages;
+		size_t capacity;
+		size_t bytes = 0;
+		uint64_t tick = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+	};
+}
@@ -0,0 +1,249 @@
+#include "Cpu.h"
+#include "Grayscale.h"
+
+#if defined(IG_X86)
+#include <immintrin.h>
+#elif defined(IG_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		void RowScalar(uint8_t* row, int x, int w, int channels, GrayscaleMethod method)
+		{
+			for (uint8_t* px = row + (size_t)x * channels; x < w; x++, px += channels) {
+				uint8_t gray = GrayPixel(px, method);
+				px[0] = gray;
+				px[1] = gray;
+				px[2] = gray;
+			}
+		}
+
+		// Each kernel handles as many leading pixels of a row as it can without reading
+		// past the row, and returns how many it processed; the scalar loop finishes.
+		typedef int (*GrayRowKernel)(uint8_t* row, int w, GrayscaleMethod method);
+
+#if defined(IG_X86)
+		// Four RGBA pixels held as 32-bit lanes (alpha may be anything) become four
+		// 32-bit gray values: multiply-add byte pairs, then add the pair sums.
+		IG_TARGET_SSE41 inline __m128i Gray4(__m128i rgba, GrayscaleMethod method)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i weights = method == GrayscaleMethodLum ?
+				_mm_setr_epi16(LUM_R, LUM_G, LUM_B, 0, LUM_R, LUM_G, LUM_B, 0) :
+				_mm_setr_epi16(1, 1, 1, 0, 1, 1, 1, 0);
+
+			__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(rgba, zero), weights);
+			__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(rgba, zero), weights);
+			__m128i sum = _mm_hadd_epi32(lo, hi);
+
+			if (method == GrayscaleMethodLum) {
+				return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(LUM_ROUND)), LUM_SHIFT);
+			}
+			return _mm_srli_epi32(_mm_madd_epi16(sum, _mm_set1_epi32(AVG_RECIPROCAL)), AVG_SHIFT);
+		}
+
+		IG_TARGET_SSE41 int RowSSE41Rgba(uint8_t* row, int w, GrayscaleMethod method)
+		{
+			const __m128i spread = _mm_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+			const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+			int x = 0;
+			for (; x + 4 <= w; x += 4) {
+				__m128i* p = (__m128i*)(row + (size_t)x * 4);
+				__m128i v = _mm_loadu_si128(p);
+				__m128i gray = _mm_shuffle_epi8(Gray4(v, method), spread);
+				_mm_storeu_si128(p, _mm_or_si128(gray, _mm_and_si128(v, alpha)));
+			}
+			return x;
+		}
+
+		// Sixteen gray bytes back to 48 bytes of RGB.
+		IG_TARGET_SSE41 inline void StoreRgb16(uint8_t* p, __m128i gray)
+		{
+			const __m128i spread0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+			const __m128i spread1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+			const __m128i spread2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+
+			_mm_storeu_si128((__m128i*)p, _mm_shuffle_epi8(gray, spread0));
+			_mm_storeu_si128((__m128i*)(p + 16), _mm_shuffle_epi8(gray, spread1));
+			_mm_storeu_si128((__m128i*)(p + 32), _mm_shuffle_epi8(gray, spread2));
+		}
+
+		// RGB rows are handled sixteen pixels (48 bytes, three loads) at a time. The loads
+		// are realigned into four groups of four pixels and widened to RGBA.
+		IG_TARGET_SSE41 int RowSSE41Rgb(uint8_t* row, int w, GrayscaleMethod method)
+		{
+			const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8_t* p = row + (size_t)x * 3;
+				__m128i v0 = _mm_loadu_si128((const __m128i*)p);
+				__m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+				__m128i v2 = _mm_loadu_si128((const __m128i*)(p + 32));
+
+				__m128i g0 = Gray4(_mm_shuffle_epi8(v0, expand), method);
+				__m128i g1 = Gray4(_mm_shuffle_epi8(_mm_alignr_epi8(v1, v0, 12), expand), method);
+				__m128i g2 = Gray4(_mm_shuffle_epi8(_mm_alignr_epi8(v2, v1, 8), expand), method);
+				__m128i g3 = Gray4(_mm_shuffle_epi8(_mm_srli_si128(v2, 4), expand), method);
+
+				__m128i gray = _mm_packus_epi16(_mm_packus_epi32(g0, g1), _mm_packus_epi32(g2, g3));
+				StoreRgb16(p, gray);
+			}
+			return x;
+		}
+
+		IG_TARGET_AVX2 inline __m256i Gray8(__m256i rgba, GrayscaleMethod method)
+		{
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i weights = method == GrayscaleMethodLum ?
+				_mm256_setr_epi16(LUM_R, LUM_G, LUM_B, 0, LUM_R, LUM_G, LUM_B, 0,
+					LUM_R, LUM_G, LUM_B, 0, LUM_R, LUM_G, LUM_B, 0) :
+				_mm256_setr_epi16(1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0);
+
+			// unpack and hadd stay within 128-bit lanes, so pixel order is preserved.
+			__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(rgba, zero), weights);
+			__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(rgba, zero), weights);
+			__m256i sum = _mm256_hadd_epi32(lo, hi);
+
+			if (method == GrayscaleMethodLum) {
+				return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(LUM_ROUND)), LUM_SHIFT);
+			}
+			return _mm256_srli_epi32(_mm256_madd_epi16(sum, _mm256_set1_epi32(AVG_RECIPROCAL)), AVG_SHIFT);
+		}
+
+		IG_TARGET_AVX2 int RowAVX2Rgba(uint8_t* row, int w, GrayscaleMethod method)
+		{
+			const __m256i spread = _mm256_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1,
+				0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+			const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+
+			int x = 0;
+			for (; x + 8 <= w; x += 8) {
+				__m256i* p = (__m256i*)(row + (size_t)x * 4);
+				__m256i v = _mm256_loadu_si256(p);
+				__m256i gray = _mm256_shuffle_epi8(Gray8(v, method), spread);
+				_mm256_storeu_si256(p, _mm256_or_si256(gray, _mm256_and_si256(v, alpha)));
+			}
+			return x;
+		}
+
+		// Same sixteen-pixel RGB step as SSE4.1, with two pixel groups per register.
+		IG_TARGET_AVX2 int RowAVX2Rgb(uint8_t* row, int w, GrayscaleMethod method)
+		{
+			const __m256i expand = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+				0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8_t* p = row + (size_t)x * 3;
+				__m128i v0 = _mm_loadu_si128((const __m128i*)p);
+				__m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+				__m128i v2 = _mm_loadu_si128((const __m128i*)(p + 32));
+
+				__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(v0), _mm_alignr_epi8(v1, v0, 12), 1);
+				__m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_alignr_epi8(v2, v1, 8)),
+					_mm_srli_si128(v2, 4), 1);
+
+				// packus works per lane: [0-3, 8-11 | 4-7, 12-15], restored by the permute.
+				__m256i packed = _mm256_packus_epi32(
+					Gray8(_mm256_shuffle_epi8(a, expand), method),
+					Gray8(_mm256_shuffle_epi8(b, expand), method));
+				packed = _mm256_permute4x64_epi64(packed, 0xD8);
+
+				__m128i gray = _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+				StoreRgb16(p, gray);
+			}
+			return x;
+		}
+#elif defined(IG_NEON)
+		inline uint8x8_t Gray8(uint8x8_t r, uint8x8_t g, uint8x8_t b, GrayscaleMethod method)
+		{
+			if (method == GrayscaleMethodLum) {
+				uint16x8_t r16 = vmovl_u8(r);
+				uint16x8_t g16 = vmovl_u8(g);
+				uint16x8_t b16 = vmovl_u8(b);
+				uint32x4_t lo = vmull_n_u16(vget_low_u16(r16), LUM_R);
+				uint32x4_t hi = vmull_n_u16(vget_high_u16(r16), LUM_R);
+				lo = vmlal_n_u16(lo, vget_low_u16(g16), LUM_G);
+				hi = vmlal_n_u16(hi, vget_high_u16(g16), LUM_G);
+				lo = vmlal_n_u16(lo, vget_low_u16(b16), LUM_B);
+				hi = vmlal_n_u16(hi, vget_high_u16(b16), LUM_B);
+				// Rounding narrow: (x + 2^14) >> 15.
+				return vmovn_u16(vcombine_u16(vrshrn_n_u32(lo, LUM_SHIFT), vrshrn_n_u32(hi, LUM_SHIFT)));
+			}
+			uint16x8_t sum = vaddw_u8(vaddl_u8(r, g), b);
+			uint32x4_t lo = vmull_n_u16(vget_low_u16(sum), AVG_RECIPROCAL);
+			uint32x4_t hi = vmull_n_u16(vget_high_u16(sum), AVG_RECIPROCAL);
+			return vmovn_u16(vcombine_u16(vshrn_n_u32(lo, AVG_SHIFT), vshrn_n_u32(hi, AVG_SHIFT)));
+		}
+
+		inline uint8x16_t Gray16(uint8x16_t r, uint8x16_t g, uint8x16_t b, GrayscaleMethod method)
+		{
+			return vcombine_u8(
+				Gray8(vget_low_u8(r), vget_low_u8(g), vget_low_u8(b), method),
+				Gray8(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b), method));
+		}
+
+		int RowNEONRgba(uint8_t* row, int w, GrayscaleMethod method)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8_t* p = row + (size_t)x * 4;
+				uint8x16x4_t px = vld4q_u8(p);
+				uint8x16_t gray = Gray16(px.val[0], px.val[1], px.val[2], method);
+				px.val[0] = gray;
+				px.val[1] = gray;
+				px.val[2] = gray;
+				vst4q_u8(p, px);
+			}
+			return x;
+		}
+
+		int RowNEONRgb(uint8_t* row, int w, GrayscaleMethod method)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8_t* p = row + (size_t)x * 3;
+				uint8x16x3_t px = vld3q_u8(p);
+				uint8x16_t gray = Gray16(px.val[0], px.val[1], px.val[2], method);
+				px.val[0] = gray;
+				px.val[1] = gray;
+				px.val[2] = gray;
+				vst3q_u8(p, px);
+			}
+			return x;
+		}
+#endif
+
+		GrayRowKernel SelectKernel(int channels)
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdAVX2) {
+				return channels == 4 ? RowAVX2Rgba : (channels == 3 ? RowAVX2Rgb : nullptr);
+			}
+			if (level >= SimdSSE41) {
+				return channels == 4 ? RowSSE41Rgba : (channels == 3 ? RowSSE41Rgb : nullptr);
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				return channels == 4 ? RowNEONRgba : (channels == 3 ? RowNEONRgb : nullptr);
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+	}
+
+	void GrayscaleRows(uint8_t* data, int w, int h, int channels, size_t stride, GrayscaleMethod method)
+	{
+		GrayRowKernel kernel = SelectKernel(channels);
+		for (int y = 0; y < h; y++) {
+			uint8_t* row = data + (size_t)y * stride;
+			int x = kernel ? kernel(row, w, method) : 0;
+			RowScalar(row, x, w, channels, method);
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageGene {
+	// Fixed-point grayscale conversion shared by the scalar and SIMD kernels. Every
+	// implementation produces the same bytes:
+	//   Lum:     Y = (6966 R + 23436 G + 2366 B + 16384) >> 15
+	//            (BT.709 weights in Q15, summing to 32768, rounded half up)
+	//   Average: Y = ((R + G + B) * 21846) >> 16, which equals (R + G + B) / 3
+	//            truncated for every 8-bit input
+	// Y is written to the first three channels; any further channels are untouched.
+	enum GrayscaleMethod {
+		GrayscaleMethodAverage, GrayscaleMethodLum
+	};
+
+	const uint32_t LUM_R = 6966;
+	const uint32_t LUM_G = 23436;
+	const uint32_t LUM_B = 2366;
+	const uint32_t LUM_ROUND = 1 << 14;
+	const int LUM_SHIFT = 15;
+
+	// ceil(2^16 / 3); exact floor division for sums up to 765.
+	const uint32_t AVG_RECIPROCAL = 21846;
+	const int AVG_SHIFT = 16;
+
+	inline uint8_t GrayPixel(const uint8_t* px, GrayscaleMethod method)
+	{
+		if (method == GrayscaleMethodLum) {
+			return (uint8_t)((LUM_R * px[0] + LUM_G * px[1] + LUM_B * px[2] + LUM_ROUND) >> LUM_SHIFT);
+		}
+		return (uint8_t)(((uint32_t)(px[0] + px[1] + px[2]) * AVG_RECIPROCAL) >> AVG_SHIFT);
+	}
+
+	void GrayscaleRows(uint8_t* data, int w, int h, int channels, size_t stride, GrayscaleMethod method);
+}
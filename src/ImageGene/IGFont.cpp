@@ -36,4 +36,19 @@ namespace ImageGene {
 		sft.xScale = size;
 		sft.yScale = size;
 	}
+
+	bool IGFont::Glyph(uint32_t codepoint, CachedGlyph* glyph) const
+	{
+		return sft.font != NULL && cache.Find(sft, codepoint, glyph);
+	}
+
+	void IGFont::SetCacheCapacity(size_t bytes)
+	{
+		cache.SetCapacity(bytes);
+	}
+
+	GlyphCacheStats IGFont::CacheStats() const
+	{
+		return cache.Stats();
+	}
 }
\ No newline at end of file
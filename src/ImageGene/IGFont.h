@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <map>
 
+#include "GlyphCache.h"
 #include "schrift.h"
 
 namespace ImageGene {
@@ -28,6 +29,12 @@ namespace ImageGene {
 	
 		void SetFontSize(uint16_t size);
 
+		// Rendered glyph for a codepoint at the current size, from the glyph cache.
+		bool Glyph(uint32_t codepoint, CachedGlyph* glyph) const;
+
+		void SetCacheCapacity(size_t bytes);
+		GlyphCacheStats CacheStats() const;
+
 		std::map<IGFontFamily, const char*> fontFamilyMap = {
 			{Arial, "arial.ttf"},
 			{ArialBlack, "arialblk.ttf"},
@@ -35,6 +42,9 @@ namespace ImageGene {
 			{ArialBoldItalic, "arialbi.ttf"},
 			{ArialItalic, "ariali.ttf"}
 		};
+
+	private:
+		mutable GlyphCache cache;
 	};
 }
 
@@ -1,49 +1,345 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STBI_MALLOC(size) ImageGene::AllocateBuffer(size)
+#define STBI_REALLOC(buffer, size) ImageGene::ReallocateBuffer(buffer, size)
+#define STBI_FREE(buffer) ImageGene::FreeBuffer(buffer)
+#define STBIW_MALLOC(size) ImageGene::AllocateBuffer(size)
+#define STBIW_REALLOC(buffer, size) ImageGene::ReallocateBuffer(buffer, size)
+#define STBIW_FREE(buffer) ImageGene::FreeBuffer(buffer)
 #define _CRT_SECURE_NO_WARNINGS
 
 #define BYTE_BOUND(x) x < 0 ? 0 : (x >= 255 ? 255 : x)
 
 #define STEG_HEADER_SIZE sizeof(uint32_t) * 8
 
+#include <atomic>
 #include <cstdio>
 #include <cstdint>
+#include <vector>
 
 #include "Image.h"
+#include "Allocator.h"
+#include "Blend.h"
+#include "Blit.h"
+#include "Compare.h"
 #include "IGFont.h"
+#include "Convolution.h"
+#include "Dither.h"
+#include "Grayscale.h"
+#include "Pixels.h"
+#include "Planar.h"
+#include "Resize.h"
+#include "Png.h"
+#include "RawImage.h"
+#include "Stream.h"
 
 #include "stb_image.h"
 #include "stb_image_write.h"
 
 namespace ImageGene {
 	Image::Image(const char* filename) {
-		if (Read(filename)) {
-			size = w * h * channels;
+		if (!Read(filename)) {
+			printf("Failed to read %s\n", filename);
 		}
-		else {
-			printf("Failed to read %s", filename);
+	}
+
+	Image::Image(const char* filename, MapMode mode) {
+		if (!Map(filename, mode)) {
+			printf("Failed to map %s\n", filename);
 		}
 	}
 
+	// Pixels behind one or more Images. Heap pixels come from AllocateBuffer; mapped
+	// pixels belong to the mapping and pixels is null. Read-only mappings count as shared
+	// with the file, so the first write through Mutable() copies them.
+	struct PixelBuffer {
+		std::atomic<uint32_t> refs;
+		uint8_t* pixels;
+		MappedFile* mapping;
+		bool readOnly;
+	};
+
 	Image::Image(int w, int h, int channels) : w(w), h(h), channels(channels) {
 		size = w * h * channels;
-		data = new uint8_t[size];
+		data = (uint8_t*)AllocateBuffer(size);
+		Own(data, nullptr);
 	}
 
-	Image::Image(const Image& img) : Image(img.w, img.h, img.channels) {
-		memcpy(data, img.data, size);
+	Image::Image(const Image& img) : data(img.data), size(img.size), w(img.w), h(img.h), channels(img.channels),
+		layout(img.layout), buffer(img.buffer) {
+		if (buffer != nullptr) {
+			buffer->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	Image::Image(Image&& img) noexcept : data(img.data), size(img.size), w(img.w), h(img.h), channels(img.channels),
+		layout(img.layout), buffer(img.buffer) {
+		img.data = nullptr;
+		img.size = 0;
+		img.buffer = nullptr;
 	}
 
 	Image::~Image() {
-		stbi_image_free(data);
+		Release();
+	}
+
+	Image& Image::operator=(const Image& img) {
+		if (this != &img) {
+			if (img.buffer != nullptr) {
+				img.buffer->refs.fetch_add(1, std::memory_order_relaxed);
+			}
+			Release();
+			data = img.data;
+			size = img.size;
+			w = img.w;
+			h = img.h;
+			channels = img.channels;
+			layout = img.layout;
+			buffer = img.buffer;
+		}
+		return *this;
+	}
+
+	Image& Image::operator=(Image&& img) noexcept {
+		if (this != &img) {
+			Release();
+			data = img.data;
+			size = img.size;
+			w = img.w;
+			h = img.h;
+			channels = img.channels;
+			layout = img.layout;
+			buffer = img.buffer;
+			img.data = nullptr;
+			img.size = 0;
+			img.buffer = nullptr;
+		}
+		return *this;
+	}
+
+	uint8_t* Image::Mutable() {
+		if (Shared()) {
+			size_t bytes = (size_t)w * h * channels;
+			uint8_t* copy = (uint8_t*)AllocateBuffer(bytes);
+			memcpy(copy, data, bytes);
+			Release();
+			Own(copy, nullptr);
+			data = copy;
+			size = bytes;
+		}
+		return data;
+	}
+
+	bool Image::Shared() const {
+		return buffer != nullptr && (buffer->readOnly || buffer->refs.load(std::memory_order_acquire) > 1);
+	}
+
+	void Image::Adopt(uint8_t* pixels, int w, int h, int channels) {
+		Release();
+		Own(pixels, nullptr);
+		data = pixels;
+		this->w = w;
+		this->h = h;
+		this->channels = channels;
+		size = (size_t)w * h * channels;
+		layout = LayoutInterleaved;
+	}
+
+	void Image::SetLayout(PixelLayout layout, const ExecutionPolicy& policy) {
+		if (layout == this->layout) {
+			return;
+		}
+
+		const uint8_t* pixels = data;
+		uint8_t* converted = (uint8_t*)AllocateBuffer(size);
+		size_t plane = (size_t)w * h;
+		size_t rowBytes = (size_t)w * channels;
+		ParallelRows(h, rowBytes, policy, [&](int y0, int y1) {
+			if (layout == LayoutPlanar) {
+				DeinterleaveRows(pixels + y0 * rowBytes, rowBytes, w, y1 - y0, channels,
+					converted + (size_t)y0 * w, plane, w);
+			}
+			else {
+				InterleaveRows(pixels + (size_t)y0 * w, plane, w, w, y1 - y0, channels,
+					converted + y0 * rowBytes, rowBytes);
+			}
+		});
+
+		Adopt(converted, w, h, channels);
+		this->layout = layout;
+	}
+
+	ImageView Image::Plane(int channel) {
+		if (layout == LayoutPlanar && channel >= 0 && channel < channels) {
+			Mutable();
+		}
+		return static_cast<const Image*>(this)->Plane(channel);
+	}
+
+	ImageView Image::Plane(int channel) const {
+		if (layout != LayoutPlanar) {
+			printf("Image is not planar\n");
+			return ImageView();
+		}
+		if (channel < 0 || channel >= channels) {
+			printf("Channel %d is out of range. This image has %d channels\n", channel, channels);
+			return ImageView();
+		}
+		return ImageView(data + (size_t)channel * w * h, w, h, 1, (size_t)w);
+	}
+
+	void Image::Own(uint8_t* pixels, MappedFile* mapping) {
+		buffer = new PixelBuffer();
+		buffer->refs.store(1, std::memory_order_relaxed);
+		buffer->pixels = pixels;
+		buffer->mapping = mapping;
+		buffer->readOnly = false;
+	}
+
+	void Image::Release() {
+		if (buffer != nullptr && buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			if (buffer->mapping != nullptr) {
+				delete buffer->mapping;
+			}
+			else {
+				FreeBuffer(buffer->pixels);
+			}
+			delete buffer;
+		}
+		buffer = nullptr;
+		data = nullptr;
+		size = 0;
+	}
+
+	ImageView::ImageView(uint8_t* data, int w, int h, int channels, size_t stride)
+		: data(data), w(w), h(h), channels(channels), stride(stride) {
+	}
+
+	ImageView::ImageView(Image& image) {
+		image.SetLayout(LayoutInterleaved);
+		data = image.Mutable();
+		w = image.w;
+		h = image.h;
+		channels = image.channels;
+		stride = (size_t)image.w * image.channels;
+	}
+
+	ImageView::ImageView(const Image& image) {
+		if (image.layout != LayoutInterleaved) {
+			printf("Image is planar and has no interleaved view\n");
+			return;
+		}
+		data = image.data;
+		w = image.w;
+		h = image.h;
+		channels = image.channels;
+		stride = (size_t)image.w * image.channels;
+	}
+
+	Rect ImageView::Clip(int x, int y, int w, int h) const {
+		int x0 = x < 0 ? 0 : x > this->w ? this->w : x;
+		int y0 = y < 0 ? 0 : y > this->h ? this->h : y;
+		int x1 = (int)((int64_t)x + w < x0 ? x0 : (int64_t)x + w > this->w ? this->w : x + w);
+		int y1 = (int)((int64_t)y + h < y0 ? y0 : (int64_t)y + h > this->h ? this->h : y + h);
+		return { x0, y0, x1 - x0, y1 - y0 };
+	}
+
+	ImageView ImageView::Region(int x, int y, int w, int h) const {
+		Rect clip = Clip(x, y, w, h);
+		return ImageView(Row(clip.y) + (size_t)clip.x * channels, clip.w, clip.h, channels, stride);
+	}
+
+	Image Materialize(const ImageView& view) {
+		Image image(view.w, view.h, view.channels);
+		size_t rowBytes = view.RowBytes();
+		for (int y = 0; y < view.h; y++) {
+			memcpy(image.data + (size_t)y * rowBytes, view.Row(y), rowBytes);
+		}
+		return image;
 	}
 
 	bool Image::Read(const char* filename) {
+		Release();
+		layout = LayoutInterleaved;
+		if (GetImageType(filename) == ImageType::RAW) {
+			return Map(filename, MapCopyOnWrite);
+		}
+		if (GetImageType(filename) == ImageType::PNM || GetImageType(filename) == ImageType::QOI) {
+			std::unique_ptr<StripReader> reader = OpenStripReader(filename);
+			if (!reader) {
+				data = NULL;
+				return false;
+			}
+			w = reader->Width();
+			h = reader->Height();
+			channels = reader->Channels();
+			size = (size_t)w * h * channels;
+			data = (uint8_t*)AllocateBuffer(size);
+			Own(data, nullptr);
+			if (!reader->ReadRows(data, (size_t)w * channels, h)) {
+				Release();
+				return false;
+			}
+			return true;
+		}
 		data = stbi_load(filename, &w, &h, &channels, 0);
-		return data != NULL;
+		if (data == NULL) {
+			return false;
+		}
+		Own(data, nullptr);
+		size = (size_t)w * h * channels;
+		return true;
+	}
+
+	bool Image::Map(const char* filename, MapMode mode) {
+		Release();
+		layout = LayoutInterleaved;
+		MappedFile* file = new MappedFile();
+		RawHeader header;
+		if (!file->Open(filename, mode) || file->Size() < sizeof(header)) {
+			delete file;
+			return false;
+		}
+		memcpy(&header, file->Data(), sizeof(header));
+		if (!ValidRawHeader(header, file->Size())) {
+			delete file;
+			return false;
+		}
+
+		w = header.w;
+		h = header.h;
+		channels = header.channels;
+		size_t rowBytes = (size_t)w * channels;
+		if (header.stride == rowBytes) {
+			Own(nullptr, file);
+			buffer->readOnly = mode == MapReadOnly;
+			data = file->Data() + header.dataOffset;
+			size = rowBytes * h;
+			return true;
+		}
+
+		// Image rows are packed, so padded files are copied out.
+		size = rowBytes * h;
+		data = (uint8_t*)AllocateBuffer(size);
+		Own(data, nullptr);
+		for (int y = 0; y < h; y++) {
+			memcpy(data + (size_t)y * rowBytes, file->Data() + header.dataOffset + (size_t)y * header.stride, rowBytes);
+		}
+		delete file;
+		return true;
 	}
 
 	bool Image::Write(const char* filename) {
+		return Write(filename, PngOptions());
+	}
+
+	bool Image::Write(const char* filename, const PngOptions& png) {
+		if (layout != LayoutInterleaved) {
+			Image interleaved(*this);
+			interleaved.SetLayout(LayoutInterleaved);
+			return interleaved.Write(filename, png);
+		}
+
 		ImageType type = GetImageType(filename);
 
 		int success;
@@ -51,7 +347,7 @@ namespace ImageGene {
 		switch (type)
 		{
 			case ImageType::PNG:
-				success = stbi_write_png(filename, w, h, channels, data, w * channels);
+				success = WritePng(filename, ImageView(data, w, h, channels, (size_t)w * channels), png);
 				break;
 
 			case ImageType::JPG:
@@ -65,6 +361,17 @@ namespace ImageGene {
 			case ImageType::TGA:
 				success = stbi_write_tga(filename, w, h, channels, data);
 				break;
+
+			case ImageType::PNM:
+			case ImageType::QOI: {
+				std::unique_ptr<StripWriter> writer = CreateStripWriter(filename, w, h, channels);
+				success = writer && writer->WriteRows(data, (size_t)w * channels, h) && writer->Finish();
+				break;
+			}
+
+			case ImageType::RAW:
+				success = WriteRawImage(filename, data, w, h, channels, (size_t)w * channels);
+				break;
 		}
 		return success != 0;
 	}
@@ -76,56 +383,78 @@ namespace ImageGene {
 			else if (strcmp(ext, ".bmp") == 0) return ImageType::BMP;
 			else if (strcmp(ext, ".tga") == 0) return ImageType::TGA;
 			else if (strcmp(ext, ".jpg") == 0) return ImageType::JPG;
+			else if (strcmp(ext, ".pgm") == 0 || strcmp(ext, ".ppm") == 0 ||
+				strcmp(ext, ".pam") == 0 || strcmp(ext, ".pnm") == 0) return ImageType::PNM;
+			else if (strcmp(ext, ".igr") == 0) return ImageType::RAW;
+			else if (strcmp(ext, ".qoi") == 0) return ImageType::QOI;
 		}
 		return ImageType::PNG;
 	}
 
-	Image& GrayscaleAverage(Image *image)
+	ImageView SourceView(const Image& image, std::unique_ptr<Image>& copy)
+	{
+		if (image.layout == LayoutInterleaved) {
+			return ImageView(image);
+		}
+		copy.reset(new Image(image));
+		copy->SetLayout(LayoutInterleaved);
+		return ImageView(static_cast<const Image&>(*copy));
+	}
+
+	Image& GrayscaleAverage(Image *image, const ExecutionPolicy& policy)
 	{
 		// TODO: insert return statement here
-		if (image->channels < 3) {
+		GrayscaleAverage(ImageView(*image), policy);
+		return *image;
+	}
+
+	ImageView GrayscaleAverage(const ImageView& image, const ExecutionPolicy& policy)
+	{
+		if (image.channels < 3) {
 			printf("Given image has less than 3 channels\n");
 		}
 		else {
-			for (int i = 0; i < image->size; i += image->channels) {
-				int gray = (image->data[i] + image->data[i + 1] + image->data[i + 2]) / 3;
-				memset(image->data + i, gray, 3);
-			}
+			ParallelRows(image.h, image.RowBytes(), policy, [&](int y0, int y1) {
+				GrayscaleRows(image.Row(y0), image.w, y1 - y0, image.channels, image.stride,
+					GrayscaleMethodAverage);
+			});
 		}
 
-		return *image;
+		return image;
 	}
 
-	Image& GrayscaleLum(Image *image)
+	Image& GrayscaleLum(Image *image, const ExecutionPolicy& policy)
 	{
 		// TODO: insert return statement here
-		if (image->channels < 3) {
-			printf("Given image has less than 3 channels. This image has %d channels\n", image->channels);
+		GrayscaleLum(ImageView(*image), policy);
+		return *image;
+	}
+
+	ImageView GrayscaleLum(const ImageView& image, const ExecutionPolicy& policy)
+	{
+		if (image.channels < 3) {
+			printf("Given image has less than 3 channels. This image has %d channels\n", image.channels);
 		}
 		else {
-			for (int i = 0; i < image->size; i += image->channels) {
-				int gray = (0.2126 * image->data[i] + 0.7152 * image->data[i + 1] + 0.0722 * image->data[i + 2]);
-				memset(image->data + i, gray, 3);
-			}
+			ParallelRows(image.h, image.RowBytes(), policy, [&](int y0, int y1) {
+				GrayscaleRows(image.Row(y0), image.w, y1 - y0, image.channels, image.stride,
+					GrayscaleMethodLum);
+			});
 		}
 
-		return *image;
+		return image;
 	}
-	Image& ColorMask(Image *image, int r, int g, int b)
+	Image& ColorMask(Image *image, int r, int g, int b, const ExecutionPolicy& policy)
 	{
 		// TODO: insert return statement here
-		if (image->channels < 3) {
-			printf("Given image has less than 3 channels. This image has %d channels\n", image->channels);
-		}
-		else {
-			for (int i = 0; i < image->size; i += image->channels) {
-				image->data[i] *= r;
-				image->data[i + 1] *= g;
-				image->data[i + 2] *= b;
-			}
-		}
+		ColorMask(ImageView(*image), r, g, b, policy);
 		return *image;
 	}
+
+	ImageView ColorMask(const ImageView& image, int r, int g, int b, const ExecutionPolicy& policy)
+	{
+		return Pixels::Apply(image, Pixels::ColorMask(r, g, b), policy);
+	}
 	Image& Steganograph(Image* image, const char* text)
 	{
 		// TODO: insert return statement here
@@ -135,6 +464,8 @@ namespace ImageGene {
 			return *image;
 		}
 
+		image->SetLayout(LayoutInterleaved);
+		image->Mutable();
 		for (uint8_t i = 0; i < STEG_HEADER_SIZE; ++i) {
 			image->data[i] &= 0xFE;
 			image->data[i] |= (len >> (STEG_HEADER_SIZE - 1 - i)) & 1UL;
@@ -151,6 +482,7 @@ namespace ImageGene {
 	{
 		// TODO: insert return statement here
 		uint32_t len = 0;
+		image->SetLayout(LayoutInterleaved);
 		for (uint8_t i = 0; i < STEG_HEADER_SIZE; ++i) {
 			len = (len << 1) | (image->data[i] & 1);
 		}
@@ -163,293 +495,275 @@ namespace ImageGene {
 		return *image;
 	}
 
-	Image& ConvolveClampTo0(Image* image, uint8_t channel, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc)
+	Image& ConvolveClampTo0(Image* image, uint8_t channel, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc,
+		const ExecutionPolicy& policy)
 	{
-		// TODO: insert return statement here
-		uint8_t* newData = new uint8_t[image->w * image->h];
-		uint64_t center = (uint64_t)cr * kernelWidth + cc;
+		// A plane is a single-channel image of its own, so the kernel reads contiguous bytes.
+		if (image->layout == LayoutPlanar && channel < image->channels) {
+			ConvolveClampTo0(image->Plane(channel), 0, kernelWidth, kernelHeight, kernel, cr, cc, policy);
+			return *image;
+		}
+		ConvolveClampTo0(ImageView(*image), channel, kernelWidth, kernelHeight, kernel, cr, cc, policy);
+		return *image;
+	}
 
-		int a = kernelHeight - cr;
-		int b = kernelWidth - cc;
+	ImageView ConvolveClampTo0(const ImageView& image, uint8_t channel, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc,
+		const ExecutionPolicy& policy)
+	{
+		if (channel >= image.channels) {
+			printf("Channel %d is out of range. This image has %d channels\n", channel, image.channels);
+			return image;
+		}
+		ConvolveChannels(image.data, image.w, image.h, image.channels, image.stride,
+			channel, 1, kernel, kernelWidth, kernelHeight, cr, cc, BorderZero, policy);
 
-		for (uint64_t k = channel; k < image->size; k += image->channels) {
-			double c = 0;
-			for (int i = -((int)cr); i < a; i++) {
-				long row = ((long)k / image->channels) / image->w - i;
-				if (row < 0 || row > image->h - 1) {
-					continue;
-				}
-				for (int j = -((int)cc); j < b; j++) {
-					long col = ((long)k / image->channels) % image->w - j;
-					if (col < 0 || col > image->w - 1) {
-						continue;
-					}
-					c += kernel[center + i * (long)kernelWidth + j] * image->data[(row * image->w + col) * image->channels + channel];
-				}
-			}
-			newData[k / image->channels] = (uint8_t)BYTE_BOUND(round(c));
+		return image;
+	}
+
+	Image& ConvolveClampToBorder(Image* image, uint8_t channel, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc,
+		const ExecutionPolicy& policy)
+	{
+		// A plane is a single-channel image of its own, so the kernel reads contiguous bytes.
+		if (image->layout == LayoutPlanar && channel < image->channels) {
+			ConvolveClampToBorder(image->Plane(channel), 0, kernelWidth, kernelHeight, kernel, cr, cc, policy);
+			return *image;
 		}
-		for (uint64_t k = channel; k < image->size; k += image->channels) {
-			image->data[k] = newData[k / image->channels];
+		ConvolveClampToBorder(ImageView(*image), channel, kernelWidth, kernelHeight, kernel, cr, cc, policy);
+		return *image;
+	}
+
+	ImageView ConvolveClampToBorder(const ImageView& image, uint8_t channel, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc,
+		const ExecutionPolicy& policy)
+	{
+		if (channel >= image.channels) {
+			printf("Channel %d is out of range. This image has %d channels\n", channel, image.channels);
+			return image;
 		}
+		ConvolveChannels(image.data, image.w, image.h, image.channels, image.stride,
+			channel, 1, kernel, kernelWidth, kernelHeight, cr, cc, BorderClamp, policy);
 
-		return *image;
+		return image;
 	}
 
-	Image& ConvolveClampToBorder(Image* image, uint8_t channel, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc)
+	Image& Convolve(Image* image, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc, BorderMode border,
+		const ExecutionPolicy& policy)
 	{
-		// TODO: insert return statement here
-		uint8_t* newData = new uint8_t[image->w * image->h];
-		uint64_t center = (uint64_t)cr * kernelWidth + cc;
-
-		int a = kernelHeight - cr;
-		int b = kernelWidth - cc;
-
-		for (uint64_t k = channel; k < image->size; k += image->channels) {
-			double c = 0;
-			for (int i = -((int)cr); i < a; i++) {
-				long row = ((long)k / image->channels) / image->w - i;
-				if (row < 0) {
-					row = 0;
-				}
-				else if (row > image->h - 1) {
-					row = image->h - 1;
-				}
-				for (int j = -((int)cc); j < b; j++) {
-					long col = ((long)k / image->channels) % image->w - j;
-					if (col < 0) {
-						col = 0;
-					}
-					else if (col > image->w - 1) {
-						col = image->w - 1;
-					}
-					c += kernel[center + i * (long)kernelWidth + j] * image->data[(row * image->w + col) * image->channels + channel];
-				}
+		if (image->layout == LayoutPlanar) {
+			for (int c = 0; c < image->channels; c++) {
+				Convolve(image->Plane(c), kernelWidth, kernelHeight, kernel, cr, cc, border, policy);
 			}
-			newData[k / image->channels] = (uint8_t)BYTE_BOUND(round(c));
-		}
-		for (uint64_t k = channel; k < image->size; k += image->channels) {
-			image->data[k] = newData[k / image->channels];
+			return *image;
 		}
-
+		Convolve(ImageView(*image), kernelWidth, kernelHeight, kernel, cr, cc, border, policy);
 		return *image;
 	}
 
-	Image& Diffmap(Image* image1, Image* image2) {
-		int c_width = fmin(image1->w, image2->w);
-		int c_height = fmin(image1->h, image2->h);
-		int c_channels = fmin(image1->channels, image2->channels);
+	ImageView Convolve(const ImageView& image, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc, BorderMode border,
+		const ExecutionPolicy& policy)
+	{
+		ConvolveChannels(image.data, image.w, image.h, image.channels, image.stride,
+			0, image.channels, kernel, kernelWidth, kernelHeight, cr, cc, border, policy);
 
-		for (uint32_t i = 0; i < c_height; i++) {
-			for (uint32_t j = 0; j < c_width; j++) {
-				for (uint8_t k = 0; k < c_channels; k++) {
-					image1->data[(i * image1->w + j) * image1->channels + k] =
-						BYTE_BOUND(abs(
-							image1->data[(i * image1->w + j) * image1->channels + k] -
-							image2->data[(i * image2->w + j) * image2->channels + k]
-						));
-				}
-			}
-		}
+		return image;
+	}
 
+	Image& Diffmap(Image* image1, Image* image2, const ExecutionPolicy& policy) {
+		std::unique_ptr<Image> copy;
+		Diffmap(ImageView(*image1), SourceView(*image2, copy), policy);
 		return *image1;
 	}
 
-	Image& DiffmapWithScale(Image* image1, Image* image2, uint8_t scale) {
-		int c_width = fmin(image1->w, image2->w);
-		int c_height = fmin(image1->h, image2->h);
-		int c_channels = fmin(image1->channels, image2->channels);
-
-		uint8_t largest = 0;
+	ImageView Diffmap(const ImageView& image1, const ImageView& image2, const ExecutionPolicy& policy) {
+		Compare(image1, image2, CompareWriteDiff, false, policy);
+		return image1;
+	}
 
-		for (uint32_t i = 0; i < c_height; i++) {
-			for (uint32_t j = 0; j < c_width; j++) {
-				for (uint8_t k = 0; k < c_channels; k++) {
-					image1->data[(i * image1->w + j) * image1->channels + k] =
-						BYTE_BOUND(abs(
-							image1->data[(i * image1->w + j) * image1->channels + k] -
-							image2->data[(i * image2->w + j) * image2->channels + k]
-						));
-					largest = fmax(largest, image1->data[(i * image1->w + j) * image1->channels + k]);
-				}
-			}
-		}
+	Image& DiffmapWithScale(Image* image1, Image* image2, uint8_t scale, const ExecutionPolicy& policy) {
+		std::unique_ptr<Image> copy;
+		DiffmapWithScale(ImageView(*image1), SourceView(*image2, copy), scale, policy);
+		return *image1;
+	}
 
-		scale = 255 / fmax(1, fmax(largest, scale));
+	ImageView DiffmapWithScale(const ImageView& image1, const ImageView& image2, uint8_t scale, const ExecutionPolicy& policy) {
+		DiffStats stats = Compare(image1, image2, CompareWriteDiff, false, policy);
 
-		for (uint32_t i = 0; i < image1->size; i++) {
-			image1->data[i] *= scale;
+		// Stretch 0..reference onto 0..255, rounding, over the compared region only.
+		int reference = stats.maxError > scale ? stats.maxError : scale;
+		reference = reference > 1 ? reference : 1;
+		if (reference >= 255) {
+			return image1;
+		}
+		uint8_t stretch[256];
+		for (int d = 0; d < 256; d++) {
+			int value = (d * 255 + reference / 2) / reference;
+			stretch[d] = (uint8_t)(value > 255 ? 255 : value);
 		}
 
-		return *image1;
-	}	
+		int c_width = fmin(image1.w, image2.w);
+		int c_height = fmin(image1.h, image2.h);
+		int c_channels = fmin(image1.channels, image2.channels);
+		ParallelRows(c_height, (size_t)c_width * c_channels, policy, [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				uint8_t* row = image1.Row(y);
+				if (image1.channels == c_channels) {
+					for (size_t i = 0; i < (size_t)c_width * c_channels; i++) {
+						row[i] = stretch[row[i]];
+					}
+					continue;
+				}
+				for (int x = 0; x < c_width; x++) {
+					for (int k = 0; k < c_channels; k++) {
+						row[x * image1.channels + k] = stretch[row[x * image1.channels + k]];
+					}
+				}
+			}
+		});
+
+		return image1;
+	}
 
-	Image& FlipHorizontal(Image* image)
+	Image& FlipHorizontal(Image* image, const ExecutionPolicy& policy)
 	{
 		// TODO: insert return statement here
-		uint8_t tmp[4];
-		uint8_t* px1;
-		uint8_t* px2;
-
-		for (int y = 0; y < image->h; y++) {
-			for (int x = 0; x < image->w / 2; x++) {
-				px1 = &image->data[(x + y * image->w) * image->channels];
-				px2 = &image->data[((image->w - 1 - x) + y * image->w) * image->channels];
-
-				memcpy(tmp, px1, image->channels);
-				memcpy(px1, px2, image->channels);
-				memcpy(px2, tmp, image->channels);
-			}
-		}
+		FlipHorizontal(ImageView(*image), policy);
 		return *image;
 	}
 
-	Image& FlipVertical(Image* image)
+	ImageView FlipHorizontal(const ImageView& image, const ExecutionPolicy& policy)
 	{
-		// TODO: insert return statement here
-		uint8_t tmp[4];
-		uint8_t* px1;
-		uint8_t* px2;
-
-		for (int y = 0; y < image->h / 2; y++) {
-			for (int x = 0; x < image->w; x++) {
-				px1 = &image->data[(x + y * image->w) * image->channels];
-				px2 = &image->data[(x + (image->h - 1 - y) * image->w) * image->channels];
-
-				memcpy(tmp, px1, image->channels);
-				memcpy(px1, px2, image->channels);
-				memcpy(px2, tmp, image->channels);
+		ParallelRows(image.h, image.RowBytes(), policy, [&](int y0, int y1) {
+			uint8_t tmp[4];
+			uint8_t* px1;
+			uint8_t* px2;
+
+			for (int y = y0; y < y1; y++) {
+				uint8_t* row = image.Row(y);
+				for (int x = 0; x < image.w / 2; x++) {
+					px1 = &row[x * image.channels];
+					px2 = &row[(image.w - 1 - x) * image.channels];
+
+					memcpy(tmp, px1, image.channels);
+					memcpy(px1, px2, image.channels);
+					memcpy(px2, tmp, image.channels);
+				}
 			}
-		}
-		return *image;
+		});
+		return image;
 	}
 
-	Image& Overlay(Image* image, const Image* source, int x, int y)
+	Image& FlipVertical(Image* image, const ExecutionPolicy& policy)
 	{
-		uint8_t* sourcePixels;
-		uint8_t* destPixels;
-
-		for (int sx = 0; sx < source->w; sx++) {
-			if (sx + x < 0) {
-				continue;
-			}
-			else if (sx + x >= image->w) {
-				break;
-			}
-			for (int sy = 0; sy < source->h; sy++) {
-				if (sy + y < 0) {
-					continue;
-				}
-				else if (sy + y >= image->h) {
-					break;
-				}
-				sourcePixels = &source->data[(sx + sy * source->w) * source->channels];
-				destPixels = &image->data[((sx + x) + (sy + y) * image->w) * image->channels];
+		// TODO: insert return statement here
+		FlipVertical(ImageView(*image), policy);
+		return *image;
+	}
 
-				memcpy(destPixels, sourcePixels, image->channels);
+	ImageView FlipVertical(const ImageView& image, const ExecutionPolicy& policy)
+	{
+		size_t rowBytes = image.RowBytes();
+		ParallelRows(image.h / 2, 2 * rowBytes, policy, [&](int y0, int y1) {
+			std::vector<uint8_t> tmp(rowBytes);
+			for (int y = y0; y < y1; y++) {
+				uint8_t* row1 = image.Row(y);
+				uint8_t* row2 = image.Row(image.h - 1 - y);
+
+				memcpy(tmp.data(), row1, rowBytes);
+				memcpy(row1, row2, rowBytes);
+				memcpy(row2, tmp.data(), rowBytes);
 			}
-		}
+		});
+		return image;
+	}
 
+	Image& Overlay(Image* image, const Image* source, int x, int y, const ExecutionPolicy& policy)
+	{
+		std::unique_ptr<Image> copy;
+		Overlay(ImageView(*image), SourceView(*source, copy), x, y, policy);
 		return *image;
 	}
 
-	Image& OverlayWithAlpha(Image* image, const Image* source, int x, int y)
+	ImageView Overlay(const ImageView& image, const ImageView& source, int x, int y, const ExecutionPolicy& policy)
 	{
-		uint8_t* sourcePixels;
-		uint8_t* destPixels;
+		Rect clip = image.Clip(x, y, source.w, source.h);
+		if (clip.w == 0 || clip.h == 0) {
+			return image;
+		}
+		ImageView target = image.Region(clip.x, clip.y, clip.w, clip.h);
+		const uint8_t* origin = source.Row(clip.y - y) + (size_t)(clip.x - x) * source.channels;
 
-		for (int sx = 0; sx < source->w; sx++) {
-			if (sx + x < 0) {
-				continue;
-			}
-			else if (sx + x >= image->w) {
-				break;
+		ParallelRows(target.h, target.RowBytes(), policy, [&](int first, int last) {
+			for (int row = first; row < last; row++) {
+				ConvertPixels(origin + (size_t)row * source.stride, source.channels, target.Row(row), target.channels, target.w);
 			}
-			for (int sy = 0; sy < source->h; sy++) {
-				if (sy + y < 0) {
-					continue;
-				}
-				else if (sy + y >= image->h) {
-					break;
-				}
-				sourcePixels = &source->data[(sx + sy * source->w) * source->channels];
-				destPixels = &image->data[((sx + x) + (sy + y) * image->w) * image->channels];
+		});
 
-				float sourceAlpha = source->channels < 4 ? 1 : sourcePixels[3] / 255.0f;
-				float destAlpha = image->channels < 4 ? 1 : destPixels[3] / 255.0f;
+		return image;
+	}
 
-				if (sourceAlpha > 0.99 && destAlpha > 0.99) {
-					if (source->channels >= image->channels) {
-						memcpy(destPixels, sourcePixels, image->channels);
-					}
-					else {
-						memset(destPixels, sourcePixels[0], image->channels);
-					}
-				}
-				else {
-					float outputAlpha = sourceAlpha + destAlpha * (1 - sourceAlpha);
-					if (outputAlpha < 0.01f) {
-						memset(destPixels, 0, image->channels);
-					}
-					else {
-						for (int chnl = 0; chnl < image->channels; chnl++) {
-							destPixels[chnl] = (uint8_t)BYTE_BOUND((sourcePixels[chnl] / 255.0f * sourceAlpha + destPixels[chnl] / 255.0f * destAlpha * (1 - sourceAlpha)) / outputAlpha * 255.0f);
-						}
-						if (image->channels > 3) {
-							destPixels[3] = (uint8_t) BYTE_BOUND(outputAlpha * 255.0f);
-						}
-					}
-				}
-			}
-		}
+	Image& OverlayWithAlpha(Image* image, const Image* source, int x, int y)
+	{
+		return Blend(image, source, x, y, BlendOver);
+	}
 
-		return *image;
+	ImageView OverlayWithAlpha(const ImageView& image, const ImageView& source, int x, int y)
+	{
+		return Blend(image, source, x, y, BlendOver);
 	}
+
 	Image& OverlayText(Image* image, const char* text, const ImageGene::IGFont& font, int x, int y, 
 		uint8_t r, uint8_t g, uint8_t b, uint8_t alpha)
 	{
-		size_t len = strlen(text);
-		int32_t dx, dy;
+		OverlayText(ImageView(*image), text, font, x, y, r, g, b, alpha);
+		return *image;
+	}
+
+	ImageView OverlayText(const ImageView& image, const char* text, const ImageGene::IGFont& font, int x, int y, 
+		uint8_t r, uint8_t g, uint8_t b, uint8_t alpha)
+	{
 		uint8_t* destPixels;
 		uint8_t sourcePixel;
 		uint8_t color[4] = {r, g, b, alpha};
-		
-		ImageGene::SFTChar chr;
 
-		for (size_t i = 0; i < len; i++) {
-			if (sft_char(&font.sft, text[i], &chr) != 0) {
-				printf("Error: Font is missing character %s\n", &text[i]);
+		ImageGene::CachedGlyph chr;
+
+		for (const char* next = text; *next != '\0';) {
+			const char* at = next;
+			if (!font.Glyph(NextCodepoint(&next), &chr)) {
+				printf("Error: Font is missing character %s\n", at);
 				continue; 
 			}
-			for (uint16_t sy = 0; sy < chr.height; sy++) {
-				dy = sy + y + chr.y;
-				if (dy < 0) { continue; }
-				else if (dy >= image->h) { break; }
-				for (uint16_t sx = 0; sx < chr.width; sx++) {
-					dx = sx + x + chr.x;
-					if (dx < 0) continue;
-					else if (dx >= image->w) break;
-
-					destPixels = &image->data[(dx + dy * image->w) * image->channels];
-					sourcePixel = chr.image[sx + sy * chr.width];
+
+			// Clip the glyph to the image once, rather than testing every pixel.
+			int left = x + chr.x;
+			int top = y + chr.y;
+			int sx0 = left < 0 ? -left : 0;
+			int sy0 = top < 0 ? -top : 0;
+			int sx1 = image.w - left < chr.width ? image.w - left : chr.width;
+			int sy1 = image.h - top < chr.height ? image.h - top : chr.height;
+
+			for (int sy = sy0; sy < sy1; sy++) {
+				const uint8_t* coverage = chr.pixels + (size_t)sy * chr.pitch;
+				destPixels = image.Row(top + sy) + (size_t)(left + sx0) * image.channels;
+				for (int sx = sx0; sx < sx1; sx++, destPixels += image.channels) {
+					sourcePixel = coverage[sx];
 
 					if (sourcePixel != 0) {
 						float sourceAlpha = (sourcePixel / 255.0f) * (alpha / 255.0f);
-						float destAlpha = image->channels < 4 ? 1 : destPixels[3] / 255.0f;
+						float destAlpha = image.channels < 4 ? 1 : destPixels[3] / 255.0f;
 
 						if (sourceAlpha > 0.99 && destAlpha > 0.99) {
-							memcpy(destPixels, color, image->channels);
+							memcpy(destPixels, color, image.channels);
 						}
 						else {
 							float outputAlpha = sourceAlpha + destAlpha * (1 - sourceAlpha);
 							if (outputAlpha < 0.01f) {
-								memset(destPixels, 0, image->channels);
+								memset(destPixels, 0, image.channels);
 							}
 							else {
-								for (int chnl = 0; chnl < image->channels; chnl++) {
+								for (int chnl = 0; chnl < image.channels; chnl++) {
 									destPixels[chnl] = (uint8_t)BYTE_BOUND((color[chnl] / 255.0f * sourceAlpha + destPixels[chnl] / 255.0f * destAlpha * (1 - sourceAlpha)) / outputAlpha * 255.0f);
 								}
-								if (image->channels > 3) {
+								if (image.channels > 3) {
 									destPixels[3] = (uint8_t)BYTE_BOUND(outputAlpha * 255.0f);
 								}
 							}
@@ -458,118 +772,136 @@ namespace ImageGene {
 				}
 			}
 			x += chr.advance;
-			free(chr.image);
 		}
-		return *image;
+		return image;
 	}
 	Image& Crop(Image* image, uint16_t cx, uint16_t cy, uint16_t cw, uint16_t ch)
 	{
 		size_t size = cw * ch * image->channels;
-		uint8_t* croppedImage = new uint8_t[size];
-
-		memset(croppedImage, 0, size);
-
-		for (uint16_t x = 0; x < cw; x++) {
-			if (x + cx >= image->w) { break; }
-			for (uint16_t y = 0; y < ch; y++) {
-				if (y + cy >= image->h) { break; }
-				memcpy(&croppedImage[(x + y * cw) * image->channels], 
-					&image->data[(x + cx + (y + cy) * image->w) * image->channels],
-					image->channels);
+		uint8_t* croppedImage = (uint8_t*)AllocateBuffer(size);
+		const Image& pixels = *image;
+
+		// The part of the crop outside the image stays black. A planar image is cropped
+		// plane by plane and stays planar.
+		PixelLayout layout = image->layout;
+		int planes = layout == LayoutPlanar ? image->channels : 1;
+		for (int c = 0; c < planes; c++) {
+			ImageView region = Crop(layout == LayoutPlanar ? pixels.Plane(c) : ImageView(pixels), cx, cy, cw, ch);
+			uint8_t* dst = croppedImage + (size_t)c * cw * ch;
+			size_t dstStride = (size_t)cw * region.channels;
+			if (region.w < cw || region.h < ch) {
+				memset(dst, 0, dstStride * ch);
+			}
+			for (int y = 0; y < region.h; y++) {
+				memcpy(dst + (size_t)y * dstStride, region.Row(y), region.RowBytes());
 			}
 		}
 
-		image->w = cw;
-		image->h = ch;
-		image->size = cw * ch * image->channels;
-
-		delete[] image->data;
-		image->data = croppedImage;
+		// Cropping reads the old pixels into a new buffer, so a shared image is never copied.
+		image->Adopt(croppedImage, cw, ch, image->channels);
+		image->layout = layout;
 		croppedImage = nullptr;
 
 		// TODO: insert return statement here
 		return *image;
 	}
-	Image& DitherThreshold(Image* image, uint8_t threshold)
+
+	ImageView Crop(const ImageView& image, int cx, int cy, int cw, int ch)
 	{
+		return image.Region(cx, cy, cw, ch);
+	}
+
+	Image& Resize(Image* image, int w, int h, ResizeFilter filter, const ExecutionPolicy& policy)
+	{
+		if (w <= 0 || h <= 0) {
+			printf("Cannot resize to %d x %d\n", w, h);
+			return *image;
+		}
+
+		std::unique_ptr<Image> copy;
+		ImageView source = SourceView(*image, copy);
+		uint8_t* resized = (uint8_t*)AllocateBuffer((size_t)w * h * image->channels);
+		ResizePixels(source, ImageView(resized, w, h, image->channels, (size_t)w * image->channels), filter, policy);
+
+		// Resizing reads the old pixels into a new buffer, so a shared image is never copied.
+		image->Adopt(resized, w, h, image->channels);
+
 		// TODO: insert return statement here
-		for (uint32_t y = 0; y < image->h; y++) {
-			for (uint32_t x = 0; x < image->w; x++) {
-				if (image->data[(x + image->w * y) * image->channels] <= threshold) {
-					for (uint32_t k = 0; k < image->channels; k++) {
-						image->data[(x + image->w * y) * image->channels + k] = 0x00;
-					}					
-				}
-				else {
-					for (uint32_t k = 0; k < image->channels; k++) {
-						image->data[(x + image->w * y) * image->channels + k] = 0xFF;
-					}
-				}
-			}
-		}	
+		return *image;
+	}
+
+	ImageView Resize(const ImageView& image, const ImageView& source, ResizeFilter filter, const ExecutionPolicy& policy)
+	{
+		ResizePixels(source, image, filter, policy);
+		return image;
+	}
 
+	Image& DitherThreshold(Image* image, uint8_t threshold, const ExecutionPolicy& policy)
+	{
+		// TODO: insert return statement here
+		DitherThreshold(ImageView(*image), threshold, policy);
 		return *image;
 	}
-	Image& DitherRandom(Image* image)
+
+	ImageView DitherThreshold(const ImageView& image, uint8_t threshold, const ExecutionPolicy& policy)
+	{
+		ParallelRows(image.h, image.RowBytes(), policy, [&](int y0, int y1) {
+			DitherThresholdRows(image.Row(y0), image.w, y1 - y0, image.channels, image.stride, threshold);
+		});
+
+		return image;
+	}
+
+	Image& DitherRandom(Image* image, uint64_t seed, const ExecutionPolicy& policy)
 	{
 		// TODO: insert return statement here
-		for (uint32_t y = 0; y < image->h; y++) {
-			for (uint32_t x = 0; x < image->w; x++) {
-				uint8_t randomVal = 0 + (std::rand() % 256);
-				if (randomVal <= image->data[(x + image->w * y) * image->channels]) {
-					for (uint32_t k = 0; k < image->channels; k++) {
-						image->data[(x + image->w * y) * image->channels + k] = 0xFF;
-					}
-				}
-				else {
-					for (uint32_t k = 0; k < image->channels; k++) {
-						image->data[(x + image->w * y) * image->channels + k] = 0x00;
-					}
-				}
-			}
-		}
+		DitherRandom(ImageView(*image), seed, policy);
+		return *image;
+	}
+
+	ImageView DitherRandom(const ImageView& image, uint64_t seed, const ExecutionPolicy& policy)
+	{
+		ParallelRows(image.h, image.RowBytes(), policy, [&](int y0, int y1) {
+			DitherRandomRows(image.Row(y0), image.w, y1 - y0, image.channels, image.stride, y0, seed);
+		});
 
+		return image;
+	}
+
+	Image& DitherOrdered(Image* image, OrderedMatrix matrix, const ExecutionPolicy& policy)
+	{
+		DitherOrdered(ImageView(*image), matrix, policy);
 		return *image;
 	}
-	Image& DitherFloydSteinberg(Image* image)
-	{
-		//// TODO: insert return statement here
-		uint8_t ditheringFilter[4] = { 7, 3, 5, 1 };
-
-		for (uint32_t y = 0; y < image->h; y++) {
-			for (uint32_t x = 0; x < image->w; x++) {
-				if (x - 1 >= 0 && y + 1 < image->h && x + 1 < image->w) {
-					uint8_t newPixel = 0xFF;
-					uint8_t oldPixel = image->data[(x + y * image->w) * image->channels];
-					uint8_t vicinity[4] = {
-						image->data[(x + 1 + y * image->w) * image->channels],
-						image->data[(x - 1 + (y + 1) * image->w) * image->channels],
-						image->data[(x + (y + 1) * image->w) * image->channels],
-						image->data[(x + 1 + (y + 1) * image->w) * image->channels],
-					};
-					uint8_t error = 0x00;
-					uint8_t otherValues[4];
-
-					if (oldPixel > 0x80) {
-						newPixel = 0x00;
-					}
-					for (uint32_t k = 0; k < image->channels; k++) {
-						image->data[(x + image->w * y) * image->channels + k] = newPixel;
-					}
-					error = oldPixel - newPixel;
-					for (int i = 0; i < sizeof(ditheringFilter) / sizeof(uint8_t); i++) {
-						otherValues[i] = vicinity[i] + error * ditheringFilter[i] * 0.0625;
-					}
-					for (uint32_t k = 0; k < image->channels; k++) {
-						image->data[(x + 1 + y * image->w) * image->channels + k] = otherValues[0];
-						image->data[(x - 1 + (y + 1) * image->w) * image->channels + k] = otherValues[1];
-						image->data[(x + (y + 1) * image->w) * image->channels + k] = otherValues[2];
-						image->data[(x + 1 + (y + 1) * image->w) * image->channels + k] = otherValues[3];
-					}
-				}
-			}
-		}
-		
+
+	ImageView DitherOrdered(const ImageView& image, OrderedMatrix matrix, const ExecutionPolicy& policy)
+	{
+		ParallelRows(image.h, image.RowBytes(), policy, [&](int y0, int y1) {
+			DitherOrderedRows(image.Row(y0), image.w, y1 - y0, image.channels, image.stride, y0, matrix);
+		});
+
+		return image;
+	}
+	Image& DitherFloydSteinberg(Image* image, bool serpentine, const ExecutionPolicy& policy)
+	{
+		return DitherErrorDiffusion(image, FloydSteinberg, serpentine, policy);
+	}
+
+	ImageView DitherFloydSteinberg(const ImageView& image, bool serpentine, const ExecutionPolicy& policy)
+	{
+		return DitherErrorDiffusion(image, FloydSteinberg, serpentine, policy);
+	}
+	Image& DitherErrorDiffusion(Image* image, DiffusionKernel kernel, bool serpentine, const ExecutionPolicy& policy)
+	{
+		DitherErrorDiffusion(ImageView(*image), kernel, serpentine, policy);
 		return *image;
 	}
+
+	ImageView DitherErrorDiffusion(const ImageView& image, DiffusionKernel kernel, bool serpentine, const ExecutionPolicy& policy)
+	{
+		ErrorDiffuser diffuser(image.w, kernel, serpentine, policy);
+		diffuser.DitherRows(image.data, image.channels, image.stride, image.h);
+
+		return image;
+	}
 }
\ No newline at end of file
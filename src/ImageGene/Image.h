@@ -2,58 +2,233 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <memory>
 
 #include "IGFont.h"
+#include "ThreadPool.h"
 
 namespace ImageGene {
 	enum ImageType {
-		PNG, JPG, BMP, TGA
+		PNG, JPG, BMP, TGA, PNM, RAW, QOI
 	};
 
+	enum MapMode {
+		MapReadOnly, MapCopyOnWrite
+	};
+
+	enum BorderMode {
+		BorderZero, BorderClamp
+	};
+
+	enum DiffusionKernel {
+		FloydSteinberg, JarvisJudiceNinke, Stucki, Atkinson
+	};
+
+	enum OrderedMatrix {
+		Bayer2x2, Bayer4x4, Bayer8x8, Bayer16x16, BlueNoise64x64
+	};
+
+	// Resize filters, from softest to sharpest. Box averages the source pixels under each
+	// output pixel, bilinear is a triangle, bicubic is Catmull-Rom (a = -0.5) and Lanczos
+	// has three lobes. Downscaling widens each filter to the source area an output pixel
+	// covers, so none of them alias.
+	enum ResizeFilter {
+		ResizeBox, ResizeBilinear, ResizeBicubic, ResizeLanczos
+	};
+
+	// Interleaved pixels are stored RGBRGB...; planar pixels as one contiguous w x h
+	// plane per channel, plane c starting c * w * h bytes into data.
+	enum PixelLayout {
+		LayoutInterleaved, LayoutPlanar
+	};
+
+	class MappedFile;
+	struct PixelBuffer;
+	struct ImageView;
+	struct PngOptions;
+
+	// Copies share their pixels until one of them is written to. Operations in this file
+	// call Mutable() before they write, which gives the image a private copy only if
+	// the pixels are still shared, so fanning one image out to several filters costs a
+	// copy per filter that actually writes and nothing for the ones that only read.
+	// Code that writes to data directly must call Mutable() first.
+	//
+	// Images are interleaved unless SetLayout makes them planar. The convolutions work
+	// on the planes of a planar image directly; every other operation, and viewing the
+	// image through a non-const ImageView, interleaves it again first.
 	class Image {
 	public:
-		uint8_t* data;
+		uint8_t* data = nullptr;
 		size_t size = 0;
 
 		int w;
 		int h;
 		int channels;
+		PixelLayout layout = LayoutInterleaved;
 	public:
 		Image(const char* filename);
+		Image(const char* filename, MapMode mode);
 		Image(int w, int h, int channels);
 		Image(const Image& img);
+		Image(Image&& img) noexcept;
 		~Image();
 
+		Image& operator=(const Image& img);
+		Image& operator=(Image&& img) noexcept;
+
+		// Copies the pixels first if another image or a read-only mapping shares them, and
+		// returns data.
+		uint8_t* Mutable();
+		bool Shared() const;
+		// Replaces the pixels with a w x h buffer from AllocateBuffer, which the image
+		// takes ownership of.
+		void Adopt(uint8_t* pixels, int w, int h, int channels);
+
+		// Converts the pixels to the given layout into a new buffer; other images sharing
+		// the old pixels keep them as they were.
+		void SetLayout(PixelLayout layout, const ExecutionPolicy& policy = Sequential);
+		// One channel of a planar image as a single-channel view. The non-const version
+		// calls Mutable(), so the plane can be written through.
+		ImageView Plane(int channel);
+		ImageView Plane(int channel) const;
+
 		bool Read(const char* filename);
+		// Maps a .igr file so data points straight at its pixels, with no decode or copy.
+		// A MapReadOnly image counts as shared with the file, so Mutable() copies it into a
+		// pooled buffer before the first write; only writes to data made without Mutable()
+		// fault. MapCopyOnWrite copies pages as they are written and never changes the file.
+		bool Map(const char* filename, MapMode mode);
 		bool Write(const char* filename);
-		ImageType GetImageType(const char* filename);
+		// PNG files are written with the given compression level, filter and policy (Png.h);
+		// other formats ignore them.
+		bool Write(const char* filename, const PngOptions& png);
+		static ImageType GetImageType(const char* filename);
+
+	private:
+		void Own(uint8_t* pixels, MappedFile* mapping);
+		void Release();
+
+		PixelBuffer* buffer = nullptr;
+	};
+
+	struct Rect {
+		int x;
+		int y;
+		int w;
+		int h;
 	};
 
-	Image& GrayscaleAverage(Image* image);
-	Image& GrayscaleLum(Image* image);
-	Image& ColorMask(Image* image, int r, int g, int b);
-	Image& Diffmap(Image* image1, Image* image2);
-	Image& DiffmapWithScale(Image* image1, Image* image2, uint8_t scale = 0);
+	// Non-owning window onto w x h interleaved pixels whose rows start stride bytes
+	// apart, such as a region of a larger image. A view does not keep its pixels alive.
+	// Viewing a non-const Image calls Mutable(), so the view can be written through, and
+	// interleaves a planar image first; a view of a const Image may still share its
+	// pixels and is only for reading, and a const planar Image has no interleaved view
+	// (the view is empty).
+	struct ImageView {
+		uint8_t* data = nullptr;
+		int w = 0;
+		int h = 0;
+		int channels = 0;
+		size_t stride = 0;
+
+		ImageView() {}
+		ImageView(uint8_t* data, int w, int h, int channels, size_t stride);
+		ImageView(Image& image);
+		ImageView(const Image& image);
+
+		uint8_t* Row(int y) const { return data + (size_t)y * stride; }
+		size_t RowBytes() const { return (size_t)w * channels; }
+
+		// The part of the rectangle that lies inside this view, in view coordinates; w and
+		// h are 0 when none of it does.
+		Rect Clip(int x, int y, int w, int h) const;
+		// The view of Clip(x, y, w, h).
+		ImageView Region(int x, int y, int w, int h) const;
+	};
+
+	// Copies a view into an image of its own, one memcpy per row.
+	Image Materialize(const ImageView& view);
+
+	// Interleaved view of an image that is only read. A planar image is interleaved
+	// into copy, which must outlive the view; the image itself is left as it is.
+	ImageView SourceView(const Image& image, std::unique_ptr<Image>& copy);
+
+	// Each operation also takes an ImageView, which works on the view's pixels in place,
+	// so a region of a larger image is processed without being copied out.
+	Image& GrayscaleAverage(Image* image, const ExecutionPolicy& policy = Sequential);
+	ImageView GrayscaleAverage(const ImageView& image, const ExecutionPolicy& policy = Sequential);
+	Image& GrayscaleLum(Image* image, const ExecutionPolicy& policy = Sequential);
+	ImageView GrayscaleLum(const ImageView& image, const ExecutionPolicy& policy = Sequential);
+	Image& ColorMask(Image* image, int r, int g, int b, const ExecutionPolicy& policy = Sequential);
+	ImageView ColorMask(const ImageView& image, int r, int g, int b, const ExecutionPolicy& policy = Sequential);
+	Image& Diffmap(Image* image1, Image* image2, const ExecutionPolicy& policy = Sequential);
+	ImageView Diffmap(const ImageView& image1, const ImageView& image2, const ExecutionPolicy& policy = Sequential);
+	// Diffmap, then the compared region stretched so that max(largest difference, scale)
+	// becomes 255, rounding to the nearest value. Compare (Compare.h) gives the statistics.
+	Image& DiffmapWithScale(Image* image1, Image* image2, uint8_t scale = 0, const ExecutionPolicy& policy = Sequential);
+	ImageView DiffmapWithScale(const ImageView& image1, const ImageView& image2, uint8_t scale = 0,
+		const ExecutionPolicy& policy = Sequential);
 
 	Image& Steganograph(Image* image, const char* text);
 	Image& DecodeSteganograph(Image* image, char* buffer, size_t* messageSize);
 
 	Image& ConvolveClampTo0(Image* image, uint8_t channel,
-		uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc);
+		uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc,
+		const ExecutionPolicy& policy = Sequential);
+	ImageView ConvolveClampTo0(const ImageView& image, uint8_t channel,
+		uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc,
+		const ExecutionPolicy& policy = Sequential);
 	Image& ConvolveClampToBorder(Image* image, uint8_t channel,
-		uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc);
+		uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc,
+		const ExecutionPolicy& policy = Sequential);
+	ImageView ConvolveClampToBorder(const ImageView& image, uint8_t channel,
+		uint32_t kernelWidth, uint32_t kernelHeight, double kernel[], uint32_t cr, uint32_t cc,
+		const ExecutionPolicy& policy = Sequential);
+	Image& Convolve(Image* image, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[],
+		uint32_t cr, uint32_t cc, BorderMode border = BorderClamp, const ExecutionPolicy& policy = Sequential);
+	ImageView Convolve(const ImageView& image, uint32_t kernelWidth, uint32_t kernelHeight, double kernel[],
+		uint32_t cr, uint32_t cc, BorderMode border = BorderClamp, const ExecutionPolicy& policy = Sequential);
 
-	Image& FlipHorizontal(Image* image);
-	Image& FlipVertical(Image* image);
+	Image& FlipHorizontal(Image* image, const ExecutionPolicy& policy = Sequential);
+	ImageView FlipHorizontal(const ImageView& image, const ExecutionPolicy& policy = Sequential);
+	Image& FlipVertical(Image* image, const ExecutionPolicy& policy = Sequential);
+	ImageView FlipVertical(const ImageView& image, const ExecutionPolicy& policy = Sequential);
 
-	Image& Overlay(Image* image, const Image* source, int x, int y);
+	// Copies source into image with its top left corner at (x, y), clipped to image. Each
+	// row is one span: a memcpy, or ConvertPixels (Blit.h) when the channel counts differ.
+	Image& Overlay(Image* image, const Image* source, int x, int y, const ExecutionPolicy& policy = Sequential);
+	ImageView Overlay(const ImageView& image, const ImageView& source, int x, int y,
+		const ExecutionPolicy& policy = Sequential);
+	// Straight-alpha "over" compositing; Blend (Blend.h) with BlendOver.
 	Image& OverlayWithAlpha(Image* image, const Image* source, int x, int y);
+	ImageView OverlayWithAlpha(const ImageView& image, const ImageView& source, int x, int y);
 	Image& OverlayText(Image* image, const char* text, const IGFont& font, int x, int y, 
 		uint8_t r = 255, uint8_t g = 255, uint8_t b = 255, uint8_t alpha = 255);
+	ImageView OverlayText(const ImageView& image, const char* text, const IGFont& font, int x, int y,
+		uint8_t r = 255, uint8_t g = 255, uint8_t b = 255, uint8_t alpha = 255);
 
 	Image& Crop(Image* image, uint16_t cx, uint16_t cy, uint16_t cw, uint16_t ch);
+	// The crop rectangle as a view into the image, clipped to it: no pixels are copied.
+	ImageView Crop(const ImageView& image, int cx, int cy, int cw, int ch);
+
+	// Resamples the image to w x h with ResizePixels (Resize.h): separable fixed-point
+	// passes, with 2:1 box reductions first for downscales of 4x or more.
+	Image& Resize(Image* image, int w, int h, ResizeFilter filter = ResizeLanczos,
+		const ExecutionPolicy& policy = Sequential);
+	// Resamples all of source to fill image, which must have the same number of channels.
+	ImageView Resize(const ImageView& image, const ImageView& source, ResizeFilter filter = ResizeLanczos,
+		const ExecutionPolicy& policy = Sequential);
 
-	Image& DitherThreshold(Image *image, uint8_t threshold = 0x7F);
-	Image& DitherRandom(Image* image);
-	Image& DitherFloydSteinberg(Image* image);
+	Image& DitherThreshold(Image *image, uint8_t threshold = 0x7F, const ExecutionPolicy& policy = Sequential);
+	ImageView DitherThreshold(const ImageView& image, uint8_t threshold = 0x7F, const ExecutionPolicy& policy = Sequential);
+	Image& DitherRandom(Image* image, uint64_t seed, const ExecutionPolicy& policy = Sequential);
+	ImageView DitherRandom(const ImageView& image, uint64_t seed, const ExecutionPolicy& policy = Sequential);
+	Image& DitherFloydSteinberg(Image* image, bool serpentine = false, const ExecutionPolicy& policy = Sequential);
+	ImageView DitherFloydSteinberg(const ImageView& image, bool serpentine = false, const ExecutionPolicy& policy = Sequential);
+	Image& DitherOrdered(Image* image, OrderedMatrix matrix = Bayer8x8, const ExecutionPolicy& policy = Sequential);
+	ImageView DitherOrdered(const ImageView& image, OrderedMatrix matrix = Bayer8x8, const ExecutionPolicy& policy = Sequential);
+	Image& DitherErrorDiffusion(Image* image, DiffusionKernel kernel, bool serpentine = false,
+		const ExecutionPolicy& policy = Sequential);
+	ImageView DitherErrorDiffusion(const ImageView& image, DiffusionKernel kernel, bool serpentine = false,
+		const ExecutionPolicy& policy = Sequential);
 }
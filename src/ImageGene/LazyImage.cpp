@@ -0,0 +1,439 @@
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "LazyImage.h"
+#include "Convolution.h"
+#include "Dither.h"
+#include "Grayscale.h"
+
+namespace ImageGene {
+	// Row-local operations work on any band of rows given the band's first image row;
+	// convolutions read rows around the ones they write; whole-image operations run
+	// on the finished output of the nodes before them.
+	struct LazyNode {
+		enum Kind { Rows, Convolution, Whole };
+
+		Kind kind;
+		StripOperation rows;
+		std::function<void(const ImageView& image, const ExecutionPolicy& policy)> whole;
+
+		std::vector<double> kernel;
+		uint32_t kernelWidth;
+		uint32_t kernelHeight;
+		uint32_t cr;
+		uint32_t cc;
+		int firstChannel;
+		int channelCount;
+		BorderMode border;
+	};
+
+	namespace {
+		// Small enough that a tile stays in L2 while every operation of a pass runs on it.
+		const size_t LAZY_TILE_BYTES = 256 * 1024;
+		const int MIN_LAZY_TILE_ROWS = 8;
+
+		LazyNode RowsNode(StripOperation operation)
+		{
+			LazyNode node = {};
+			node.kind = LazyNode::Rows;
+			node.rows = operation;
+			return node;
+		}
+
+		LazyNode WholeNode(std::function<void(const ImageView&, const ExecutionPolicy&)> operation)
+		{
+			LazyNode node = {};
+			node.kind = LazyNode::Whole;
+			node.whole = operation;
+			return node;
+		}
+
+		LazyNode ConvolutionNode(uint32_t kernelWidth, uint32_t kernelHeight, const double* kernel, uint32_t cr, uint32_t cc,
+			int firstChannel, int channelCount, BorderMode border)
+		{
+			LazyNode node = {};
+			node.kind = LazyNode::Convolution;
+			node.kernel.assign(kernel, kernel + (size_t)kernelWidth * kernelHeight);
+			node.kernelWidth = kernelWidth;
+			node.kernelHeight = kernelHeight;
+			node.cr = cr;
+			node.cc = cc;
+			node.firstChannel = firstChannel;
+			node.channelCount = channelCount;
+			node.border = border;
+			return node;
+		}
+
+		void CopyRows(const ImageView& from, const ImageView& to)
+		{
+			for (int y = 0; y < to.h; y++) {
+				memcpy(to.Row(y), from.Row(y), to.RowBytes());
+			}
+		}
+
+		// Runs nodes [first, last), none of them whole-image, from input into output a
+		// tile of rows at a time. Without convolutions the tile is processed where it
+		// lies in output; with them it is carried through scratch buffers, starting from
+		// the input rows every convolution of the pass needs, so input must not be output.
+		void RunPass(const std::vector<LazyNode>& nodes, size_t first, size_t last,
+			const ImageView& input, const ImageView& output, const ExecutionPolicy& policy)
+		{
+			const int w = output.w;
+			const int h = output.h;
+			const int channels = output.channels;
+			const size_t rowBytes = output.RowBytes();
+
+			int halo = 0;
+			bool convolves = false;
+			for (size_t i = first; i < last; i++) {
+				if (nodes[i].kind == LazyNode::Convolution) {
+					halo += nodes[i].kernelHeight - 1;
+					convolves = true;
+				}
+			}
+
+			int tileRows = (int)(LAZY_TILE_BYTES / (rowBytes > 0 ? rowBytes : 1));
+			tileRows = tileRows < MIN_LAZY_TILE_ROWS ? MIN_LAZY_TILE_ROWS : tileRows;
+			// Keep the recomputed halo a small fraction of each tile.
+			tileRows = tileRows < 4 * halo ? 4 * halo : tileRows;
+			int tiles = (h + tileRows - 1) / tileRows;
+
+			ThreadPool& pool = ThreadPool::Shared();
+			pool.ParallelFor(0, tiles, 1, pool.Concurrency(policy), [&](int firstTile, int lastTile) {
+				std::vector<int> top(last - first + 1);
+				std::vector<int> bottom(last - first + 1);
+				std::vector<uint8_t> current;
+				std::vector<uint8_t> next;
+				std::vector<uint8_t> packed;
+
+				for (int t = firstTile; t < lastTile; t++) {
+					int y0 = t * tileRows;
+					int y1 = y0 + tileRows < h ? y0 + tileRows : h;
+
+					if (!convolves) {
+						if (input.data != output.data) {
+							for (int y = y0; y < y1; y++) {
+								memcpy(output.Row(y), input.Row(y), rowBytes);
+							}
+						}
+						for (size_t i = first; i < last; i++) {
+							nodes[i].rows(output.Row(y0), w, y1 - y0, channels, output.stride, y0);
+						}
+						continue;
+					}
+
+					// Rows each node has to produce, working back from the tile: a
+					// convolution needs its kernel's reach above and below its output.
+					size_t n = last - first;
+					top[n] = y0;
+					bottom[n] = y1;
+					for (size_t i = n; i-- > 0;) {
+						const LazyNode& node = nodes[first + i];
+						top[i] = top[i + 1];
+						bottom[i] = bottom[i + 1];
+						if (node.kind == LazyNode::Convolution) {
+							int above = node.kernelHeight - 1 - node.cr;
+							int below = node.cr;
+							top[i] = top[i] - above > 0 ? top[i] - above : 0;
+							bottom[i] = bottom[i] + below < h ? bottom[i] + below : h;
+						}
+					}
+
+					current.resize((size_t)(bottom[0] - top[0]) * rowBytes);
+					for (int y = top[0]; y < bottom[0]; y++) {
+						memcpy(&current[(size_t)(y - top[0]) * rowBytes], input.Row(y), rowBytes);
+					}
+
+					for (size_t i = 0; i < n; i++) {
+						const LazyNode& node = nodes[first + i];
+						if (node.kind == LazyNode::Rows) {
+							node.rows(current.data(), w, bottom[i] - top[i], channels, rowBytes, top[i]);
+							continue;
+						}
+
+						int rows = bottom[i + 1] - top[i + 1];
+						const uint8_t* src = current.data();
+						next.resize((size_t)rows * rowBytes);
+						if (node.channelCount == channels) {
+							ConvolveRows(src, rowBytes, top[i], w, h, channels, 0, channels,
+								node.kernel.data(), node.kernelWidth, node.kernelHeight, node.cr, node.cc, node.border,
+								next.data(), rowBytes, top[i + 1], rows);
+						}
+						else {
+							// Channels the kernel does not touch pass through unchanged.
+							memcpy(next.data(), src + (size_t)(top[i + 1] - top[i]) * rowBytes, (size_t)rows * rowBytes);
+							size_t packedStride = (size_t)w * node.channelCount;
+							packed.resize((size_t)rows * packedStride);
+							ConvolveRows(src, rowBytes, top[i], w, h, channels, node.firstChannel, node.channelCount,
+								node.kernel.data(), node.kernelWidth, node.kernelHeight, node.cr, node.cc, node.border,
+								packed.data(), packedStride, top[i + 1], rows);
+							for (int y = 0; y < rows; y++) {
+								uint8_t* dst = &next[(size_t)y * rowBytes] + node.firstChannel;
+								const uint8_t* from = &packed[(size_t)y * packedStride];
+								for (int x = 0; x < w; x++) {
+									memcpy(dst + (size_t)x * channels, from + (size_t)x * node.channelCount, node.channelCount);
+								}
+							}
+						}
+						current.swap(next);
+					}
+
+					for (int y = y0; y < y1; y++) {
+						memcpy(output.Row(y), &current[(size_t)(y - y0) * rowBytes], rowBytes);
+					}
+				}
+			});
+		}
+	}
+
+	LazyImage::LazyImage(const ImageView& source) : source(source) {}
+
+	LazyImage::~LazyImage() {}
+
+	LazyImage& LazyImage::Pointwise(StripOperation operation)
+	{
+		nodes.push_back(RowsNode(operation));
+		return *this;
+	}
+
+	LazyImage& LazyImage::GrayscaleAverage()
+	{
+		if (source.channels < 3) {
+			printf("Given image has less than 3 channels\n");
+			return *this;
+		}
+		return Pointwise([](uint8_t* data, int w, int rows, int channels, size_t stride, int) {
+			GrayscaleRows(data, w, rows, channels, stride, GrayscaleMethodAverage);
+		});
+	}
+
+	LazyImage& LazyImage::GrayscaleLum()
+	{
+		if (source.channels < 3) {
+			printf("Given image has less than 3 channels. This image has %d channels\n", source.channels);
+			return *this;
+		}
+		return Pointwise([](uint8_t* data, int w, int rows, int channels, size_t stride, int) {
+			GrayscaleRows(data, w, rows, channels, stride, GrayscaleMethodLum);
+		});
+	}
+
+	LazyImage& LazyImage::ColorMask(int r, int g, int b)
+	{
+		if (source.channels < 3) {
+			printf("Given image has less than 3 channels. This image has %d channels\n", source.channels);
+			return *this;
+		}
+		return Pointwise([r, g, b](uint8_t* data, int w, int rows, int channels, size_t stride, int) {
+			ImageGene::ColorMask(ImageView(data, w, rows, channels, stride), r, g, b);
+		});
+	}
+
+	LazyImage& LazyImage::Diffmap(const ImageView& other)
+	{
+		return Pointwise([other](uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow) {
+			int overlap = other.h - firstRow < rows ? other.h - firstRow : rows;
+			if (overlap > 0) {
+				ImageGene::Diffmap(ImageView(data, w, overlap, channels, stride), other.Region(0, firstRow, other.w, overlap));
+			}
+		});
+	}
+
+	LazyImage& LazyImage::DiffmapWithScale(const ImageView& other, uint8_t scale)
+	{
+		nodes.push_back(WholeNode([other, scale](const ImageView& image, const ExecutionPolicy& policy) {
+			ImageGene::DiffmapWithScale(image, other, scale, policy);
+		}));
+		return *this;
+	}
+
+	LazyImage& LazyImage::ConvolveClampTo0(uint8_t channel,
+		uint32_t kernelWidth, uint32_t kernelHeight, const double kernel[], uint32_t cr, uint32_t cc)
+	{
+		if (channel >= source.channels) {
+			printf("Channel %d is out of range. This image has %d channels\n", channel, source.channels);
+			return *this;
+		}
+		nodes.push_back(ConvolutionNode(kernelWidth, kernelHeight, kernel, cr, cc, channel, 1, BorderZero));
+		return *this;
+	}
+
+	LazyImage& LazyImage::ConvolveClampToBorder(uint8_t channel,
+		uint32_t kernelWidth, uint32_t kernelHeight, const double kernel[], uint32_t cr, uint32_t cc)
+	{
+		if (channel >= source.channels) {
+			printf("Channel %d is out of range. This image has %d channels\n", channel, source.channels);
+			return *this;
+		}
+		nodes.push_back(ConvolutionNode(kernelWidth, kernelHeight, kernel, cr, cc, channel, 1, BorderClamp));
+		return *this;
+	}
+
+	LazyImage& LazyImage::Convolve(uint32_t kernelWidth, uint32_t kernelHeight, const double kernel[],
+		uint32_t cr, uint32_t cc, BorderMode border)
+	{
+		nodes.push_back(ConvolutionNode(kernelWidth, kernelHeight, kernel, cr, cc, 0, source.channels, border));
+		return *this;
+	}
+
+	LazyImage& LazyImage::FlipHorizontal()
+	{
+		return Pointwise([](uint8_t* data, int w, int rows, int channels, size_t stride, int) {
+			ImageGene::FlipHorizontal(ImageView(data, w, rows, channels, stride));
+		});
+	}
+
+	LazyImage& LazyImage::FlipVertical()
+	{
+		nodes.push_back(WholeNode([](const ImageView& image, const ExecutionPolicy& policy) {
+			ImageGene::FlipVertical(image, policy);
+		}));
+		return *this;
+	}
+
+	// An overlay of a band is the overlay of the whole image restricted to the band's
+	// rows, with the source shifted up by the band's first row.
+	LazyImage& LazyImage::Overlay(const ImageView& overlay, int x, int y)
+	{
+		return Pointwise([overlay, x, y](uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow) {
+			ImageGene::Overlay(ImageView(data, w, rows, channels, stride), overlay, x, y - firstRow);
+		});
+	}
+
+	LazyImage& LazyImage::OverlayWithAlpha(const ImageView& overlay, int x, int y)
+	{
+		return Pointwise([overlay, x, y](uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow) {
+			ImageGene::OverlayWithAlpha(ImageView(data, w, rows, channels, stride), overlay, x, y - firstRow);
+		});
+	}
+
+	LazyImage& LazyImage::OverlayText(const char* text, const IGFont& font, int x, int y,
+		uint8_t r, uint8_t g, uint8_t b, uint8_t alpha)
+	{
+		std::string copy = text;
+		const IGFont* face = &font;
+		nodes.push_back(WholeNode([copy, face, x, y, r, g, b, alpha](const ImageView& image, const ExecutionPolicy&) {
+			ImageGene::OverlayText(image, copy.c_str(), *face, x, y, r, g, b, alpha);
+		}));
+		return *this;
+	}
+
+	LazyImage& LazyImage::DitherThreshold(uint8_t threshold)
+	{
+		return Pointwise([threshold](uint8_t* data, int w, int rows, int channels, size_t stride, int) {
+			DitherThresholdRows(data, w, rows, channels, stride, threshold);
+		});
+	}
+
+	LazyImage& LazyImage::DitherRandom(uint64_t seed)
+	{
+		return Pointwise([seed](uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow) {
+			DitherRandomRows(data, w, rows, channels, stride, firstRow, seed);
+		});
+	}
+
+	LazyImage& LazyImage::DitherOrdered(OrderedMatrix matrix)
+	{
+		return Pointwise([matrix](uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow) {
+			DitherOrderedRows(data, w, rows, channels, stride, firstRow, matrix);
+		});
+	}
+
+	LazyImage& LazyImage::DitherFloydSteinberg(bool serpentine)
+	{
+		return DitherErrorDiffusion(FloydSteinberg, serpentine);
+	}
+
+	LazyImage& LazyImage::DitherErrorDiffusion(DiffusionKernel kernel, bool serpentine)
+	{
+		nodes.push_back(WholeNode([kernel, serpentine](const ImageView& image, const ExecutionPolicy& policy) {
+			ImageGene::DitherErrorDiffusion(image, kernel, serpentine, policy);
+		}));
+		return *this;
+	}
+
+	Image LazyImage::Evaluate(const ExecutionPolicy& policy) const
+	{
+		Image image(source.w, source.h, source.channels);
+		Run(ImageView(image), policy, true);
+		return image;
+	}
+
+	void LazyImage::EvaluateInPlace(const ExecutionPolicy& policy) const
+	{
+		Run(source, policy, true);
+	}
+
+	int LazyImage::Operations() const
+	{
+		return (int)nodes.size();
+	}
+
+	int LazyImage::Passes() const
+	{
+		return Run(ImageView(), Sequential, false);
+	}
+
+	// Values move from the source to output. A pass with convolutions cannot overwrite
+	// rows it still has to read, so when the latest values are already in output it
+	// writes to a spare image instead, and the next pass or a final copy brings them back.
+	int LazyImage::Run(const ImageView& output, const ExecutionPolicy& policy, bool execute) const
+	{
+		enum Location { AtSource, AtOutput, AtSpare };
+
+		std::unique_ptr<Image> spare;
+		auto view = [&](Location at) {
+			if (at == AtSpare && !spare) {
+				spare.reset(new Image(source.w, source.h, source.channels));
+			}
+			return at == AtSource ? source : at == AtOutput ? output : ImageView(*spare);
+		};
+
+		Location at = execute && output.data == source.data ? AtOutput : AtSource;
+		int passes = 0;
+
+		for (size_t i = 0; i < nodes.size();) {
+			if (nodes[i].kind == LazyNode::Whole) {
+				if (at != AtOutput) {
+					if (execute) {
+						CopyRows(view(at), output);
+					}
+					at = AtOutput;
+					passes++;
+				}
+				if (execute) {
+					nodes[i].whole(output, policy);
+				}
+				passes++;
+				i++;
+				continue;
+			}
+
+			size_t last = i;
+			bool convolves = false;
+			while (last < nodes.size() && nodes[last].kind != LazyNode::Whole) {
+				convolves = convolves || nodes[last].kind == LazyNode::Convolution;
+				last++;
+			}
+
+			Location target = convolves && at == AtOutput ? AtSpare : AtOutput;
+			if (execute) {
+				RunPass(nodes, i, last, view(at), view(target), policy);
+			}
+			at = target;
+			passes++;
+			i = last;
+		}
+
+		if (at != AtOutput) {
+			if (execute) {
+				CopyRows(view(at), output);
+			}
+			passes++;
+		}
+		return passes;
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Image.h"
+#include "Stream.h"
+
+namespace ImageGene {
+	struct LazyNode;
+
+	// Operations recorded against an image and run only when the result is requested.
+	// Each node reads the output of the node before it, and Diffmap and the overlays
+	// also read a second image. Evaluation groups the nodes into passes: a run of
+	// row-local operations, with any convolutions among them, is swept once, a
+	// cache-sized tile of rows at a time, carrying each tile through every operation
+	// of the run before moving on. A tile also recomputes the halo rows its
+	// convolutions read above and below it, so tiles are independent and run in
+	// parallel. Operations that need the whole image (FlipVertical, error diffusion,
+	// DiffmapWithScale and OverlayText) run on their own between passes.
+	//
+	// Output is byte-identical to calling the same operations eagerly. Images, fonts
+	// and views passed to the recording methods must outlive the evaluation.
+	class LazyImage {
+	public:
+		explicit LazyImage(const ImageView& source);
+		~LazyImage();
+
+		LazyImage& Pointwise(StripOperation operation);
+		LazyImage& GrayscaleAverage();
+		LazyImage& GrayscaleLum();
+		LazyImage& ColorMask(int r, int g, int b);
+		LazyImage& Diffmap(const ImageView& other);
+		LazyImage& DiffmapWithScale(const ImageView& other, uint8_t scale = 0);
+
+		LazyImage& ConvolveClampTo0(uint8_t channel,
+			uint32_t kernelWidth, uint32_t kernelHeight, const double kernel[], uint32_t cr, uint32_t cc);
+		LazyImage& ConvolveClampToBorder(uint8_t channel,
+			uint32_t kernelWidth, uint32_t kernelHeight, const double kernel[], uint32_t cr, uint32_t cc);
+		LazyImage& Convolve(uint32_t kernelWidth, uint32_t kernelHeight, const double kernel[],
+			uint32_t cr, uint32_t cc, BorderMode border = BorderClamp);
+
+		LazyImage& FlipHorizontal();
+		LazyImage& FlipVertical();
+
+		LazyImage& Overlay(const ImageView& overlay, int x, int y);
+		LazyImage& OverlayWithAlpha(const ImageView& overlay, int x, int y);
+		LazyImage& OverlayText(const char* text, const IGFont& font, int x, int y,
+			uint8_t r = 255, uint8_t g = 255, uint8_t b = 255, uint8_t alpha = 255);
+
+		LazyImage& DitherThreshold(uint8_t threshold = 0x7F);
+		LazyImage& DitherRandom(uint64_t seed);
+		LazyImage& DitherOrdered(OrderedMatrix matrix = Bayer8x8);
+		LazyImage& DitherFloydSteinberg(bool serpentine = false);
+		LazyImage& DitherErrorDiffusion(DiffusionKernel kernel, bool serpentine = false);
+
+		// Runs the operations into a new image and leaves the source as it is.
+		Image Evaluate(const ExecutionPolicy& policy = Sequential) const;
+		// Runs the operations on the source's pixels.
+		void EvaluateInPlace(const ExecutionPolicy& policy = Sequential) const;
+
+		// Number of recorded operations, which is the number of sweeps over the image
+		// running them eagerly takes.
+		int Operations() const;
+		// Sweeps over the image Evaluate makes, including copies between buffers.
+		int Passes() const;
+
+	private:
+		int Run(const ImageView& output, const ExecutionPolicy& policy, bool execute) const;
+
+		ImageView source;
+		std::vector<LazyNode> nodes;
+	};
+}
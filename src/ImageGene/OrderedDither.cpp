@@ -0,0 +1,378 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "Cpu.h"
+#include "Dither.h"
+#include "Random.h"
+
+#if defined(IG_X86)
+#include <immintrin.h>
+#elif defined(IG_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		const int MAP_CELLS = THRESHOLD_MAP_SIZE * THRESHOLD_MAP_SIZE;
+		const int MAP_MASK = THRESHOLD_MAP_SIZE - 1;
+		const int MATRIX_COUNT = BlueNoise64x64 + 1;
+
+		const double BLUE_NOISE_SIGMA = 1.5;
+		const int BLUE_NOISE_SEED_PERCENT = 10;
+		const uint64_t BLUE_NOISE_SEED = 0x626C75656E6F6973ull;
+
+		// Writes the thresholds of an n x n rank matrix, tiled, into a 64x64 map.
+		void TileRanks(const std::vector<int>& ranks, int n, uint8_t* map)
+		{
+			int cells = n * n;
+			for (int y = 0; y < THRESHOLD_MAP_SIZE; y++) {
+				for (int x = 0; x < THRESHOLD_MAP_SIZE; x++) {
+					int rank = ranks[(y % n) * n + (x % n)];
+					map[y * THRESHOLD_MAP_SIZE + x] = (uint8_t)((255 * (2 * rank + 1)) / (2 * cells));
+				}
+			}
+		}
+
+		// M(2n) = [4M, 4M + 2; 4M + 3, 4M + 1]
+		std::vector<int> BayerRanks(int n)
+		{
+			std::vector<int> ranks(1, 0);
+			for (int size = 1; size < n; size *= 2) {
+				std::vector<int> next(4 * size * size);
+				for (int y = 0; y < size; y++) {
+					for (int x = 0; x < size; x++) {
+						int r = 4 * ranks[y * size + x];
+						next[y * 2 * size + x] = r;
+						next[y * 2 * size + x + size] = r + 2;
+						next[(y + size) * 2 * size + x] = r + 3;
+						next[(y + size) * 2 * size + x + size] = r + 1;
+					}
+				}
+				ranks.swap(next);
+			}
+			return ranks;
+		}
+
+		// Ulichney's void-and-cluster method on a 64x64 torus: ranks are assigned by
+		// repeatedly removing the tightest cluster of set cells and filling the largest
+		// void, measured with a Gaussian energy.
+		class VoidAndCluster {
+		public:
+			VoidAndCluster() : energy(MAP_CELLS, 0.0), set(MAP_CELLS, false), count(0)
+			{
+				for (int dy = 0; dy < THRESHOLD_MAP_SIZE; dy++) {
+					for (int dx = 0; dx < THRESHOLD_MAP_SIZE; dx++) {
+						int wy = dy < THRESHOLD_MAP_SIZE - dy ? dy : THRESHOLD_MAP_SIZE - dy;
+						int wx = dx < THRESHOLD_MAP_SIZE - dx ? dx : THRESHOLD_MAP_SIZE - dx;
+						gaussian[dy * THRESHOLD_MAP_SIZE + dx] =
+							exp(-(wx * wx + wy * wy) / (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+					}
+				}
+			}
+
+			std::vector<int> Ranks()
+			{
+				// Deterministic initial pattern drawn from the counter-based generator.
+				for (uint32_t i = 0; count < MAP_CELLS * BLUE_NOISE_SEED_PERCENT / 100; i++) {
+					int cell = (int)(PixelRandom(BLUE_NOISE_SEED, i, 0) % MAP_CELLS);
+					if (!set[cell]) {
+						Toggle(cell);
+					}
+				}
+
+				for (;;) {
+					int cluster = Extreme(true);
+					Toggle(cluster);
+					int hole = Extreme(false);
+					Toggle(hole);
+					if (hole == cluster) {
+						break;
+					}
+				}
+
+				std::vector<int> ranks(MAP_CELLS, 0);
+				std::vector<double> seedEnergy = energy;
+				std::vector<bool> seedSet = set;
+				int seedCount = count;
+
+				for (int rank = seedCount - 1; rank >= 0; rank--) {
+					int cluster = Extreme(true);
+					Toggle(cluster);
+					ranks[cluster] = rank;
+				}
+
+				energy = seedEnergy;
+				set = seedSet;
+				count = seedCount;
+				for (int rank = seedCount; rank < MAP_CELLS; rank++) {
+					int hole = Extreme(false);
+					Toggle(hole);
+					ranks[hole] = rank;
+				}
+				return ranks;
+			}
+
+		private:
+			void Toggle(int cell)
+			{
+				double sign = set[cell] ? -1.0 : 1.0;
+				set[cell] = !set[cell];
+				count += set[cell] ? 1 : -1;
+
+				int cx = cell & MAP_MASK;
+				int cy = cell / THRESHOLD_MAP_SIZE;
+				for (int y = 0; y < THRESHOLD_MAP_SIZE; y++) {
+					const double* g = &gaussian[((y - cy) & MAP_MASK) * THRESHOLD_MAP_SIZE];
+					double* e = &energy[y * THRESHOLD_MAP_SIZE];
+					for (int x = 0; x < THRESHOLD_MAP_SIZE; x++) {
+						e[x] += sign * g[(x - cx) & MAP_MASK];
+					}
+				}
+			}
+
+			// Set cell with the highest energy, or unset cell with the lowest.
+			int Extreme(bool cluster)
+			{
+				int best = -1;
+				for (int cell = 0; cell < MAP_CELLS; cell++) {
+					if (set[cell] != cluster) {
+						continue;
+					}
+					if (best < 0 || (cluster ? energy[cell] > energy[best] : energy[cell] < energy[best])) {
+						best = cell;
+					}
+				}
+				return best;
+			}
+
+			double gaussian[MAP_CELLS];
+			std::vector<double> energy;
+			std::vector<bool> set;
+			int count;
+		};
+
+		struct ThresholdMaps {
+			uint8_t maps[MATRIX_COUNT][MAP_CELLS];
+
+			ThresholdMaps()
+			{
+				TileRanks(BayerRanks(2), 2, maps[Bayer2x2]);
+				TileRanks(BayerRanks(4), 4, maps[Bayer4x4]);
+				TileRanks(BayerRanks(8), 8, maps[Bayer8x8]);
+				TileRanks(BayerRanks(16), 16, maps[Bayer16x16]);
+				TileRanks(VoidAndCluster().Ranks(), THRESHOLD_MAP_SIZE, maps[BlueNoise64x64]);
+			}
+		};
+
+		inline uint8_t Mask(uint8_t value, uint8_t threshold)
+		{
+			return (uint8_t)(0 - (value > threshold));
+		}
+
+		// Each kernel dithers the leading pixels of a row it can handle whole and returns
+		// how many; thresholds is the map row, which repeats every THRESHOLD_MAP_SIZE pixels.
+		typedef int (*OrderedRowKernel)(uint8_t* row, int w, const uint8_t* thresholds);
+
+#if defined(IG_X86)
+		// v > t for unsigned bytes: not (max(v, t) == t).
+		IG_TARGET_SSE41 inline __m128i Greater(__m128i v, __m128i t)
+		{
+			return _mm_andnot_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, t), t), _mm_set1_epi8(-1));
+		}
+
+		IG_TARGET_SSE41 int RowSSE41Gray(uint8_t* row, int w, const uint8_t* thresholds)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				__m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+				__m128i t = _mm_loadu_si128((const __m128i*)(thresholds + (x & MAP_MASK)));
+				_mm_storeu_si128((__m128i*)(row + x), Greater(v, t));
+			}
+			return x;
+		}
+
+		// Sixteen pixels, three vectors, at a time: channel 0 of each pixel is gathered into
+		// one vector, compared, and the mask spread back over the three channels.
+		IG_TARGET_SSE41 int RowSSE41Rgb(uint8_t* row, int w, const uint8_t* thresholds)
+		{
+			const __m128i fromA = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i fromB = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+			const __m128i fromC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+			const __m128i toA = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+			const __m128i toB = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+			const __m128i toC = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				__m128i* p = (__m128i*)(row + (size_t)x * 3);
+				__m128i a = _mm_loadu_si128(p);
+				__m128i b = _mm_loadu_si128(p + 1);
+				__m128i c = _mm_loadu_si128(p + 2);
+				__m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, fromA), _mm_shuffle_epi8(b, fromB)),
+					_mm_shuffle_epi8(c, fromC));
+				__m128i t = _mm_loadu_si128((const __m128i*)(thresholds + (x & MAP_MASK)));
+				__m128i mask = Greater(v, t);
+				_mm_storeu_si128(p, _mm_shuffle_epi8(mask, toA));
+				_mm_storeu_si128(p + 1, _mm_shuffle_epi8(mask, toB));
+				_mm_storeu_si128(p + 2, _mm_shuffle_epi8(mask, toC));
+			}
+			return x;
+		}
+
+		IG_TARGET_SSE41 int RowSSE41Rgba(uint8_t* row, int w, const uint8_t* thresholds)
+		{
+			const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+			const __m128i expand = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+
+			int x = 0;
+			for (; x + 4 <= w; x += 4) {
+				__m128i* p = (__m128i*)(row + (size_t)x * 4);
+				__m128i v = _mm_shuffle_epi8(_mm_loadu_si128(p), spread);
+				int32_t packed;
+				memcpy(&packed, thresholds + (x & MAP_MASK), sizeof(packed));
+				__m128i t = _mm_shuffle_epi8(_mm_cvtsi32_si128(packed), expand);
+				_mm_storeu_si128(p, Greater(v, t));
+			}
+			return x;
+		}
+
+		IG_TARGET_AVX2 inline __m256i Greater(__m256i v, __m256i t)
+		{
+			return _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, t), t), _mm256_set1_epi8(-1));
+		}
+
+		IG_TARGET_AVX2 int RowAVX2Gray(uint8_t* row, int w, const uint8_t* thresholds)
+		{
+			int x = 0;
+			for (; x + 32 <= w; x += 32) {
+				__m256i v = _mm256_loadu_si256((const __m256i*)(row + x));
+				__m256i t = _mm256_loadu_si256((const __m256i*)(thresholds + (x & MAP_MASK)));
+				_mm256_storeu_si256((__m256i*)(row + x), Greater(v, t));
+			}
+			return x;
+		}
+
+		IG_TARGET_AVX2 int RowAVX2Rgba(uint8_t* row, int w, const uint8_t* thresholds)
+		{
+			const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12,
+				0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+			const __m256i expand = _mm256_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+				4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+
+			int x = 0;
+			for (; x + 8 <= w; x += 8) {
+				__m256i* p = (__m256i*)(row + (size_t)x * 4);
+				__m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256(p), spread);
+				__m128i t8 = _mm_loadl_epi64((const __m128i*)(thresholds + (x & MAP_MASK)));
+				__m256i t = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(t8), expand);
+				_mm256_storeu_si256(p, Greater(v, t));
+			}
+			return x;
+		}
+#elif defined(IG_NEON)
+		int RowNEONGray(uint8_t* row, int w, const uint8_t* thresholds)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16_t v = vld1q_u8(row + x);
+				vst1q_u8(row + x, vcgtq_u8(v, vld1q_u8(thresholds + (x & MAP_MASK))));
+			}
+			return x;
+		}
+
+		int RowNEONRgb(uint8_t* row, int w, const uint8_t* thresholds)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8_t* p = row + (size_t)x * 3;
+				uint8x16x3_t px = vld3q_u8(p);
+				uint8x16_t mask = vcgtq_u8(px.val[0], vld1q_u8(thresholds + (x & MAP_MASK)));
+				px.val[0] = mask;
+				px.val[1] = mask;
+				px.val[2] = mask;
+				vst3q_u8(p, px);
+			}
+			return x;
+		}
+
+		int RowNEONRgba(uint8_t* row, int w, const uint8_t* thresholds)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8_t* p = row + (size_t)x * 4;
+				uint8x16x4_t px = vld4q_u8(p);
+				uint8x16_t mask = vcgtq_u8(px.val[0], vld1q_u8(thresholds + (x & MAP_MASK)));
+				px.val[0] = mask;
+				px.val[1] = mask;
+				px.val[2] = mask;
+				px.val[3] = mask;
+				vst4q_u8(p, px);
+			}
+			return x;
+		}
+#endif
+
+		// RGB rows use the SSE4.1 kernel under AVX2 too: its shuffles do not cross the
+		// 128-bit lanes an AVX2 version would be split into.
+		OrderedRowKernel SelectKernel(int channels)
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdAVX2) {
+				switch (channels) {
+					case 1: return RowAVX2Gray;
+					case 3: return RowSSE41Rgb;
+					case 4: return RowAVX2Rgba;
+				}
+				return nullptr;
+			}
+			if (level >= SimdSSE41) {
+				switch (channels) {
+					case 1: return RowSSE41Gray;
+					case 3: return RowSSE41Rgb;
+					case 4: return RowSSE41Rgba;
+				}
+				return nullptr;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				switch (channels) {
+					case 1: return RowNEONGray;
+					case 3: return RowNEONRgb;
+					case 4: return RowNEONRgba;
+				}
+				return nullptr;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+	}
+
+	const uint8_t* ThresholdMap(OrderedMatrix matrix)
+	{
+		static const ThresholdMaps maps;
+		return maps.maps[matrix];
+	}
+
+	void DitherOrderedRows(uint8_t* data, int w, int h, int channels, size_t stride, int64_t firstRow,
+		OrderedMatrix matrix)
+	{
+		const uint8_t* map = ThresholdMap(matrix);
+		OrderedRowKernel kernel = SelectKernel(channels);
+
+		for (int y = 0; y < h; y++) {
+			uint8_t* row = data + (size_t)y * stride;
+			const uint8_t* thresholds = map + ((firstRow + y) & MAP_MASK) * THRESHOLD_MAP_SIZE;
+
+			int x = kernel ? kernel(row, w, thresholds) : 0;
+			for (uint8_t* px = row + (size_t)x * channels; x < w; x++, px += channels) {
+				uint8_t mask = Mask(px[0], thresholds[x & MAP_MASK]);
+				for (int k = 0; k < channels; k++) {
+					px[k] = mask;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,305 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "PipelineSpec.h"
+#include "Blend.h"
+
+namespace ImageGene {
+	namespace {
+		std::string Trim(const std::string& text)
+		{
+			size_t first = text.find_first_not_of(" \t\r\n");
+			if (first == std::string::npos) {
+				return std::string();
+			}
+			size_t last = text.find_last_not_of(" \t\r\n");
+			return text.substr(first, last - first + 1);
+		}
+
+		std::vector<std::string> Split(const std::string& text, char separator)
+		{
+			std::vector<std::string> parts;
+			size_t start = 0;
+			while (true) {
+				size_t end = text.find(separator, start);
+				parts.push_back(Trim(text.substr(start, end == std::string::npos ? std::string::npos : end - start)));
+				if (end == std::string::npos) {
+					return parts;
+				}
+				start = end + 1;
+			}
+		}
+
+		// Arguments of one operation, with its name for error messages.
+		struct Arguments {
+			const std::string& name;
+			const std::vector<std::string>& values;
+
+			bool Count(size_t least, size_t most) const
+			{
+				if (values.size() < least || values.size() > most) {
+					if (least == most) {
+						printf("%s takes %zu arguments, got %zu\n", name.c_str(), least, values.size());
+					}
+					else {
+						printf("%s takes %zu to %zu arguments, got %zu\n", name.c_str(), least, most, values.size());
+					}
+					return false;
+				}
+				return true;
+			}
+
+			bool Integer(size_t index, long long low, long long high, long long fallback, long long* value) const
+			{
+				if (index >= values.size()) {
+					*value = fallback;
+					return true;
+				}
+				const char* text = values[index].c_str();
+				char* end = nullptr;
+				errno = 0;
+				long long parsed = strtoll(text, &end, 0);
+				if (*text == '\0' || *end != '\0' || errno == ERANGE || parsed < low || parsed > high) {
+					printf("Argument %zu of %s must be an integer from %lld to %lld, got '%s'\n",
+						index + 1, name.c_str(), low, high, text);
+					return false;
+				}
+				*value = parsed;
+				return true;
+			}
+
+			bool Number(size_t index, double* value) const
+			{
+				const char* text = values[index].c_str();
+				char* end = nullptr;
+				*value = strtod(text, &end);
+				if (*text == '\0' || *end != '\0') {
+					printf("Argument %zu of %s must be a number, got '%s'\n", index + 1, name.c_str(), text);
+					return false;
+				}
+				return true;
+			}
+
+			// Index of the argument in names, or fallback when the argument is left out.
+			bool Choice(size_t index, const char* const names[], int count, int fallback, int* value) const
+			{
+				if (index >= values.size()) {
+					*value = fallback;
+					return true;
+				}
+				for (int i = 0; i < count; i++) {
+					if (values[index] == names[i]) {
+						*value = i;
+						return true;
+					}
+				}
+				std::string expected;
+				for (int i = 0; i < count; i++) {
+					expected += (i == 0 ? "" : ", ");
+					expected += names[i];
+				}
+				printf("Argument %zu of %s must be one of %s, got '%s'\n",
+					index + 1, name.c_str(), expected.c_str(), values[index].c_str());
+				return false;
+			}
+		};
+
+		const char* const ORDERED_MATRICES[] = { "bayer2", "bayer4", "bayer8", "bayer16", "bluenoise" };
+		const char* const DIFFUSION_KERNELS[] = { "floyd", "jarvis", "stucki", "atkinson" };
+		const char* const BLEND_MODES[] = { "over", "multiply", "screen", "add" };
+		const char* const RESIZE_FILTERS[] = { "box", "bilinear", "bicubic", "lanczos" };
+
+		std::shared_ptr<const Image> LoadOverlay(const std::string& filename)
+		{
+			std::shared_ptr<Image> image = std::make_shared<Image>(0, 0, 0);
+			if (!image->Read(filename.c_str())) {
+				printf("Failed to read overlay image %s\n", filename.c_str());
+				return nullptr;
+			}
+			image->SetLayout(LayoutInterleaved);
+			return image;
+		}
+	}
+
+	bool PipelineSpec::Parse(const char* spec)
+	{
+		steps.clear();
+		std::vector<Step> parsed;
+
+		for (const std::string& operation : Split(spec, ';')) {
+			if (operation.empty()) {
+				continue;
+			}
+			size_t colon = operation.find(':');
+			std::string name = Trim(operation.substr(0, colon));
+			std::string rest = colon == std::string::npos ? std::string() : operation.substr(colon + 1);
+			std::vector<std::string> values;
+			if (!Trim(rest).empty()) {
+				values = Split(rest, ',');
+			}
+			Arguments args = { name, values };
+			Step step;
+
+			if (name == "grayscale-average" || name == "grayscale-lum" || name == "flip-h" || name == "flip-v") {
+				if (!args.Count(0, 0)) return false;
+				if (name == "grayscale-average") step.lazy = [](LazyImage& lazy) { lazy.GrayscaleAverage(); };
+				else if (name == "grayscale-lum") step.lazy = [](LazyImage& lazy) { lazy.GrayscaleLum(); };
+				else if (name == "flip-h") step.lazy = [](LazyImage& lazy) { lazy.FlipHorizontal(); };
+				else step.lazy = [](LazyImage& lazy) { lazy.FlipVertical(); };
+			}
+			else if (name == "color-mask") {
+				long long r, g, b;
+				if (!args.Count(3, 3) || !args.Integer(0, 0, 255, 0, &r) || !args.Integer(1, 0, 255, 0, &g) ||
+					!args.Integer(2, 0, 255, 0, &b)) return false;
+				step.lazy = [r, g, b](LazyImage& lazy) { lazy.ColorMask((int)r, (int)g, (int)b); };
+			}
+			else if (name == "crop") {
+				long long x, y, w, h;
+				if (!args.Count(4, 4) || !args.Integer(0, 0, UINT16_MAX, 0, &x) || !args.Integer(1, 0, UINT16_MAX, 0, &y) ||
+					!args.Integer(2, 1, UINT16_MAX, 0, &w) || !args.Integer(3, 1, UINT16_MAX, 0, &h)) return false;
+				step.eager = [x, y, w, h](Image* image, const ExecutionPolicy&) {
+					Crop(image, (uint16_t)x, (uint16_t)y, (uint16_t)w, (uint16_t)h);
+				};
+			}
+			else if (name == "resize") {
+				long long w, h;
+				int filter;
+				if (!args.Count(2, 3) || !args.Integer(0, 1, INT32_MAX, 0, &w) || !args.Integer(1, 1, INT32_MAX, 0, &h) ||
+					!args.Choice(2, RESIZE_FILTERS, 4, ResizeLanczos, &filter)) return false;
+				step.eager = [w, h, filter](Image* image, const ExecutionPolicy& policy) {
+					Resize(image, (int)w, (int)h, (ResizeFilter)filter, policy);
+				};
+			}
+			else if (name == "convolve") {
+				long long w, h;
+				if (values.size() < 2 || !args.Integer(0, 1, 255, 0, &w) || !args.Integer(1, 1, 255, 0, &h) ||
+					!args.Count(2 + (size_t)(w * h), 2 + (size_t)(w * h))) {
+					if (values.size() < 2) printf("convolve takes a width, a height and width x height weights\n");
+					return false;
+				}
+				std::vector<double> kernel((size_t)(w * h));
+				for (size_t i = 0; i < kernel.size(); i++) {
+					if (!args.Number(2 + i, &kernel[i])) return false;
+				}
+				step.lazy = [w, h, kernel](LazyImage& lazy) {
+					lazy.Convolve((uint32_t)w, (uint32_t)h, kernel.data(), (uint32_t)h / 2, (uint32_t)w / 2);
+				};
+			}
+			else if (name == "box-blur") {
+				long long radius;
+				if (!args.Count(1, 1) || !args.Integer(0, 1, 127, 0, &radius)) return false;
+				uint32_t size = (uint32_t)(2 * radius + 1);
+				std::vector<double> kernel((size_t)size * size, 1.0 / ((double)size * size));
+				step.lazy = [size, kernel](LazyImage& lazy) {
+					lazy.Convolve(size, size, kernel.data(), size / 2, size / 2);
+				};
+			}
+			else if (name == "dither-threshold") {
+				long long threshold;
+				if (!args.Count(0, 1) || !args.Integer(0, 0, 255, 0x7F, &threshold)) return false;
+				step.lazy = [threshold](LazyImage& lazy) { lazy.DitherThreshold((uint8_t)threshold); };
+			}
+			else if (name == "dither-random") {
+				long long seed;
+				if (!args.Count(0, 1) || !args.Integer(0, 0, INT64_MAX, 1, &seed)) return false;
+				step.lazy = [seed](LazyImage& lazy) { lazy.DitherRandom((uint64_t)seed); };
+			}
+			else if (name == "dither-floyd") {
+				long long serpentine;
+				if (!args.Count(0, 1) || !args.Integer(0, 0, 1, 0, &serpentine)) return false;
+				step.lazy = [serpentine](LazyImage& lazy) { lazy.DitherFloydSteinberg(serpentine != 0); };
+			}
+			else if (name == "dither-ordered") {
+				int matrix;
+				if (!args.Count(0, 1) || !args.Choice(0, ORDERED_MATRICES, 5, Bayer8x8, &matrix)) return false;
+				step.lazy = [matrix](LazyImage& lazy) { lazy.DitherOrdered((OrderedMatrix)matrix); };
+			}
+			else if (name == "dither-diffusion") {
+				int kernel;
+				long long serpentine;
+				if (!args.Count(1, 2) || !args.Choice(0, DIFFUSION_KERNELS, 4, FloydSteinberg, &kernel) ||
+					!args.Integer(1, 0, 1, 0, &serpentine)) return false;
+				step.lazy = [kernel, serpentine](LazyImage& lazy) {
+					lazy.DitherErrorDiffusion((DiffusionKernel)kernel, serpentine != 0);
+				};
+			}
+			else if (name == "overlay" || name == "blend") {
+				long long x, y;
+				int mode;
+				bool blend = name == "blend";
+				if (!args.Count(3, blend ? 4 : 3) || !args.Integer(1, INT32_MIN, INT32_MAX, 0, &x) ||
+					!args.Integer(2, INT32_MIN, INT32_MAX, 0, &y) || !args.Choice(3, BLEND_MODES, 4, BlendOver, &mode)) return false;
+				std::shared_ptr<const Image> source = LoadOverlay(values[0]);
+				if (!source) return false;
+				if (blend) {
+					step.eager = [source, x, y, mode](Image* image, const ExecutionPolicy& policy) {
+						Blend(image, source.get(), (int)x, (int)y, (BlendMode)mode, policy);
+					};
+				}
+				else {
+					step.lazy = [source, x, y](LazyImage& lazy) { lazy.Overlay(ImageView(*source), (int)x, (int)y); };
+				}
+			}
+			else if (name == "text") {
+				// The message is everything after the seventh comma, commas included.
+				size_t start = 0;
+				for (int i = 0; i < 7 && start != std::string::npos; i++) {
+					start = rest.find(',', start);
+					start = start == std::string::npos ? start : start + 1;
+				}
+				if (start == std::string::npos) {
+					printf("text takes a font file, size, x, y, r, g, b and the message\n");
+					return false;
+				}
+				std::vector<std::string> leading(values.begin(), values.begin() + 7);
+				Arguments fields = { name, leading };
+				long long size, x, y, r, g, b;
+				if (!fields.Integer(1, 1, UINT16_MAX, 0, &size) || !fields.Integer(2, INT32_MIN, INT32_MAX, 0, &x) ||
+					!fields.Integer(3, INT32_MIN, INT32_MAX, 0, &y) || !fields.Integer(4, 0, 255, 0, &r) ||
+					!fields.Integer(5, 0, 255, 0, &g) || !fields.Integer(6, 0, 255, 0, &b)) return false;
+				std::shared_ptr<IGFont> font = std::make_shared<IGFont>(leading[0].c_str(), (uint16_t)size);
+				if (font->sft.font == NULL) return false;
+				std::shared_ptr<std::string> message = std::make_shared<std::string>(rest.substr(start));
+				step.lazy = [font, message, x, y, r, g, b](LazyImage& lazy) {
+					lazy.OverlayText(message->c_str(), *font, (int)x, (int)y, (uint8_t)r, (uint8_t)g, (uint8_t)b);
+				};
+			}
+			else {
+				printf("Unknown operation '%s'\n", name.c_str());
+				return false;
+			}
+
+			parsed.push_back(step);
+		}
+
+		steps.swap(parsed);
+		return true;
+	}
+
+	Image& PipelineSpec::Apply(Image* image, const ExecutionPolicy& policy) const
+	{
+		size_t i = 0;
+		while (i < steps.size()) {
+			if (steps[i].eager) {
+				steps[i].eager(image, policy);
+				i++;
+				continue;
+			}
+			ImageView view(*image);
+			LazyImage lazy(view);
+			for (; i < steps.size() && steps[i].lazy; i++) {
+				steps[i].lazy(lazy);
+			}
+			lazy.EvaluateInPlace(policy);
+		}
+		return *image;
+	}
+
+	int PipelineSpec::Operations() const
+	{
+		return (int)steps.size();
+	}
+}
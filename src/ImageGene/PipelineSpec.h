@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Image.h"
+#include "LazyImage.h"
+
+namespace ImageGene {
+	// Sequence of Image.h operations parsed from text such as
+	//   "grayscale-lum; crop:0,0,512,512; dither-ordered:bayer8"
+	// Operations are separated by ';' and take comma-separated arguments after ':'.
+	// Trailing arguments may be left out to get the defaults given here.
+	//   grayscale-average, grayscale-lum, flip-h, flip-v
+	//   color-mask:r,g,b
+	//   crop:x,y,w,h
+	//   resize:w,h[,box|bilinear|bicubic|lanczos=lanczos]
+	//   convolve:w,h,k0,k1,...     w x h kernel, row by row, centered, BorderClamp
+	//   box-blur:radius            (2 radius + 1)^2 box, as a convolution
+	//   dither-threshold[:threshold=127]
+	//   dither-random[:seed=1]
+	//   dither-floyd[:serpentine=0]
+	//   dither-ordered[:bayer2|bayer4|bayer8|bayer16|bluenoise=bayer8]
+	//   dither-diffusion:floyd|jarvis|stucki|atkinson[,serpentine=0]
+	//   overlay:file,x,y
+	//   blend:file,x,y[,over|multiply|screen|add=over]
+	//   text:font.ttf,size,x,y,r,g,b,message   the message is the rest of the operation
+	// Overlay images and fonts are loaded once by Parse and shared by every Apply.
+	//
+	// Apply records each run of operations LazyImage supports into one LazyImage, so
+	// consecutive row-local operations are fused into a single tiled sweep; crop,
+	// resize and blend run eagerly between runs. Apply is const and may be called from
+	// several threads at once on different images.
+	class PipelineSpec {
+	public:
+		// Replaces the operations with those in spec. Prints the first problem and returns
+		// false if the spec does not parse or a file it names cannot be loaded.
+		bool Parse(const char* spec);
+
+		Image& Apply(Image* image, const ExecutionPolicy& policy = Sequential) const;
+
+		int Operations() const;
+
+	private:
+		struct Step {
+			std::function<void(LazyImage& lazy)> lazy;
+			std::function<void(Image* image, const ExecutionPolicy& policy)> eager;
+		};
+
+		std::vector<Step> steps;
+	};
+}
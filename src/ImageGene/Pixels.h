@@ -0,0 +1,344 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+
+#include "Dither.h"
+#include "Grayscale.h"
+#include "Image.h"
+#include "Random.h"
+#include "Stream.h"
+
+namespace ImageGene {
+	// Pointwise operations as functors that compose at compile time:
+	//
+	//   (image | Pixels::GrayscaleLum | Pixels::DitherThreshold(0x7F)).Run(policy);
+	//
+	// `|` only builds a type describing the chain; Run makes a single sweep over the
+	// image, carrying every pixel through the whole chain before moving to the next, with
+	// no virtual calls or std::function in between. The row loop is instantiated for 1, 2,
+	// 3 and 4 channels, so each functor's channel loops become straight-line code the
+	// compiler can inline and vectorize across the chain.
+	//
+	// Every functor produces the same bytes as the eager function of the same name. Before
+	// running, each stage checks the image the way its eager function does and prints the
+	// same message; if any stage rejects the image the chain leaves it untouched.
+	namespace Pixels {
+		// Base of every stage, which is what lets `|` pick them out.
+		struct Stage {};
+
+		// A stage provides Check(image), printing and returning false when the image is not
+		// one it can work on, and Row(y), giving a functor for image row y whose
+		// operator()(px, channels, x) transforms the pixel at column x in place.
+
+		template<GrayscaleMethod Method>
+		struct GrayscaleStage : Stage {
+			bool Check(const ImageView& image) const
+			{
+				if (image.channels >= 3) {
+					return true;
+				}
+				if (Method == GrayscaleMethodLum) {
+					printf("Given image has less than 3 channels. This image has %d channels\n", image.channels);
+				}
+				else {
+					printf("Given image has less than 3 channels\n");
+				}
+				return false;
+			}
+
+			const GrayscaleStage& Row(int64_t) const { return *this; }
+
+			void operator()(uint8_t* px, int, int) const
+			{
+				uint8_t gray = GrayPixel(px, Method);
+				px[0] = gray;
+				px[1] = gray;
+				px[2] = gray;
+			}
+		};
+
+		struct ColorMaskStage : Stage {
+			int r;
+			int g;
+			int b;
+
+			bool Check(const ImageView& image) const
+			{
+				if (image.channels < 3) {
+					printf("Given image has less than 3 channels. This image has %d channels\n", image.channels);
+					return false;
+				}
+				return true;
+			}
+
+			const ColorMaskStage& Row(int64_t) const { return *this; }
+
+			void operator()(uint8_t* px, int, int) const
+			{
+				px[0] *= r;
+				px[1] *= g;
+				px[2] *= b;
+			}
+		};
+
+		// Absolute difference against the matching pixel of another image, over the
+		// columns, rows and channels the two have in common.
+		struct DiffmapStage : Stage {
+			ImageView other;
+
+			struct RowStage {
+				const uint8_t* row;
+				int w;
+				int otherChannels;
+
+				void operator()(uint8_t* px, int channels, int x) const
+				{
+					if (row == nullptr || x >= w) {
+						return;
+					}
+					const uint8_t* q = row + (size_t)x * otherChannels;
+					int common = channels < otherChannels ? channels : otherChannels;
+					for (int k = 0; k < common; k++) {
+						px[k] = (uint8_t)(px[k] > q[k] ? px[k] - q[k] : q[k] - px[k]);
+					}
+				}
+			};
+
+			bool Check(const ImageView&) const { return true; }
+
+			RowStage Row(int64_t y) const
+			{
+				return { y < other.h ? other.Row((int)y) : nullptr, other.w, other.channels };
+			}
+		};
+
+		struct DitherThresholdStage : Stage {
+			uint8_t threshold;
+
+			bool Check(const ImageView&) const { return true; }
+
+			const DitherThresholdStage& Row(int64_t) const { return *this; }
+
+			void operator()(uint8_t* px, int channels, int) const
+			{
+				uint8_t out = px[0] > threshold ? 0xFF : 0x00;
+				for (int k = 0; k < channels; k++) {
+					px[k] = out;
+				}
+			}
+		};
+
+		struct DitherRandomStage : Stage {
+			uint64_t seed;
+
+			struct RowStage {
+				uint64_t seed;
+				uint32_t y;
+
+				void operator()(uint8_t* px, int channels, int x) const
+				{
+					uint8_t randomVal = (uint8_t)(PixelRandom(seed, x, y) >> 56);
+					uint8_t out = randomVal <= px[0] ? 0xFF : 0x00;
+					for (int k = 0; k < channels; k++) {
+						px[k] = out;
+					}
+				}
+			};
+
+			bool Check(const ImageView&) const { return true; }
+
+			RowStage Row(int64_t y) const { return { seed, (uint32_t)y }; }
+		};
+
+		struct DitherOrderedStage : Stage {
+			const uint8_t* map;
+
+			struct RowStage {
+				const uint8_t* thresholds;
+
+				void operator()(uint8_t* px, int channels, int x) const
+				{
+					uint8_t out = (uint8_t)(0 - (px[0] > thresholds[x & (THRESHOLD_MAP_SIZE - 1)]));
+					for (int k = 0; k < channels; k++) {
+						px[k] = out;
+					}
+				}
+			};
+
+			bool Check(const ImageView&) const { return true; }
+
+			RowStage Row(int64_t y) const
+			{
+				return { map + (y & (THRESHOLD_MAP_SIZE - 1)) * THRESHOLD_MAP_SIZE };
+			}
+		};
+
+		// First then Second, pixel by pixel.
+		template<class First, class Second>
+		struct Chain : Stage {
+			First first;
+			Second second;
+
+			template<class FirstRow, class SecondRow>
+			struct RowStage {
+				FirstRow first;
+				SecondRow second;
+
+				void operator()(uint8_t* px, int channels, int x) const
+				{
+					first(px, channels, x);
+					second(px, channels, x);
+				}
+			};
+
+			Chain(const First& first, const Second& second) : first(first), second(second) {}
+
+			bool Check(const ImageView& image) const
+			{
+				bool valid = first.Check(image);
+				return second.Check(image) && valid;
+			}
+
+			auto Row(int64_t y) const
+			{
+				return RowStage<std::decay_t<decltype(first.Row(y))>, std::decay_t<decltype(second.Row(y))>>{
+					first.Row(y), second.Row(y) };
+			}
+		};
+
+		const GrayscaleStage<GrayscaleMethodAverage> GrayscaleAverage = {};
+		const GrayscaleStage<GrayscaleMethodLum> GrayscaleLum = {};
+
+		inline ColorMaskStage ColorMask(int r, int g, int b)
+		{
+			ColorMaskStage stage;
+			stage.r = r;
+			stage.g = g;
+			stage.b = b;
+			return stage;
+		}
+
+		// other must outlive the chain's Run.
+		inline DiffmapStage Diffmap(const ImageView& other)
+		{
+			DiffmapStage stage;
+			stage.other = other;
+			return stage;
+		}
+
+		inline DitherThresholdStage DitherThreshold(uint8_t threshold = 0x7F)
+		{
+			DitherThresholdStage stage;
+			stage.threshold = threshold;
+			return stage;
+		}
+
+		inline DitherRandomStage DitherRandom(uint64_t seed)
+		{
+			DitherRandomStage stage;
+			stage.seed = seed;
+			return stage;
+		}
+
+		inline DitherOrderedStage DitherOrdered(OrderedMatrix matrix = Bayer8x8)
+		{
+			DitherOrderedStage stage;
+			stage.map = ThresholdMap(matrix);
+			return stage;
+		}
+
+		template<class T>
+		using EnableIfStage = std::enable_if_t<std::is_base_of<Stage, T>::value, int>;
+
+		template<int Channels, class S>
+		void RunRows(uint8_t* data, int w, int h, int channels, size_t stride, int64_t firstRow, const S& stage)
+		{
+			const int ch = Channels > 0 ? Channels : channels;
+			for (int y = 0; y < h; y++) {
+				auto row = stage.Row(firstRow + y);
+				uint8_t* px = data + (size_t)y * stride;
+				for (int x = 0; x < w; x++, px += ch) {
+					row(px, ch, x);
+				}
+			}
+		}
+
+		// Runs a stage over rows that start at image row firstRow, without checking the
+		// channel count.
+		template<class S, EnableIfStage<S> = 0>
+		void ApplyRows(uint8_t* data, int w, int h, int channels, size_t stride, int64_t firstRow, const S& stage)
+		{
+			switch (channels) {
+				case 1: RunRows<1>(data, w, h, channels, stride, firstRow, stage); break;
+				case 2: RunRows<2>(data, w, h, channels, stride, firstRow, stage); break;
+				case 3: RunRows<3>(data, w, h, channels, stride, firstRow, stage); break;
+				case 4: RunRows<4>(data, w, h, channels, stride, firstRow, stage); break;
+				default: RunRows<0>(data, w, h, channels, stride, firstRow, stage); break;
+			}
+		}
+
+		template<class S, EnableIfStage<S> = 0>
+		ImageView Apply(const ImageView& image, const S& stage, const ExecutionPolicy& policy = Sequential)
+		{
+			if (stage.Check(image)) {
+				ParallelRows(image.h, image.RowBytes(), policy, [&](int y0, int y1) {
+					ApplyRows(image.Row(y0), image.w, y1 - y0, image.channels, image.stride, y0, stage);
+				});
+			}
+			return image;
+		}
+
+		// The stage as an operation for StripPipeline::Pointwise or LazyImage::Pointwise.
+		// Strips the stage cannot handle are left unchanged, as Apply leaves such images.
+		template<class S, EnableIfStage<S> = 0>
+		StripOperation Strip(const S& stage)
+		{
+			return [stage](uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow) {
+				if (stage.Check(ImageView(data, w, rows, channels, stride))) {
+					ApplyRows(data, w, rows, channels, stride, firstRow, stage);
+				}
+			};
+		}
+
+		// An image and the stages recorded against it; nothing runs until Run.
+		template<class S>
+		class Expression {
+		public:
+			Expression(const ImageView& image, const S& stage) : image(image), stage(stage) {}
+
+			ImageView Run(const ExecutionPolicy& policy = Sequential) const
+			{
+				return Apply(image, stage, policy);
+			}
+
+			const ImageView& View() const { return image; }
+			const S& Stages() const { return stage; }
+
+		private:
+			ImageView image;
+			S stage;
+		};
+
+		template<class First, class Second, EnableIfStage<First> = 0, EnableIfStage<Second> = 0>
+		Chain<First, Second> operator|(const First& first, const Second& second)
+		{
+			return Chain<First, Second>(first, second);
+		}
+
+		// Viewing a non-const Image calls Mutable(), so the chain can write to it.
+		template<class S, EnableIfStage<S> = 0>
+		Expression<S> operator|(const ImageView& image, const S& stage)
+		{
+			return Expression<S>(image, stage);
+		}
+
+		template<class S, class Next, EnableIfStage<Next> = 0>
+		Expression<Chain<S, Next>> operator|(const Expression<S>& expression, const Next& next)
+		{
+			return Expression<Chain<S, Next>>(expression.View(), Chain<S, Next>(expression.Stages(), next));
+		}
+	}
+}
@@ -0,0 +1,352 @@
+#include <cstring>
+#include <vector>
+
+#include "Cpu.h"
+#include "Planar.h"
+
+#if defined(IG_X86)
+#include <immintrin.h>
+#elif defined(IG_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		void DeinterleaveScalar(const uint8_t* src, int x, int w, int channels, uint8_t* const* planes)
+		{
+			for (const uint8_t* px = src + (size_t)x * channels; x < w; x++, px += channels) {
+				for (int c = 0; c < channels; c++) {
+					planes[c][x] = px[c];
+				}
+			}
+		}
+
+		void InterleaveScalar(const uint8_t* const* planes, int x, int w, int channels, uint8_t* dst)
+		{
+			for (uint8_t* px = dst + (size_t)x * channels; x < w; x++, px += channels) {
+				for (int c = 0; c < channels; c++) {
+					px[c] = planes[c][x];
+				}
+			}
+		}
+
+		// Each kernel converts as many leading pixels of a row as it can without reading
+		// or writing past the row, and returns how many it converted; the scalar loop
+		// finishes.
+		typedef int (*DeinterleaveKernel)(const uint8_t* src, int w, uint8_t* const* planes);
+		typedef int (*InterleaveKernel)(const uint8_t* const* planes, int w, uint8_t* dst);
+
+#if defined(IG_X86)
+		// Sixteen pixels per step throughout, so every plane gets one full 16-byte store.
+		IG_TARGET_SSE41 int DeinterleaveSSE41x2(const uint8_t* src, int w, uint8_t* const* planes)
+		{
+			const __m128i split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				const uint8_t* p = src + (size_t)x * 2;
+				__m128i s0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), split);
+				__m128i s1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), split);
+				_mm_storeu_si128((__m128i*)(planes[0] + x), _mm_unpacklo_epi64(s0, s1));
+				_mm_storeu_si128((__m128i*)(planes[1] + x), _mm_unpackhi_epi64(s0, s1));
+			}
+			return x;
+		}
+
+		IG_TARGET_SSE41 int InterleaveSSE41x2(const uint8_t* const* planes, int w, uint8_t* dst)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				__m128i a = _mm_loadu_si128((const __m128i*)(planes[0] + x));
+				__m128i b = _mm_loadu_si128((const __m128i*)(planes[1] + x));
+				uint8_t* p = dst + (size_t)x * 2;
+				_mm_storeu_si128((__m128i*)p, _mm_unpacklo_epi8(a, b));
+				_mm_storeu_si128((__m128i*)(p + 16), _mm_unpackhi_epi8(a, b));
+			}
+			return x;
+		}
+
+		// Each plane collects its bytes from the three loads with one shuffle per load;
+		// lanes a shuffle does not fill are zeroed, so the three results are ORed.
+		IG_TARGET_SSE41 int DeinterleaveSSE41x3(const uint8_t* src, int w, uint8_t* const* planes)
+		{
+			const __m128i r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+			const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+			const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+			const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+			const __m128i b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+			const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				const uint8_t* p = src + (size_t)x * 3;
+				__m128i v0 = _mm_loadu_si128((const __m128i*)p);
+				__m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+				__m128i v2 = _mm_loadu_si128((const __m128i*)(p + 32));
+
+				__m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, r0), _mm_shuffle_epi8(v1, r1)),
+					_mm_shuffle_epi8(v2, r2));
+				__m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, g0), _mm_shuffle_epi8(v1, g1)),
+					_mm_shuffle_epi8(v2, g2));
+				__m128i b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, b0), _mm_shuffle_epi8(v1, b1)),
+					_mm_shuffle_epi8(v2, b2));
+
+				_mm_storeu_si128((__m128i*)(planes[0] + x), r);
+				_mm_storeu_si128((__m128i*)(planes[1] + x), g);
+				_mm_storeu_si128((__m128i*)(planes[2] + x), b);
+			}
+			return x;
+		}
+
+		// The reverse: each 16-byte output block is built from one shuffle per plane.
+		IG_TARGET_SSE41 int InterleaveSSE41x3(const uint8_t* const* planes, int w, uint8_t* dst)
+		{
+			const __m128i r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+			const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+			const __m128i b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+			const __m128i r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+			const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+			const __m128i b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+			const __m128i r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+			const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+			const __m128i b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				__m128i r = _mm_loadu_si128((const __m128i*)(planes[0] + x));
+				__m128i g = _mm_loadu_si128((const __m128i*)(planes[1] + x));
+				__m128i b = _mm_loadu_si128((const __m128i*)(planes[2] + x));
+				uint8_t* p = dst + (size_t)x * 3;
+
+				_mm_storeu_si128((__m128i*)p, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r0),
+					_mm_shuffle_epi8(g, g0)), _mm_shuffle_epi8(b, b0)));
+				_mm_storeu_si128((__m128i*)(p + 16), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r1),
+					_mm_shuffle_epi8(g, g1)), _mm_shuffle_epi8(b, b1)));
+				_mm_storeu_si128((__m128i*)(p + 32), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r2),
+					_mm_shuffle_epi8(g, g2)), _mm_shuffle_epi8(b, b2)));
+			}
+			return x;
+		}
+
+		// Each load of four pixels is shuffled into four 32-bit lanes of one channel each,
+		// then the four loads are transposed as a 4 x 4 matrix of lanes.
+		IG_TARGET_SSE41 int DeinterleaveSSE41x4(const uint8_t* src, int w, uint8_t* const* planes)
+		{
+			const __m128i group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				const uint8_t* p = src + (size_t)x * 4;
+				__m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), group);
+				__m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), group);
+				__m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), group);
+				__m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), group);
+
+				__m128i t0 = _mm_unpacklo_epi32(v0, v1);
+				__m128i t1 = _mm_unpackhi_epi32(v0, v1);
+				__m128i t2 = _mm_unpacklo_epi32(v2, v3);
+				__m128i t3 = _mm_unpackhi_epi32(v2, v3);
+
+				_mm_storeu_si128((__m128i*)(planes[0] + x), _mm_unpacklo_epi64(t0, t2));
+				_mm_storeu_si128((__m128i*)(planes[1] + x), _mm_unpackhi_epi64(t0, t2));
+				_mm_storeu_si128((__m128i*)(planes[2] + x), _mm_unpacklo_epi64(t1, t3));
+				_mm_storeu_si128((__m128i*)(planes[3] + x), _mm_unpackhi_epi64(t1, t3));
+			}
+			return x;
+		}
+
+		IG_TARGET_SSE41 int InterleaveSSE41x4(const uint8_t* const* planes, int w, uint8_t* dst)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				__m128i r = _mm_loadu_si128((const __m128i*)(planes[0] + x));
+				__m128i g = _mm_loadu_si128((const __m128i*)(planes[1] + x));
+				__m128i b = _mm_loadu_si128((const __m128i*)(planes[2] + x));
+				__m128i a = _mm_loadu_si128((const __m128i*)(planes[3] + x));
+
+				__m128i rgLo = _mm_unpacklo_epi8(r, g);
+				__m128i rgHi = _mm_unpackhi_epi8(r, g);
+				__m128i baLo = _mm_unpacklo_epi8(b, a);
+				__m128i baHi = _mm_unpackhi_epi8(b, a);
+
+				uint8_t* p = dst + (size_t)x * 4;
+				_mm_storeu_si128((__m128i*)p, _mm_unpacklo_epi16(rgLo, baLo));
+				_mm_storeu_si128((__m128i*)(p + 16), _mm_unpackhi_epi16(rgLo, baLo));
+				_mm_storeu_si128((__m128i*)(p + 32), _mm_unpacklo_epi16(rgHi, baHi));
+				_mm_storeu_si128((__m128i*)(p + 48), _mm_unpackhi_epi16(rgHi, baHi));
+			}
+			return x;
+		}
+#elif defined(IG_NEON)
+		int DeinterleaveNEONx2(const uint8_t* src, int w, uint8_t* const* planes)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16x2_t px = vld2q_u8(src + (size_t)x * 2);
+				vst1q_u8(planes[0] + x, px.val[0]);
+				vst1q_u8(planes[1] + x, px.val[1]);
+			}
+			return x;
+		}
+
+		int InterleaveNEONx2(const uint8_t* const* planes, int w, uint8_t* dst)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16x2_t px;
+				px.val[0] = vld1q_u8(planes[0] + x);
+				px.val[1] = vld1q_u8(planes[1] + x);
+				vst2q_u8(dst + (size_t)x * 2, px);
+			}
+			return x;
+		}
+
+		int DeinterleaveNEONx3(const uint8_t* src, int w, uint8_t* const* planes)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16x3_t px = vld3q_u8(src + (size_t)x * 3);
+				vst1q_u8(planes[0] + x, px.val[0]);
+				vst1q_u8(planes[1] + x, px.val[1]);
+				vst1q_u8(planes[2] + x, px.val[2]);
+			}
+			return x;
+		}
+
+		int InterleaveNEONx3(const uint8_t* const* planes, int w, uint8_t* dst)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16x3_t px;
+				px.val[0] = vld1q_u8(planes[0] + x);
+				px.val[1] = vld1q_u8(planes[1] + x);
+				px.val[2] = vld1q_u8(planes[2] + x);
+				vst3q_u8(dst + (size_t)x * 3, px);
+			}
+			return x;
+		}
+
+		int DeinterleaveNEONx4(const uint8_t* src, int w, uint8_t* const* planes)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16x4_t px = vld4q_u8(src + (size_t)x * 4);
+				vst1q_u8(planes[0] + x, px.val[0]);
+				vst1q_u8(planes[1] + x, px.val[1]);
+				vst1q_u8(planes[2] + x, px.val[2]);
+				vst1q_u8(planes[3] + x, px.val[3]);
+			}
+			return x;
+		}
+
+		int InterleaveNEONx4(const uint8_t* const* planes, int w, uint8_t* dst)
+		{
+			int x = 0;
+			for (; x + 16 <= w; x += 16) {
+				uint8x16x4_t px;
+				px.val[0] = vld1q_u8(planes[0] + x);
+				px.val[1] = vld1q_u8(planes[1] + x);
+				px.val[2] = vld1q_u8(planes[2] + x);
+				px.val[3] = vld1q_u8(planes[3] + x);
+				vst4q_u8(dst + (size_t)x * 4, px);
+			}
+			return x;
+		}
+#endif
+
+		DeinterleaveKernel SelectDeinterleave(int channels)
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				switch (channels) {
+					case 2: return DeinterleaveSSE41x2;
+					case 3: return DeinterleaveSSE41x3;
+					case 4: return DeinterleaveSSE41x4;
+				}
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				switch (channels) {
+					case 2: return DeinterleaveNEONx2;
+					case 3: return DeinterleaveNEONx3;
+					case 4: return DeinterleaveNEONx4;
+				}
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		InterleaveKernel SelectInterleave(int channels)
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				switch (channels) {
+					case 2: return InterleaveSSE41x2;
+					case 3: return InterleaveSSE41x3;
+					case 4: return InterleaveSSE41x4;
+				}
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				switch (channels) {
+					case 2: return InterleaveNEONx2;
+					case 3: return InterleaveNEONx3;
+					case 4: return InterleaveNEONx4;
+				}
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+	}
+
+	void DeinterleaveRows(const uint8_t* src, size_t srcStride, int w, int h, int channels,
+		uint8_t* planes, size_t planeStride, size_t planeRowStride)
+	{
+		if (channels == 1) {
+			for (int y = 0; y < h; y++) {
+				memcpy(planes + (size_t)y * planeRowStride, src + (size_t)y * srcStride, w);
+			}
+			return;
+		}
+
+		DeinterleaveKernel kernel = SelectDeinterleave(channels);
+		std::vector<uint8_t*> rows(channels);
+		for (int y = 0; y < h; y++) {
+			for (int c = 0; c < channels; c++) {
+				rows[c] = planes + c * planeStride + (size_t)y * planeRowStride;
+			}
+			const uint8_t* row = src + (size_t)y * srcStride;
+			int x = kernel ? kernel(row, w, rows.data()) : 0;
+			DeinterleaveScalar(row, x, w, channels, rows.data());
+		}
+	}
+
+	void InterleaveRows(const uint8_t* planes, size_t planeStride, size_t planeRowStride, int w, int h, int channels,
+		uint8_t* dst, size_t dstStride)
+	{
+		if (channels == 1) {
+			for (int y = 0; y < h; y++) {
+				memcpy(dst + (size_t)y * dstStride, planes + (size_t)y * planeRowStride, w);
+			}
+			return;
+		}
+
+		InterleaveKernel kernel = SelectInterleave(channels);
+		std::vector<const uint8_t*> rows(channels);
+		for (int y = 0; y < h; y++) {
+			for (int c = 0; c < channels; c++) {
+				rows[c] = planes + c * planeStride + (size_t)y * planeRowStride;
+			}
+			uint8_t* row = dst + (size_t)y * dstStride;
+			int x = kernel ? kernel(rows.data(), w, row) : 0;
+			InterleaveScalar(rows.data(), x, w, channels, row);
+		}
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageGene {
+	// Conversions between interleaved pixels (RGBRGB...) and planes, one per channel
+	// (RRR... GGG... BBB...). Plane c starts planeStride bytes after plane c - 1, and
+	// rows within a plane are planeRowStride bytes apart. 2, 3 and 4 channel rows use
+	// SIMD shuffles (SSE4.1 or NEON), anything else a scalar loop; every path writes the
+	// same bytes.
+	void DeinterleaveRows(const uint8_t* src, size_t srcStride, int w, int h, int channels,
+		uint8_t* planes, size_t planeStride, size_t planeRowStride);
+	void InterleaveRows(const uint8_t* planes, size_t planeStride, size_t planeRowStride, int w, int h, int channels,
+		uint8_t* dst, size_t dstStride);
+}
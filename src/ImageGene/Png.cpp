@@ -0,0 +1,556 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+#include <zlib.h>
+
+#include "Png.h"
+#include "Cpu.h"
+
+#if defined(IG_X86)
+#include <immintrin.h>
+#elif defined(IG_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		// Strips much smaller than this lose ratio to the flush at each end; much larger
+		// ones leave threads idle on small images.
+		const size_t PNG_STRIP_BYTES = 256 * 1024;
+		const size_t DEFLATE_WINDOW = 32 * 1024;
+
+		const uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+		inline uint8_t Paeth(int a, int b, int c)
+		{
+			int p = a + b - c;
+			int pa = abs(p - a);
+			int pb = abs(p - b);
+			int pc = abs(p - c);
+			if (pa <= pb && pa <= pc) return (uint8_t)a;
+			if (pb <= pc) return (uint8_t)b;
+			return (uint8_t)c;
+		}
+
+		// Predicted value of a byte from a, the byte bpp to its left, b, the byte above,
+		// and c, the byte above a.
+		template <PngFilter Filter>
+		inline uint8_t Predict(int a, int b, int c)
+		{
+			if (Filter == PngFilterSub) return (uint8_t)a;
+			if (Filter == PngFilterUp) return (uint8_t)b;
+			if (Filter == PngFilterAverage) return (uint8_t)((a + b) >> 1);
+			if (Filter == PngFilterPaeth) return Paeth(a, b, c);
+			return 0;
+		}
+
+		// Filters bytes [from, to) of a row into dst; bytes in the first pixel have zeros
+		// to their left.
+		template <PngFilter Filter>
+		void FilterBytes(const uint8_t* row, const uint8_t* prev, size_t from, size_t to, size_t bpp, uint8_t* dst)
+		{
+			size_t i = from;
+			for (; i < to && i < bpp; i++) {
+				dst[i] = (uint8_t)(row[i] - Predict<Filter>(0, prev[i], 0));
+			}
+			for (; i < to; i++) {
+				dst[i] = (uint8_t)(row[i] - Predict<Filter>(row[i - bpp], prev[i], prev[i - bpp]));
+			}
+		}
+
+		inline uint64_t SignedMagnitude(int residual)
+		{
+			return (uint64_t)abs((int)(int8_t)residual);
+		}
+
+		// Adds the sum of absolute values, taken as signed bytes, of bytes [from, to) of the
+		// row under each filter to sums[filter].
+		void SumBytes(const uint8_t* row, const uint8_t* prev, size_t from, size_t to, size_t bpp, uint64_t sums[5])
+		{
+			for (size_t i = from; i < to; i++) {
+				int a = i >= bpp ? row[i - bpp] : 0;
+				int c = i >= bpp ? prev[i - bpp] : 0;
+				int x = row[i];
+				int b = prev[i];
+				sums[PngFilterNone] += SignedMagnitude(x);
+				sums[PngFilterSub] += SignedMagnitude(x - Predict<PngFilterSub>(a, b, c));
+				sums[PngFilterUp] += SignedMagnitude(x - Predict<PngFilterUp>(a, b, c));
+				sums[PngFilterAverage] += SignedMagnitude(x - Predict<PngFilterAverage>(a, b, c));
+				sums[PngFilterPaeth] += SignedMagnitude(x - Predict<PngFilterPaeth>(a, b, c));
+			}
+		}
+
+		// Kernels start at byte bpp, where every neighbour is inside the row, and return the
+		// first byte they did not handle; the scalar loops finish the row. Encoding reads
+		// only unfiltered rows, so unlike decoding there is no chain from byte to byte.
+		typedef size_t(*FilterKernel)(const uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t bpp, uint8_t* dst);
+		typedef size_t(*SumsKernel)(const uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t bpp, uint64_t sums[5]);
+
+#if defined(IG_X86)
+		IG_TARGET_SSE41 inline __m128i Paeth16SSE41(__m128i a, __m128i b, __m128i c)
+		{
+			__m128i pa = _mm_abs_epi16(_mm_sub_epi16(b, c));
+			__m128i pb = _mm_abs_epi16(_mm_sub_epi16(a, c));
+			__m128i pc = _mm_abs_epi16(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+			__m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+			__m128i bc = _mm_blendv_epi8(b, c, _mm_cmpgt_epi16(pb, pc));
+			return _mm_blendv_epi8(a, bc, notA);
+		}
+
+		// Prediction for 16 bytes; a, b and c as in Predict.
+		template <PngFilter Filter>
+		IG_TARGET_SSE41 inline __m128i PredictSSE41(__m128i a, __m128i b, __m128i c)
+		{
+			if (Filter == PngFilterSub) return a;
+			if (Filter == PngFilterUp) return b;
+			if (Filter == PngFilterAverage) {
+				// pavgb rounds up; take back the 1 it adds when a + b is odd.
+				return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			}
+			__m128i zero = _mm_setzero_si128();
+			__m128i lo = Paeth16SSE41(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+			__m128i hi = Paeth16SSE41(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+			return _mm_packus_epi16(lo, hi);
+		}
+
+		template <PngFilter Filter>
+		IG_TARGET_SSE41 size_t FilterSSE41(const uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t bpp, uint8_t* dst)
+		{
+			size_t i = bpp;
+			for (; i + 16 <= rowBytes; i += 16) {
+				__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+				__m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+				__m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+				__m128i c = _mm_loadu_si128((const __m128i*)(prev + i - bpp));
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_sub_epi8(x, PredictSSE41<Filter>(a, b, c)));
+			}
+			return i;
+		}
+
+		IG_TARGET_SSE41 inline __m128i AddMagnitudesSSE41(__m128i sum, __m128i residual)
+		{
+			return _mm_add_epi64(sum, _mm_sad_epu8(_mm_abs_epi8(residual), _mm_setzero_si128()));
+		}
+
+		IG_TARGET_SSE41 size_t SumsSSE41(const uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t bpp, uint64_t sums[5])
+		{
+			__m128i total[5];
+			for (int f = 0; f < 5; f++) {
+				total[f] = _mm_setzero_si128();
+			}
+			size_t i = bpp;
+			for (; i + 16 <= rowBytes; i += 16) {
+				__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+				__m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+				__m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+				__m128i c = _mm_loadu_si128((const __m128i*)(prev + i - bpp));
+				total[PngFilterNone] = AddMagnitudesSSE41(total[PngFilterNone], x);
+				total[PngFilterSub] = AddMagnitudesSSE41(total[PngFilterSub], _mm_sub_epi8(x, a));
+				total[PngFilterUp] = AddMagnitudesSSE41(total[PngFilterUp], _mm_sub_epi8(x, b));
+				total[PngFilterAverage] = AddMagnitudesSSE41(total[PngFilterAverage],
+					_mm_sub_epi8(x, PredictSSE41<PngFilterAverage>(a, b, c)));
+				total[PngFilterPaeth] = AddMagnitudesSSE41(total[PngFilterPaeth],
+					_mm_sub_epi8(x, PredictSSE41<PngFilterPaeth>(a, b, c)));
+			}
+			for (int f = 0; f < 5; f++) {
+				uint64_t lanes[2];
+				_mm_storeu_si128((__m128i*)lanes, total[f]);
+				sums[f] += lanes[0] + lanes[1];
+			}
+			return i;
+		}
+#elif defined(IG_NEON)
+		template <PngFilter Filter>
+		inline uint8x16_t PredictNEON(uint8x16_t a, uint8x16_t b, uint8x16_t c)
+		{
+			if (Filter == PngFilterSub) return a;
+			if (Filter == PngFilterUp) return b;
+			if (Filter == PngFilterAverage) return vhaddq_u8(a, b);
+			// pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|, the last in 16 bits.
+			uint8x16_t pa = vabdq_u8(b, c);
+			uint8x16_t pb = vabdq_u8(a, c);
+			int16x8_t lo = vabsq_s16(vreinterpretq_s16_u16(vsubq_u16(vaddl_u8(vget_low_u8(a), vget_low_u8(b)),
+				vshll_n_u8(vget_low_u8(c), 1))));
+			int16x8_t hi = vabsq_s16(vreinterpretq_s16_u16(vsubq_u16(vaddl_u8(vget_high_u8(a), vget_high_u8(b)),
+				vshll_n_u8(vget_high_u8(c), 1))));
+			uint8x16_t pc = vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi));
+			uint8x16_t notA = vorrq_u8(vcgtq_u8(pa, pb), vcgtq_u8(pa, pc));
+			uint8x16_t bc = vbslq_u8(vcgtq_u8(pb, pc), c, b);
+			return vbslq_u8(notA, bc, a);
+		}
+
+		template <PngFilter Filter>
+		size_t FilterNEON(const uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t bpp, uint8_t* dst)
+		{
+			size_t i = bpp;
+			for (; i + 16 <= rowBytes; i += 16) {
+				uint8x16_t x = vld1q_u8(row + i);
+				uint8x16_t a = vld1q_u8(row + i - bpp);
+				uint8x16_t b = vld1q_u8(prev + i);
+				uint8x16_t c = vld1q_u8(prev + i - bpp);
+				vst1q_u8(dst + i, vsubq_u8(x, PredictNEON<Filter>(a, b, c)));
+			}
+			return i;
+		}
+
+		inline uint32x4_t AddMagnitudesNEON(uint32x4_t sum, uint8x16_t residual)
+		{
+			uint8x16_t magnitude = vreinterpretq_u8_s8(vabsq_s8(vreinterpretq_s8_u8(residual)));
+			return vpadalq_u16(sum, vpaddlq_u8(magnitude));
+		}
+
+		size_t SumsNEON(const uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t bpp, uint64_t sums[5])
+		{
+			uint32x4_t total[5];
+			for (int f = 0; f < 5; f++) {
+				total[f] = vdupq_n_u32(0);
+			}
+			size_t i = bpp;
+			for (; i + 16 <= rowBytes; i += 16) {
+				uint8x16_t x = vld1q_u8(row + i);
+				uint8x16_t a = vld1q_u8(row + i - bpp);
+				uint8x16_t b = vld1q_u8(prev + i);
+				uint8x16_t c = vld1q_u8(prev + i - bpp);
+				total[PngFilterNone] = AddMagnitudesNEON(total[PngFilterNone], x);
+				total[PngFilterSub] = AddMagnitudesNEON(total[PngFilterSub], vsubq_u8(x, a));
+				total[PngFilterUp] = AddMagnitudesNEON(total[PngFilterUp], vsubq_u8(x, b));
+				total[PngFilterAverage] = AddMagnitudesNEON(total[PngFilterAverage],
+					vsubq_u8(x, PredictNEON<PngFilterAverage>(a, b, c)));
+				total[PngFilterPaeth] = AddMagnitudesNEON(total[PngFilterPaeth],
+					vsubq_u8(x, PredictNEON<PngFilterPaeth>(a, b, c)));
+			}
+			for (int f = 0; f < 5; f++) {
+				uint64x2_t wide = vpaddlq_u32(total[f]);
+				sums[f] += vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1);
+			}
+			return i;
+		}
+#endif
+
+		// Kernels for the filters, indexed by PngFilter (None is a memcpy), and for the
+		// adaptive choice; null where only the scalar loops apply.
+		struct PngKernels {
+			FilterKernel filter[5];
+			SumsKernel sums;
+		};
+
+		PngKernels SelectPngKernels()
+		{
+			PngKernels kernels = {};
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				kernels.filter[PngFilterSub] = FilterSSE41<PngFilterSub>;
+				kernels.filter[PngFilterUp] = FilterSSE41<PngFilterUp>;
+				kernels.filter[PngFilterAverage] = FilterSSE41<PngFilterAverage>;
+				kernels.filter[PngFilterPaeth] = FilterSSE41<PngFilterPaeth>;
+				kernels.sums = SumsSSE41;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				kernels.filter[PngFilterSub] = FilterNEON<PngFilterSub>;
+				kernels.filter[PngFilterUp] = FilterNEON<PngFilterUp>;
+				kernels.filter[PngFilterAverage] = FilterNEON<PngFilterAverage>;
+				kernels.filter[PngFilterPaeth] = FilterNEON<PngFilterPaeth>;
+				kernels.sums = SumsNEON;
+			}
+#endif
+			(void)level;
+			return kernels;
+		}
+
+		template <PngFilter Filter>
+		void FilterWith(const uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t bpp, FilterKernel kernel, uint8_t* dst)
+		{
+			size_t i = std::min(bpp, rowBytes);
+			FilterBytes<Filter>(row, prev, 0, i, bpp, dst);
+			if (kernel != nullptr && rowBytes > bpp) {
+				i = kernel(row, prev, rowBytes, bpp, dst);
+			}
+			FilterBytes<Filter>(row, prev, i, rowBytes, bpp, dst);
+		}
+
+		// Writes the filter type and the filtered bytes of one row to out; prev is the row
+		// above, all zeros for the first row, and bpp the bytes per pixel. Adaptive
+		// filtering takes the filter with the smallest signed sum, the first of them on
+		// a tie.
+		void FilterRow(const uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t bpp, PngFilter filter,
+			const PngKernels& kernels, uint8_t* out)
+		{
+			if (filter == PngFilterAdaptive) {
+				uint64_t sums[5] = {};
+				size_t i = std::min(bpp, rowBytes);
+				SumBytes(row, prev, 0, i, bpp, sums);
+				if (kernels.sums != nullptr && rowBytes > bpp) {
+					i = kernels.sums(row, prev, rowBytes, bpp, sums);
+				}
+				SumBytes(row, prev, i, rowBytes, bpp, sums);
+				filter = PngFilterNone;
+				for (int f = PngFilterSub; f <= PngFilterPaeth; f++) {
+					if (sums[f] < sums[filter]) {
+						filter = (PngFilter)f;
+					}
+				}
+			}
+
+			out[0] = (uint8_t)filter;
+			uint8_t* dst = out + 1;
+			switch (filter) {
+			case PngFilterSub:
+				FilterWith<PngFilterSub>(row, prev, rowBytes, bpp, kernels.filter[PngFilterSub], dst);
+				break;
+			case PngFilterUp:
+				FilterWith<PngFilterUp>(row, prev, rowBytes, bpp, kernels.filter[PngFilterUp], dst);
+				break;
+			case PngFilterAverage:
+				FilterWith<PngFilterAverage>(row, prev, rowBytes, bpp, kernels.filter[PngFilterAverage], dst);
+				break;
+			case PngFilterPaeth:
+				FilterWith<PngFilterPaeth>(row, prev, rowBytes, bpp, kernels.filter[PngFilterPaeth], dst);
+				break;
+			default:
+				memcpy(dst, row, rowBytes);
+				break;
+			}
+		}
+
+		void Put32(uint8_t* out, uint32_t v)
+		{
+			out[0] = (uint8_t)(v >> 24);
+			out[1] = (uint8_t)(v >> 16);
+			out[2] = (uint8_t)(v >> 8);
+			out[3] = (uint8_t)v;
+		}
+
+		// One IDAT chunk per strip, type included, with its CRC: the zlib header goes in
+		// front of the first strip and the Adler-32 of all filtered bytes after the last.
+		struct PngStrip {
+			std::vector<uint8_t> chunk;
+			uint32_t crc;
+			uint32_t adler;
+			size_t length;
+		};
+
+		typedef PngEncoder::Sink PngSink;
+
+		// typeAndData is the 4-byte chunk type followed by size bytes of data.
+		bool WriteChunk(const PngSink& sink, const uint8_t* typeAndData, size_t size, uint32_t crc)
+		{
+			uint8_t length[4];
+			uint8_t footer[4];
+			Put32(length, (uint32_t)size);
+			Put32(footer, crc);
+			return sink(length, 4) && sink(typeAndData, 4 + size) && sink(footer, 4);
+		}
+
+		bool WriteChunk(const PngSink& sink, const char* type, const uint8_t* data, size_t size)
+		{
+			std::vector<uint8_t> chunk(4 + size);
+			memcpy(chunk.data(), type, 4);
+			if (size > 0) {
+				memcpy(chunk.data() + 4, data, size);
+			}
+			return WriteChunk(sink, chunk.data(), size, (uint32_t)crc32(0, chunk.data(), (uInt)chunk.size()));
+		}
+	}
+
+	PngEncoder::PngEncoder(int w, int h, int channels, const PngOptions& options, Sink sink)
+		: w(w), h(h), channels(channels), options(options), sink(sink)
+	{
+	}
+
+	bool PngEncoder::Begin()
+	{
+		static const uint8_t COLOR_TYPES[] = { 0, 0, 4, 2, 6 };
+		if (channels < 1 || channels > 4) {
+			printf("PNG holds 1 to 4 channels. This image has %d channels\n", channels);
+			return false;
+		}
+		if (options.filter < PngFilterNone || options.filter > PngFilterAdaptive) {
+			printf("Unknown PNG filter %d\n", (int)options.filter);
+			return false;
+		}
+		if (options.level < 0 || options.level > 9) {
+			printf("PNG compression level must be 0 to 9, got %d\n", options.level);
+			return false;
+		}
+		if (w <= 0 || h <= 0) {
+			printf("Cannot write an empty PNG\n");
+			return false;
+		}
+
+		rowBytes = (size_t)w * channels;
+		filteredBytes = rowBytes + 1;
+		rowsPerStrip = (int)std::max<size_t>(1, PNG_STRIP_BYTES / filteredBytes);
+		previous.assign(rowBytes, 0);
+
+		uint8_t header[13];
+		Put32(header, (uint32_t)w);
+		Put32(header + 4, (uint32_t)h);
+		header[8] = 8;
+		header[9] = COLOR_TYPES[channels];
+		header[10] = 0;
+		header[11] = 0;
+		header[12] = 0;
+		return sink(PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) && WriteChunk(sink, "IHDR", header, sizeof(header));
+	}
+
+	bool PngEncoder::EncodeRows(const uint8_t* data, size_t stride, int rows)
+	{
+		if (rows <= 0) {
+			return true;
+		}
+		if (rows > h - encoded) {
+			printf("PNG is %d rows tall; %d rows were given\n", h, encoded + rows);
+			return false;
+		}
+
+		size_t end = filtered.size();
+		filtered.resize(end + (size_t)rows * filteredBytes);
+		uint8_t* out = filtered.data() + end;
+		PngKernels kernels = SelectPngKernels();
+		ParallelRows(rows, filteredBytes, options.policy, [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				const uint8_t* prev = y == 0 ? previous.data() : data + (size_t)(y - 1) * stride;
+				FilterRow(data + (size_t)y * stride, prev, rowBytes, (size_t)channels, options.filter, kernels,
+					out + (size_t)y * filteredBytes);
+			}
+		});
+		memcpy(previous.data(), data + (size_t)(rows - 1) * stride, rowBytes);
+		encoded += rows;
+
+		// Whole strips are compressed now, and the last, short one once the final row is in.
+		size_t stripBytes = (size_t)rowsPerStrip * filteredBytes;
+		bool lastRows = encoded == h;
+		size_t pending = filtered.size() - window;
+		int stripCount = (int)((pending + (lastRows ? stripBytes - 1 : 0)) / stripBytes);
+		if (stripCount == 0) {
+			return true;
+		}
+
+		std::vector<PngStrip> strips(stripCount);
+		std::atomic<bool> ok(true);
+		ThreadPool& pool = ThreadPool::Shared();
+		pool.ParallelFor(0, stripCount, 1, pool.Concurrency(options.policy), [&](int first, int last) {
+			for (int s = first; s < last; s++) {
+				size_t start = window + (size_t)s * stripBytes;
+				size_t length = std::min(filtered.size() - start, stripBytes);
+				bool firstStrip = written == 0 && s == 0;
+				bool lastStrip = lastRows && s == stripCount - 1;
+				PngStrip& strip = strips[s];
+
+				z_stream z = {};
+				if (deflateInit2(&z, options.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+					ok = false;
+					return;
+				}
+				// The window in front of the pending rows holds the end of the strips already
+				// written, so every strip but the first is primed with the 32 KB before it.
+				if (start > 0 && options.level > 0) {
+					size_t dictionary = std::min(start, DEFLATE_WINDOW);
+					deflateSetDictionary(&z, filtered.data() + start - dictionary, (uInt)dictionary);
+				}
+
+				// Chunk type, and the zlib header in the first strip; a sync flush adds at
+				// most a few bytes to the deflateBound of the strip.
+				size_t prefix = 4 + (firstStrip ? 2 : 0);
+				strip.chunk.resize(prefix + deflateBound(&z, (uLong)length) + 16);
+				memcpy(strip.chunk.data(), "IDAT", 4);
+				if (firstStrip) {
+					// FLEVEL as zlib sets it, then FCHECK to make the header a multiple of 31.
+					int level = options.level < 2 ? 0 : options.level < 6 ? 1 : options.level == 6 ? 2 : 3;
+					uint8_t cmf = 0x78;
+					uint8_t flg = (uint8_t)(level << 6);
+					flg = (uint8_t)(flg + 31 - (cmf * 256 + flg) % 31);
+					strip.chunk[4] = cmf;
+					strip.chunk[5] = flg;
+				}
+
+				z.next_in = filtered.data() + start;
+				z.avail_in = (uInt)length;
+				z.next_out = strip.chunk.data() + prefix;
+				z.avail_out = (uInt)(strip.chunk.size() - prefix);
+				int result = deflate(&z, lastStrip ? Z_FINISH : Z_SYNC_FLUSH);
+				if (result != (lastStrip ? Z_STREAM_END : Z_OK) || z.avail_in != 0 || z.avail_out == 0) {
+					ok = false;
+				}
+				strip.chunk.resize(prefix + z.total_out);
+				deflateEnd(&z);
+
+				strip.crc = (uint32_t)crc32(0, strip.chunk.data(), (uInt)strip.chunk.size());
+				strip.adler = (uint32_t)adler32(1, filtered.data() + start, (uInt)length);
+				strip.length = length;
+			}
+		});
+		if (!ok) {
+			printf("Failed to compress PNG data\n");
+			return false;
+		}
+
+		size_t consumed = window;
+		for (int s = 0; s < stripCount; s++) {
+			adler = (uint32_t)adler32_combine(adler, strips[s].adler, (z_off_t)strips[s].length);
+			consumed += strips[s].length;
+		}
+		if (lastRows) {
+			PngStrip& last = strips.back();
+			last.chunk.resize(last.chunk.size() + 4);
+			Put32(last.chunk.data() + last.chunk.size() - 4, adler);
+			last.crc = (uint32_t)crc32(last.crc, last.chunk.data() + last.chunk.size() - 4, 4);
+		}
+		for (const PngStrip& strip : strips) {
+			if (!WriteChunk(sink, strip.chunk.data(), strip.chunk.size() - 4, strip.crc)) {
+				return false;
+			}
+		}
+		written += stripCount;
+
+		// Keep the last 32 KB written as the next strip's dictionary, then the rows of the
+		// strip not yet complete.
+		size_t keep = std::min(consumed, DEFLATE_WINDOW);
+		size_t drop = consumed - keep;
+		memmove(filtered.data(), filtered.data() + drop, filtered.size() - drop);
+		filtered.resize(filtered.size() - drop);
+		window = keep;
+		return true;
+	}
+
+	bool PngEncoder::Finish()
+	{
+		if (encoded != h) {
+			printf("PNG is %d rows tall; only %d rows were given\n", h, encoded);
+			return false;
+		}
+		return WriteChunk(sink, "IEND", nullptr, 0);
+	}
+
+	bool EncodePng(const ImageView& image, const PngOptions& options, std::vector<uint8_t>* png)
+	{
+		png->clear();
+		PngEncoder encoder(image.w, image.h, image.channels, options, [png](const uint8_t* data, size_t size) {
+			png->insert(png->end(), data, data + size);
+			return true;
+		});
+		return encoder.Begin() && encoder.EncodeRows(image.data, image.stride, image.h) && encoder.Finish();
+	}
+
+	bool WritePng(const char* filename, const ImageView& image, const PngOptions& options)
+	{
+		FILE* file = fopen(filename, "wb");
+		if (file == nullptr) {
+			printf("Failed to write %s\n", filename);
+			return false;
+		}
+		PngEncoder encoder(image.w, image.h, image.channels, options, [file](const uint8_t* data, size_t size) {
+			return fwrite(data, 1, size, file) == size;
+		});
+		bool ok = encoder.Begin() && encoder.EncodeRows(image.data, image.stride, image.h) && encoder.Finish();
+		return fclose(file) == 0 && ok;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Image.h"
+#include "ThreadPool.h"
+
+namespace ImageGene {
+	// PNG row filters. PngFilterAdaptive picks, for each row, the filter whose output
+	// has the smallest sum of absolute values taken as signed bytes (the heuristic
+	// libpng uses).
+	enum PngFilter {
+		PngFilterNone, PngFilterSub, PngFilterUp, PngFilterAverage, PngFilterPaeth, PngFilterAdaptive
+	};
+
+	// level is the zlib compression level, 0 (stored) to 9; the default 5 writes files a
+	// few percent larger than zlib's usual 6 in about half the time. Rows are filtered
+	// with SSE4.1 or NEON kernels, then compressed in strips of about 256 KB, each by its
+	// own deflate stream primed with the 32 KB before it and ended on a byte boundary
+	// with a sync flush, and the strips are joined into one zlib stream, as pigz does.
+	// Filtering and strips run in parallel under policy. The strip size does not depend
+	// on the policy, so neither does the file.
+	struct PngOptions {
+		int level = 5;
+		PngFilter filter = PngFilterAdaptive;
+		ExecutionPolicy policy = Sequential;
+	};
+
+	// For intermediate files that are read back soon: level 1 compresses several times
+	// faster than the defaults, into larger files. The Up filter is nearly free and
+	// leaves deflate fewer literals than unfiltered rows, so it is faster as well as
+	// smaller than no filter at this level.
+	const PngOptions PngFast = { 1, PngFilterUp, Sequential };
+
+	// Encodes a PNG a strip of rows at a time, handing the file to sink in order: the
+	// signature and IHDR from Begin, an IDAT chunk for each strip of about 256 KB as soon
+	// as its rows are in, and IEND from Finish. Only the rows of the strip in progress and
+	// the 32 KB deflate window are kept between calls. The file is byte for byte the one
+	// EncodePng writes for the whole image, however the rows are split between calls.
+	class PngEncoder {
+	public:
+		typedef std::function<bool(const uint8_t* data, size_t size)> Sink;
+
+		PngEncoder(int w, int h, int channels, const PngOptions& options, Sink sink);
+
+		// Returns false, after printing why, for the same images and options EncodePng refuses.
+		bool Begin();
+		// Encodes the next `rows` rows, one every `stride` bytes.
+		bool EncodeRows(const uint8_t* data, size_t stride, int rows);
+		// False unless all h rows were encoded.
+		bool Finish();
+
+	private:
+		int w;
+		int h;
+		int channels;
+		PngOptions options;
+		Sink sink;
+
+		size_t rowBytes = 0;
+		size_t filteredBytes = 0;
+		int rowsPerStrip = 1;
+		// The last `window` bytes of filtered data already compressed, for the next strip's
+		// dictionary, followed by the filtered rows not yet compressed.
+		std::vector<uint8_t> filtered;
+		size_t window = 0;
+		// The last row encoded, which the next row is filtered against.
+		std::vector<uint8_t> previous;
+		int encoded = 0;
+		int written = 0;
+		uint32_t adler = 1;
+	};
+
+	// Encodes 1 to 4 channels (gray, gray + alpha, RGB, RGBA) as an 8-bit PNG. Returns
+	// false, after printing why, for other channel counts or an invalid level.
+	bool EncodePng(const ImageView& image, const PngOptions& options, std::vector<uint8_t>* png);
+	bool WritePng(const char* filename, const ImageView& image, const PngOptions& options = PngOptions());
+}
@@ -0,0 +1,192 @@
+#include <cstring>
+
+#include "Qoi.h"
+
+namespace ImageGene {
+	namespace {
+		const uint8_t QOI_OP_INDEX = 0x00;
+		const uint8_t QOI_OP_DIFF = 0x40;
+		const uint8_t QOI_OP_LUMA = 0x80;
+		const uint8_t QOI_OP_RUN = 0xC0;
+		const uint8_t QOI_OP_RGB = 0xFE;
+		const uint8_t QOI_OP_RGBA = 0xFF;
+		const int QOI_MAX_RUN = 62;
+
+		// Pixels are packed as r | g << 8 | b << 16 | a << 24.
+		inline uint32_t Pack(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+		{
+			return r | g << 8 | b << 16 | a << 24;
+		}
+
+		inline int Hash(uint32_t px)
+		{
+			return (int)(((px & 0xFF) * 3 + (px >> 8 & 0xFF) * 5 + (px >> 16 & 0xFF) * 7 + (px >> 24) * 11) % 64);
+		}
+
+		void Put32(uint8_t* out, uint32_t v)
+		{
+			out[0] = (uint8_t)(v >> 24);
+			out[1] = (uint8_t)(v >> 16);
+			out[2] = (uint8_t)(v >> 8);
+			out[3] = (uint8_t)v;
+		}
+
+		uint32_t Get32(const uint8_t* in)
+		{
+			return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+		}
+	}
+
+	const uint8_t QOI_END[QOI_END_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+	void QoiWriteHeader(uint8_t header[QOI_HEADER_SIZE], int w, int h, int channels, int colorspace)
+	{
+		memcpy(header, "qoif", 4);
+		Put32(header + 4, (uint32_t)w);
+		Put32(header + 8, (uint32_t)h);
+		header[12] = (uint8_t)channels;
+		header[13] = (uint8_t)colorspace;
+	}
+
+	bool QoiReadHeader(const uint8_t header[QOI_HEADER_SIZE], int* w, int* h, int* channels)
+	{
+		uint32_t width = Get32(header + 4);
+		uint32_t height = Get32(header + 8);
+		if (memcmp(header, "qoif", 4) != 0 || width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX ||
+			(header[12] != 3 && header[12] != 4) || header[13] > 1) {
+			return false;
+		}
+		*w = (int)width;
+		*h = (int)height;
+		*channels = header[12];
+		return true;
+	}
+
+	uint8_t* QoiEncoder::EncodeRow(const uint8_t* pixels, int w, int channels, uint8_t* out)
+	{
+		for (int x = 0; x < w; x++, pixels += channels) {
+			uint32_t px = Pack(pixels[0], pixels[1], pixels[2], channels == 4 ? pixels[3] : 255);
+			if (px == previous) {
+				if (++run == QOI_MAX_RUN) {
+					*out++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0) {
+				*out++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+
+			int hash = Hash(px);
+			if (index[hash] == px) {
+				*out++ = (uint8_t)(QOI_OP_INDEX | hash);
+			}
+			else {
+				index[hash] = px;
+				if ((px >> 24) == (previous >> 24)) {
+					int vr = (int8_t)(uint8_t)(px - previous);
+					int vg = (int8_t)(uint8_t)((px >> 8) - (previous >> 8));
+					int vb = (int8_t)(uint8_t)((px >> 16) - (previous >> 16));
+					int vgr = vr - vg;
+					int vgb = vb - vg;
+					if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1) {
+						*out++ = (uint8_t)(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+					}
+					else if (vgr >= -8 && vgr <= 7 && vg >= -32 && vg <= 31 && vgb >= -8 && vgb <= 7) {
+						*out++ = (uint8_t)(QOI_OP_LUMA | (vg + 32));
+						*out++ = (uint8_t)((vgr + 8) << 4 | (vgb + 8));
+					}
+					else {
+						*out++ = QOI_OP_RGB;
+						*out++ = (uint8_t)px;
+						*out++ = (uint8_t)(px >> 8);
+						*out++ = (uint8_t)(px >> 16);
+					}
+				}
+				else {
+					*out++ = QOI_OP_RGBA;
+					*out++ = (uint8_t)px;
+					*out++ = (uint8_t)(px >> 8);
+					*out++ = (uint8_t)(px >> 16);
+					*out++ = (uint8_t)(px >> 24);
+				}
+			}
+			previous = px;
+		}
+		return out;
+	}
+
+	uint8_t* QoiEncoder::Finish(uint8_t* out)
+	{
+		if (run > 0) {
+			*out++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+			run = 0;
+		}
+		memcpy(out, QOI_END, QOI_END_SIZE);
+		return out + QOI_END_SIZE;
+	}
+
+	const uint8_t* QoiDecoder::DecodeRow(const uint8_t* in, const uint8_t* end, uint8_t* pixels, int w, int channels)
+	{
+		uint32_t px = previous;
+		for (int x = 0; x < w; x++, pixels += channels) {
+			if (run > 0) {
+				run--;
+			}
+			else {
+				if (in == end) {
+					return nullptr;
+				}
+				uint8_t tag = *in++;
+				if (tag == QOI_OP_RGB) {
+					if (end - in < 3) {
+						return nullptr;
+					}
+					px = Pack(in[0], in[1], in[2], px >> 24);
+					in += 3;
+				}
+				else if (tag == QOI_OP_RGBA) {
+					if (end - in < 4) {
+						return nullptr;
+					}
+					px = Pack(in[0], in[1], in[2], in[3]);
+					in += 4;
+				}
+				else if ((tag & 0xC0) == QOI_OP_INDEX) {
+					px = index[tag];
+				}
+				else if ((tag & 0xC0) == QOI_OP_DIFF) {
+					uint32_t r = (px + (tag >> 4 & 3) - 2) & 0xFF;
+					uint32_t g = ((px >> 8) + (tag >> 2 & 3) - 2) & 0xFF;
+					uint32_t b = ((px >> 16) + (tag & 3) - 2) & 0xFF;
+					px = Pack(r, g, b, px >> 24);
+				}
+				else if ((tag & 0xC0) == QOI_OP_LUMA) {
+					if (in == end) {
+						return nullptr;
+					}
+					uint8_t next = *in++;
+					int vg = (tag & 0x3F) - 32;
+					uint32_t r = (px + vg - 8 + (next >> 4)) & 0xFF;
+					uint32_t g = ((px >> 8) + vg) & 0xFF;
+					uint32_t b = ((px >> 16) + vg - 8 + (next & 0x0F)) & 0xFF;
+					px = Pack(r, g, b, px >> 24);
+				}
+				else {
+					run = tag & 0x3F;
+				}
+				index[Hash(px)] = px;
+			}
+
+			pixels[0] = (uint8_t)px;
+			pixels[1] = (uint8_t)(px >> 8);
+			pixels[2] = (uint8_t)(px >> 16);
+			if (channels == 4) {
+				pixels[3] = (uint8_t)(px >> 24);
+			}
+		}
+		previous = px;
+		return in;
+	}
+}
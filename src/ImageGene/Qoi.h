@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageGene {
+	// QOI ("Quite OK Image", qoiformat.org): lossless RGB or RGBA in a single pass with
+	// no entropy coding, which makes it an order of magnitude faster than PNG to write
+	// and read back, for files somewhat larger than PNG's. A 14-byte header, then one
+	// chunk per pixel or run of pixels, then an 8-byte end marker.
+	const size_t QOI_HEADER_SIZE = 14;
+	const size_t QOI_END_SIZE = 8;
+	// Longest chunk: QOI_OP_RGBA, a tag byte and four channels.
+	const size_t QOI_MAX_CHUNK = 5;
+
+	// Big-endian header fields. channels is 3 or 4; colorspace 0 is sRGB with linear
+	// alpha and 1 is all linear, and does not change how pixels are coded.
+	void QoiWriteHeader(uint8_t header[QOI_HEADER_SIZE], int w, int h, int channels, int colorspace = 0);
+	// False if the header is not QOI or describes an image this library cannot hold.
+	bool QoiReadHeader(const uint8_t header[QOI_HEADER_SIZE], int* w, int* h, int* channels);
+
+	extern const uint8_t QOI_END[QOI_END_SIZE];
+
+	// Encoder state carried from pixel to pixel, so an image can be encoded a row at a
+	// time: the previous pixel, the 64-entry table of recently seen pixels and the
+	// length of the run in progress. The chunks are exactly those of the reference
+	// encoder.
+	class QoiEncoder {
+	public:
+		// Encodes w pixels of 3 or 4 channels and returns the end of the chunks written to
+		// out, which must have room for w * QOI_MAX_CHUNK bytes. A run still in progress
+		// is held back until the next pixel that breaks it, or Finish.
+		uint8_t* EncodeRow(const uint8_t* pixels, int w, int channels, uint8_t* out);
+		// Writes the run in progress, if any, and the end marker: at most
+		// 1 + QOI_END_SIZE bytes.
+		uint8_t* Finish(uint8_t* out);
+
+	private:
+		uint32_t index[64] = {};
+		uint32_t previous = 0xFF000000u;
+		int run = 0;
+	};
+
+	// Decoder state carried from pixel to pixel, the counterpart of QoiEncoder.
+	class QoiDecoder {
+	public:
+		// Decodes w pixels into 3 or 4 channels from the chunks in [in, end) and returns
+		// the first chunk byte not consumed, or nullptr if the chunks ran out first.
+		// Reading w * QOI_MAX_CHUNK bytes, or to the end of the data, is always enough.
+		const uint8_t* DecodeRow(const uint8_t* in, const uint8_t* end, uint8_t* pixels, int w, int channels);
+
+	private:
+		uint32_t index[64] = {};
+		uint32_t previous = 0xFF000000u;
+		int run = 0;
+	};
+}
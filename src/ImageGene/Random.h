@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ImageGene {
+	// SplitMix64 output function (Steele, Lea and Flood).
+	inline uint64_t Mix64(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	// Counter-based generator: the value for (x, y) is the SplitMix64 output at
+	// position y * 2^32 + x of the stream selected by seed. It keeps no state, so any
+	// pixel can be generated independently, in any order, on any thread or SIMD lane,
+	// and gives the same value on every platform.
+	inline uint64_t PixelRandom(uint64_t seed, uint32_t x, uint32_t y)
+	{
+		uint64_t counter = ((uint64_t)y << 32) | x;
+		return Mix64(Mix64(seed) + (counter + 1) * 0x9E3779B97F4A7C15ull);
+	}
+}
@@ -0,0 +1,157 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "RawImage.h"
+
+namespace ImageGene {
+	bool ValidRawHeader(const RawHeader& header, uint64_t fileSize)
+	{
+		if (memcmp(header.magic, RAW_MAGIC, sizeof(RAW_MAGIC)) != 0 || header.version != RAW_VERSION) {
+			return false;
+		}
+		if (header.w == 0 || header.h == 0 || header.w > INT_MAX || header.h > INT_MAX ||
+			header.channels < 1 || header.channels > 4) {
+			return false;
+		}
+		uint64_t rowBytes = (uint64_t)header.w * header.channels;
+		if (header.stride < rowBytes || header.dataOffset < sizeof(RawHeader)) {
+			return false;
+		}
+		// Each step is checked against what is left of the file, so a crafted stride or
+		// offset cannot wrap around and pass.
+		if (header.dataOffset > fileSize || rowBytes > fileSize - header.dataOffset) {
+			return false;
+		}
+		return header.h == 1 || header.stride <= (fileSize - header.dataOffset - rowBytes) / (header.h - 1);
+	}
+
+	std::vector<uint8_t> RawHeaderBlock(int w, int h, int channels)
+	{
+		RawHeader header = {};
+		memcpy(header.magic, RAW_MAGIC, sizeof(RAW_MAGIC));
+		header.version = RAW_VERSION;
+		header.w = w;
+		header.h = h;
+		header.channels = channels;
+		header.stride = (uint64_t)w * channels;
+		header.dataOffset = RAW_DATA_ALIGNMENT;
+
+		std::vector<uint8_t> block(RAW_DATA_ALIGNMENT, 0);
+		memcpy(block.data(), &header, sizeof(header));
+		return block;
+	}
+
+	bool WriteRawImage(const char* filename, const uint8_t* data, int w, int h, int channels, size_t stride)
+	{
+		FILE* file = fopen(filename, "wb");
+		if (file == nullptr) {
+			return false;
+		}
+
+		std::vector<uint8_t> head = RawHeaderBlock(w, h, channels);
+		bool ok = fwrite(head.data(), 1, head.size(), file) == head.size();
+
+		size_t rowBytes = (size_t)w * channels;
+		if (ok && stride == rowBytes) {
+			ok = fwrite(data, rowBytes, h, file) == (size_t)h;
+		}
+		for (int y = 0; ok && stride != rowBytes && y < h; y++) {
+			ok = fwrite(data + (size_t)y * stride, 1, rowBytes, file) == rowBytes;
+		}
+		return fclose(file) == 0 && ok;
+	}
+
+#if defined(_WIN32)
+
+	bool MappedFile::Open(const char* filename, MapMode mode)
+	{
+		HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		DWORD high;
+		DWORD low = GetFileSize(file, &high);
+		if (low == INVALID_FILE_SIZE) {
+			CloseHandle(file);
+			return false;
+		}
+		size = (size_t)high << (8 * sizeof(DWORD)) | low;
+
+		// PAGE_WRITECOPY lets a FILE_MAP_COPY view take private copies of written pages.
+		mapping = CreateFileMapping(file, NULL, mode == MapCopyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, high, low, NULL);
+		CloseHandle(file);
+		if (mapping == NULL) {
+			return false;
+		}
+
+		memory = (uint8_t*)MapViewOfFile(mapping, mode == MapCopyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+		if (memory == NULL) {
+			CloseHandle(mapping);
+			mapping = NULL;
+			return false;
+		}
+		return true;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (memory != NULL) {
+			UnmapViewOfFile(memory);
+		}
+		if (mapping != NULL) {
+			CloseHandle(mapping);
+		}
+	}
+
+#else
+
+	bool MappedFile::Open(const char* filename, MapMode mode)
+	{
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) < 0 || info.st_size == 0) {
+			close(fd);
+			return false;
+		}
+
+		// A private writable mapping of a read-only descriptor is copy-on-write.
+		int protection = mode == MapCopyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+		void* mapped = mmap(NULL, info.st_size, protection, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+
+		memory = (uint8_t*)mapped;
+		size = info.st_size;
+		return true;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (memory != nullptr) {
+			munmap(memory, size);
+		}
+	}
+
+#endif
+}
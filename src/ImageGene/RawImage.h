@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Image.h"
+
+namespace ImageGene {
+	// Native uncompressed format (.igr): this header, then rows of pixels starting at
+	// dataOffset, one every `stride` bytes. dataOffset is a multiple of
+	// RAW_DATA_ALIGNMENT, so a mapping of the whole file puts the pixels on a page
+	// boundary. Fields are little-endian.
+	const char RAW_MAGIC[4] = { 'I', 'G', 'R', 'W' };
+	const uint32_t RAW_VERSION = 1;
+	const size_t RAW_DATA_ALIGNMENT = 4096;
+
+	struct RawHeader {
+		char magic[4];
+		uint32_t version;
+		uint32_t w;
+		uint32_t h;
+		uint32_t channels;
+		uint32_t reserved;
+		uint64_t stride;
+		uint64_t dataOffset;
+	};
+
+	// Checks that a header describes pixel data lying within a file of fileSize bytes.
+	bool ValidRawHeader(const RawHeader& header, uint64_t fileSize);
+
+	// Header padded to dataOffset, ready to be followed by packed rows.
+	std::vector<uint8_t> RawHeaderBlock(int w, int h, int channels);
+
+	bool WriteRawImage(const char* filename, const uint8_t* data, int w, int h, int channels, size_t stride);
+
+	// A whole file mapped into memory. MapReadOnly shares the page cache and faults on
+	// writes; MapCopyOnWrite gives private pages that are only copied when written.
+	class MappedFile {
+	public:
+		MappedFile() {}
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool Open(const char* filename, MapMode mode);
+
+		uint8_t* Data() const { return memory; }
+		size_t Size() const { return size; }
+
+	private:
+		uint8_t* memory = nullptr;
+		size_t size = 0;
+#if defined(_WIN32)
+		void* mapping = nullptr;
+#endif
+	};
+}
@@ -0,0 +1,603 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Resize.h"
+#include "Cpu.h"
+
+#if defined(IG_X86)
+#include <immintrin.h>
+#elif defined(IG_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ImageGene {
+	namespace {
+		const int WEIGHT_BITS = 14;
+		const int WEIGHT_ONE = 1 << WEIGHT_BITS;
+		const int WEIGHT_ROUND = 1 << (WEIGHT_BITS - 1);
+		const double PI = 3.14159265358979323846;
+
+		double Sinc(double x)
+		{
+			if (x == 0.0) {
+				return 1.0;
+			}
+			x *= PI;
+			return sin(x) / x;
+		}
+
+		// Filter support in source pixels at a scale of 1, and the filter itself.
+		double FilterSupport(ResizeFilter filter)
+		{
+			switch (filter) {
+			case ResizeBox: return 0.5;
+			case ResizeBilinear: return 1.0;
+			case ResizeBicubic: return 2.0;
+			default: return 3.0;
+			}
+		}
+
+		double FilterValue(ResizeFilter filter, double x)
+		{
+			switch (filter) {
+			case ResizeBox:
+				return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+			case ResizeBilinear:
+				x = fabs(x);
+				return x < 1.0 ? 1.0 - x : 0.0;
+			case ResizeBicubic: {
+				const double a = -0.5;
+				x = fabs(x);
+				if (x < 1.0) {
+					return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+				}
+				return x < 2.0 ? (((x - 5.0) * x + 8.0) * x - 4.0) * a : 0.0;
+			}
+			default:
+				x = fabs(x);
+				return x < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+			}
+		}
+
+		// Fixed-point weights of every output pixel along one axis. Output i reads the taps
+		// source pixels from start[i]; weights past its window are 0. Windows near the end
+		// are moved back so that every one lies inside the source, which lets the kernels
+		// read all taps without bounds checks.
+		struct Weights {
+			int taps = 0;
+			std::vector<int> start;
+			std::vector<int16_t> values;
+
+			const int16_t* Of(int i) const { return values.data() + (size_t)i * taps; }
+		};
+
+		// srcExtent is the width, in source pixels, that the dst pixels cover. It is srcSize
+		// except after halving, where it keeps the fraction an odd size dropped. taps is
+		// rounded up to a multiple of align when the source is wide enough.
+		Weights ComputeWeights(int srcSize, double srcExtent, int dstSize, ResizeFilter filter, int align)
+		{
+			double scale = srcExtent / dstSize;
+			double filterScale = scale > 1.0 ? scale : 1.0;
+			double support = FilterSupport(filter) * filterScale;
+			int window = (int)ceil(2.0 * support) + 1;
+			int count = window < srcSize ? window : srcSize;
+
+			Weights weights;
+			weights.taps = (count + align - 1) / align * align;
+			if (weights.taps > srcSize) {
+				weights.taps = count;
+			}
+			weights.start.resize(dstSize);
+			weights.values.assign((size_t)dstSize * weights.taps, 0);
+
+			std::vector<double> values(window);
+			for (int i = 0; i < dstSize; i++) {
+				double center = (i + 0.5) * scale;
+				int lo = (int)floor(center - support + 0.5);
+				int hi = (int)floor(center + support + 0.5);
+				lo = lo < 0 ? 0 : lo > srcSize - 1 ? srcSize - 1 : lo;
+				hi = hi > srcSize ? srcSize : hi < lo + 1 ? lo + 1 : hi;
+
+				double total = 0.0;
+				for (int x = lo; x < hi; x++) {
+					values[x - lo] = FilterValue(filter, (x + 0.5 - center) / filterScale);
+					total += values[x - lo];
+				}
+				if (total == 0.0) {
+					// A box sample exactly between two source pixels: take the one it starts.
+					int nearest = (int)floor(center);
+					lo = nearest < lo ? lo : nearest > hi - 1 ? hi - 1 : nearest;
+					hi = lo + 1;
+					values[0] = total = 1.0;
+				}
+
+				int first = lo < srcSize - weights.taps ? lo : srcSize - weights.taps;
+				weights.start[i] = first;
+				int16_t* out = weights.values.data() + (size_t)i * weights.taps;
+				int sum = 0;
+				int largest = lo;
+				for (int x = lo; x < hi; x++) {
+					int q = (int)lround(values[x - lo] / total * WEIGHT_ONE);
+					out[x - first] = (int16_t)q;
+					sum += q;
+					if (fabs(values[x - lo]) > fabs(values[largest - lo])) {
+						largest = x;
+					}
+				}
+				// Rounding error goes to the largest weight, so the weights sum to exactly 1.
+				out[largest - first] = (int16_t)(out[largest - first] + WEIGHT_ONE - sum);
+			}
+			return weights;
+		}
+
+		inline uint8_t Clamp(int sum)
+		{
+			int v = (sum + WEIGHT_ROUND) >> WEIGHT_BITS;
+			return (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+		}
+
+		void HorizontalScalar(const uint8_t* src, int channels, uint8_t* dst, int x, int dstW, const Weights& weights)
+		{
+			for (; x < dstW; x++) {
+				const uint8_t* px = src + (size_t)weights.start[x] * channels;
+				const int16_t* w = weights.Of(x);
+				for (int c = 0; c < channels; c++) {
+					int sum = 0;
+					for (int j = 0; j < weights.taps; j++) {
+						sum += w[j] * px[j * channels + c];
+					}
+					dst[(size_t)x * channels + c] = Clamp(sum);
+				}
+			}
+		}
+
+		void VerticalScalar(const uint8_t* src, size_t stride, const int16_t* w, int taps, uint8_t* dst, size_t i,
+			size_t bytes)
+		{
+			for (; i < bytes; i++) {
+				int sum = 0;
+				for (int k = 0; k < taps; k++) {
+					sum += w[k] * src[(size_t)k * stride + i];
+				}
+				dst[i] = Clamp(sum);
+			}
+		}
+
+		void HalveScalar(const uint8_t* row0, const uint8_t* row1, int srcW, int channels, uint8_t* dst, int x, int dstW)
+		{
+			for (; x < dstW; x++) {
+				const uint8_t* a = row0 + (size_t)2 * x * channels;
+				const uint8_t* b = row1 + (size_t)2 * x * channels;
+				int next = srcW > 1 ? channels : 0;
+				for (int c = 0; c < channels; c++) {
+					dst[(size_t)x * channels + c] = (uint8_t)((a[c] + a[next + c] + b[c] + b[next + c] + 2) >> 2);
+				}
+			}
+		}
+
+		// Byte shuffles for the SIMD kernels. pairs puts channel c of two neighbouring pixels
+		// side by side in 16-bit lane pair c (2 to 4 channels), for a madd with two taps.
+		// halve puts each byte next to the same channel of the following pixel, for a
+		// pairwise add, over `step` source bytes that reduce to step / 2 output bytes.
+		struct Shuffles {
+			int8_t pairs[16];
+			int8_t halve[16];
+			int step;
+
+			explicit Shuffles(int channels)
+			{
+				for (int lane = 0; lane < 4; lane++) {
+					bool used = lane < channels;
+					pairs[4 * lane] = used ? (int8_t)lane : (int8_t)-128;
+					pairs[4 * lane + 1] = (int8_t)-128;
+					pairs[4 * lane + 2] = used ? (int8_t)(channels + lane) : (int8_t)-128;
+					pairs[4 * lane + 3] = (int8_t)-128;
+				}
+
+				int groups = channels == 3 ? 2 : 8 / channels;
+				step = groups * 2 * channels;
+				memset(halve, -128, sizeof(halve));
+				for (int g = 0; g < groups; g++) {
+					for (int c = 0; c < channels; c++) {
+						int out = g * channels + c;
+						halve[2 * out] = (int8_t)(g * 2 * channels + c);
+						halve[2 * out + 1] = (int8_t)(g * 2 * channels + channels + c);
+					}
+				}
+			}
+		};
+
+		// Each kernel handles as many leading outputs as it can without reading past the
+		// row and returns how many; the scalar loop finishes. The windows only move right,
+		// so the outputs a kernel cannot handle are the last ones.
+		typedef int (*HorizontalKernel)(const uint8_t* src, int srcW, int channels, uint8_t* dst, int dstW,
+			const Weights& weights, const Shuffles& shuffles);
+		typedef size_t (*VerticalKernel)(const uint8_t* src, size_t stride, const int16_t* w, int taps, uint8_t* dst,
+			size_t bytes);
+		typedef int (*HalveKernel)(const uint8_t* row0, const uint8_t* row1, int srcW, int channels, uint8_t* dst,
+			int dstW, const Shuffles& shuffles);
+
+#if defined(IG_X86)
+		// One channel: eight taps per madd and a horizontal sum. Two to four channels: two
+		// taps per madd, with one 32-bit lane per channel.
+		IG_TARGET_SSE41 int HorizontalSSE41(const uint8_t* src, int srcW, int channels, uint8_t* dst, int dstW,
+			const Weights& weights, const Shuffles& shuffles)
+		{
+			const int taps = weights.taps;
+			const __m128i round = _mm_set1_epi32(WEIGHT_ROUND);
+			int x = 0;
+			if (channels == 1) {
+				if (taps % 8 != 0) {
+					return 0;
+				}
+				for (; x < dstW; x++) {
+					const uint8_t* px = src + weights.start[x];
+					const int16_t* w = weights.Of(x);
+					__m128i sum = _mm_setzero_si128();
+					for (int j = 0; j < taps; j += 8) {
+						__m128i p = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(px + j)));
+						sum = _mm_add_epi32(sum, _mm_madd_epi16(p, _mm_loadu_si128((const __m128i*)(w + j))));
+					}
+					sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+					sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+					__m128i v = _mm_srai_epi32(_mm_add_epi32(sum, round), WEIGHT_BITS);
+					dst[x] = (uint8_t)_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(v, v), v));
+				}
+				return x;
+			}
+
+			if (taps % 2 != 0) {
+				return 0;
+			}
+			const __m128i mask = _mm_loadu_si128((const __m128i*)shuffles.pairs);
+			const size_t rowBytes = (size_t)srcW * channels;
+			for (; x < dstW && (size_t)(weights.start[x] + taps - 2) * channels + 8 <= rowBytes; x++) {
+				const uint8_t* px = src + (size_t)weights.start[x] * channels;
+				const int16_t* w = weights.Of(x);
+				__m128i sum = round;
+				for (int j = 0; j < taps; j += 2) {
+					__m128i p = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)(px + j * channels)), mask);
+					int32_t pair;
+					memcpy(&pair, w + j, sizeof(pair));
+					sum = _mm_add_epi32(sum, _mm_madd_epi16(p, _mm_set1_epi32(pair)));
+				}
+				__m128i v = _mm_srai_epi32(sum, WEIGHT_BITS);
+				int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(v, v), v));
+				memcpy(dst + (size_t)x * channels, &bytes, channels);
+			}
+			return x;
+		}
+
+		IG_TARGET_SSE41 inline void AddPairs(__m128i a, __m128i b, __m128i w, __m128i* sum)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i lo = _mm_unpacklo_epi8(a, b);
+			__m128i hi = _mm_unpackhi_epi8(a, b);
+			sum[0] = _mm_add_epi32(sum[0], _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			sum[1] = _mm_add_epi32(sum[1], _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			sum[2] = _mm_add_epi32(sum[2], _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			sum[3] = _mm_add_epi32(sum[3], _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		}
+
+		// 16 bytes of a row per step, whatever the channels: bytes of two source rows are
+		// interleaved into 16-bit pairs for a madd with their two weights.
+		IG_TARGET_SSE41 size_t VerticalSSE41(const uint8_t* src, size_t stride, const int16_t* w, int taps, uint8_t* dst,
+			size_t bytes)
+		{
+			const __m128i round = _mm_set1_epi32(WEIGHT_ROUND);
+			size_t i = 0;
+			for (; i + 16 <= bytes; i += 16) {
+				const uint8_t* px = src + i;
+				__m128i sum[4] = { round, round, round, round };
+				int k = 0;
+				for (; k + 1 < taps; k += 2) {
+					int32_t pair;
+					memcpy(&pair, w + k, sizeof(pair));
+					AddPairs(_mm_loadu_si128((const __m128i*)(px + (size_t)k * stride)),
+						_mm_loadu_si128((const __m128i*)(px + (size_t)(k + 1) * stride)), _mm_set1_epi32(pair), sum);
+				}
+				if (k < taps) {
+					AddPairs(_mm_loadu_si128((const __m128i*)(px + (size_t)k * stride)), _mm_setzero_si128(),
+						_mm_set1_epi32((uint16_t)w[k]), sum);
+				}
+				__m128i lo = _mm_packs_epi32(_mm_srai_epi32(sum[0], WEIGHT_BITS), _mm_srai_epi32(sum[1], WEIGHT_BITS));
+				__m128i hi = _mm_packs_epi32(_mm_srai_epi32(sum[2], WEIGHT_BITS), _mm_srai_epi32(sum[3], WEIGHT_BITS));
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+			}
+			return i;
+		}
+
+		// Neighbouring pixels' channels are paired by the shuffle and summed by a maddubs
+		// with ones, then the two rows are added.
+		IG_TARGET_SSE41 int HalveSSE41(const uint8_t* row0, const uint8_t* row1, int srcW, int channels, uint8_t* dst,
+			int dstW, const Shuffles& shuffles)
+		{
+			const __m128i mask = _mm_loadu_si128((const __m128i*)shuffles.halve);
+			const __m128i ones = _mm_set1_epi8(1);
+			const __m128i two = _mm_set1_epi16(2);
+			const size_t srcBytes = (size_t)srcW * channels;
+			const size_t dstBytes = (size_t)dstW * channels;
+			const int step = shuffles.step / 2 / channels;
+
+			int x = 0;
+			for (; (size_t)x * 2 * channels + 16 <= srcBytes && (size_t)x * channels + 8 <= dstBytes; x += step) {
+				size_t offset = (size_t)x * 2 * channels;
+				__m128i a = _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(row0 + offset)), mask), ones);
+				__m128i b = _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(row1 + offset)), mask), ones);
+				__m128i mean = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(a, b), two), 2);
+				_mm_storel_epi64((__m128i*)(dst + (size_t)x * channels), _mm_packus_epi16(mean, mean));
+			}
+			return x;
+		}
+#elif defined(IG_NEON)
+		template <int C>
+		int HorizontalPairsNEON(const uint8_t* src, int srcW, uint8_t* dst, int dstW, const Weights& weights)
+		{
+			const int taps = weights.taps;
+			const size_t rowBytes = (size_t)srcW * C;
+			int x = 0;
+			for (; x < dstW && (size_t)(weights.start[x] + taps - 2) * C + 8 <= rowBytes; x++) {
+				const uint8_t* px = src + (size_t)weights.start[x] * C;
+				const int16_t* w = weights.Of(x);
+				int32x4_t sum = vdupq_n_s32(0);
+				for (int j = 0; j < taps; j += 2) {
+					int16x8_t p = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(px + j * C)));
+					sum = vmlal_n_s16(sum, vget_low_s16(p), w[j]);
+					sum = vmlal_n_s16(sum, vget_low_s16(vextq_s16(p, p, C)), w[j + 1]);
+				}
+				uint16x4_t v = vqrshrun_n_s32(sum, WEIGHT_BITS);
+				uint8_t bytes[8];
+				vst1_u8(bytes, vqmovn_u16(vcombine_u16(v, v)));
+				memcpy(dst + (size_t)x * C, bytes, C);
+			}
+			return x;
+		}
+
+		int HorizontalNEON(const uint8_t* src, int srcW, int channels, uint8_t* dst, int dstW,
+			const Weights& weights, const Shuffles&)
+		{
+			const int taps = weights.taps;
+			if (channels == 1) {
+				if (taps % 8 != 0) {
+					return 0;
+				}
+				int x = 0;
+				for (; x < dstW; x++) {
+					const uint8_t* px = src + weights.start[x];
+					const int16_t* w = weights.Of(x);
+					int32x4_t sum = vdupq_n_s32(0);
+					for (int j = 0; j < taps; j += 8) {
+						int16x8_t p = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(px + j)));
+						int16x8_t wj = vld1q_s16(w + j);
+						sum = vmlal_s16(sum, vget_low_s16(p), vget_low_s16(wj));
+						sum = vmlal_s16(sum, vget_high_s16(p), vget_high_s16(wj));
+					}
+					int32x2_t pair = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+					dst[x] = Clamp(vget_lane_s32(vpadd_s32(pair, pair), 0));
+				}
+				return x;
+			}
+			if (taps % 2 != 0) {
+				return 0;
+			}
+			switch (channels) {
+			case 2: return HorizontalPairsNEON<2>(src, srcW, dst, dstW, weights);
+			case 3: return HorizontalPairsNEON<3>(src, srcW, dst, dstW, weights);
+			case 4: return HorizontalPairsNEON<4>(src, srcW, dst, dstW, weights);
+			default: return 0;
+			}
+		}
+
+		size_t VerticalNEON(const uint8_t* src, size_t stride, const int16_t* w, int taps, uint8_t* dst, size_t bytes)
+		{
+			size_t i = 0;
+			for (; i + 16 <= bytes; i += 16) {
+				const uint8_t* px = src + i;
+				int32x4_t sum0 = vdupq_n_s32(0), sum1 = sum0, sum2 = sum0, sum3 = sum0;
+				for (int k = 0; k < taps; k++) {
+					uint8x16_t row = vld1q_u8(px + (size_t)k * stride);
+					int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(row)));
+					int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(row)));
+					sum0 = vmlal_n_s16(sum0, vget_low_s16(lo), w[k]);
+					sum1 = vmlal_n_s16(sum1, vget_high_s16(lo), w[k]);
+					sum2 = vmlal_n_s16(sum2, vget_low_s16(hi), w[k]);
+					sum3 = vmlal_n_s16(sum3, vget_high_s16(hi), w[k]);
+				}
+				uint16x8_t lo = vcombine_u16(vqrshrun_n_s32(sum0, WEIGHT_BITS), vqrshrun_n_s32(sum1, WEIGHT_BITS));
+				uint16x8_t hi = vcombine_u16(vqrshrun_n_s32(sum2, WEIGHT_BITS), vqrshrun_n_s32(sum3, WEIGHT_BITS));
+				vst1q_u8(dst + i, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+			}
+			return i;
+		}
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+		// Table lookups of 16 bytes are AArch64 only; 32-bit ARM halves with the scalar loop.
+		int HalveNEON(const uint8_t* row0, const uint8_t* row1, int srcW, int channels, uint8_t* dst, int dstW,
+			const Shuffles& shuffles)
+		{
+			const uint8x16_t mask = vreinterpretq_u8_s8(vld1q_s8(shuffles.halve));
+			const size_t srcBytes = (size_t)srcW * channels;
+			const size_t dstBytes = (size_t)dstW * channels;
+			const int step = shuffles.step / 2 / channels;
+
+			int x = 0;
+			for (; (size_t)x * 2 * channels + 16 <= srcBytes && (size_t)x * channels + 8 <= dstBytes; x += step) {
+				size_t offset = (size_t)x * 2 * channels;
+				uint16x8_t a = vpaddlq_u8(vqtbl1q_u8(vld1q_u8(row0 + offset), mask));
+				uint16x8_t b = vpaddlq_u8(vqtbl1q_u8(vld1q_u8(row1 + offset), mask));
+				vst1_u8(dst + (size_t)x * channels, vrshrn_n_u16(vaddq_u16(a, b), 2));
+			}
+			return x;
+		}
+#define IG_HALVE_NEON 1
+#endif
+#endif
+
+		HorizontalKernel SelectHorizontalKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return HorizontalSSE41;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				return HorizontalNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		VerticalKernel SelectVerticalKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return VerticalSSE41;
+			}
+#elif defined(IG_NEON)
+			if (level == SimdNEON) {
+				return VerticalNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		HalveKernel SelectHalveKernel()
+		{
+			SimdLevel level = ActiveSimdLevel();
+#if defined(IG_X86)
+			if (level >= SimdSSE41) {
+				return HalveSSE41;
+			}
+#elif defined(IG_HALVE_NEON)
+			if (level == SimdNEON) {
+				return HalveNEON;
+			}
+#endif
+			(void)level;
+			return nullptr;
+		}
+
+		// Resamples src, which stands for srcExtentW x srcExtentH source pixels, into dst.
+		void Resample(const ImageView& src, double srcExtentW, double srcExtentH, const ImageView& dst,
+			ResizeFilter filter, const ExecutionPolicy& policy)
+		{
+			const int channels = dst.channels;
+			const size_t dstBytes = dst.RowBytes();
+			const bool horizontal = src.w != dst.w || srcExtentW != src.w;
+			const bool vertical = src.h != dst.h || srcExtentH != src.h;
+
+			if (!horizontal && !vertical) {
+				ParallelRows(dst.h, dstBytes, policy, [&](int y0, int y1) {
+					for (int y = y0; y < y1; y++) {
+						memcpy(dst.Row(y), src.Row(y), dstBytes);
+					}
+				});
+				return;
+			}
+
+			// The kernels cover 1 to 4 channels.
+			Weights columns;
+			HorizontalKernel horizontalKernel = channels <= 4 ? SelectHorizontalKernel() : nullptr;
+			Shuffles shuffles(channels);
+			if (horizontal) {
+				columns = ComputeWeights(src.w, srcExtentW, dst.w, filter, channels == 1 ? 8 : 2);
+			}
+			auto resampleRow = [&](const uint8_t* in, uint8_t* out) {
+				int x = horizontalKernel ? horizontalKernel(in, src.w, channels, out, dst.w, columns, shuffles) : 0;
+				HorizontalScalar(in, channels, out, x, dst.w, columns);
+			};
+			size_t rowWork = (size_t)dst.w * channels * columns.taps;
+
+			if (!vertical) {
+				ParallelRows(dst.h, rowWork, policy, [&](int y0, int y1) {
+					for (int y = y0; y < y1; y++) {
+						resampleRow(src.Row(y), dst.Row(y));
+					}
+				});
+				return;
+			}
+
+			// Only the source rows some output row reads are resampled horizontally.
+			Weights rows = ComputeWeights(src.h, srcExtentH, dst.h, filter, 2);
+			int first = rows.start[0];
+			int last = rows.start[dst.h - 1] + rows.taps;
+			const uint8_t* band = src.Row(first);
+			size_t bandStride = src.stride;
+			std::vector<uint8_t> scratch;
+			if (horizontal) {
+				scratch.resize((size_t)(last - first) * dstBytes);
+				ParallelRows(last - first, rowWork, policy, [&](int y0, int y1) {
+					for (int y = y0; y < y1; y++) {
+						resampleRow(src.Row(first + y), scratch.data() + (size_t)y * dstBytes);
+					}
+				});
+				band = scratch.data();
+				bandStride = dstBytes;
+			}
+
+			VerticalKernel verticalKernel = SelectVerticalKernel();
+			ParallelRows(dst.h, dstBytes * rows.taps, policy, [&](int y0, int y1) {
+				for (int y = y0; y < y1; y++) {
+					const uint8_t* in = band + (size_t)(rows.start[y] - first) * bandStride;
+					size_t i = verticalKernel ? verticalKernel(in, bandStride, rows.Of(y), rows.taps, dst.Row(y), dstBytes) : 0;
+					VerticalScalar(in, bandStride, rows.Of(y), rows.taps, dst.Row(y), i, dstBytes);
+				}
+			});
+		}
+	}
+
+	void HalvePixels(const ImageView& src, const ImageView& dst, const ExecutionPolicy& policy)
+	{
+		if (dst.w != HalfSize(src.w) || dst.h != HalfSize(src.h) || dst.channels != src.channels) {
+			printf("Halving %d x %d x %d needs a %d x %d x %d destination, got %d x %d x %d\n",
+				src.w, src.h, src.channels, HalfSize(src.w), HalfSize(src.h), src.channels, dst.w, dst.h, dst.channels);
+			return;
+		}
+
+		HalveKernel kernel = src.channels <= 4 ? SelectHalveKernel() : nullptr;
+		Shuffles shuffles(src.channels);
+		ParallelRows(dst.h, 2 * src.RowBytes(), policy, [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				const uint8_t* row0 = src.Row(src.h > 1 ? 2 * y : 0);
+				const uint8_t* row1 = src.Row(src.h > 1 ? 2 * y + 1 : 0);
+				int x = kernel && src.w > 1 ? kernel(row0, row1, src.w, src.channels, dst.Row(y), dst.w, shuffles) : 0;
+				HalveScalar(row0, row1, src.w, src.channels, dst.Row(y), x, dst.w);
+			}
+		});
+	}
+
+	void ResizePixels(const ImageView& src, const ImageView& dst, ResizeFilter filter, const ExecutionPolicy& policy)
+	{
+		ResizeReduced(src, src.w, src.h, dst, filter, policy);
+	}
+
+	void ResizeReduced(const ImageView& src, double extentW, double extentH, const ImageView& dst,
+		ResizeFilter filter, const ExecutionPolicy& policy)
+	{
+		if (src.channels != dst.channels) {
+			printf("Cannot resize %d channels into %d channels\n", src.channels, dst.channels);
+			return;
+		}
+		if (src.w <= 0 || src.h <= 0 || dst.w <= 0 || dst.h <= 0) {
+			return;
+		}
+
+		ImageView level = src;
+		Image halved(0, 0, 0);
+		while (HalfSize(level.w) >= 2 * dst.w && HalfSize(level.h) >= 2 * dst.h) {
+			Image next(HalfSize(level.w), HalfSize(level.h), level.channels);
+			HalvePixels(level, ImageView(next.data, next.w, next.h, next.channels, (size_t)next.w * next.channels), policy);
+			halved = std::move(next);
+			level = ImageView(halved.data, halved.w, halved.h, halved.channels, (size_t)halved.w * halved.channels);
+			extentW /= 2;
+			extentH /= 2;
+		}
+		Resample(level, extentW, extentH, dst, filter, policy);
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Image.h"
+
+namespace ImageGene {
+	// Resamples src to the size of dst, which must have the same number of channels, in
+	// two separable passes: each row to dst.w pixels into a scratch band of the source
+	// rows that are needed, then each column of that band to dst.h pixels. The weights of
+	// each output pixel are computed once per call in 14-bit fixed point and sum to
+	// exactly 1, so flat areas stay flat; sums are rounded to nearest and clamped to
+	// 0..255. SSE4.1 and NEON kernels produce the same bytes as the scalar loops.
+	//
+	// Downscales by 4x or more first halve the source with HalvePixels until the filter
+	// has between 2x and 4x left to reduce, which keeps its taps short. The filter then
+	// places its samples by the full source size, so the geometry does not shift.
+	// Both passes, and each halving, run in parallel across row bands under policy.
+	void ResizePixels(const ImageView& src, const ImageView& dst, ResizeFilter filter,
+		const ExecutionPolicy& policy = Sequential);
+
+	// ResizePixels for a src made by halving a larger image, which stands for extentW x
+	// extentH pixels of src: the larger image's size divided by 2 per halving, so
+	// including the fraction that odd sizes dropped. Samples land where they would have
+	// landed in the larger image.
+	void ResizeReduced(const ImageView& src, double extentW, double extentH, const ImageView& dst,
+		ResizeFilter filter, const ExecutionPolicy& policy = Sequential);
+
+	// Size of a dimension after one 2:1 reduction: half, rounded down, but at least 1.
+	inline int HalfSize(int size)
+	{
+		return size > 1 ? size / 2 : 1;
+	}
+
+	// 2:1 box reduction into dst, which is HalfSize(src.w) x HalfSize(src.h) with the
+	// same channels. Each output pixel is the rounded mean of a 2x2 block; an odd last
+	// row or column is dropped, and a dimension of 1 is averaged with itself.
+	void HalvePixels(const ImageView& src, const ImageView& dst, const ExecutionPolicy& policy = Sequential);
+}
@@ -0,0 +1,890 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Stream.h"
+#include "Blit.h"
+#include "Convolution.h"
+#include "Dither.h"
+#include "Grayscale.h"
+#include "Png.h"
+#include "Qoi.h"
+#include "RawImage.h"
+
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+namespace ImageGene {
+	namespace {
+		const size_t STRIP_BYTES = 4 * 1024 * 1024;
+		const int MIN_STRIP_ROWS = 16;
+		const size_t QOI_BUFFER_BYTES = 64 * 1024;
+
+		// Reads the next whitespace-separated header token, skipping # comments.
+		bool ReadToken(FILE* file, char* token, size_t capacity)
+		{
+			int c = fgetc(file);
+			for (;;) {
+				while (c != EOF && isspace(c)) {
+					c = fgetc(file);
+				}
+				if (c != '#') {
+					break;
+				}
+				while (c != EOF && c != '\n') {
+					c = fgetc(file);
+				}
+			}
+
+			size_t n = 0;
+			while (c != EOF && !isspace(c) && n + 1 < capacity) {
+				token[n++] = (char)c;
+				c = fgetc(file);
+			}
+			token[n] = '\0';
+			return n > 0;
+		}
+
+		bool ReadNumber(FILE* file, int* value)
+		{
+			char token[32];
+			if (!ReadToken(file, token, sizeof(token))) {
+				return false;
+			}
+			*value = atoi(token);
+			return *value > 0;
+		}
+
+		class PnmReader : public StripReader {
+		public:
+			~PnmReader()
+			{
+				if (file != nullptr) {
+					fclose(file);
+				}
+			}
+
+			bool Open(const char* filename)
+			{
+				file = fopen(filename, "rb");
+				if (file == nullptr) {
+					return false;
+				}
+
+				char magic[3] = {};
+				if (fread(magic, 1, 2, file) != 2 || magic[0] != 'P') {
+					return false;
+				}
+
+				int maxval = 0;
+				if (magic[1] == '5' || magic[1] == '6') {
+					channels = magic[1] == '5' ? 1 : 3;
+					// A single whitespace character, consumed by the token reader, ends the header.
+					return ReadNumber(file, &w) && ReadNumber(file, &h) && ReadNumber(file, &maxval) && maxval == 255;
+				}
+				if (magic[1] != '7') {
+					return false;
+				}
+
+				char token[64];
+				while (ReadToken(file, token, sizeof(token))) {
+					if (strcmp(token, "ENDHDR") == 0) {
+						return w > 0 && h > 0 && channels >= 1 && channels <= 4 && maxval == 255;
+					}
+					if (strcmp(token, "WIDTH") == 0 && !ReadNumber(file, &w)) break;
+					if (strcmp(token, "HEIGHT") == 0 && !ReadNumber(file, &h)) break;
+					if (strcmp(token, "DEPTH") == 0 && !ReadNumber(file, &channels)) break;
+					if (strcmp(token, "MAXVAL") == 0 && !ReadNumber(file, &maxval)) break;
+					if (strcmp(token, "TUPLTYPE") == 0 && !ReadToken(file, token, sizeof(token))) break;
+				}
+				return false;
+			}
+
+			bool ReadRows(uint8_t* data, size_t stride, int rows) override
+			{
+				size_t rowBytes = (size_t)w * channels;
+				if (stride == rowBytes) {
+					return fread(data, rowBytes, rows, file) == (size_t)rows;
+				}
+				for (int y = 0; y < rows; y++) {
+					if (fread(data + (size_t)y * stride, 1, rowBytes, file) != rowBytes) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+		private:
+			FILE* file = nullptr;
+		};
+
+		// Rows are copied out of a read-only mapping, so only the pages in use are resident.
+		class RawReader : public StripReader {
+		public:
+			bool Open(const char* filename)
+			{
+				if (!file.Open(filename, MapReadOnly) || file.Size() < sizeof(header)) {
+					return false;
+				}
+				memcpy(&header, file.Data(), sizeof(header));
+				if (!ValidRawHeader(header, file.Size())) {
+					return false;
+				}
+				w = header.w;
+				h = header.h;
+				channels = header.channels;
+				return true;
+			}
+
+			bool ReadRows(uint8_t* data, size_t stride, int rows) override
+			{
+				size_t rowBytes = (size_t)w * channels;
+				if (next + rows > h) {
+					return false;
+				}
+				for (int y = 0; y < rows; y++, next++) {
+					memcpy(data + (size_t)y * stride, file.Data() + header.dataOffset + (size_t)next * header.stride, rowBytes);
+				}
+				return true;
+			}
+
+		private:
+			MappedFile file;
+			RawHeader header;
+			int next = 0;
+		};
+
+		// Chunks are read from the file into a buffer that always holds a worst-case row
+		// (or the rest of the file) before a row is decoded.
+		class QoiReader : public StripReader {
+		public:
+			~QoiReader()
+			{
+				if (file != nullptr) {
+					fclose(file);
+				}
+			}
+
+			bool Open(const char* filename)
+			{
+				file = fopen(filename, "rb");
+				if (file == nullptr) {
+					return false;
+				}
+				uint8_t header[QOI_HEADER_SIZE];
+				if (fread(header, 1, sizeof(header), file) != sizeof(header) || !QoiReadHeader(header, &w, &h, &channels)) {
+					return false;
+				}
+				rowChunks = (size_t)w * QOI_MAX_CHUNK;
+				buffer.resize(rowChunks > QOI_BUFFER_BYTES ? rowChunks : QOI_BUFFER_BYTES);
+				return true;
+			}
+
+			bool ReadRows(uint8_t* data, size_t stride, int rows) override
+			{
+				for (int y = 0; y < rows; y++) {
+					if (end - next < rowChunks && !Refill()) {
+						return false;
+					}
+					const uint8_t* in = decoder.DecodeRow(buffer.data() + next, buffer.data() + end, data + (size_t)y * stride, w, channels);
+					if (in == nullptr) {
+						return false;
+					}
+					next = in - buffer.data();
+				}
+				return true;
+			}
+
+		private:
+			bool Refill()
+			{
+				if (feof(file)) {
+					return true;
+				}
+				memmove(buffer.data(), buffer.data() + next, end - next);
+				end -= next;
+				next = 0;
+				end += fread(buffer.data() + end, 1, buffer.size() - end, file);
+				return !ferror(file);
+			}
+
+			FILE* file = nullptr;
+			QoiDecoder decoder;
+			std::vector<uint8_t> buffer;
+			size_t rowChunks = 0;
+			size_t next = 0;
+			size_t end = 0;
+		};
+
+		class StbReader : public StripReader {
+		public:
+			~StbReader()
+			{
+				stbi_image_free(pixels);
+			}
+
+			bool Open(const char* filename)
+			{
+				pixels = stbi_load(filename, &w, &h, &channels, 0);
+				return pixels != nullptr;
+			}
+
+			bool ReadRows(uint8_t* data, size_t stride, int rows) override
+			{
+				size_t rowBytes = (size_t)w * channels;
+				if (next + rows > h) {
+					return false;
+				}
+				for (int y = 0; y < rows; y++, next++) {
+					memcpy(data + (size_t)y * stride, pixels + (size_t)next * rowBytes, rowBytes);
+				}
+				return true;
+			}
+
+		private:
+			uint8_t* pixels = nullptr;
+			int next = 0;
+		};
+
+		class FileWriter : public StripWriter {
+		public:
+			FileWriter(int w, int h, int channels) : w(w), h(h), channels(channels) {}
+
+			~FileWriter()
+			{
+				if (file != nullptr) {
+					fclose(file);
+				}
+			}
+
+			bool Open(const char* filename)
+			{
+				file = fopen(filename, "wb");
+				return file != nullptr && WriteHeader();
+			}
+
+			bool Finish() override
+			{
+				bool complete = written == h && fflush(file) == 0;
+				fclose(file);
+				file = nullptr;
+				return complete;
+			}
+
+		protected:
+			virtual bool WriteHeader() = 0;
+
+			int w;
+			int h;
+			int channels;
+			int written = 0;
+			FILE* file = nullptr;
+		};
+
+		class PnmWriter : public FileWriter {
+		public:
+			using FileWriter::FileWriter;
+
+			bool WriteRows(const uint8_t* data, size_t stride, int rows) override
+			{
+				size_t rowBytes = (size_t)w * channels;
+				for (int y = 0; y < rows; y++) {
+					if (fwrite(data + (size_t)y * stride, 1, rowBytes, file) != rowBytes) {
+						return false;
+					}
+				}
+				written += rows;
+				return true;
+			}
+
+		protected:
+			bool WriteHeader() override
+			{
+				if (channels == 1 || channels == 3) {
+					return fprintf(file, "P%d\n%d %d\n255\n", channels == 1 ? 5 : 6, w, h) > 0;
+				}
+				return fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+					w, h, channels, channels == 2 ? "GRAYSCALE_ALPHA" : "RGB_ALPHA") > 0;
+			}
+		};
+
+		class RawWriter : public FileWriter {
+		public:
+			using FileWriter::FileWriter;
+
+			bool WriteRows(const uint8_t* data, size_t stride, int rows) override
+			{
+				size_t rowBytes = (size_t)w * channels;
+				for (int y = 0; y < rows; y++) {
+					if (fwrite(data + (size_t)y * stride, 1, rowBytes, file) != rowBytes) {
+						return false;
+					}
+				}
+				written += rows;
+				return true;
+			}
+
+		protected:
+			bool WriteHeader() override
+			{
+				std::vector<uint8_t> header = RawHeaderBlock(w, h, channels);
+				return fwrite(header.data(), 1, header.size(), file) == header.size();
+			}
+		};
+
+		// Same pixel formats as stbi_write_bmp (24-bit, or 32-bit with a V4 header for
+		// RGBA), but stored top-down with a negative height so rows can be written as
+		// they arrive.
+		class BmpWriter : public FileWriter {
+		public:
+			using FileWriter::FileWriter;
+
+			bool WriteRows(const uint8_t* data, size_t stride, int rows) override
+			{
+				int bytes = channels == 4 ? 4 : 3;
+				int pad = bytes == 3 ? (-w * 3) & 3 : 0;
+				row.assign((size_t)w * bytes + pad, 0);
+
+				for (int y = 0; y < rows; y++) {
+					const uint8_t* px = data + (size_t)y * stride;
+					uint8_t* dst = row.data();
+					for (int x = 0; x < w; x++, px += channels, dst += bytes) {
+						if (channels < 3) {
+							dst[0] = dst[1] = dst[2] = px[0];
+						}
+						else {
+							dst[0] = px[2];
+							dst[1] = px[1];
+							dst[2] = px[0];
+							if (bytes == 4) {
+								dst[3] = px[3];
+							}
+						}
+					}
+					if (fwrite(row.data(), 1, row.size(), file) != row.size()) {
+						return false;
+					}
+				}
+				written += rows;
+				return true;
+			}
+
+		protected:
+			bool WriteHeader() override
+			{
+				bool v4 = channels == 4;
+				uint32_t info = v4 ? 108 : 40;
+				uint32_t rowBytes = v4 ? w * 4 : (w * 3 + ((-w * 3) & 3));
+
+				std::vector<uint8_t> header;
+				Put16(header, 0x4D42);
+				Put32(header, 14 + info + rowBytes * h);
+				Put32(header, 0);
+				Put32(header, 14 + info);
+				Put32(header, info);
+				Put32(header, w);
+				Put32(header, (uint32_t)-h);
+				Put16(header, 1);
+				Put16(header, v4 ? 32 : 24);
+				Put32(header, v4 ? 3 : 0);
+				for (int k = 0; k < 5; k++) {
+					Put32(header, 0);
+				}
+				if (v4) {
+					Put32(header, 0xFF0000);
+					Put32(header, 0xFF00);
+					Put32(header, 0xFF);
+					Put32(header, 0xFF000000u);
+					header.resize(14 + info, 0);
+				}
+				return fwrite(header.data(), 1, header.size(), file) == header.size();
+			}
+
+		private:
+			static void Put16(std::vector<uint8_t>& out, uint32_t v)
+			{
+				out.push_back((uint8_t)v);
+				out.push_back((uint8_t)(v >> 8));
+			}
+
+			static void Put32(std::vector<uint8_t>& out, uint32_t v)
+			{
+				Put16(out, v);
+				Put16(out, v >> 16);
+			}
+
+			std::vector<uint8_t> row;
+		};
+
+		// Rows are encoded as they arrive, through a buffer flushed to the file whenever less
+		// than a worst-case row is left. QOI has no gray formats, so gray is stored as RGB
+		// and gray + alpha as RGBA.
+		class QoiWriter : public FileWriter {
+		public:
+			using FileWriter::FileWriter;
+
+			bool WriteRows(const uint8_t* data, size_t stride, int rows) override
+			{
+				int qoiChannels = QoiChannels();
+				size_t rowChunks = (size_t)w * QOI_MAX_CHUNK;
+				if (buffer.empty()) {
+					buffer.resize(rowChunks > QOI_BUFFER_BYTES ? rowChunks : QOI_BUFFER_BYTES);
+					if (qoiChannels != channels) {
+						row.resize((size_t)w * qoiChannels);
+					}
+				}
+
+				for (int y = 0; y < rows; y++) {
+					const uint8_t* src = data + (size_t)y * stride;
+					if (qoiChannels != channels) {
+						ConvertPixels(src, channels, row.data(), qoiChannels, w);
+						src = row.data();
+					}
+					if (buffer.size() - used < rowChunks && !Flush()) {
+						return false;
+					}
+					used = encoder.EncodeRow(src, w, qoiChannels, buffer.data() + used) - buffer.data();
+				}
+				written += rows;
+				return true;
+			}
+
+			bool Finish() override
+			{
+				uint8_t tail[1 + QOI_END_SIZE];
+				size_t tailBytes = encoder.Finish(tail) - tail;
+				bool flushed = Flush() && fwrite(tail, 1, tailBytes, file) == tailBytes;
+				return FileWriter::Finish() && flushed;
+			}
+
+		protected:
+			bool WriteHeader() override
+			{
+				uint8_t header[QOI_HEADER_SIZE];
+				QoiWriteHeader(header, w, h, QoiChannels());
+				return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+			}
+
+		private:
+			int QoiChannels() const
+			{
+				return channels == 2 || channels == 4 ? 4 : 3;
+			}
+
+			bool Flush()
+			{
+				bool flushed = fwrite(buffer.data(), 1, used, file) == used;
+				used = 0;
+				return flushed;
+			}
+
+			QoiEncoder encoder;
+			std::vector<uint8_t> buffer;
+			std::vector<uint8_t> row;
+			size_t used = 0;
+		};
+
+		// Each strip is filtered and compressed as it arrives and written as IDAT chunks
+		// (PngEncoder, Png.h), so only the rows of an unfinished 256 KB strip are held.
+		class PngWriter : public FileWriter {
+		public:
+			PngWriter(int w, int h, int channels, const PngOptions& options)
+				: FileWriter(w, h, channels),
+				encoder(w, h, channels, options, [this](const uint8_t* data, size_t size) {
+					return fwrite(data, 1, size, file) == size;
+				}) {}
+
+			bool WriteRows(const uint8_t* data, size_t stride, int rows) override
+			{
+				if (!encoder.EncodeRows(data, stride, rows)) {
+					return false;
+				}
+				written += rows;
+				return true;
+			}
+
+			bool Finish() override
+			{
+				bool ended = encoder.Finish();
+				return FileWriter::Finish() && ended;
+			}
+
+		protected:
+			bool WriteHeader() override
+			{
+				return encoder.Begin();
+			}
+
+		private:
+			PngEncoder encoder;
+		};
+
+		// JPG and TGA are encoded by stb_image_write, which needs the whole image.
+		class BufferedWriter : public StripWriter {
+		public:
+			BufferedWriter(const char* filename, ImageType type, int w, int h, int channels)
+				: filename(filename), type(type), w(w), h(h), channels(channels) {}
+
+			bool WriteRows(const uint8_t* data, size_t stride, int rows) override
+			{
+				size_t rowBytes = (size_t)w * channels;
+				for (int y = 0; y < rows; y++) {
+					const uint8_t* src = data + (size_t)y * stride;
+					pixels.insert(pixels.end(), src, src + rowBytes);
+				}
+				return true;
+			}
+
+			bool Finish() override
+			{
+				if (pixels.size() != (size_t)w * h * channels) {
+					return false;
+				}
+				if (type == ImageType::JPG) {
+					return stbi_write_jpg(filename.c_str(), w, h, channels, pixels.data(), 100) != 0;
+				}
+				return stbi_write_tga(filename.c_str(), w, h, channels, pixels.data()) != 0;
+			}
+
+		private:
+			std::string filename;
+			ImageType type;
+			int w;
+			int h;
+			int channels;
+			std::vector<uint8_t> pixels;
+		};
+	}
+
+	std::unique_ptr<StripReader> OpenStripReader(const char* filename)
+	{
+		std::unique_ptr<RawReader> raw(new RawReader());
+		if (raw->Open(filename)) {
+			return raw;
+		}
+
+		std::unique_ptr<PnmReader> pnm(new PnmReader());
+		if (pnm->Open(filename)) {
+			return pnm;
+		}
+
+		std::unique_ptr<QoiReader> qoi(new QoiReader());
+		if (qoi->Open(filename)) {
+			return qoi;
+		}
+
+		std::unique_ptr<StbReader> stb(new StbReader());
+		if (stb->Open(filename)) {
+			return stb;
+		}
+
+		printf("Failed to read %s\n", filename);
+		return nullptr;
+	}
+
+	std::unique_ptr<StripWriter> CreateStripWriter(const char* filename, int w, int h, int channels,
+		const PngOptions& png)
+	{
+		ImageType type = Image::GetImageType(filename);
+		if (type == ImageType::JPG || type == ImageType::TGA) {
+			return std::unique_ptr<StripWriter>(new BufferedWriter(filename, type, w, h, channels));
+		}
+
+		std::unique_ptr<FileWriter> writer;
+		if (type == ImageType::PNG) {
+			writer.reset(new PngWriter(w, h, channels, png));
+		}
+		else if (type == ImageType::PNM) {
+			writer.reset(new PnmWriter(w, h, channels));
+		}
+		else if (type == ImageType::RAW) {
+			writer.reset(new RawWriter(w, h, channels));
+		}
+		else if (type == ImageType::QOI) {
+			writer.reset(new QoiWriter(w, h, channels));
+		}
+		else {
+			writer.reset(new BmpWriter(w, h, channels));
+		}
+		if (!writer->Open(filename)) {
+			printf("Failed to write %s\n", filename);
+			return nullptr;
+		}
+		return writer;
+	}
+
+	// Receives rows [y, y + rows) in order and passes finished rows to the next stage,
+	// either straight away or, when it needs rows below them, once those have arrived.
+	typedef std::function<bool(uint8_t* data, size_t stride, int y, int rows)> RowSink;
+
+	class StripStage {
+	public:
+		virtual ~StripStage() {}
+
+		virtual bool Start(int w, int h, int channels)
+		{
+			this->w = w;
+			this->h = h;
+			this->channels = channels;
+			return true;
+		}
+
+		virtual bool Push(uint8_t* data, size_t stride, int y, int rows, const RowSink& next) = 0;
+
+	protected:
+		int w = 0;
+		int h = 0;
+		int channels = 0;
+	};
+
+	namespace {
+		class PointwiseStage : public StripStage {
+		public:
+			PointwiseStage(StripOperation operation, const ExecutionPolicy& policy, int minChannels = 1)
+				: operation(operation), policy(policy), minChannels(minChannels) {}
+
+			bool Start(int w, int h, int channels) override
+			{
+				if (channels < minChannels) {
+					printf("Given image has less than %d channels. This image has %d channels\n", minChannels, channels);
+					return false;
+				}
+				return StripStage::Start(w, h, channels);
+			}
+
+			bool Push(uint8_t* data, size_t stride, int y, int rows, const RowSink& next) override
+			{
+				ParallelRows(rows, stride, policy, [&](int y0, int y1) {
+					operation(data + (size_t)y0 * stride, w, y1 - y0, channels, stride, y + y0);
+				});
+				return next(data, stride, y, rows);
+			}
+
+		private:
+			StripOperation operation;
+			ExecutionPolicy policy;
+			int minChannels;
+		};
+
+		// Keeps the source rows the kernel still needs in a window: the halo above the
+		// next output row and everything received since. An output row is emitted once the
+		// rows below it that the kernel reads have arrived.
+		class ConvolutionStage : public StripStage {
+		public:
+			ConvolutionStage(uint32_t kw, uint32_t kh, const double* kernel, uint32_t cr, uint32_t cc,
+				BorderMode border, const ExecutionPolicy& policy)
+				: kernel(kernel, kernel + (size_t)kw * kh), kw(kw), kh(kh), cr(cr), cc(cc),
+				border(border), policy(policy) {}
+
+			bool Start(int w, int h, int channels) override
+			{
+				window.clear();
+				windowFirst = 0;
+				windowRows = 0;
+				nextOut = 0;
+				return StripStage::Start(w, h, channels);
+			}
+
+			bool Push(uint8_t* data, size_t stride, int y, int rows, const RowSink& next) override
+			{
+				const size_t rowBytes = (size_t)w * channels;
+				const int above = kh - 1 - cr;
+				const int below = cr;
+
+				window.resize((size_t)(windowRows + rows) * rowBytes);
+				for (int r = 0; r < rows; r++) {
+					memcpy(&window[(size_t)(windowRows + r) * rowBytes], data + (size_t)r * stride, rowBytes);
+				}
+				windowRows += rows;
+
+				int ready = y + rows == h ? h : y + rows - below;
+				if (ready <= nextOut) {
+					return true;
+				}
+
+				out.resize((size_t)(ready - nextOut) * rowBytes);
+				ConvolveRows(window.data(), rowBytes, windowFirst, w, h, channels, 0, channels,
+					kernel.data(), kw, kh, cr, cc, border, out.data(), rowBytes, nextOut, ready - nextOut, policy);
+				bool ok = next(out.data(), rowBytes, nextOut, ready - nextOut);
+				nextOut = ready;
+
+				int keep = nextOut - above;
+				if (keep > windowFirst) {
+					int drop = keep - windowFirst < windowRows ? keep - windowFirst : windowRows;
+					memmove(window.data(), &window[(size_t)drop * rowBytes], (size_t)(windowRows - drop) * rowBytes);
+					windowFirst += drop;
+					windowRows -= drop;
+					window.resize((size_t)windowRows * rowBytes);
+				}
+				return ok;
+			}
+
+		private:
+			std::vector<double> kernel;
+			uint32_t kw;
+			uint32_t kh;
+			uint32_t cr;
+			uint32_t cc;
+			BorderMode border;
+			ExecutionPolicy policy;
+
+			std::vector<uint8_t> window;
+			int windowFirst = 0;
+			int windowRows = 0;
+			int nextOut = 0;
+			std::vector<uint8_t> out;
+		};
+
+		// The diffuser carries its error rows from one strip to the next.
+		class DiffusionStage : public StripStage {
+		public:
+			DiffusionStage(DiffusionKernel kernel, bool serpentine, const ExecutionPolicy& policy)
+				: kernel(kernel), serpentine(serpentine), policy(policy) {}
+
+			bool Start(int w, int h, int channels) override
+			{
+				diffuser.reset(new ErrorDiffuser(w, kernel, serpentine, policy));
+				return StripStage::Start(w, h, channels);
+			}
+
+			bool Push(uint8_t* data, size_t stride, int y, int rows, const RowSink& next) override
+			{
+				diffuser->DitherRows(data, channels, stride, rows);
+				return next(data, stride, y, rows);
+			}
+
+		private:
+			DiffusionKernel kernel;
+			bool serpentine;
+			ExecutionPolicy policy;
+			std::unique_ptr<ErrorDiffuser> diffuser;
+		};
+	}
+
+	StripPipeline::StripPipeline(const ExecutionPolicy& policy, int stripRows) : policy(policy), stripRows(stripRows) {}
+
+	StripPipeline::~StripPipeline() {}
+
+	StripPipeline& StripPipeline::Pointwise(StripOperation operation)
+	{
+		stages.emplace_back(new PointwiseStage(operation, policy));
+		return *this;
+	}
+
+	StripPipeline& StripPipeline::GrayscaleAverage()
+	{
+		stages.emplace_back(new PointwiseStage([](uint8_t* data, int w, int rows, int channels, size_t stride, int) {
+			GrayscaleRows(data, w, rows, channels, stride, GrayscaleMethodAverage);
+		}, policy, 3));
+		return *this;
+	}
+
+	StripPipeline& StripPipeline::GrayscaleLum()
+	{
+		stages.emplace_back(new PointwiseStage([](uint8_t* data, int w, int rows, int channels, size_t stride, int) {
+			GrayscaleRows(data, w, rows, channels, stride, GrayscaleMethodLum);
+		}, policy, 3));
+		return *this;
+	}
+
+	StripPipeline& StripPipeline::Convolve(uint32_t kernelWidth, uint32_t kernelHeight, const double kernel[],
+		uint32_t cr, uint32_t cc, BorderMode border)
+	{
+		stages.emplace_back(new ConvolutionStage(kernelWidth, kernelHeight, kernel, cr, cc, border, policy));
+		return *this;
+	}
+
+	StripPipeline& StripPipeline::DitherThreshold(uint8_t threshold)
+	{
+		return Pointwise([threshold](uint8_t* data, int w, int rows, int channels, size_t stride, int) {
+			DitherThresholdRows(data, w, rows, channels, stride, threshold);
+		});
+	}
+
+	StripPipeline& StripPipeline::DitherRandom(uint64_t seed)
+	{
+		return Pointwise([seed](uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow) {
+			DitherRandomRows(data, w, rows, channels, stride, firstRow, seed);
+		});
+	}
+
+	StripPipeline& StripPipeline::DitherOrdered(OrderedMatrix matrix)
+	{
+		return Pointwise([matrix](uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow) {
+			DitherOrderedRows(data, w, rows, channels, stride, firstRow, matrix);
+		});
+	}
+
+	StripPipeline& StripPipeline::DitherErrorDiffusion(DiffusionKernel kernel, bool serpentine)
+	{
+		stages.emplace_back(new DiffusionStage(kernel, serpentine, policy));
+		return *this;
+	}
+
+	bool StripPipeline::Run(StripReader& reader, StripWriter& writer)
+	{
+		const int w = reader.Width();
+		const int h = reader.Height();
+		const int channels = reader.Channels();
+		const size_t rowBytes = (size_t)w * channels;
+
+		for (std::unique_ptr<StripStage>& stage : stages) {
+			if (!stage->Start(w, h, channels)) {
+				return false;
+			}
+		}
+
+		// sinks[i] feeds stage i; the last one hands rows to the writer.
+		std::vector<RowSink> sinks(stages.size() + 1);
+		sinks[stages.size()] = [&writer](uint8_t* data, size_t stride, int, int rows) {
+			return writer.WriteRows(data, stride, rows);
+		};
+		for (size_t i = stages.size(); i-- > 0;) {
+			StripStage* stage = stages[i].get();
+			const RowSink& next = sinks[i + 1];
+			sinks[i] = [stage, &next](uint8_t* data, size_t stride, int y, int rows) {
+				return stage->Push(data, stride, y, rows, next);
+			};
+		}
+
+		int rows = stripRows;
+		if (rows <= 0) {
+			rows = (int)(STRIP_BYTES / (rowBytes > 0 ? rowBytes : 1));
+			rows = rows < MIN_STRIP_ROWS ? MIN_STRIP_ROWS : rows;
+		}
+		std::vector<uint8_t> strip((size_t)rows * rowBytes);
+
+		for (int y = 0; y < h; y += rows) {
+			int count = h - y < rows ? h - y : rows;
+			if (!reader.ReadRows(strip.data(), rowBytes, count)) {
+				printf("Failed to read rows %d to %d\n", y, y + count);
+				return false;
+			}
+			if (!sinks[0](strip.data(), rowBytes, y, count)) {
+				printf("Failed to write rows %d to %d\n", y, y + count);
+				return false;
+			}
+		}
+		return writer.Finish();
+	}
+
+	bool StripPipeline::Run(const char* input, const char* output)
+	{
+		std::unique_ptr<StripReader> reader = OpenStripReader(input);
+		if (!reader) {
+			return false;
+		}
+		PngOptions png;
+		png.policy = policy;
+		std::unique_ptr<StripWriter> writer = CreateStripWriter(output, reader->Width(), reader->Height(),
+			reader->Channels(), png);
+		if (!writer) {
+			return false;
+		}
+		return Run(*reader, *writer);
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Image.h"
+#include "Png.h"
+
+namespace ImageGene {
+	// Source of an image's rows, delivered top to bottom in strips.
+	class StripReader {
+	public:
+		virtual ~StripReader() {}
+
+		int Width() const { return w; }
+		int Height() const { return h; }
+		int Channels() const { return channels; }
+
+		// Reads the next `rows` rows into data, one row every `stride` bytes.
+		virtual bool ReadRows(uint8_t* data, size_t stride, int rows) = 0;
+
+	protected:
+		int w = 0;
+		int h = 0;
+		int channels = 0;
+	};
+
+	// Destination of an image's rows, accepted top to bottom in strips.
+	class StripWriter {
+	public:
+		virtual ~StripWriter() {}
+
+		virtual bool WriteRows(const uint8_t* data, size_t stride, int rows) = 0;
+
+		// Completes the file once every row has been written.
+		virtual bool Finish() = 0;
+	};
+
+	// .igr files are read from a mapping, and binary PNM files (P5, P6 and P7 with 8-bit
+	// samples) and QOI files from the file, as rows are requested.
+	// Anything else is decoded whole by stb_image and then handed out in strips.
+	std::unique_ptr<StripReader> OpenStripReader(const char* filename);
+
+	// .igr, PNM, BMP, QOI and PNG files are encoded as rows arrive, PNG with the given
+	// options. JPG and TGA rows are collected and encoded in Finish by stb_image_write, so
+	// those outputs are not bounded in memory.
+	std::unique_ptr<StripWriter> CreateStripWriter(const char* filename, int w, int h, int channels,
+		const PngOptions& png = PngOptions());
+
+	// Operation on the rows of one strip; data points at image row firstRow.
+	typedef std::function<void(uint8_t* data, int w, int rows, int channels, size_t stride, int firstRow)> StripOperation;
+
+	class StripStage;
+
+	// Chain of operations run over an image a strip at a time, from a reader to a writer.
+	// Each stage holds at most a strip plus, for convolutions, the halo rows the kernel
+	// reads above and below it, so memory use does not depend on the image height.
+	// Output is identical to running the same operations on the whole image.
+	class StripPipeline {
+	public:
+		// stripRows == 0 picks strips of about 4 MB.
+		explicit StripPipeline(const ExecutionPolicy& policy = Sequential, int stripRows = 0);
+		~StripPipeline();
+
+		StripPipeline& Pointwise(StripOperation operation);
+		StripPipeline& GrayscaleAverage();
+		StripPipeline& GrayscaleLum();
+		StripPipeline& Convolve(uint32_t kernelWidth, uint32_t kernelHeight, const double kernel[],
+			uint32_t cr, uint32_t cc, BorderMode border = BorderClamp);
+		StripPipeline& DitherThreshold(uint8_t threshold = 0x7F);
+		StripPipeline& DitherRandom(uint64_t seed);
+		StripPipeline& DitherOrdered(OrderedMatrix matrix = Bayer8x8);
+		StripPipeline& DitherErrorDiffusion(DiffusionKernel kernel, bool serpentine = false);
+
+		bool Run(StripReader& reader, StripWriter& writer);
+		bool Run(const char* input, const char* output);
+
+	private:
+		ExecutionPolicy policy;
+		int stripRows;
+		std::vector<std::unique_ptr<StripStage>> stages;
+	};
+}
@@ -0,0 +1,281 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "ThreadPool.h"
+
+namespace ImageGene {
+	namespace {
+		const size_t BAND_BYTES = 256 * 1024;
+		const int BANDS_PER_THREAD = 4;
+
+		// A participant's share of a ParallelFor: chunk indices [first, last) packed in
+		// one word so the owner (taking from the front) and thieves (taking from the
+		// back) agree on every split with a single compare-and-swap.
+		class ChunkRange {
+		public:
+			void Assign(uint32_t first, uint32_t last)
+			{
+				range.store(Pack(first, last), std::memory_order_relaxed);
+			}
+
+			bool TakeFront(uint32_t* chunk)
+			{
+				uint64_t current = range.load(std::memory_order_acquire);
+				while (First(current) < Last(current)) {
+					if (range.compare_exchange_weak(current, Pack(First(current) + 1, Last(current)))) {
+						*chunk = First(current);
+						return true;
+					}
+				}
+				return false;
+			}
+
+			bool TakeBack(uint32_t* chunk)
+			{
+				uint64_t current = range.load(std::memory_order_acquire);
+				while (First(current) < Last(current)) {
+					if (range.compare_exchange_weak(current, Pack(First(current), Last(current) - 1))) {
+						*chunk = Last(current) - 1;
+						return true;
+					}
+				}
+				return false;
+			}
+
+		private:
+			static uint64_t Pack(uint32_t first, uint32_t last) { return ((uint64_t)last << 32) | first; }
+			static uint32_t First(uint64_t packed) { return (uint32_t)packed; }
+			static uint32_t Last(uint64_t packed) { return (uint32_t)(packed >> 32); }
+
+			std::atomic<uint64_t> range;
+		};
+
+		struct ForJob {
+			int begin;
+			int end;
+			int grain;
+			std::function<void(int, int)> body;
+
+			std::unique_ptr<ChunkRange[]> ranges;
+			uint32_t participants;
+			std::atomic<uint32_t> joined;
+			std::atomic<uint32_t> remaining;
+
+			std::mutex mutex;
+			std::condition_variable done;
+
+			void Participate(uint32_t self)
+			{
+				uint32_t chunk;
+				for (;;) {
+					bool found = ranges[self].TakeFront(&chunk);
+					for (uint32_t k = 1; !found && k < participants; k++) {
+						found = ranges[(self + k) % participants].TakeBack(&chunk);
+					}
+					if (!found) {
+						return;
+					}
+
+					int first = begin + (int)chunk * grain;
+					int last = end - first > grain ? first + grain : end;
+					body(first, last);
+
+					if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+						std::lock_guard<std::mutex> lock(mutex);
+						done.notify_all();
+					}
+				}
+			}
+		};
+	}
+
+	struct ThreadPool::Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	struct ThreadPool::State {
+		std::vector<std::thread> threads;
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		size_t pending = 0;
+		bool stopping = false;
+
+		std::atomic<uint32_t> next{ 0 };
+	};
+
+	ThreadPool::ThreadPool(uint32_t workers) : state(new State())
+	{
+		for (uint32_t i = 0; i < workers; i++) {
+			queues.emplace_back(new Queue());
+		}
+		for (uint32_t i = 0; i < workers; i++) {
+			state->threads.emplace_back(&ThreadPool::Run, this, i);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->stopping = true;
+		}
+		state->wake.notify_all();
+		for (std::thread& thread : state->threads) {
+			thread.join();
+		}
+	}
+
+	ThreadPool& ThreadPool::Shared()
+	{
+		static ThreadPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+		return pool;
+	}
+
+	uint32_t ThreadPool::Workers() const
+	{
+		return (uint32_t)queues.size();
+	}
+
+	uint32_t ThreadPool::Concurrency(const ExecutionPolicy& policy) const
+	{
+		uint32_t available = Workers() + 1;
+		if (policy.threads == 0 || policy.threads > available) {
+			return available;
+		}
+		return policy.threads;
+	}
+
+	void ThreadPool::Submit(std::function<void()> task)
+	{
+		if (queues.empty()) {
+			task();
+			return;
+		}
+
+		uint32_t index = state->next.fetch_add(1, std::memory_order_relaxed) % queues.size();
+		{
+			std::lock_guard<std::mutex> lock(queues[index]->mutex);
+			queues[index]->tasks.push_back(std::move(task));
+		}
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->pending++;
+		}
+		state->wake.notify_one();
+	}
+
+	bool ThreadPool::Take(uint32_t index, std::function<void()>& task)
+	{
+		for (size_t k = 0; k < queues.size(); k++) {
+			Queue& queue = *queues[(index + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tasks.empty()) {
+				continue;
+			}
+			if (k == 0) {
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+			}
+			else {
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+			}
+			return true;
+		}
+		return false;
+	}
+
+	void ThreadPool::Run(uint32_t index)
+	{
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(state->mutex);
+				state->wake.wait(lock, [this] { return state->stopping || state->pending > 0; });
+				if (state->pending == 0) {
+					return;
+				}
+				state->pending--;
+			}
+
+			// pending counts queued tasks, so one is guaranteed to be found.
+			std::function<void()> task;
+			while (!Take(index, task)) {
+				std::this_thread::yield();
+			}
+			task();
+		}
+	}
+
+	void ThreadPool::ParallelFor(int begin, int end, int grain, uint32_t threads,
+		const std::function<void(int, int)>& body)
+	{
+		if (end <= begin) {
+			return;
+		}
+		if (grain < 1) {
+			grain = 1;
+		}
+
+		uint32_t chunks = (uint32_t)((end - begin + grain - 1) / grain);
+		uint32_t participants = Concurrency({ threads });
+		if (participants > chunks) {
+			participants = chunks;
+		}
+		if (participants <= 1) {
+			body(begin, end);
+			return;
+		}
+
+		std::shared_ptr<ForJob> job = std::make_shared<ForJob>();
+		job->begin = begin;
+		job->end = end;
+		job->grain = grain;
+		job->body = body;
+		job->participants = participants;
+		job->joined = 1;
+		job->remaining = chunks;
+		job->ranges.reset(new ChunkRange[participants]);
+		for (uint32_t p = 0; p < participants; p++) {
+			job->ranges[p].Assign(chunks * p / participants, chunks * (p + 1) / participants);
+		}
+
+		// Helpers hold a reference to the job, so one that starts after the work is
+		// finished simply finds nothing to take.
+		for (uint32_t p = 1; p < participants; p++) {
+			Submit([job] {
+				job->Participate(job->joined.fetch_add(1, std::memory_order_relaxed) % job->participants);
+			});
+		}
+
+		job->Participate(0);
+
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->done.wait(lock, [&job] { return job->remaining.load(std::memory_order_acquire) == 0; });
+	}
+
+	void ParallelRows(int h, size_t rowBytes, const ExecutionPolicy& policy,
+		const std::function<void(int, int)>& body)
+	{
+		ThreadPool& pool = ThreadPool::Shared();
+		uint32_t threads = pool.Concurrency(policy);
+		if (threads <= 1 || h <= 1) {
+			body(0, h);
+			return;
+		}
+
+		int grain = (int)(BAND_BYTES / (rowBytes > 0 ? rowBytes : 1));
+		int balanced = (h + threads * BANDS_PER_THREAD - 1) / (threads * BANDS_PER_THREAD);
+		if (grain > balanced) {
+			grain = balanced;
+		}
+		if (grain < 1) {
+			grain = 1;
+		}
+		pool.ParallelFor(0, h, grain, threads, body);
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace ImageGene {
+	// How an operation spreads its rows over threads. threads == 1 runs on the calling
+	// thread only, threads == 0 uses every hardware thread, any other value caps the
+	// number of threads (the caller included) that work on the operation.
+	struct ExecutionPolicy {
+		uint32_t threads;
+	};
+
+	const ExecutionPolicy Sequential = { 1 };
+	const ExecutionPolicy Parallel = { 0 };
+
+	inline ExecutionPolicy Threads(uint32_t count)
+	{
+		return { count == 0 ? 1 : count };
+	}
+
+	// Fixed set of workers, each with its own task deque. Workers take tasks from the
+	// front of their own deque and steal from the back of the others' when idle.
+	class ThreadPool {
+	public:
+		explicit ThreadPool(uint32_t workers);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Process-wide pool with one worker per hardware thread besides the caller.
+		static ThreadPool& Shared();
+
+		uint32_t Workers() const;
+
+		// Number of threads a policy resolves to on this pool, caller included.
+		uint32_t Concurrency(const ExecutionPolicy& policy) const;
+
+		void Submit(std::function<void()> task);
+
+		// Calls body(first, last) on consecutive chunks of at most grain indices covering
+		// [begin, end), using at most `threads` threads including the caller, and returns
+		// once every chunk has run. Idle participants steal chunks from busy ones.
+		void ParallelFor(int begin, int end, int grain, uint32_t threads,
+			const std::function<void(int, int)>& body);
+
+	private:
+		struct Queue;
+		struct State;
+
+		void Run(uint32_t index);
+		bool Take(uint32_t index, std::function<void()>& task);
+
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::unique_ptr<State> state;
+	};
+
+	// Splits h rows into bands of roughly cache-sized work and runs body(y0, y1) on
+	// them under the given policy.
+	void ParallelRows(int h, size_t rowBytes, const ExecutionPolicy& policy,
+		const std::function<void(int, int)>& body);
+}
@@ -0,0 +1,107 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+
+#include "Thumbnail.h"
+#include "Resize.h"
+
+namespace ImageGene {
+	ImagePyramid::ImagePyramid(const ImageView& image, int minW, int minH, const ExecutionPolicy& policy)
+		: image(image)
+	{
+		ImageView level = image;
+		while ((level.w > 1 || level.h > 1) && HalfSize(level.w) >= minW && HalfSize(level.h) >= minH) {
+			Image next(HalfSize(level.w), HalfSize(level.h), level.channels);
+			HalvePixels(level, ImageView(next.data, next.w, next.h, next.channels, (size_t)next.w * next.channels), policy);
+			levels.push_back(std::move(next));
+			level = Level(Levels() - 1);
+		}
+	}
+
+	ImageView ImagePyramid::Level(int level) const
+	{
+		if (level == 0) {
+			return image;
+		}
+		const Image& reduced = levels[level - 1];
+		return ImageView(reduced.data, reduced.w, reduced.h, reduced.channels, (size_t)reduced.w * reduced.channels);
+	}
+
+	int ImagePyramid::Closest(int w, int h) const
+	{
+		for (int level = Levels() - 1; level > 0; level--) {
+			if (levels[level - 1].w >= w && levels[level - 1].h >= h) {
+				return level;
+			}
+		}
+		return 0;
+	}
+
+	void ImagePyramid::Resize(const ImageView& dst, ResizeFilter filter, const ExecutionPolicy& policy) const
+	{
+		int level = Closest(2 * dst.w, 2 * dst.h);
+		ResizeReduced(Level(level), ldexp(image.w, -level), ldexp(image.h, -level), dst, filter, policy);
+	}
+
+	void FitInside(int w, int h, int boxW, int boxH, int* fitW, int* fitH)
+	{
+		if (w <= boxW && h <= boxH) {
+			*fitW = w;
+			*fitH = h;
+			return;
+		}
+		double scale = fmin((double)boxW / w, (double)boxH / h);
+		*fitW = (int)lround(w * scale);
+		*fitH = (int)lround(h * scale);
+		*fitW = *fitW < 1 ? 1 : *fitW;
+		*fitH = *fitH < 1 ? 1 : *fitH;
+	}
+
+	std::vector<Image> MakeThumbnails(const Image& image, const std::vector<ThumbnailSpec>& specs,
+		ResizeFilter filter, const ExecutionPolicy& policy)
+	{
+		std::vector<Image> thumbnails;
+		int minW = image.w;
+		int minH = image.h;
+		for (const ThumbnailSpec& spec : specs) {
+			int w, h;
+			FitInside(image.w, image.h, spec.w < 1 ? 1 : spec.w, spec.h < 1 ? 1 : spec.h, &w, &h);
+			thumbnails.emplace_back(w, h, image.channels);
+			minW = w < minW ? w : minW;
+			minH = h < minH ? h : minH;
+		}
+
+		std::unique_ptr<Image> copy;
+		ImagePyramid pyramid(SourceView(image, copy), 2 * minW, 2 * minH, policy);
+		for (Image& thumbnail : thumbnails) {
+			pyramid.Resize(ImageView(thumbnail), filter, policy);
+		}
+		return thumbnails;
+	}
+
+	bool WriteThumbnails(const char* input, const std::vector<ThumbnailSpec>& specs,
+		ResizeFilter filter, const PngOptions& png, const ExecutionPolicy& policy)
+	{
+		std::vector<Image> thumbnails;
+		{
+			Image image(input);
+			if (image.data == nullptr) {
+				return false;
+			}
+			thumbnails = MakeThumbnails(image, specs, filter, policy);
+		}
+
+		std::atomic<bool> written(true);
+		ThreadPool& pool = ThreadPool::Shared();
+		pool.ParallelFor(0, (int)thumbnails.size(), 1, pool.Concurrency(policy), [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				if (!thumbnails[i].Write(specs[i].filename.c_str(), png)) {
+					printf("Failed to write thumbnail %s\n", specs[i].filename.c_str());
+					written = false;
+				}
+			}
+		});
+		return written;
+	}
+}
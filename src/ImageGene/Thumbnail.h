@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Image.h"
+#include "Png.h"
+
+namespace ImageGene {
+	// Mip-style chain of 2:1 box reductions (HalvePixels) of one image. Level 0 is the
+	// image itself, which is viewed, not copied, and must outlive the pyramid; level
+	// i + 1 is made from level i, so the full-size pixels are read once however many
+	// levels there are, and each later level reads a quarter of the bytes of the one
+	// before.
+	class ImagePyramid {
+	public:
+		// Halves down to the last level that is still at least minW x minH, or until a
+		// level is 1 x 1.
+		ImagePyramid(const ImageView& image, int minW, int minH, const ExecutionPolicy& policy = Sequential);
+
+		int Levels() const { return (int)levels.size() + 1; }
+		ImageView Level(int level) const;
+
+		// The smallest level that is at least w x h: the closest one to resample down from.
+		int Closest(int w, int h) const;
+
+		// Resamples the closest level to at least twice dst's size to fill dst, placing
+		// samples by the size of level 0 (ResizeReduced). That is the level ResizePixels
+		// halves down to before filtering, so the result is byte-identical to resizing
+		// level 0, and the filter still reduces by 2x or more, which a 2x2 box
+		// reduction alone would alias.
+		void Resize(const ImageView& dst, ResizeFilter filter = ResizeLanczos,
+			const ExecutionPolicy& policy = Sequential) const;
+
+	private:
+		ImageView image;
+		std::vector<Image> levels;
+	};
+
+	// Size of an image w x h scaled to fit inside boxW x boxH with its aspect ratio kept,
+	// rounded to the nearest pixel and at least 1 x 1. Images that already fit keep
+	// their size.
+	void FitInside(int w, int h, int boxW, int boxH, int* fitW, int* fitH);
+
+	struct ThumbnailSpec {
+		int w;
+		int h;
+		std::string filename;
+	};
+
+	// Thumbnails that fit inside each spec's w x h, each made by ImagePyramid::Resize from
+	// one pyramid, so identical to Resize of the image. The pyramid and each resize run
+	// under policy.
+	std::vector<Image> MakeThumbnails(const Image& image, const std::vector<ThumbnailSpec>& specs,
+		ResizeFilter filter = ResizeLanczos, const ExecutionPolicy& policy = Sequential);
+
+	// Reads input once and writes one thumbnail per spec to its filename, in the format
+	// of its extension. The thumbnails are encoded in parallel with each other, on as
+	// many threads as policy allows; png applies to PNG outputs. Prints and returns false
+	// if the input cannot be read or any output cannot be written.
+	bool WriteThumbnails(const char* input, const std::vector<ThumbnailSpec>& specs,
+		ResizeFilter filter = ResizeLanczos, const PngOptions& png = PngOptions(),
+		const ExecutionPolicy& policy = Sequential);
+}
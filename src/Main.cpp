@@ -1,24 +1,484 @@
-#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
-#include "ImageGene/IGFont.h"
 #include "ImageGene/Image.h"
+#include "ImageGene/PipelineSpec.h"
+#include "ImageGene/Png.h"
 
-int main() {
-	ImageGene::Image test1("david.png");
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
 
-	ImageGene::Image test2 = test1;
-	ImageGene::DitherRandom(&test2);
-	test2.Write("david_ditherrandom.png");
+namespace {
+	const char* const USAGE =
+		"Usage: Imager -p SPEC -o DIR [options] INPUT...\n"
+		"Runs the operations in SPEC on every input image and writes the results to DIR.\n"
+		"INPUT is an image file or a directory of them.\n"
+		"\n"
+		"  -p, --pipeline SPEC  operations, e.g. \"grayscale-lum; crop:0,0,512,512; dither-ordered:bayer8\"\n"
+		"                       (see src/ImageGene/PipelineSpec.h for the full list)\n"
+		"  -o, --output DIR     output directory; inputs found in a directory keep their\n"
+		"                       path relative to it\n"
+		"  -f, --format EXT     output format: png, jpg, bmp, tga, pgm, ppm, pam, pnm, igr or qoi\n"
+		"                       (default: the input's, png if it cannot be written)\n"
+		"  -j, --jobs N         worker threads (default: one per hardware thread)\n"
+		"  -q, --queue N        images decoded but not yet encoded, at most (default: 2 x jobs)\n"
+		"  -t, --threads N      threads each operation and PNG encode may use on one image\n"
+		"                       (default: 1)\n"
+		"  -r, --recursive      also take images from subdirectories\n"
+		"  -s, --suffix TEXT    appended to each output file name before the extension\n"
+		"  -z, --png-level N    PNG compression level, 0 to 9 (default: 5)\n"
+		"      --png-filter F   PNG row filter: none, sub, up, average, paeth or adaptive\n"
+		"                       (default: adaptive)\n"
+		"      --fast           PNG filter up at level 1, for intermediate files\n"
+		"  -h, --help           show this message\n";
 
-	ImageGene::Image test3 = test1;
-	ImageGene::DitherThreshold(&test3);
-	test3.Write("david_ditherthreshold.png");
-	
-	ImageGene::Image test4 = test1;
-	ImageGene::DitherFloydSteinberg(&test4);
-	test4.Write("david_ditherfloyd.png");
+	const char* const READABLE[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".pgm", ".ppm", ".pam", ".pnm", ".igr", ".qoi" };
+	const char* const WRITABLE[] = { ".png", ".jpg", ".bmp", ".tga", ".pgm", ".ppm", ".pam", ".pnm", ".igr", ".qoi" };
+	const char* const PNG_FILTERS[] = { "none", "sub", "up", "average", "paeth", "adaptive" };
 
-	std::getchar();
+	struct Options {
+		std::string pipeline;
+		std::string output;
+		std::string format;
+		std::string suffix;
+		std::vector<std::string> inputs;
+		unsigned jobs = 0;
+		unsigned queue = 0;
+		unsigned threads = 1;
+		bool recursive = false;
+		ImageGene::PngOptions png;
+	};
 
+	struct Task {
+		fs::path input;
+		fs::path output;
+	};
+
+	// Time each stage took for one image, and the time from the start of its decode to
+	// the end of its encode, waits in between included.
+	struct Timing {
+		double decode = 0;
+		double process = 0;
+		double encode = 0;
+		double latency = 0;
+		bool ok = false;
+		uint64_t pixels = 0;
+	};
+
+	std::string Lower(std::string text)
+	{
+		for (char& c : text) {
+			c = (char)tolower((unsigned char)c);
+		}
+		return text;
+	}
+
+	bool Listed(const std::string& extension, const char* const list[], size_t count)
+	{
+		for (size_t i = 0; i < count; i++) {
+			if (extension == list[i]) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Count(const char* text, unsigned* value)
+	{
+		char* end = nullptr;
+		long parsed = strtol(text, &end, 10);
+		if (*text == '\0' || *end != '\0' || parsed < 1 || parsed > 4096) {
+			return false;
+		}
+		*value = (unsigned)parsed;
+		return true;
+	}
+
+	// Returns 0 to go on, otherwise the exit code.
+	int ParseOptions(int argc, char** argv, Options* options)
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "-h" || arg == "--help") {
+				printf("%s", USAGE);
+				return -1;
+			}
+			if (arg == "-r" || arg == "--recursive") {
+				options->recursive = true;
+				continue;
+			}
+			if (arg == "--fast") {
+				options->png.level = ImageGene::PngFast.level;
+				options->png.filter = ImageGene::PngFast.filter;
+				continue;
+			}
+			if (arg.size() > 1 && arg[0] == '-') {
+				if (i + 1 >= argc) {
+					printf("%s needs a value\n", arg.c_str());
+					return 2;
+				}
+				const char* value = argv[++i];
+				bool valid = true;
+				if (arg == "-p" || arg == "--pipeline") options->pipeline = value;
+				else if (arg == "-o" || arg == "--output") options->output = value;
+				else if (arg == "-f" || arg == "--format") options->format = Lower(value[0] == '.' ? value : std::string(".") + value);
+				else if (arg == "-s" || arg == "--suffix") options->suffix = value;
+				else if (arg == "-j" || arg == "--jobs") valid = Count(value, &options->jobs);
+				else if (arg == "-q" || arg == "--queue") valid = Count(value, &options->queue);
+				else if (arg == "-t" || arg == "--threads") valid = Count(value, &options->threads);
+				else if (arg == "-z" || arg == "--png-level") {
+					char* end = nullptr;
+					options->png.level = (int)strtol(value, &end, 10);
+					if (*value == '\0' || *end != '\0' || options->png.level < 0 || options->png.level > 9) {
+						printf("%s must be 0 to 9, got '%s'\n", arg.c_str(), value);
+						return 2;
+					}
+				}
+				else if (arg == "--png-filter") {
+					size_t filter = 0;
+					while (filter < sizeof(PNG_FILTERS) / sizeof(*PNG_FILTERS) && Lower(value) != PNG_FILTERS[filter]) {
+						filter++;
+					}
+					if (filter == sizeof(PNG_FILTERS) / sizeof(*PNG_FILTERS)) {
+						printf("%s must be none, sub, up, average, paeth or adaptive, got '%s'\n", arg.c_str(), value);
+						return 2;
+					}
+					options->png.filter = (ImageGene::PngFilter)filter;
+				}
+				else {
+					printf("Unknown option %s\n\n%s", arg.c_str(), USAGE);
+					return 2;
+				}
+				if (!valid) {
+					printf("%s must be a count from 1 to 4096, got '%s'\n", arg.c_str(), value);
+					return 2;
+				}
+				continue;
+			}
+			options->inputs.push_back(arg);
+		}
+
+		if (options->pipeline.empty() || options->output.empty() || options->inputs.empty()) {
+			printf("%s", USAGE);
+			return 2;
+		}
+		if (!options->format.empty() && !Listed(options->format, WRITABLE, sizeof(WRITABLE) / sizeof(*WRITABLE))) {
+			printf("Cannot write %s files\n", options->format.c_str());
+			return 2;
+		}
+		return 0;
+	}
+
+	fs::path OutputPath(const Options& options, const fs::path& relative)
+	{
+		std::string extension = options.format;
+		if (extension.empty()) {
+			extension = Lower(relative.extension().string());
+			if (!Listed(extension, WRITABLE, sizeof(WRITABLE) / sizeof(*WRITABLE))) {
+				extension = ".png";
+			}
+		}
+		fs::path output = fs::path(options.output) / relative;
+		output.replace_filename(relative.stem().string() + options.suffix + extension);
+		return output;
+	}
+
+	// Expands directories into the images they contain, in a stable order.
+	bool CollectTasks(const Options& options, std::vector<Task>* tasks)
+	{
+		for (const std::string& input : options.inputs) {
+			std::error_code error;
+			fs::path root(input);
+			if (fs::is_regular_file(root, error)) {
+				tasks->push_back({ root, OutputPath(options, root.filename()) });
+				continue;
+			}
+			if (!fs::is_directory(root, error)) {
+				printf("No such file or directory: %s\n", input.c_str());
+				return false;
+			}
+
+			std::vector<fs::path> found;
+			auto add = [&](const fs::directory_entry& entry) {
+				std::string extension = Lower(entry.path().extension().string());
+				if (entry.is_regular_file() && Listed(extension, READABLE, sizeof(READABLE) / sizeof(*READABLE))) {
+					found.push_back(entry.path());
+				}
+			};
+			if (options.recursive) {
+				for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root, error)) add(entry);
+			}
+			else {
+				for (const fs::directory_entry& entry : fs::directory_iterator(root, error)) add(entry);
+			}
+			if (error) {
+				printf("Failed to list %s: %s\n", input.c_str(), error.message().c_str());
+				return false;
+			}
+			std::sort(found.begin(), found.end());
+			for (const fs::path& path : found) {
+				tasks->push_back({ path, OutputPath(options, path.lexically_relative(root)) });
+			}
+		}
+		return true;
+	}
+
+	double Milliseconds(Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	// Runs every task through decode, process and encode on a fixed set of workers.
+	// Each worker takes the most downstream work available: an image to encode, else
+	// one to process, else the next file to decode, as long as fewer than `queue`
+	// images are held in memory. Stages of different images therefore overlap, and
+	// memory stays bounded however far decoding could get ahead of encoding.
+	class Batch {
+	public:
+		Batch(const std::vector<Task>& tasks, const ImageGene::PipelineSpec& pipeline,
+			const ImageGene::PngOptions& png, unsigned queue)
+			: tasks(tasks), pipeline(pipeline), png(png), queue(queue), timings(tasks.size()) {}
+
+		void Run(unsigned jobs)
+		{
+			std::vector<std::thread> workers;
+			for (unsigned i = 0; i < jobs; i++) {
+				workers.emplace_back([this] { Work(); });
+			}
+			for (std::thread& worker : workers) {
+				worker.join();
+			}
+		}
+
+		const std::vector<Timing>& Timings() const { return timings; }
+
+	private:
+		struct Job {
+			size_t index;
+			ImageGene::Image image;
+			Clock::time_point start;
+		};
+
+		void Work()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true) {
+				if (!processed.empty()) {
+					std::unique_ptr<Job> job = std::move(processed.front());
+					processed.pop_front();
+					lock.unlock();
+					Encode(*job);
+					job.reset();
+					lock.lock();
+					inFlight--;
+					ready.notify_all();
+				}
+				else if (!decoded.empty()) {
+					std::unique_ptr<Job> job = std::move(decoded.front());
+					decoded.pop_front();
+					lock.unlock();
+					Process(*job);
+					lock.lock();
+					processed.push_back(std::move(job));
+					ready.notify_all();
+				}
+				else if (next < tasks.size() && inFlight < queue) {
+					size_t index = next++;
+					inFlight++;
+					lock.unlock();
+					std::unique_ptr<Job> job = Decode(index);
+					lock.lock();
+					if (job) {
+						decoded.push_back(std::move(job));
+					}
+					else {
+						inFlight--;
+					}
+					ready.notify_all();
+				}
+				else if (next == tasks.size() && inFlight == 0) {
+					return;
+				}
+				else {
+					ready.wait(lock);
+				}
+			}
+		}
+
+		std::unique_ptr<Job> Decode(size_t index)
+		{
+			std::unique_ptr<Job> job(new Job{ index, ImageGene::Image(0, 0, 0), Clock::now() });
+			std::string input = tasks[index].input.string();
+			bool ok = job->image.Read(input.c_str());
+			timings[index].decode = Milliseconds(job->start, Clock::now());
+			if (!ok) {
+				printf("Failed to read %s\n", input.c_str());
+				return nullptr;
+			}
+			timings[index].pixels = (uint64_t)job->image.w * job->image.h;
+			return job;
+		}
+
+		void Process(Job& job)
+		{
+			Clock::time_point start = Clock::now();
+			pipeline.Apply(&job.image, png.policy);
+			timings[job.index].process = Milliseconds(start, Clock::now());
+		}
+
+		void Encode(Job& job)
+		{
+			Clock::time_point start = Clock::now();
+			std::string output = tasks[job.index].output.string();
+			bool ok = job.image.Write(output.c_str(), png);
+			Clock::time_point end = Clock::now();
+			timings[job.index].encode = Milliseconds(start, end);
+			timings[job.index].latency = Milliseconds(job.start, end);
+			timings[job.index].ok = ok;
+			if (!ok) {
+				printf("Failed to write %s\n", output.c_str());
+			}
+		}
+
+		const std::vector<Task>& tasks;
+		const ImageGene::PipelineSpec& pipeline;
+		// Its policy is also the one the operations run under.
+		ImageGene::PngOptions png;
+		unsigned queue;
+
+		// Each entry is written only by the worker holding that image.
+		std::vector<Timing> timings;
+
+		std::mutex mutex;
+		std::condition_variable ready;
+		std::deque<std::unique_ptr<Job>> decoded;
+		std::deque<std::unique_ptr<Job>> processed;
+		size_t next = 0;
+		unsigned inFlight = 0;
+	};
+
+	// Nearest-rank percentile of sorted values.
+	double Percentile(const std::vector<double>& sorted, double p)
+	{
+		size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+	}
+
+	void PrintStage(const char* name, std::vector<double> values)
+	{
+		std::sort(values.begin(), values.end());
+		double sum = 0;
+		for (double value : values) {
+			sum += value;
+		}
+		printf("%-8s %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, sum / values.size(),
+			Percentile(values, 50), Percentile(values, 90), Percentile(values, 99), values.back());
+	}
+
+	void Report(const std::vector<Timing>& timings, double seconds, unsigned jobs)
+	{
+		std::vector<double> decode, process, encode, latency;
+		uint64_t pixels = 0;
+		size_t failed = 0;
+		for (const Timing& timing : timings) {
+			if (!timing.ok) {
+				failed++;
+				continue;
+			}
+			decode.push_back(timing.decode);
+			process.push_back(timing.process);
+			encode.push_back(timing.encode);
+			latency.push_back(timing.latency);
+			pixels += timing.pixels;
+		}
+
+		printf("%zu images, %zu failed, in %.2f s on %u workers: %.1f images/s, %.1f megapixels/s\n",
+			decode.size(), failed, seconds, jobs, decode.size() / seconds, pixels / seconds / 1e6);
+		if (decode.empty()) {
+			return;
+		}
+		printf("%-8s %10s %10s %10s %10s %10s\n", "ms", "mean", "p50", "p90", "p99", "max");
+		PrintStage("decode", decode);
+		PrintStage("process", process);
+		PrintStage("encode", encode);
+		PrintStage("latency", latency);
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	int code = ParseOptions(argc, argv, &options);
+	if (code != 0) {
+		return code < 0 ? 0 : code;
+	}
+
+	ImageGene::PipelineSpec pipeline;
+	if (!pipeline.Parse(options.pipeline.c_str())) {
+		return 2;
+	}
+
+	std::vector<Task> tasks;
+	if (!CollectTasks(options, &tasks)) {
+		return 2;
+	}
+	if (tasks.empty()) {
+		printf("No images found\n");
+		return 0;
+	}
+
+	std::vector<fs::path> outputs;
+	for (const Task& task : tasks) {
+		outputs.push_back(task.output);
+	}
+	std::sort(outputs.begin(), outputs.end());
+	auto duplicate = std::adjacent_find(outputs.begin(), outputs.end());
+	if (duplicate != outputs.end()) {
+		printf("Several inputs would be written to %s\n", duplicate->string().c_str());
+		return 2;
+	}
+
+	// Output directories are made up front so workers only ever write files.
+	for (const Task& task : tasks) {
+		std::error_code error;
+		fs::create_directories(task.output.parent_path(), error);
+		if (error) {
+			printf("Failed to create %s: %s\n", task.output.parent_path().string().c_str(), error.message().c_str());
+			return 1;
+		}
+	}
+
+	unsigned jobs = options.jobs;
+	if (jobs == 0) {
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+	}
+	jobs = (unsigned)std::min<size_t>(jobs, tasks.size());
+	unsigned queue = options.queue != 0 ? options.queue : 2 * jobs;
+
+	options.png.policy = ImageGene::Threads(options.threads);
+	Batch batch(tasks, pipeline, options.png, queue);
+	Clock::time_point start = Clock::now();
+	batch.Run(jobs);
+	double seconds = Milliseconds(start, Clock::now()) / 1000.0;
+
+	Report(batch.Timings(), seconds, jobs);
+
+	for (const Timing& timing : batch.Timings()) {
+		if (!timing.ok) {
+			return 1;
+		}
+	}
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,245 @@
+// Checks of behaviour the library promises and the benchmarks cannot see: output that
+// must match an earlier implementation exactly, and operations that must not fault.
+// Each check prints what went wrong and the program exits with the number of failures.
+//   ImageGeneTests [name filter]
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../ImageGene/Image.h"
+#include "../ImageGene/Png.h"
+#include "../ImageGene/Random.h"
+#include "../ImageGene/Stream.h"
+
+using namespace ImageGene;
+
+namespace {
+	struct Check {
+		const char* name;
+		std::function<bool()> run;
+	};
+
+	std::vector<Check>& Checks()
+	{
+		static std::vector<Check> checks;
+		return checks;
+	}
+
+	struct Register {
+		Register(const char* name, std::function<bool()> run) { Checks().push_back({ name, run }); }
+	};
+
+	Image Noise(int w, int h, int channels, uint64_t seed)
+	{
+		Image image(w, h, channels);
+		for (size_t i = 0; i < image.size; i++) {
+			image.data[i] = (uint8_t)(PixelRandom(seed, (uint32_t)i, 0) >> 56);
+		}
+		return image;
+	}
+
+	// The per-tap loop ConvolveClampTo0 and ConvolveClampToBorder ran before the tiled
+	// engine, with the result clamped to [0, 255] as the engine does.
+	void ReferenceConvolve(Image* image, uint8_t channel, uint32_t kernelWidth, uint32_t kernelHeight,
+		const double* kernel, uint32_t cr, uint32_t cc, BorderMode border)
+	{
+		std::vector<uint8_t> newData((size_t)image->w * image->h);
+		uint64_t center = (uint64_t)cr * kernelWidth + cc;
+
+		int a = kernelHeight - cr;
+		int b = kernelWidth - cc;
+
+		for (uint64_t k = channel; k < image->size; k += image->channels) {
+			double c = 0;
+			for (int i = -((int)cr); i < a; i++) {
+				long row = ((long)k / image->channels) / image->w - i;
+				if (row < 0 || row > image->h - 1) {
+					if (border == BorderZero) {
+						continue;
+					}
+					row = row < 0 ? 0 : image->h - 1;
+				}
+				for (int j = -((int)cc); j < b; j++) {
+					long col = ((long)k / image->channels) % image->w - j;
+					if (col < 0 || col > image->w - 1) {
+						if (border == BorderZero) {
+							continue;
+						}
+						col = col < 0 ? 0 : image->w - 1;
+					}
+					c += kernel[center + i * (long)kernelWidth + j] * image->data[(row * image->w + col) * image->channels + channel];
+				}
+			}
+			c = round(c);
+			newData[k / image->channels] = (uint8_t)(c < 0 ? 0 : c > 255 ? 255 : c);
+		}
+		for (uint64_t k = channel; k < image->size; k += image->channels) {
+			image->data[k] = newData[k / image->channels];
+		}
+	}
+
+	// Box kernels of every size up to 8x8, whose 1/(w*h) weights are not exact in binary,
+	// the binomial Gaussians, which are, and random non-negative kernels, on random images
+	// with both borders, against the old loop.
+	bool ConvolveMatchesReference()
+	{
+		std::vector<std::vector<double>> kernels;
+		std::vector<std::pair<uint32_t, uint32_t>> sizes;
+		for (uint32_t kh = 1; kh <= 8; kh++) {
+			for (uint32_t kw = 1; kw <= 8; kw++) {
+				kernels.push_back(std::vector<double>(kw * kh, 1.0 / (kw * kh)));
+				sizes.push_back({ kw, kh });
+			}
+		}
+		const double binomial[] = { 1, 4, 6, 4, 1 };
+		for (double scale : { 1.0 / 256, 1.0 / 273 }) {
+			std::vector<double> kernel(25);
+			for (int k = 0; k < 25; k++) {
+				kernel[k] = binomial[k / 5] * binomial[k % 5] * scale;
+			}
+			kernels.push_back(kernel);
+			sizes.push_back({ 5, 5 });
+		}
+		for (uint32_t seed = 0; seed < 8; seed++) {
+			uint32_t kw = 1 + seed % 7;
+			uint32_t kh = 1 + (seed * 3) % 7;
+			std::vector<double> kernel(kw * kh);
+			for (size_t k = 0; k < kernel.size(); k++) {
+				kernel[k] = (PixelRandom(seed, (uint32_t)k, 1) >> 11) * 0x1.0p-53 / kernel.size();
+			}
+			kernels.push_back(kernel);
+			sizes.push_back({ kw, kh });
+		}
+
+		bool passed = true;
+		for (size_t n = 0; n < kernels.size(); n++) {
+			uint32_t kw = sizes[n].first;
+			uint32_t kh = sizes[n].second;
+			for (BorderMode border : { BorderZero, BorderClamp }) {
+				Image source = Noise(37, 23, 3, n);
+				uint32_t cr = kh / 2;
+				uint32_t cc = kw / 2;
+				Image expected(source);
+				expected.Mutable();
+				ReferenceConvolve(&expected, 1, kw, kh, kernels[n].data(), cr, cc, border);
+
+				Image actual(source);
+				if (border == BorderZero) {
+					ConvolveClampTo0(&actual, 1, kw, kh, kernels[n].data(), cr, cc);
+				}
+				else {
+					ConvolveClampToBorder(&actual, 1, kw, kh, kernels[n].data(), cr, cc);
+				}
+				if (memcmp(expected.data, actual.data, expected.size) != 0) {
+					printf("  %ux%u kernel %zu, %s border: output differs from the old loop\n",
+						kw, kh, n, border == BorderZero ? "zero" : "clamp");
+					passed = false;
+				}
+			}
+		}
+		return passed;
+	}
+	Register convolveMatchesReference("ConvolveMatchesReference", ConvolveMatchesReference);
+
+	// In-place operations on a MapReadOnly image work on a private copy: they must not
+	// fault on the read-only pages, and the file keeps its pixels.
+	bool MapReadOnlyInPlace()
+	{
+		const char* filename = "ImageGeneTests_map.igr";
+		Image source = Noise(64, 64, 3, 7);
+		if (!source.Write(filename)) {
+			printf("  could not write %s\n", filename);
+			return false;
+		}
+
+		bool passed = true;
+		{
+			Image expected(source);
+			GrayscaleLum(&expected);
+			DitherThreshold(&expected);
+			Image mapped(filename, MapReadOnly);
+			GrayscaleLum(&mapped);
+			DitherThreshold(&mapped);
+			if (memcmp(mapped.data, expected.data, expected.size) != 0) {
+				printf("  in-place operations on the mapping gave different pixels\n");
+				passed = false;
+			}
+
+			Image reread(filename, MapReadOnly);
+			if (reread.data == nullptr || memcmp(reread.data, source.data, source.size) != 0) {
+				printf("  the mapped file was changed\n");
+				passed = false;
+			}
+		}
+		// The mappings are closed first; Windows cannot delete a mapped file.
+		remove(filename);
+		return passed;
+	}
+	Register mapReadOnlyInPlace("MapReadOnlyInPlace", MapReadOnlyInPlace);
+
+	// A PNG written a strip at a time is the file EncodePng makes of the whole image,
+	// whether strips end inside a compressed strip or on its boundary.
+	bool StreamedPngMatchesWhole()
+	{
+		const char* filename = "ImageGeneTests_stream.png";
+		Image source = Noise(300, 1100, 3, 11);
+		ImageView view(static_cast<const Image&>(source));
+		std::vector<uint8_t> whole;
+		if (!EncodePng(view, PngOptions(), &whole)) {
+			printf("  EncodePng failed\n");
+			return false;
+		}
+
+		bool passed = true;
+		for (int rows : { 1, 37, 290, 1100 }) {
+			std::unique_ptr<StripWriter> writer = CreateStripWriter(filename, source.w, source.h, source.channels);
+			bool ok = writer != nullptr;
+			for (int y = 0; ok && y < source.h; y += rows) {
+				int count = rows < source.h - y ? rows : source.h - y;
+				ok = writer->WriteRows(view.Row(y), view.stride, count);
+			}
+			ok = ok && writer->Finish();
+			writer.reset();
+
+			std::vector<uint8_t> streamed;
+			FILE* file = fopen(filename, "rb");
+			if (file != nullptr) {
+				uint8_t buffer[4096];
+				size_t n;
+				while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+					streamed.insert(streamed.end(), buffer, buffer + n);
+				}
+				fclose(file);
+			}
+			if (!ok || streamed != whole) {
+				printf("  %d rows per strip: streamed file differs from EncodePng\n", rows);
+				passed = false;
+			}
+		}
+		remove(filename);
+		return passed;
+	}
+	Register streamedPngMatchesWhole("StreamedPngMatchesWhole", StreamedPngMatchesWhole);
+}
+
+int main(int argc, char** argv)
+{
+	const char* filter = argc > 1 ? argv[1] : "";
+	int failures = 0;
+	for (const Check& check : Checks()) {
+		if (strstr(check.name, filter) == nullptr) {
+			continue;
+		}
+		bool passed = check.run();
+		printf("%s %s\n", passed ? "[ OK ]" : "[FAIL]", check.name);
+		failures += passed ? 0 : 1;
+	}
+	return failures;
+}